@@ -0,0 +1,400 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "mustach-cache.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+/* initial count of buckets, must be a power of 2 */
+#ifndef CACHE_INIT_BUCKETS
+# define CACHE_INIT_BUCKETS 16
+#endif
+
+/* identification of the state of a file */
+typedef
+struct {
+	/* modification time */
+	struct timespec mtime;
+	/* size of the file */
+	off_t size;
+	/* inode of the file */
+	ino_t ino;
+	/* device of the file */
+	dev_t dev;
+}
+	stamp_t;
+
+/* a record of the cache */
+typedef struct record record_t;
+struct record {
+	/* next record of the same bucket */
+	record_t *hnext;
+	/* more recently used record */
+	record_t *prev;
+	/* less recently used record */
+	record_t *next;
+	/* the recorded template */
+	mustach_template_t *templ;
+	/* size accounted for the record */
+	size_t size;
+	/* hash of the key */
+	uint64_t hash;
+	/* path of the file or NULL */
+	char *path;
+	/* stamp of the file if path isn't NULL */
+	stamp_t stamp;
+	/* length of the key */
+	size_t keylen;
+	/* the key */
+	char key[];
+};
+
+/* the cache */
+struct mustach_cache {
+	/* protection against concurrent accesses */
+	pthread_mutex_t mutex;
+	/* flags of the cache */
+	int flags;
+	/* the budget or zero */
+	size_t budget;
+	/* the size currently used */
+	size_t used;
+	/* count of records */
+	size_t count;
+	/* count of buckets (a power of 2) */
+	size_t nbuckets;
+	/* the buckets */
+	record_t **buckets;
+	/* most recently used record */
+	record_t *mru;
+	/* least recently used record */
+	record_t *lru;
+};
+
+/* continues the hash h (FNV-1a) with the bytes of key */
+static uint64_t hash_more(uint64_t h, const char *key, size_t keylen)
+{
+	while (keylen--) {
+		h ^= (uint64_t)(unsigned char)*key++;
+		h *= UINT64_C(1099511628211);
+	}
+	return h;
+}
+
+/* computes the hash of a key (FNV-1a) */
+static uint64_t hash(const char *key, size_t keylen)
+{
+	return hash_more(UINT64_C(14695981039346656037), key, keylen);
+}
+
+/* get the stamp of the file of path */
+static int get_stamp(const char *path, stamp_t *stamp)
+{
+	struct stat st;
+	if (stat(path, &st) < 0)
+		return 0;
+#if defined(__APPLE__)
+	stamp->mtime = st.st_mtimespec;
+#else
+	stamp->mtime = st.st_mtim;
+#endif
+	stamp->size = st.st_size;
+	stamp->ino = st.st_ino;
+	stamp->dev = st.st_dev;
+	return 1;
+}
+
+/* check if stamps are the same */
+static int same_stamp(const stamp_t *a, const stamp_t *b)
+{
+	return a->mtime.tv_sec == b->mtime.tv_sec
+	    && a->mtime.tv_nsec == b->mtime.tv_nsec
+	    && a->size == b->size
+	    && a->ino == b->ino
+	    && a->dev == b->dev;
+}
+
+/* search the record of the key made of head and key */
+static record_t **search2(mustach_cache_t *cache, uint64_t h, const char *head, size_t headlen, const char *key, size_t keylen)
+{
+	record_t *rec, **prec = &cache->buckets[h & (cache->nbuckets - 1)];
+	while ((rec = *prec) != NULL
+	    && (rec->hash != h
+	     || rec->keylen != headlen + keylen
+	     || (headlen != 0 && memcmp(rec->key, head, headlen))
+	     || memcmp(&rec->key[headlen], key, keylen)))
+		prec = &rec->hnext;
+	return prec;
+}
+
+/* search the record of key */
+static record_t **search(mustach_cache_t *cache, uint64_t h, const char *key, size_t keylen)
+{
+	return search2(cache, h, NULL, 0, key, keylen);
+}
+
+/* unlink the record from the LRU list */
+static void lru_unlink(mustach_cache_t *cache, record_t *rec)
+{
+	if (rec->prev == NULL)
+		cache->mru = rec->next;
+	else
+		rec->prev->next = rec->next;
+	if (rec->next == NULL)
+		cache->lru = rec->prev;
+	else
+		rec->next->prev = rec->prev;
+}
+
+/* link the record as the most recently used */
+static void lru_link(mustach_cache_t *cache, record_t *rec)
+{
+	rec->prev = NULL;
+	rec->next = cache->mru;
+	if (cache->mru == NULL)
+		cache->lru = rec;
+	else
+		cache->mru->prev = rec;
+	cache->mru = rec;
+}
+
+/* remove the record pointed by prec and return it */
+static record_t *drop(mustach_cache_t *cache, record_t **prec)
+{
+	record_t *rec = *prec;
+	*prec = rec->hnext;
+	lru_unlink(cache, rec);
+	cache->used -= rec->size;
+	cache->count--;
+	return rec;
+}
+
+/* release the records of the list linked by hnext */
+static void release(record_t *rec)
+{
+	record_t *next;
+	for ( ; rec != NULL ; rec = next) {
+		next = rec->hnext;
+		mustach_unref_template(rec->templ, NULL, NULL);
+		free(rec);
+	}
+}
+
+/* double the count of buckets if needed */
+static void grow(mustach_cache_t *cache)
+{
+	size_t idx, nbuckets = cache->nbuckets << 1;
+	record_t *rec, *next, **buckets;
+
+	if (cache->count <= cache->nbuckets || nbuckets == 0)
+		return;
+	buckets = calloc(nbuckets, sizeof *buckets);
+	if (buckets == NULL)
+		return; /* not fatal */
+	for (idx = 0 ; idx < cache->nbuckets ; idx++)
+		for (rec = cache->buckets[idx] ; rec != NULL ; rec = next) {
+			next = rec->hnext;
+			rec->hnext = buckets[rec->hash & (nbuckets - 1)];
+			buckets[rec->hash & (nbuckets - 1)] = rec;
+		}
+	free(cache->buckets);
+	cache->buckets = buckets;
+	cache->nbuckets = nbuckets;
+}
+
+/* see header file */
+int mustach_cache_create(mustach_cache_t **cache, size_t budget, int flags)
+{
+	mustach_cache_t *c = malloc(sizeof *c);
+	if (c != NULL) {
+		c->buckets = calloc(CACHE_INIT_BUCKETS, sizeof *c->buckets);
+		if (c->buckets != NULL) {
+			pthread_mutex_init(&c->mutex, NULL);
+			c->flags = flags;
+			c->budget = budget;
+			c->used = 0;
+			c->count = 0;
+			c->nbuckets = CACHE_INIT_BUCKETS;
+			c->mru = c->lru = NULL;
+			*cache = c;
+			return MUSTACH_OK;
+		}
+		free(c);
+	}
+	*cache = NULL;
+	return MUSTACH_ERROR_OUT_OF_MEMORY;
+}
+
+/* see header file */
+void mustach_cache_destroy(mustach_cache_t *cache)
+{
+	if (cache != NULL) {
+		mustach_cache_clear(cache);
+		pthread_mutex_destroy(&cache->mutex);
+		free(cache->buckets);
+		free(cache);
+	}
+}
+
+/* see header file */
+void mustach_cache_clear(mustach_cache_t *cache)
+{
+	record_t *rec, *next;
+
+	pthread_mutex_lock(&cache->mutex);
+	rec = cache->mru;
+	memset(cache->buckets, 0, cache->nbuckets * sizeof *cache->buckets);
+	cache->mru = cache->lru = NULL;
+	cache->used = 0;
+	cache->count = 0;
+	pthread_mutex_unlock(&cache->mutex);
+
+	for ( ; rec != NULL ; rec = next) {
+		next = rec->next;
+		mustach_unref_template(rec->templ, NULL, NULL);
+		free(rec);
+	}
+}
+
+/* get the template of the key made of head and key */
+static int get(mustach_cache_t *cache, const char *head, size_t headlen, const char *key, size_t keylen, mustach_template_t **templ)
+{
+	uint64_t h = hash_more(hash(head, headlen), key, keylen);
+	record_t *rec, **prec, *dropped;
+	mustach_template_t *result;
+	char path[PATH_MAX];
+	stamp_t stamp, cur;
+	int check;
+
+	/* search the record */
+	pthread_mutex_lock(&cache->mutex);
+	rec = *search2(cache, h, head, headlen, key, keylen);
+	if (rec == NULL) {
+		pthread_mutex_unlock(&cache->mutex);
+		*templ = NULL;
+		return MUSTACH_ERROR_NOT_FOUND;
+	}
+	/* found, take a reference and mark it as recently used */
+	result = mustach_ref_template(rec->templ);
+	lru_unlink(cache, rec);
+	lru_link(cache, rec);
+	check = rec->path != NULL && (cache->flags & Mustach_Cache_Check_MTime) != 0;
+	if (check) {
+		/* copy the data for checking it unlocked */
+		strcpy(path, rec->path);
+		stamp = rec->stamp;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	/* check the file if required */
+	if (check && (!get_stamp(path, &cur) || !same_stamp(&stamp, &cur))) {
+		/* the file changed, invalidate the record if not already done */
+		pthread_mutex_lock(&cache->mutex);
+		prec = search2(cache, h, head, headlen, key, keylen);
+		dropped = NULL;
+		if (*prec != NULL && (*prec)->templ == result) {
+			dropped = drop(cache, prec);
+			dropped->hnext = NULL;
+		}
+		pthread_mutex_unlock(&cache->mutex);
+		release(dropped);
+		mustach_unref_template(result, NULL, NULL);
+		*templ = NULL;
+		return MUSTACH_ERROR_NOT_FOUND;
+	}
+	*templ = result;
+	return MUSTACH_OK;
+}
+
+/* see header file */
+int mustach_cache_get(mustach_cache_t *cache, const char *key, size_t keylen, mustach_template_t **templ)
+{
+	return get(cache, NULL, 0, key, keylen, templ);
+}
+
+/* see header file */
+int mustach_cache_get_prefixed(mustach_cache_t *cache, char prefix, const char *key, size_t keylen, mustach_template_t **templ)
+{
+	return get(cache, &prefix, 1, key, keylen, templ);
+}
+
+/* see header file */
+int mustach_cache_add(mustach_cache_t *cache, const char *key, size_t keylen, mustach_template_t *templ, const char *path)
+{
+	uint64_t h = hash(key, keylen);
+	size_t lenpath = path == NULL ? 0 : 1 + strlen(path);
+	record_t *rec, **prec, *evicted = NULL;
+
+	/* create the record */
+	if (lenpath > PATH_MAX)
+		lenpath = 0;
+	rec = malloc(sizeof *rec + keylen + lenpath);
+	if (rec == NULL)
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+	rec->keylen = keylen;
+	memcpy(rec->key, key, keylen);
+	rec->hash = h;
+	if (lenpath == 0 || !get_stamp(path, &rec->stamp))
+		rec->path = NULL;
+	else {
+		rec->path = &rec->key[keylen];
+		memcpy(rec->path, path, lenpath);
+	}
+	rec->size = sizeof *rec + keylen + lenpath + mustach_get_template_size(templ);
+	rec->templ = mustach_ref_template(templ);
+
+	pthread_mutex_lock(&cache->mutex);
+
+	/* replace any existing record */
+	prec = search(cache, h, key, keylen);
+	if (*prec != NULL) {
+		record_t *old = drop(cache, prec);
+		old->hnext = evicted;
+		evicted = old;
+	}
+
+	/* add the record */
+	rec->hnext = *prec;
+	*prec = rec;
+	lru_link(cache, rec);
+	cache->used += rec->size;
+	cache->count++;
+	grow(cache);
+
+	/* evict least recently used records */
+	while (cache->budget != 0 && cache->used > cache->budget && cache->lru != rec) {
+		record_t *old = cache->lru;
+		old = drop(cache, search(cache, old->hash, old->key, old->keylen));
+		old->hnext = evicted;
+		evicted = old;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	/* release replaced or evicted records */
+	release(evicted);
+	return MUSTACH_OK;
+}
+
+/* see header file */
+void mustach_cache_release(mustach_template_t *templ)
+{
+	mustach_unref_template(templ, NULL, NULL);
+}
+
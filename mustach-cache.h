@@ -0,0 +1,115 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+#ifndef _mustach_cache_h_included_
+#define _mustach_cache_h_included_
+
+/*
+ * mustach-cache records prepared templates by key for avoiding
+ * to read and to build them again and again.
+ *
+ * Records of a cache are reference counted: a template got from
+ * the cache stays valid until it is released using the function
+ * 'mustach_cache_release', even if it is evicted from the cache
+ * in the meantime.
+ *
+ * When a memory budget is set, the least recently used records
+ * are evicted until the memory used by the recorded templates
+ * fits the budget.
+ *
+ * The functions of caches can be called concurrently from
+ * several threads.
+ */
+#include "mustach2.h"
+
+typedef struct mustach_cache mustach_cache_t;
+
+/**
+ * Flags for creating caches
+ *
+ * Mustach_Cache_Check_MTime: when a record is associated to a file,
+ *     check, each time the record is got, that the file wasn't
+ *     modified since the record was added and otherwise invalidates
+ *     the record.
+ */
+#define Mustach_Cache_Check_MTime   1
+
+/**
+ * mustach_cache_create - Creates a cache of templates
+ *
+ * @cache:   pointer receiving the created cache
+ * @budget:  the memory budget in bytes or 0 for no limit
+ * @flags:   flags of the cache (see Mustach_Cache_...)
+ *
+ * Returns MUSTACH_OK in case of success or MUSTACH_ERROR_OUT_OF_MEMORY.
+ */
+extern int mustach_cache_create(mustach_cache_t **cache, size_t budget, int flags);
+
+/**
+ * mustach_cache_destroy - Destroys the cache, releasing its records
+ *
+ * @cache:   the cache to destroy
+ */
+extern void mustach_cache_destroy(mustach_cache_t *cache);
+
+/**
+ * mustach_cache_clear - Removes all records of the cache
+ *
+ * @cache:   the cache to clear
+ */
+extern void mustach_cache_clear(mustach_cache_t *cache);
+
+/**
+ * mustach_cache_get - Gets the template recorded for the key
+ *
+ * @cache:   the cache
+ * @key:     the key of the record
+ * @keylen:  length of the key
+ * @templ:   pointer receiving the found template
+ *
+ * Returns MUSTACH_OK when found, in which case the returned template
+ * must be released using 'mustach_cache_release', or returns
+ * MUSTACH_ERROR_NOT_FOUND.
+ */
+extern int mustach_cache_get(mustach_cache_t *cache, const char *key, size_t keylen, mustach_template_t **templ);
+
+/**
+ * mustach_cache_get_prefixed - Same as mustach_cache_get for the key
+ * made of the byte 'prefix' followed by the 'keylen' bytes of 'key',
+ * without having to build that key
+ */
+extern int mustach_cache_get_prefixed(mustach_cache_t *cache, char prefix, const char *key, size_t keylen, mustach_template_t **templ);
+
+/**
+ * mustach_cache_add - Records the template for the key
+ *
+ * The cache takes its own reference on the template, the reference
+ * of the caller is not changed.
+ *
+ * When a record already exists for the key, it is replaced.
+ *
+ * @cache:   the cache
+ * @key:     the key of the record
+ * @keylen:  length of the key
+ * @templ:   the template to record
+ * @path:    path of the file of the template or NULL if
+ *           not associated to a file
+ *
+ * Returns MUSTACH_OK in case of success or MUSTACH_ERROR_OUT_OF_MEMORY.
+ */
+extern int mustach_cache_add(mustach_cache_t *cache, const char *key, size_t keylen, mustach_template_t *templ, const char *path);
+
+/**
+ * mustach_cache_release - Releases a template got from a cache
+ *
+ * @templ:   the template to release
+ */
+extern void mustach_cache_release(mustach_template_t *templ);
+
+#endif
+
@@ -0,0 +1,404 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+/*
+ * mustach-cgen translates mustache templates to C code.
+ *
+ * Each template is compiled to a native rendering function that
+ * calls the functions 'mustach_native_...' (see mustach2.h): texts
+ * are emitted from constant strings, sections become loops and
+ * partials that are templates of the same translation become direct
+ * calls of their functions. Other partials are resolved at runtime.
+ *
+ * Parents and blocks are not supported.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "mustach2.h"
+#include "mustach-helpers.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <libgen.h>
+
+/* extension of templates, removed from their names */
+static const char extension[] = ".mustache";
+
+/* a translated template */
+typedef struct {
+	/* path of its file */
+	const char *path;
+	/* its name */
+	char *name;
+	/* name of its function */
+	char *func;
+	/* the prepared template */
+	mustach_template_t *templ;
+}
+	item_t;
+
+/* state of the translation of a template */
+typedef struct {
+	/* the output */
+	FILE *out;
+	/* the translated items */
+	item_t *items;
+	/* count of items */
+	int count;
+	/* indentation depth */
+	int depth;
+	/* pending prefix */
+	const char *prefix;
+	/* length of the pending prefix */
+	size_t preflen;
+	/* the item being translated */
+	item_t *item;
+}
+	gen_t;
+
+static void help(char *prog)
+{
+	char *name = basename(prog);
+#define STR_INDIR(x) #x
+#define STR(x) STR_INDIR(x)
+	printf("%s version %s\n", name, STR(VERSION));
+#undef STR
+#undef STR_INDIR
+	printf(
+		"\n"
+		"USAGE:\n"
+		"    %s [FLAGS] <mustach-templates...>\n"
+		"\n"
+		"FLAGS:\n"
+		"    -h, --help           Prints help information\n"
+		"    -o, --output FILE    Writes the C code to FILE (default stdout)\n"
+		"    -p, --prefix PREFIX  Prefix of generated names (default mustach_cgen_)\n"
+		"    -s, --strict         Don't accept tags {{:...}} and empty tags\n"
+		"\n"
+		"ARGS:\n"
+		"    <mustach-templates...>   Template files to translate, the name of\n"
+		"                             a template is its path without extension\n",
+		name);
+	exit(0);
+}
+
+/* print the indentation */
+static void indent(gen_t *gen)
+{
+	int i;
+	for (i = 0 ; i <= gen->depth ; i++)
+		putc('\t', gen->out);
+}
+
+/* print the C string literal of text */
+static void string(gen_t *gen, const char *text, size_t length)
+{
+	size_t idx;
+	int c;
+
+	putc('"', gen->out);
+	for (idx = 0 ; idx < length ; idx++) {
+		c = (unsigned char)text[idx];
+		switch (c) {
+		case '\n':
+			fputs("\\n", gen->out);
+			if (idx + 1 < length) {
+				fputs("\"\n", gen->out);
+				indent(gen);
+				fputs("\t\"", gen->out);
+			}
+			break;
+		case '\r': fputs("\\r", gen->out); break;
+		case '\t': fputs("\\t", gen->out); break;
+		case '"': fputs("\\\"", gen->out); break;
+		case '\\': fputs("\\\\", gen->out); break;
+		case '?': fputs("\\?", gen->out); break;
+		default:
+			if (c < ' ' || c >= 127)
+				fprintf(gen->out, "\\%03o", c);
+			else
+				putc(c, gen->out);
+			break;
+		}
+	}
+	putc('"', gen->out);
+}
+
+/* print the C string literal of text, then its length */
+static void literal(gen_t *gen, const char *text, size_t length)
+{
+	string(gen, text, length);
+	fprintf(gen->out, ", %zu", length);
+}
+
+/* search the item of name */
+static item_t *search(gen_t *gen, const char *name, size_t length)
+{
+	int i;
+	for (i = 0 ; i < gen->count ; i++)
+		if (strlen(gen->items[i].name) == length
+		 && memcmp(gen->items[i].name, name, length) == 0)
+			return &gen->items[i];
+	return NULL;
+}
+
+static int gen_text(void *closure, const char *text, size_t length)
+{
+	gen_t *gen = closure;
+	indent(gen);
+	fputs("CHECK(mustach_native_text(native, ", gen->out);
+	literal(gen, text, length);
+	fputs("));\n", gen->out);
+	return MUSTACH_OK;
+}
+
+static int gen_repl(void *closure, const char *name, size_t length, int escape)
+{
+	gen_t *gen = closure;
+	indent(gen);
+	fputs("CHECK(mustach_native_repl(native, ", gen->out);
+	literal(gen, name, length);
+	fprintf(gen->out, ", %d));\n", escape);
+	return MUSTACH_OK;
+}
+
+static int gen_prefix(void *closure, const char *text, size_t length)
+{
+	gen_t *gen = closure;
+	gen->prefix = text;
+	gen->preflen = length;
+	return MUSTACH_OK;
+}
+
+static int gen_partial(void *closure, const char *name, size_t length)
+{
+	gen_t *gen = closure;
+	item_t *item = search(gen, name, length);
+	indent(gen);
+	if (item != NULL)
+		fprintf(gen->out, "CHECK(mustach_native_call(native, %s, ", item->func);
+	else {
+		fputs("CHECK(mustach_native_partial(native, ", gen->out);
+		literal(gen, name, length);
+		fputs(", ", gen->out);
+	}
+	if (gen->preflen == 0)
+		fputs("NULL, 0", gen->out);
+	else
+		literal(gen, gen->prefix, gen->preflen);
+	fputs("));\n", gen->out);
+	gen->preflen = 0;
+	return MUSTACH_OK;
+}
+
+static int gen_enter(void *closure, int kind, const char *name, size_t length)
+{
+	gen_t *gen = closure;
+	if (kind != Mustach_Walk_Section && kind != Mustach_Walk_Inverted) {
+		fprintf(stderr, "Unsupported parent or block %.*s (file %s)\n",
+			(int)length, name, gen->item->path);
+		return MUSTACH_ERROR_INVALID_ITF;
+	}
+	indent(gen);
+	fputs("rc = mustach_native_enter(native, ", gen->out);
+	literal(gen, name, length);
+	fputs(");\n", gen->out);
+	indent(gen);
+	if (kind == Mustach_Walk_Section) {
+		fputs("if (rc > 0) {\n", gen->out);
+		gen->depth++;
+		indent(gen);
+		fputs("do {\n", gen->out);
+	}
+	else
+		fputs("if (rc == 0) {\n", gen->out);
+	gen->depth++;
+	return MUSTACH_OK;
+}
+
+static int gen_leave(void *closure, int kind)
+{
+	gen_t *gen = closure;
+	gen->depth--;
+	indent(gen);
+	if (kind == Mustach_Walk_Section) {
+		fputs("} while ((rc = mustach_native_next(native)) > 0);\n", gen->out);
+		indent(gen);
+		fputs("if (rc == 0)\n", gen->out);
+		indent(gen);
+		fputs("\trc = mustach_native_leave(native);\n", gen->out);
+		gen->depth--;
+		indent(gen);
+		fputs("}\n", gen->out);
+	}
+	else {
+		fputs("}\n", gen->out);
+		indent(gen);
+		fputs("else if (rc > 0)\n", gen->out);
+		indent(gen);
+		fputs("\trc = mustach_native_leave(native);\n", gen->out);
+	}
+	indent(gen);
+	fputs("if (rc != MUSTACH_OK)\n", gen->out);
+	indent(gen);
+	fputs("\treturn rc;\n", gen->out);
+	return MUSTACH_OK;
+}
+
+static const mustach_walk_itf_t gen_itf = {
+	.version = MUSTACH_WALK_ITF_VERSION_1,
+	.line = NULL,
+	.text = gen_text,
+	.repl = gen_repl,
+	.prefix = gen_prefix,
+	.partial = gen_partial,
+	.enter = gen_enter,
+	.leave = gen_leave
+};
+
+/* make the name of the function of the template */
+static char *funcname(const char *prefix, const char *name)
+{
+	size_t lpre = strlen(prefix), lnam = strlen(name), i;
+	char *func = malloc(lpre + lnam + 1);
+	if (func != NULL) {
+		memcpy(func, prefix, lpre);
+		for (i = 0 ; i <= lnam ; i++)
+			func[lpre + i] = isalnum((unsigned char)name[i]) || name[i] == 0 ? name[i] : '_';
+	}
+	return func;
+}
+
+int main(int ac, char **av)
+{
+	const char *prefix = "mustach_cgen_", *output = NULL;
+	mustach_sbuf_t sbuf;
+	int i, j, rc, flags;
+	char *prog = *av;
+	size_t length;
+	item_t *items;
+	gen_t gen;
+
+	/* scan arguments */
+	flags = Mustach_Build_With_Colon | Mustach_Build_With_EmptyTag;
+	for( ++av ; av[0] && av[0][0] == '-' && av[0][1] != 0 ; av++) {
+		if (!strcmp(*av, "-h") || !strcmp(*av, "--help"))
+			help(prog);
+		else if (!strcmp(*av, "-s") || !strcmp(*av, "--strict"))
+			flags = 0;
+		else if ((!strcmp(*av, "-o") || !strcmp(*av, "--output")) && av[1] != NULL)
+			output = *++av;
+		else if ((!strcmp(*av, "-p") || !strcmp(*av, "--prefix")) && av[1] != NULL)
+			prefix = *++av;
+		else {
+			fprintf(stderr, "Bad option %s\n", *av);
+			return 1;
+		}
+	}
+	ac = 0;
+	while (av[ac] != NULL)
+		ac++;
+	if (ac == 0) {
+		fprintf(stderr, "No template given\n");
+		return 1;
+	}
+
+	/* prepare the templates */
+	items = calloc((size_t)ac, sizeof *items);
+	if (items == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	for (i = 0 ; i < ac ; i++) {
+		items[i].path = av[i];
+		length = strlen(av[i]);
+		if (length > sizeof extension - 1
+		 && !strcmp(&av[i][length - sizeof extension + 1], extension))
+			length -= sizeof extension - 1;
+		items[i].name = strndup(av[i], length);
+		items[i].func = items[i].name == NULL ? NULL : funcname(prefix, items[i].name);
+		if (items[i].func == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			return 1;
+		}
+		for (j = 0 ; j < i ; j++)
+			if (!strcmp(items[i].func, items[j].func)) {
+				fprintf(stderr, "Same function for %s and %s\n", items[j].path, items[i].path);
+				return 1;
+			}
+		rc = mustach_read_file(av[i], &sbuf);
+		if (rc == MUSTACH_OK)
+			rc = mustach_make_template(&items[i].templ, flags, &sbuf, items[i].name);
+		if (rc != MUSTACH_OK) {
+			fprintf(stderr, "Template error %s (file %s)\n", mustach_strerror(rc), av[i]);
+			return 1;
+		}
+	}
+
+	/* open the output */
+	gen.out = output == NULL ? stdout : fopen(output, "w");
+	if (gen.out == NULL) {
+		fprintf(stderr, "Can't open file: %s\n", output);
+		return 1;
+	}
+	gen.items = items;
+	gen.count = ac;
+
+	/* generate the header */
+	fprintf(gen.out, "/* generated by mustach-cgen, don't edit */\n\n");
+	fprintf(gen.out, "#include \"mustach2.h\"\n\n");
+	fprintf(gen.out, "#define CHECK(x) do { int rc_ = (x); if (rc_ != MUSTACH_OK) return rc_; } while (0)\n\n");
+	for (i = 0 ; i < ac ; i++)
+		fprintf(gen.out, "int %s(mustach_native_t *native);\n", items[i].func);
+
+	/* generate the functions */
+	for (i = 0 ; i < ac ; i++) {
+		fprintf(gen.out, "\n/* %s */\nint %s(mustach_native_t *native)\n{\n", items[i].name, items[i].func);
+		fprintf(gen.out, "\tint rc;\n\n");
+		gen.depth = 0;
+		gen.preflen = 0;
+		gen.item = &items[i];
+		rc = mustach_walk_template(items[i].templ, &gen_itf, &gen);
+		if (rc != MUSTACH_OK) {
+			if (output != NULL) {
+				fclose(gen.out);
+				remove(output);
+			}
+			return 1;
+		}
+		fprintf(gen.out, "\t(void)rc;\n\treturn MUSTACH_OK;\n}\n");
+	}
+
+	/* generate the table */
+	fprintf(gen.out, "\nconst struct mustach_native_entry %stemplates[] = {\n", prefix);
+	for (i = 0 ; i < ac ; i++) {
+		fputs("\t{ ", gen.out);
+		string(&gen, items[i].name, strlen(items[i].name));
+		fprintf(gen.out, ", %s },\n", items[i].func);
+	}
+	fprintf(gen.out, "\t{ NULL, NULL }\n};\n");
+
+	/* terminate */
+	for (i = 0 ; i < ac ; i++) {
+		mustach_destroy_template(items[i].templ, NULL, NULL);
+		free(items[i].func);
+		free(items[i].name);
+	}
+	free(items);
+	if (output != NULL && fclose(gen.out) != 0) {
+		fprintf(stderr, "Error while writing %s\n", output);
+		return 1;
+	}
+	return 0;
+}
+
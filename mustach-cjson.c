@@ -15,15 +15,50 @@
 #include "mustach-cjson.h"
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
+#include <float.h>
+
+/* count of children scanned before indexing the container */
+#ifndef CJ_INDEX_MIN
+#define CJ_INDEX_MIN 16
+#endif
+
+/*
+ * The children of cJSON containers are linked lists. When a lookup
+ * scans more than CJ_INDEX_MIN children, the container is indexed:
+ * a hash table of the keys for objects, a vector of the items for
+ * arrays. The indexes belong to the rendering, the data is not changed.
+ */
+struct slot {
+	cJSON *item;
+	uint32_t hash;
+};
+
+struct index {
+	/* the indexed container */
+	const cJSON *cont;
+	/* count of items of arrays, size of the hash table of objects */
+	size_t count;
+	/* the items of arrays, the hash table of objects */
+	struct slot slots[];
+};
 
 struct expl {
 	cJSON null;
 	cJSON *root;
 	cJSON *selection;
 	int depth;
+	uint64_t stamp;
+	char scratch[MUSTACH_WRAP_FORMAT_SIZE];
+	/* hash table of the indexes of the containers */
+	struct index **indexes;
+	size_t icount;
+	size_t isize;
 	struct {
+		uint64_t stamp;
 		cJSON *cont;
 		cJSON *obj;
 		cJSON *next;
@@ -38,73 +73,271 @@ static int start(void *closure)
 	memset(&e->null, 0, sizeof e->null);
 	e->null.type = cJSON_NULL;
 	e->selection = &e->null;
+	e->stamp = 1;
+	e->stack[0].stamp = 1;
 	e->stack[0].cont = NULL;
 	e->stack[0].obj = e->root;
+	e->stack[0].is_objiter = 0;
+	e->indexes = NULL;
+	e->icount = 0;
+	e->isize = 0;
 	return MUSTACH_OK;
 }
 
-static int compare(void *closure, const char *value)
+static void stop(void *closure, int status)
+{
+	struct expl *e = closure;
+	size_t i;
+
+	(void)status;/*make compiler happy #@!%!!*/
+	for (i = 0 ; i < e->isize ; i++)
+		free(e->indexes[i]);
+	free(e->indexes);
+}
+
+static int compare_lit(void *closure, const struct mustach_wrap_lit *lit)
 {
 	struct expl *e = closure;
 	cJSON *o = e->selection;
 	double d;
 
 	if (cJSON_IsNumber(o)) {
-		d = o->valuedouble - atof(value);
+		d = o->valuedouble - lit->d;
 		return d < 0 ? -1 : d > 0 ? 1 : 0;
 	} else if (cJSON_IsString(o)) {
-		return strcmp(o->valuestring, value);
+		return strcmp(o->valuestring, lit->string);
 	} else if (cJSON_IsTrue(o)) {
-		return strcmp("true", value);
+		return lit->type == Mustach_Lit_True ? 0 : strcmp("true", lit->string);
 	} else if (cJSON_IsFalse(o)) {
-		return strcmp("false", value);
+		return lit->type == Mustach_Lit_False ? 0 : strcmp("false", lit->string);
 	} else if (cJSON_IsNull(o)) {
-		return strcmp("null", value);
+		return lit->type == Mustach_Lit_Null ? 0 : strcmp("null", lit->string);
 	} else {
 		return 1;
 	}
 }
 
-static int sel(void *closure, const char *name)
+static int compare(void *closure, const char *value)
+{
+	struct mustach_wrap_lit lit;
+	mustach_wrap_parse_lit(&lit, value);
+	return compare_lit(closure, &lit);
+}
+
+static uint32_t hash(const char *name, size_t length)
+{
+	uint32_t h = 2166136261u;
+	while (length--) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static size_t slot_of(const struct expl *e, const cJSON *cont)
+{
+	return (size_t)(((uintptr_t)cont >> 4) * 2654435761u) & (e->isize - 1);
+}
+
+/* creates the index of the container */
+static struct index *make_index(const cJSON *cont)
+{
+	struct index *idx;
+	cJSON *c;
+	size_t n, size, mask, i;
+	uint32_t h;
+
+	for (n = 0, c = cont->child ; c != NULL ; c = c->next)
+		n++;
+	if (cJSON_IsArray(cont))
+		size = n;
+	else
+		for (size = 1 ; size < 2 * n ; size <<= 1);
+	idx = calloc(1, sizeof *idx + size * sizeof *idx->slots);
+	if (idx == NULL)
+		return NULL;
+	idx->cont = cont;
+	idx->count = size;
+	if (cJSON_IsArray(cont)) {
+		for (i = 0, c = cont->child ; c != NULL ; c = c->next)
+			idx->slots[i++].item = c;
+	}
+	else {
+		/* as getn, the first of same keys is kept and nothing after a child without key */
+		mask = size - 1;
+		for (c = cont->child ; c != NULL && c->string != NULL ; c = c->next) {
+			h = hash(c->string, strlen(c->string));
+			for (i = h & mask ; idx->slots[i].item != NULL ; i = (i + 1) & mask)
+				if (idx->slots[i].hash == h && !strcmp(idx->slots[i].item->string, c->string))
+					break;
+			if (idx->slots[i].item == NULL) {
+				idx->slots[i].item = c;
+				idx->slots[i].hash = h;
+			}
+		}
+	}
+	return idx;
+}
+
+/* returns the index of the container, creating it if needed, or NULL on memory depletion */
+static struct index *get_index(struct expl *e, const cJSON *cont)
+{
+	struct index **indexes, *idx;
+	size_t i, size;
+
+	if (e->isize != 0)
+		for (i = slot_of(e, cont) ; (idx = e->indexes[i]) != NULL ; i = (i + 1) & (e->isize - 1))
+			if (idx->cont == cont)
+				return idx;
+
+	/* keep the table half empty */
+	if (2 * (e->icount + 1) > e->isize) {
+		indexes = e->indexes;
+		size = e->isize;
+		e->isize = size ? 2 * size : 16;
+		e->indexes = calloc(e->isize, sizeof *e->indexes);
+		if (e->indexes == NULL) {
+			e->indexes = indexes;
+			e->isize = size;
+			return NULL;
+		}
+		while (size)
+			if ((idx = indexes[--size]) != NULL) {
+				for (i = slot_of(e, idx->cont) ; e->indexes[i] != NULL ; i = (i + 1) & (e->isize - 1));
+				e->indexes[i] = idx;
+			}
+		free(indexes);
+	}
+
+	idx = make_index(cont);
+	if (idx != NULL) {
+		for (i = slot_of(e, cont) ; e->indexes[i] != NULL ; i = (i + 1) & (e->isize - 1));
+		e->indexes[i] = idx;
+		e->icount++;
+	}
+	return idx;
+}
+
+/* same as cJSON_GetObjectItemCaseSensitive for the name of length, not always null terminated */
+static cJSON *getn(struct expl *e, const cJSON *object, const char *name, size_t length)
+{
+	struct index *idx;
+	cJSON *c;
+	size_t i, n, mask;
+	uint32_t h;
+
+	if (object == NULL)
+		return NULL;
+	for (n = 0, c = object->child ; c != NULL && c->string != NULL ; n++, c = c->next) {
+		if (n == CJ_INDEX_MIN && cJSON_IsObject(object)
+		 && (idx = get_index(e, object)) != NULL) {
+			h = hash(name, length);
+			mask = idx->count - 1;
+			for (i = h & mask ; (c = idx->slots[i].item) != NULL ; i = (i + 1) & mask)
+				if (idx->slots[i].hash == h
+				 && !strncmp(c->string, name, length) && c->string[length] == 0)
+					return c;
+			return NULL;
+		}
+		if (!strncmp(c->string, name, length) && c->string[length] == 0)
+			return c;
+	}
+	return NULL;
+}
+
+/* same as cJSON_GetArrayItem, NULL when out of range */
+static cJSON *getidx(struct expl *e, const cJSON *array, size_t index)
+{
+	struct index *idx;
+	cJSON *c;
+
+	if (index >= CJ_INDEX_MIN && (idx = get_index(e, array)) != NULL)
+		return index < idx->count ? idx->slots[index].item : NULL;
+	for (c = array->child ; c != NULL && index ; c = c->next)
+		index--;
+	return c;
+}
+
+static int sel_len(void *closure, const char *name, size_t length)
 {
 	struct expl *e = closure;
 	cJSON *o;
 	int i, r;
 
-	if (name == NULL) {
-		o = e->stack[e->depth].obj;
+	i = e->depth;
+	while (i >= 0 && !(o = getn(e, e->stack[i].obj, name, length)))
+		i--;
+	if (i >= 0)
 		r = 1;
-	} else {
-		i = e->depth;
-		while (i >= 0 && !(o = cJSON_GetObjectItemCaseSensitive(e->stack[i].obj, name)))
-			i--;
-		if (i >= 0)
-			r = 1;
-		else {
-			o = &e->null;
-			r = 0;
-		}
+	else {
+		o = &e->null;
+		r = 0;
 	}
 	e->selection = o;
 	return r;
 }
 
-static int subsel(void *closure, const char *name)
+static int sel(void *closure, const char *name)
+{
+	struct expl *e = closure;
+
+	if (name != NULL)
+		return sel_len(closure, name, strlen(name));
+	e->selection = e->stack[e->depth].obj;
+	return 1;
+}
+
+static int sel_ic_len(void *closure, const char *name, size_t length, struct mustach_wrap_ic *ic)
+{
+	struct expl *e = closure;
+	cJSON *o = NULL;
+	int i, low, valid;
+
+	/* the cache is valid if the level where the name was found is unchanged */
+	valid = ic->stamp != 0
+		&& ic->depth <= e->depth
+		&& (ic->depth < 0 || e->stack[ic->depth].stamp <= ic->stamp);
+
+	/* when valid, only search the levels changed since the cache was set */
+	low = valid ? ic->depth : -1;
+	for (i = e->depth ; i > low ; i--)
+		if ((!valid || e->stack[i].stamp > ic->stamp)
+		 && (o = getn(e, e->stack[i].obj, name, length)) != NULL)
+			break;
+	if (i == low)
+		o = valid ? ic->item : NULL;
+
+	/* record the result */
+	ic->stamp = e->stamp;
+	ic->depth = i;
+	ic->item = o;
+	e->selection = i >= 0 ? o : &e->null;
+	return i >= 0;
+}
+
+static int sel_ic(void *closure, const char *name, struct mustach_wrap_ic *ic)
+{
+	return sel_ic_len(closure, name, strlen(name), ic);
+}
+
+static int subsel_len(void *closure, const char *name, size_t length)
 {
 	struct expl *e = closure;
 	cJSON *o = NULL;
 	int r = 0;
 
 	if (cJSON_IsObject(e->selection)) {
-		o = cJSON_GetObjectItemCaseSensitive(e->selection, name);
+		o = getn(e, e->selection, name, length);
 		r = o != NULL;
 	}
-	else if (cJSON_IsArray(e->selection) && *name) {
-		char *end;
-		int idx = (int)strtol(name, &end, 10);
-		if (!*end && idx >= 0 && idx < cJSON_GetArraySize(e->selection)) {
-			o = cJSON_GetArrayItem(e->selection, idx);
-			r = 1;
+	else if (cJSON_IsArray(e->selection) && length) {
+		char copy[length + 1], *end;
+		memcpy(copy, name, length);
+		copy[length] = 0;
+		long idx = strtol(copy, &end, 10);
+		if (!*end && idx >= 0) {
+			o = getidx(e, e->selection, (size_t)idx);
+			r = o != NULL;
 		}
 	}
 	if (r)
@@ -112,6 +345,11 @@ static int subsel(void *closure, const char *name)
 	return r;
 }
 
+static int subsel(void *closure, const char *name)
+{
+	return subsel_len(closure, name, strlen(name));
+}
+
 static int enter(void *closure, int objiter)
 {
 	struct expl *e = closure;
@@ -146,6 +384,7 @@ static int enter(void *closure, int objiter)
 		e->stack[e->depth].next = NULL;
 	} else
 		goto not_entering;
+	e->stack[e->depth].stamp = ++e->stamp;
 	return 1;
 
 not_entering:
@@ -167,6 +406,7 @@ static int next(void *closure)
 
 	e->stack[e->depth].obj = o;
 	e->stack[e->depth].next = o->next;
+	e->stack[e->depth].stamp = ++e->stamp;
 	return 1;
 }
 
@@ -181,6 +421,26 @@ static int leave(void *closure)
 	return 0;
 }
 
+/* format the number as cJSON_PrintUnformatted does, in the scratch buffer */
+static size_t number(struct expl *e, const cJSON *item)
+{
+	struct mustach_wrap_lit lit;
+	double d = item->valuedouble;
+	double max;
+	size_t length;
+
+	if (isnan(d) || isinf(d))
+		return (size_t)sprintf(e->scratch, "null");
+	if (d == (double)item->valueint)
+		return mustach_wrap_format_int(e->scratch, item->valueint);
+	length = mustach_wrap_format_double(e->scratch, d, 15);
+	mustach_wrap_parse_lit(&lit, e->scratch);
+	max = fabs(lit.d) > fabs(d) ? fabs(lit.d) : fabs(d);
+	if (fabs(lit.d - d) > max * DBL_EPSILON)
+		length = mustach_wrap_format_double(e->scratch, d, 17);
+	return length;
+}
+
 static int get(void *closure, struct mustach_sbuf *sbuf, int key)
 {
 	struct expl *e = closure;
@@ -199,6 +459,14 @@ static int get(void *closure, struct mustach_sbuf *sbuf, int key)
 		s = e->selection->valuestring;
 	else if (cJSON_IsNull(e->selection))
 		s = "";
+	else if (cJSON_IsTrue(e->selection))
+		s = "true";
+	else if (cJSON_IsFalse(e->selection))
+		s = "false";
+	else if (cJSON_IsNumber(e->selection)) {
+		sbuf->length = number(e, e->selection);
+		s = e->scratch;
+	}
 	else {
 		s = cJSON_PrintUnformatted(e->selection);
 		if (s == NULL)
@@ -211,49 +479,76 @@ static int get(void *closure, struct mustach_sbuf *sbuf, int key)
 
 const struct mustach_wrap_itf mustach_cJSON_wrap_itf = {
 	.start = start,
-	.stop = NULL,
+	.stop = stop,
 	.compare = compare,
 	.sel = sel,
 	.subsel = subsel,
 	.enter = enter,
 	.next = next,
 	.leave = leave,
-	.get = get
+	.get = get,
+	.compare_lit = compare_lit,
+	.sel_ic = sel_ic,
+	.version = MUSTACH_WRAP_ITF_VERSION_2,
+	.sel_len = sel_len,
+	.subsel_len = subsel_len,
+	.sel_ic_len = sel_ic_len
 };
 
 int mustach_cJSON_file(const char *templstr, size_t length, cJSON *root, int flags, FILE *file)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_file(templstr, length, &mustach_cJSON_wrap_itf, &e, flags, file);
+	return mustach_wrap_file(templstr, length, &mustach_cJSON_wrap_itf, &e, flags | Mustach_With_ExtendedItf, file);
+}
+
+int mustach_cJSON_file_with(const char *templstr, size_t length, cJSON *root, int flags, const mustach_partial_resolver_t *resolver, FILE *file)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_file_with(templstr, length, &mustach_cJSON_wrap_itf, &e, flags | Mustach_With_ExtendedItf, resolver, file);
 }
 
 int mustach_cJSON_fd(const char *templstr, size_t length, cJSON *root, int flags, int fd)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_fd(templstr, length, &mustach_cJSON_wrap_itf, &e, flags, fd);
+	return mustach_wrap_fd(templstr, length, &mustach_cJSON_wrap_itf, &e, flags | Mustach_With_ExtendedItf, fd);
+}
+
+int mustach_cJSON_fd_with(const char *templstr, size_t length, cJSON *root, int flags, const mustach_partial_resolver_t *resolver, int fd, size_t size)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_fd_with(templstr, length, &mustach_cJSON_wrap_itf, &e, flags | Mustach_With_ExtendedItf, resolver, fd, size);
 }
 
 int mustach_cJSON_mem(const char *templstr, size_t length, cJSON *root, int flags, char **result, size_t *size)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_mem(templstr, length, &mustach_cJSON_wrap_itf, &e, flags, result, size);
+	return mustach_wrap_mem(templstr, length, &mustach_cJSON_wrap_itf, &e, flags | Mustach_With_ExtendedItf, result, size);
+}
+
+int mustach_cJSON_mem_with(const char *templstr, size_t length, cJSON *root, int flags, const mustach_partial_resolver_t *resolver, char **result, size_t *size)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_mem_with(templstr, length, &mustach_cJSON_wrap_itf, &e, flags | Mustach_With_ExtendedItf, resolver, result, size);
 }
 
 int mustach_cJSON_write(const char *templstr, size_t length, cJSON *root, int flags, mustach_write_cb_t *writecb, void *closure)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_write(templstr, length, &mustach_cJSON_wrap_itf, &e, flags, writecb, closure);
+	return mustach_wrap_write(templstr, length, &mustach_cJSON_wrap_itf, &e, flags | Mustach_With_ExtendedItf, writecb, closure);
 }
 
 int mustach_cJSON_emit(const char *templstr, size_t length, cJSON *root, int flags, mustach_emit_cb_t *emitcb, void *closure)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_emit(templstr, length, &mustach_cJSON_wrap_itf, &e, flags, emitcb, closure);
+	return mustach_wrap_emit(templstr, length, &mustach_cJSON_wrap_itf, &e, flags | Mustach_With_ExtendedItf, emitcb, closure);
 }
 
 int mustach_cJSON_apply(
@@ -266,5 +561,34 @@ int mustach_cJSON_apply(
 ) {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_apply(templstr, &mustach_cJSON_wrap_itf, &e, flags, writecb, emitcb, closure);
+	return mustach_wrap_apply(templstr, &mustach_cJSON_wrap_itf, &e, flags | Mustach_With_ExtendedItf, writecb, emitcb, closure);
+}
+
+int mustach_cJSON_apply_with(
+		mustach_template_t *templstr,
+		cJSON *root,
+		int flags,
+		const mustach_partial_resolver_t *resolver,
+		mustach_write_cb_t *writecb,
+		mustach_emit_cb_t *emitcb,
+		void *closure
+) {
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_apply_with(templstr, &mustach_cJSON_wrap_itf, &e, flags | Mustach_With_ExtendedItf, resolver, writecb, emitcb, closure);
+}
+
+int mustach_cJSON_apply_begin(
+		mustach_wrap_apply_t **apply,
+		mustach_template_t *templ,
+		cJSON *root,
+		int flags,
+		const mustach_partial_resolver_t *resolver
+) {
+	struct expl *e = malloc(sizeof *e);
+	*apply = NULL;
+	if (e == NULL)
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+	e->root = root;
+	return mustach_wrap_apply_begin(apply, templ, &mustach_cJSON_wrap_itf, e, flags | Mustach_With_ExtendedItf, resolver, free);
 }
@@ -0,0 +1,1208 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "mustach.h"
+#include "mustach-wrap.h"
+#include "mustach-helpers.h"
+#include "mustach-fastjson.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+/* minimal count of members of the objects whose keys are hashed */
+#ifndef FJ_HASH_MIN
+#define FJ_HASH_MIN 8
+#endif
+
+/* initial count of the allocated nodes and containers */
+#ifndef FJ_ALLOC_MIN
+#define FJ_ALLOC_MIN 64
+#endif
+
+/* maximal initial count of the allocated nodes */
+#ifndef FJ_ALLOC_MAX
+#define FJ_ALLOC_MAX 65536
+#endif
+
+/*
+ * The values are recorded in one array of nodes, in the order of the text.
+ * Each container is followed by its items, each member of an object being
+ * a node of its key followed by the nodes of its value. The count of nodes
+ * of a value (its span) gives the next value.
+ */
+struct mustach_fastjson_value {
+	/* the type of the value, see Mustach_FastJSON_... */
+	uint8_t type;
+	/* is the node the key of the next value? */
+	uint8_t iskey;
+	/* is the number zero? */
+	uint8_t zero;
+	/* log2 of the size of the hash table of the object or 0 */
+	uint8_t hbits;
+	/* count of nodes of the value, itself included */
+	uint32_t span;
+	/* count of items of containers, hash of keys of hashed objects */
+	uint32_t count;
+	/* length of the text of strings, numbers and keys */
+	uint32_t length;
+	union {
+		/* text of strings, numbers and keys */
+		const char *text;
+		/* hash table of objects, offsets of their keys, 0 when free */
+		const uint32_t *hash;
+	} u;
+};
+
+typedef struct mustach_fastjson_value node_t;
+
+struct mustach_fastjson {
+	/* the nodes, followed by the hash tables */
+	node_t *nodes;
+	/* the parsed text if owned */
+	char *text;
+};
+
+static const node_t null_node = { .type = Mustach_FastJSON_Null, .span = 1, .u.text = "" };
+
+/*******************************************************************/
+/** PARSING ********************************************************/
+/*******************************************************************/
+
+struct parser {
+	/* the nodes */
+	node_t *nodes;
+	uint32_t count;
+	uint32_t alloc;
+	/* the indexes of the opened containers */
+	uint32_t *stack;
+	uint32_t depth;
+	uint32_t sdepth;
+	/* cumulated size of the hash tables */
+	size_t hsize;
+};
+
+#define ISWS(c)     ((c) == ' ' || (c) == '\n' || (c) == '\r' || (c) == '\t')
+#define ISDIGIT(c)  ((c) >= '0' && (c) <= '9')
+
+#define ONES  UINT64_C(0x0101010101010101)
+#define HIGHS UINT64_C(0x8080808080808080)
+
+/* tells if the 8 chars at s have a quote, a backslash or a control char */
+static inline int strstop8(const char *s)
+{
+	uint64_t w, q, b;
+
+	memcpy(&w, s, sizeof w);
+	q = w ^ (ONES * '"');
+	b = w ^ (ONES * '\\');
+	return ((((w - ONES * 0x20) & ~w)
+		| ((q - ONES) & ~q)
+		| ((b - ONES) & ~b)) & HIGHS) != 0;
+}
+
+/* returns the value of the 4 hexadecimal digits at s or -1 */
+static int hex4(const char *s)
+{
+	int i, c, r = 0;
+
+	for (i = 0 ; i < 4 ; i++) {
+		c = s[i];
+		if (ISDIGIT(c))
+			c -= '0';
+		else if (c >= 'a' && c <= 'f')
+			c -= 'a' - 10;
+		else if (c >= 'A' && c <= 'F')
+			c -= 'A' - 10;
+		else
+			return -1;
+		r = (r << 4) | c;
+	}
+	return r;
+}
+
+/* parses the string starting after its quote at *pp, unescaping it in place */
+static int parse_string(char **pp, const char *end, node_t *node)
+{
+	char *s = *pp, *d;
+	int c, u, v;
+
+	/* search the end of the string, usually without escape */
+	for (;;) {
+		while (end - s >= 8 && !strstop8(s))
+			s += 8;
+		c = (unsigned char)*s;
+		if (c == '"' || c == '\\')
+			break;
+		if (c < 0x20)
+			return MUSTACH_ERROR_BAD_DATA;
+		s++;
+	}
+
+	/* unescape */
+	for (d = s ; c != '"' ; c = (unsigned char)*s) {
+		if (c != '\\') {
+			if (c < 0x20)
+				return MUSTACH_ERROR_BAD_DATA;
+			*d++ = *s++;
+			continue;
+		}
+		switch (s[1]) {
+		case '"': case '\\': case '/': *d++ = s[1]; break;
+		case 'b': *d++ = '\b'; break;
+		case 'f': *d++ = '\f'; break;
+		case 'n': *d++ = '\n'; break;
+		case 'r': *d++ = '\r'; break;
+		case 't': *d++ = '\t'; break;
+		case 'u':
+			u = hex4(&s[2]);
+			if (u < 0)
+				return MUSTACH_ERROR_BAD_DATA;
+			if (u >= 0xd800 && u <= 0xdfff) {
+				/* surrogates, a lone one is replaced */
+				v = u <= 0xdbff && s[6] == '\\' && s[7] == 'u' ? hex4(&s[8]) : -1;
+				if (v >= 0xdc00 && v <= 0xdfff) {
+					u = 0x10000 + ((u - 0xd800) << 10) + (v - 0xdc00);
+					s += 6;
+				}
+				else
+					u = 0xfffd;
+			}
+			if (u < 0x80)
+				*d++ = (char)u;
+			else if (u < 0x800) {
+				*d++ = (char)(0xc0 | (u >> 6));
+				*d++ = (char)(0x80 | (u & 0x3f));
+			}
+			else if (u < 0x10000) {
+				*d++ = (char)(0xe0 | (u >> 12));
+				*d++ = (char)(0x80 | ((u >> 6) & 0x3f));
+				*d++ = (char)(0x80 | (u & 0x3f));
+			}
+			else {
+				*d++ = (char)(0xf0 | (u >> 18));
+				*d++ = (char)(0x80 | ((u >> 12) & 0x3f));
+				*d++ = (char)(0x80 | ((u >> 6) & 0x3f));
+				*d++ = (char)(0x80 | (u & 0x3f));
+			}
+			s += 4;
+			break;
+		default:
+			return MUSTACH_ERROR_BAD_DATA;
+		}
+		s += 2;
+	}
+
+	if ((size_t)(d - *pp) > UINT32_MAX)
+		return MUSTACH_ERROR_TOO_BIG;
+	*d = 0;
+	node->u.text = *pp;
+	node->length = (uint32_t)(d - *pp);
+	*pp = s + 1;
+	return MUSTACH_OK;
+}
+
+/* parses the number at *pp, its text is terminated later */
+static int parse_number(char **pp, node_t *node)
+{
+	char *s = *pp;
+	int zero = 1;
+
+	if (*s == '-')
+		s++;
+	if (*s == '0')
+		s++;
+	else if (*s >= '1' && *s <= '9') {
+		zero = 0;
+		do { s++; } while (ISDIGIT(*s));
+	}
+	else
+		return MUSTACH_ERROR_BAD_DATA;
+	if (*s == '.') {
+		s++;
+		if (!ISDIGIT(*s))
+			return MUSTACH_ERROR_BAD_DATA;
+		do { zero &= *s == '0'; s++; } while (ISDIGIT(*s));
+	}
+	if (*s == 'e' || *s == 'E') {
+		s++;
+		if (*s == '+' || *s == '-')
+			s++;
+		if (!ISDIGIT(*s))
+			return MUSTACH_ERROR_BAD_DATA;
+		do { s++; } while (ISDIGIT(*s));
+	}
+	if ((size_t)(s - *pp) > UINT32_MAX)
+		return MUSTACH_ERROR_TOO_BIG;
+	node->type = Mustach_FastJSON_Number;
+	node->zero = (uint8_t)zero;
+	node->u.text = *pp;
+	node->length = (uint32_t)(s - *pp);
+	*pp = s;
+	return MUSTACH_OK;
+}
+
+/* adds a node of one item, returns NULL when out of memory or too big */
+static node_t *add(struct parser *ps)
+{
+	node_t *node;
+	uint32_t alloc;
+	size_t size;
+
+	if (ps->count == ps->alloc) {
+		alloc = ps->alloc < UINT32_MAX / 2 ? 2 * ps->alloc : UINT32_MAX - 1;
+		size = (size_t)alloc * sizeof *node;
+		if (alloc == ps->count || size / sizeof *node != alloc)
+			return NULL;
+		node = realloc(ps->nodes, size);
+		if (node == NULL)
+			return NULL;
+		ps->nodes = node;
+		ps->alloc = alloc;
+	}
+	node = &ps->nodes[ps->count++];
+	memset(node, 0, sizeof *node);
+	node->span = 1;
+	return node;
+}
+
+/* records the last added node as opened container */
+static int push(struct parser *ps)
+{
+	uint32_t *stack;
+	uint32_t sdepth;
+
+	if (ps->depth == ps->sdepth) {
+		sdepth = ps->sdepth ? 2 * ps->sdepth : FJ_ALLOC_MIN;
+		stack = realloc(ps->stack, (size_t)sdepth * sizeof *stack);
+		if (stack == NULL)
+			return MUSTACH_ERROR_OUT_OF_MEMORY;
+		ps->stack = stack;
+		ps->sdepth = sdepth;
+	}
+	ps->stack[ps->depth++] = ps->count - 1;
+	return MUSTACH_OK;
+}
+
+/* parses the text until end in the nodes of the parser */
+static int parse(struct parser *ps, char *text, const char *end)
+{
+	char *p = text, *term = NULL;
+	node_t *node;
+	uint32_t top;
+	int rc, c;
+
+value:
+	while (ISWS(*p))
+		p++;
+	node = add(ps);
+	if (node == NULL)
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+	switch (*p) {
+	case '{':
+		p++;
+		node->type = Mustach_FastJSON_Object;
+		rc = push(ps);
+		if (rc != MUSTACH_OK)
+			return rc;
+		while (ISWS(*p))
+			p++;
+		if (*p != '}')
+			goto key;
+		p++;
+		goto close;
+	case '[':
+		p++;
+		node->type = Mustach_FastJSON_Array;
+		rc = push(ps);
+		if (rc != MUSTACH_OK)
+			return rc;
+		while (ISWS(*p))
+			p++;
+		if (*p != ']')
+			goto value;
+		p++;
+		goto close;
+	case '"':
+		p++;
+		node->type = Mustach_FastJSON_String;
+		rc = parse_string(&p, end, node);
+		if (rc != MUSTACH_OK)
+			return rc;
+		break;
+	case 't':
+		if (strncmp(p, "true", 4) != 0)
+			return MUSTACH_ERROR_BAD_DATA;
+		p += 4;
+		node->type = Mustach_FastJSON_True;
+		node->u.text = "true";
+		node->length = 4;
+		break;
+	case 'f':
+		if (strncmp(p, "false", 5) != 0)
+			return MUSTACH_ERROR_BAD_DATA;
+		p += 5;
+		node->type = Mustach_FastJSON_False;
+		node->u.text = "false";
+		node->length = 5;
+		break;
+	case 'n':
+		if (strncmp(p, "null", 4) != 0)
+			return MUSTACH_ERROR_BAD_DATA;
+		p += 4;
+		node->type = Mustach_FastJSON_Null;
+		node->u.text = "";
+		break;
+	default:
+		rc = parse_number(&p, node);
+		if (rc != MUSTACH_OK)
+			return rc;
+		term = p;
+		break;
+	}
+
+after:
+	/* a value is complete, the char following a number is
+	 * read before being overwritten by its terminating zero */
+	while (ISWS(*p))
+		p++;
+	c = *p;
+	if (term != NULL) {
+		*term = 0;
+		term = NULL;
+	}
+	if (ps->depth == 0)
+		return p == end ? MUSTACH_OK : MUSTACH_ERROR_BAD_DATA;
+	top = ps->stack[ps->depth - 1];
+	ps->nodes[top].count++;
+	if (c == ',') {
+		p++;
+		if (ps->nodes[top].type == Mustach_FastJSON_Array)
+			goto value;
+		goto key;
+	}
+	if (c != (ps->nodes[top].type == Mustach_FastJSON_Array ? ']' : '}'))
+		return MUSTACH_ERROR_BAD_DATA;
+	p++;
+
+close:
+	top = ps->stack[--ps->depth];
+	node = &ps->nodes[top];
+	node->span = ps->count - top;
+	if (node->type == Mustach_FastJSON_Object && node->count >= FJ_HASH_MIN) {
+		for (node->hbits = 1 ; ((size_t)1 << node->hbits) < 2 * (size_t)node->count ; node->hbits++);
+		ps->hsize += (size_t)1 << node->hbits;
+	}
+	goto after;
+
+key:
+	while (ISWS(*p))
+		p++;
+	if (*p != '"')
+		return MUSTACH_ERROR_BAD_DATA;
+	p++;
+	node = add(ps);
+	if (node == NULL)
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+	node->type = Mustach_FastJSON_String;
+	node->iskey = 1;
+	rc = parse_string(&p, end, node);
+	if (rc != MUSTACH_OK)
+		return rc;
+	while (ISWS(*p))
+		p++;
+	if (*p != ':')
+		return MUSTACH_ERROR_BAD_DATA;
+	p++;
+	goto value;
+}
+
+static uint32_t hash(const char *name, size_t length)
+{
+	uint32_t h = 2166136261u;
+	while (length--) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/* moves the nodes in an arena with the hash tables and fills them */
+static node_t *make_arena(struct parser *ps)
+{
+	node_t *nodes, *node, *key;
+	uint32_t *table, i, n, mask, slot;
+	size_t size;
+
+	size = ps->count * sizeof *nodes;
+	if (ps->hsize > (SIZE_MAX - size) / sizeof *table)
+		return NULL;
+	nodes = realloc(ps->nodes, size + ps->hsize * sizeof *table);
+	if (nodes == NULL)
+		return NULL;
+	ps->nodes = NULL;
+
+	table = (uint32_t*)&nodes[ps->count];
+	for (node = nodes ; ps->hsize != 0 ; node++) {
+		if (node->hbits == 0)
+			continue;
+		mask = (uint32_t)(((size_t)1 << node->hbits) - 1);
+		memset(table, 0, ((size_t)mask + 1) * sizeof *table);
+		for (key = node + 1, n = node->count ; n ; n--, key += 1 + key[1].span) {
+			key->count = hash(key->u.text, key->length);
+			for (slot = key->count & mask ; (i = table[slot]) != 0 ; slot = (slot + 1) & mask)
+				if (node[i].count == key->count
+				 && node[i].length == key->length
+				 && memcmp(node[i].u.text, key->u.text, key->length) == 0)
+					break;
+			if (i == 0)
+				table[slot] = (uint32_t)(key - node);
+		}
+		node->u.hash = table;
+		table += (size_t)mask + 1;
+		ps->hsize -= (size_t)mask + 1;
+	}
+	return nodes;
+}
+
+/* see header file */
+int mustach_fastjson_parse(mustach_fastjson_t **doc, char *text, size_t length)
+{
+	struct parser ps;
+	mustach_fastjson_t *d;
+	int rc;
+
+	*doc = NULL;
+	if (length == 0)
+		length = strlen(text);
+	d = malloc(sizeof *d);
+	if (d == NULL)
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+
+	/* estimate the count of nodes, it grows when needed */
+	ps.alloc = length / 8 < FJ_ALLOC_MIN ? FJ_ALLOC_MIN
+		: length / 8 < FJ_ALLOC_MAX ? (uint32_t)(length / 8) : FJ_ALLOC_MAX;
+	ps.nodes = malloc((size_t)ps.alloc * sizeof *ps.nodes);
+	ps.count = 0;
+	ps.stack = NULL;
+	ps.depth = ps.sdepth = 0;
+	ps.hsize = 0;
+	rc = ps.nodes == NULL ? MUSTACH_ERROR_OUT_OF_MEMORY : parse(&ps, text, &text[length]);
+	if (rc == MUSTACH_OK) {
+		d->nodes = make_arena(&ps);
+		if (d->nodes == NULL)
+			rc = MUSTACH_ERROR_OUT_OF_MEMORY;
+	}
+	free(ps.stack);
+	free(ps.nodes);
+	if (rc != MUSTACH_OK)
+		free(d);
+	else {
+		d->text = NULL;
+		*doc = d;
+	}
+	return rc;
+}
+
+/* see header file */
+int mustach_fastjson_parse_copy(mustach_fastjson_t **doc, const char *text, size_t length)
+{
+	char *copy;
+	int rc;
+
+	if (length == 0)
+		length = strlen(text);
+	copy = malloc(length + 1);
+	if (copy == NULL)
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+	memcpy(copy, text, length);
+	copy[length] = 0;
+	rc = mustach_fastjson_parse(doc, copy, length);
+	if (rc == MUSTACH_OK)
+		(*doc)->text = copy;
+	else
+		free(copy);
+	return rc;
+}
+
+/* see header file */
+int mustach_fastjson_load_file(mustach_fastjson_t **doc, const char *path)
+{
+	mustach_sbuf_t sbuf = MUSTACH_SBUF_INIT;
+	int rc;
+
+	*doc = NULL;
+	rc = mustach_read_file(path, &sbuf);
+	if (rc == MUSTACH_OK) {
+		rc = mustach_fastjson_parse(doc, (char*)sbuf.value, mustach_sbuf_length(&sbuf));
+		if (rc == MUSTACH_OK)
+			(*doc)->text = (char*)sbuf.value;
+		else
+			mustach_sbuf_release(&sbuf);
+	}
+	return rc;
+}
+
+/* see header file */
+void mustach_fastjson_destroy(mustach_fastjson_t *doc)
+{
+	if (doc != NULL) {
+		free(doc->nodes);
+		free(doc->text);
+		free(doc);
+	}
+}
+
+/*******************************************************************/
+/** ACCESSING ******************************************************/
+/*******************************************************************/
+
+/* a searched name, its length and its hash are computed when needed */
+struct name {
+	const char *name;
+	size_t length;
+	uint32_t hash;
+	int hashed;
+};
+
+/* set the searched name, its length being SIZE_MAX when unknown */
+static void set_name(struct name *nm, const char *name, size_t length)
+{
+	nm->name = name;
+	nm->length = length;
+	nm->hashed = 0;
+}
+
+/* returns the value of the member of the object of name or NULL */
+static const node_t *member(const node_t *obj, struct name *nm)
+{
+	const node_t *key;
+	uint32_t i, n, mask, slot;
+
+	if (obj->type != Mustach_FastJSON_Object)
+		return NULL;
+
+	if (nm->length == SIZE_MAX)
+		nm->length = strlen(nm->name);
+	if (obj->hbits == 0) {
+		for (key = obj + 1, n = obj->count ; n ; n--, key += 1 + key[1].span)
+			if (key->length == nm->length
+			 && memcmp(key->u.text, nm->name, nm->length) == 0)
+				return key + 1;
+		return NULL;
+	}
+
+	if (!nm->hashed) {
+		nm->hash = hash(nm->name, nm->length);
+		nm->hashed = 1;
+	}
+	mask = (uint32_t)(((size_t)1 << obj->hbits) - 1);
+	for (slot = nm->hash & mask ; (i = obj->u.hash[slot]) != 0 ; slot = (slot + 1) & mask) {
+		key = obj + i;
+		if (key->count == nm->hash
+		 && key->length == nm->length
+		 && memcmp(key->u.text, nm->name, nm->length) == 0)
+			return key + 1;
+	}
+	return NULL;
+}
+
+/* returns the item of index of the array or NULL */
+static const node_t *item(const node_t *array, size_t index)
+{
+	const node_t *node;
+
+	if (array->type != Mustach_FastJSON_Array || index >= array->count)
+		return NULL;
+	for (node = array + 1 ; index ; index--)
+		node += node->span;
+	return node;
+}
+
+/* see header file */
+const mustach_fastjson_value_t *mustach_fastjson_root(const mustach_fastjson_t *doc)
+{
+	return doc->nodes;
+}
+
+/* see header file */
+int mustach_fastjson_type(const mustach_fastjson_value_t *value)
+{
+	return value->type;
+}
+
+/* see header file */
+const char *mustach_fastjson_string(const mustach_fastjson_value_t *value, size_t *length)
+{
+	if (value->type != Mustach_FastJSON_String && value->type != Mustach_FastJSON_Number)
+		return NULL;
+	if (length != NULL)
+		*length = value->length;
+	return value->u.text;
+}
+
+/* see header file */
+size_t mustach_fastjson_count(const mustach_fastjson_value_t *value)
+{
+	return value->type == Mustach_FastJSON_Array || value->type == Mustach_FastJSON_Object ? value->count : 0;
+}
+
+/* see header file */
+const mustach_fastjson_value_t *mustach_fastjson_get(const mustach_fastjson_value_t *object, const char *key)
+{
+	struct name nm;
+	set_name(&nm, key, SIZE_MAX);
+	return member(object, &nm);
+}
+
+/* see header file */
+const mustach_fastjson_value_t *mustach_fastjson_at(const mustach_fastjson_value_t *array, size_t index)
+{
+	return item(array, index);
+}
+
+/*******************************************************************/
+/** PRINTING *******************************************************/
+/*******************************************************************/
+
+static int print_string(mustach_stream_t *stream, const char *text, size_t length)
+{
+	static const char hex[] = "0123456789abcdef";
+	char esc[6];
+	size_t i, j;
+	int c, rc;
+
+	rc = mustach_stream_write(stream, "\"", 1);
+	for (i = j = 0 ; rc == MUSTACH_OK && i < length ; i++) {
+		c = (unsigned char)text[i];
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+		esc[0] = '\\';
+		switch (c) {
+		case '"': case '\\': esc[1] = (char)c; break;
+		case '\b': esc[1] = 'b'; break;
+		case '\f': esc[1] = 'f'; break;
+		case '\n': esc[1] = 'n'; break;
+		case '\r': esc[1] = 'r'; break;
+		case '\t': esc[1] = 't'; break;
+		default:
+			memcpy(&esc[1], "u00", 3);
+			esc[4] = hex[c >> 4];
+			esc[5] = hex[c & 15];
+			break;
+		}
+		rc = mustach_stream_write(stream, &text[j], i - j);
+		if (rc == MUSTACH_OK)
+			rc = mustach_stream_write(stream, esc, esc[1] == 'u' ? 6 : 2);
+		j = i + 1;
+	}
+	if (rc == MUSTACH_OK)
+		rc = mustach_stream_write(stream, &text[j], length - j);
+	if (rc == MUSTACH_OK)
+		rc = mustach_stream_write(stream, "\"", 1);
+	return rc;
+}
+
+/* prints the value without recursion using the spans of the containers */
+static int print(mustach_stream_t *stream, const node_t *value)
+{
+	const node_t *node = value, *stop = value + value->span, **ends = NULL, **tmp;
+	size_t depth = 0, alloc = 0;
+	int rc = MUSTACH_OK, first = 1;
+
+	while (rc == MUSTACH_OK && node < stop) {
+		if (!first)
+			rc = mustach_stream_write(stream, ",", 1);
+		first = 0;
+		if (rc != MUSTACH_OK)
+			break;
+		if (node->iskey) {
+			rc = print_string(stream, node->u.text, node->length);
+			if (rc == MUSTACH_OK)
+				rc = mustach_stream_write(stream, ":", 1);
+			first = 1;
+			node++;
+			continue;
+		}
+		switch (node->type) {
+		case Mustach_FastJSON_Null:
+			rc = mustach_stream_write(stream, "null", 4);
+			break;
+		case Mustach_FastJSON_String:
+			rc = print_string(stream, node->u.text, node->length);
+			break;
+		case Mustach_FastJSON_Array:
+		case Mustach_FastJSON_Object:
+			if (node->span == 1) {
+				rc = mustach_stream_write(stream, node->type == Mustach_FastJSON_Array ? "[]" : "{}", 2);
+				break;
+			}
+			if (depth == alloc) {
+				alloc = alloc ? 2 * alloc : FJ_ALLOC_MIN;
+				tmp = realloc(ends, alloc * sizeof *ends);
+				if (tmp == NULL) {
+					rc = MUSTACH_ERROR_OUT_OF_MEMORY;
+					break;
+				}
+				ends = tmp;
+			}
+			ends[depth++] = node;
+			rc = mustach_stream_write(stream, node->type == Mustach_FastJSON_Array ? "[" : "{", 1);
+			first = 1;
+			break;
+		default:
+			rc = mustach_stream_write(stream, node->u.text, node->length);
+			break;
+		}
+		node++;
+		while (rc == MUSTACH_OK && depth && node == ends[depth - 1] + ends[depth - 1]->span) {
+			depth--;
+			rc = mustach_stream_write(stream, ends[depth]->type == Mustach_FastJSON_Array ? "]" : "}", 1);
+		}
+	}
+	free(ends);
+	return rc;
+}
+
+/* see header file */
+char *mustach_fastjson_print(const mustach_fastjson_value_t *value, size_t *length)
+{
+	mustach_stream_t stream = MUSTACH_STREAM_INIT;
+	char *result;
+	size_t size;
+
+	if (print(&stream, value) != MUSTACH_OK
+	 || mustach_stream_end(&stream, &result, &size) != MUSTACH_OK) {
+		mustach_stream_abort(&stream);
+		return NULL;
+	}
+	if (length != NULL)
+		*length = size;
+	return result;
+}
+
+/*******************************************************************/
+/** WRAPPING *******************************************************/
+/*******************************************************************/
+
+struct expl {
+	const node_t *root;
+	const node_t *selection;
+	int depth;
+	uint64_t stamp;
+	char scratch[MUSTACH_WRAP_FORMAT_SIZE];
+	struct {
+		uint64_t stamp;
+		const node_t *obj;
+		const node_t *key;
+		uint32_t remain;
+		int is_objiter;
+	} stack[MUSTACH_MAX_DEPTH];
+};
+
+static int start(void *closure)
+{
+	struct expl *e = closure;
+	e->depth = 0;
+	e->stamp = 1;
+	e->selection = &null_node;
+	e->stack[0].stamp = 1;
+	e->stack[0].obj = e->root;
+	e->stack[0].key = NULL;
+	e->stack[0].remain = 0;
+	e->stack[0].is_objiter = 0;
+	return MUSTACH_OK;
+}
+
+static int compare_lit(void *closure, const struct mustach_wrap_lit *lit)
+{
+	struct expl *e = closure;
+	const node_t *o = e->selection;
+	struct mustach_wrap_lit num;
+	double d;
+	int64_t i;
+
+	switch (o->type) {
+	case Mustach_FastJSON_Number:
+		mustach_wrap_parse_lit(&num, o->u.text);
+		if (num.type == Mustach_Lit_Int && lit->type == Mustach_Lit_Int) {
+			i = num.i - lit->i;
+			return i < 0 ? -1 : i > 0 ? 1 : 0;
+		}
+		d = num.d - lit->d;
+		return d < 0 ? -1 : d > 0 ? 1 : 0;
+	case Mustach_FastJSON_String:
+		return strcmp(o->u.text, lit->string);
+	case Mustach_FastJSON_True:
+		return lit->type == Mustach_Lit_True ? 0 : strcmp("true", lit->string);
+	case Mustach_FastJSON_False:
+		return lit->type == Mustach_Lit_False ? 0 : strcmp("false", lit->string);
+	case Mustach_FastJSON_Null:
+		return lit->type == Mustach_Lit_Null ? 0 : strcmp("null", lit->string);
+	default:
+		return 1;
+	}
+}
+
+static int compare(void *closure, const char *value)
+{
+	struct mustach_wrap_lit lit;
+	mustach_wrap_parse_lit(&lit, value);
+	return compare_lit(closure, &lit);
+}
+
+static int sel_len(void *closure, const char *name, size_t length)
+{
+	struct expl *e = closure;
+	const node_t *o;
+	struct name nm;
+	int i, r;
+
+	set_name(&nm, name, length);
+	i = e->depth;
+	while (i >= 0 && !(o = member(e->stack[i].obj, &nm)))
+		i--;
+	if (i >= 0)
+		r = 1;
+	else {
+		o = &null_node;
+		r = 0;
+	}
+	e->selection = o;
+	return r;
+}
+
+static int sel(void *closure, const char *name)
+{
+	struct expl *e = closure;
+
+	if (name != NULL)
+		return sel_len(closure, name, SIZE_MAX);
+	e->selection = e->stack[e->depth].obj;
+	return 1;
+}
+
+static int sel_ic_len(void *closure, const char *name, size_t length, struct mustach_wrap_ic *ic)
+{
+	struct expl *e = closure;
+	const node_t *o = NULL;
+	struct name nm;
+	int i, low, valid;
+
+	/* the cache is valid if the level where the name was found is unchanged */
+	valid = ic->stamp != 0
+		&& ic->depth <= e->depth
+		&& (ic->depth < 0 || e->stack[ic->depth].stamp <= ic->stamp);
+
+	/* when valid, only search the levels changed since the cache was set */
+	set_name(&nm, name, length);
+	low = valid ? ic->depth : -1;
+	for (i = e->depth ; i > low ; i--)
+		if ((!valid || e->stack[i].stamp > ic->stamp)
+		 && (o = member(e->stack[i].obj, &nm)) != NULL)
+			break;
+	if (i == low)
+		o = valid ? ic->item : NULL;
+
+	/* record the result */
+	ic->stamp = e->stamp;
+	ic->depth = i;
+	ic->item = (void*)o;
+	e->selection = i >= 0 ? o : &null_node;
+	return i >= 0;
+}
+
+static int sel_ic(void *closure, const char *name, struct mustach_wrap_ic *ic)
+{
+	return sel_ic_len(closure, name, SIZE_MAX, ic);
+}
+
+static int subsel_len(void *closure, const char *name, size_t length)
+{
+	struct expl *e = closure;
+	const node_t *o = NULL;
+	struct name nm;
+	char *end;
+	size_t idx;
+
+	if (e->selection->type == Mustach_FastJSON_Object) {
+		set_name(&nm, name, length);
+		o = member(e->selection, &nm);
+	}
+	else if (e->selection->type == Mustach_FastJSON_Array) {
+		if (length == SIZE_MAX)
+			length = strlen(name);
+		if (length) {
+			char copy[length + 1];
+			memcpy(copy, name, length);
+			copy[length] = 0;
+			idx = (size_t)strtol(copy, &end, 10);
+			if (!*end)
+				o = item(e->selection, idx);
+		}
+	}
+	if (o == NULL)
+		return 0;
+	e->selection = o;
+	return 1;
+}
+
+static int subsel(void *closure, const char *name)
+{
+	return subsel_len(closure, name, SIZE_MAX);
+}
+
+static int enter(void *closure, int objiter)
+{
+	struct expl *e = closure;
+	const node_t *o;
+
+	if (++e->depth >= MUSTACH_MAX_DEPTH)
+		return MUSTACH_ERROR_TOO_DEEP;
+
+	o = e->selection;
+	e->stack[e->depth].is_objiter = 0;
+	if (objiter) {
+		if (o->type != Mustach_FastJSON_Object || o->count == 0)
+			goto not_entering;
+		e->stack[e->depth].key = o + 1;
+		e->stack[e->depth].obj = o + 2;
+		e->stack[e->depth].remain = o->count - 1;
+		e->stack[e->depth].is_objiter = 1;
+	} else if (o->type == Mustach_FastJSON_Array) {
+		if (o->count == 0)
+			goto not_entering;
+		e->stack[e->depth].obj = o + 1;
+		e->stack[e->depth].remain = o->count - 1;
+	} else if ((o->type == Mustach_FastJSON_Object && o->count != 0)
+	        || o->type == Mustach_FastJSON_True
+	        || (o->type == Mustach_FastJSON_String && o->length != 0)
+	        || (o->type == Mustach_FastJSON_Number && !o->zero)) {
+		e->stack[e->depth].obj = o;
+		e->stack[e->depth].remain = 0;
+	} else
+		goto not_entering;
+	e->stack[e->depth].stamp = ++e->stamp;
+	return 1;
+
+not_entering:
+	e->depth--;
+	return 0;
+}
+
+static int next(void *closure)
+{
+	struct expl *e = closure;
+	const node_t *o;
+
+	if (e->depth <= 0)
+		return MUSTACH_ERROR_CLOSING;
+
+	if (e->stack[e->depth].remain == 0)
+		return 0;
+
+	e->stack[e->depth].remain--;
+	o = e->stack[e->depth].obj + e->stack[e->depth].obj->span;
+	if (e->stack[e->depth].is_objiter)
+		e->stack[e->depth].key = o++;
+	e->stack[e->depth].obj = o;
+	e->stack[e->depth].stamp = ++e->stamp;
+	return 1;
+}
+
+static int leave(void *closure)
+{
+	struct expl *e = closure;
+
+	if (e->depth <= 0)
+		return MUSTACH_ERROR_CLOSING;
+
+	e->depth--;
+	return 0;
+}
+
+/* format the number with a fraction or an exponent in the scratch buffer */
+static size_t number(struct expl *e, const node_t *o)
+{
+	struct mustach_wrap_lit num, lit;
+	size_t length;
+	int precision;
+
+	mustach_wrap_parse_lit(&num, o->u.text);
+	for (precision = 15 ; ; precision++) {
+		length = mustach_wrap_format_double(e->scratch, num.d, precision);
+		if (precision == 17)
+			break;
+		mustach_wrap_parse_lit(&lit, e->scratch);
+		if (lit.d == num.d)
+			break;
+	}
+	return length;
+}
+
+static int get(void *closure, struct mustach_sbuf *sbuf, int key)
+{
+	struct expl *e = closure;
+	const node_t *o;
+	size_t length;
+	int d;
+
+	if (key) {
+		o = &null_node;
+		for (d = e->depth ; d >= 0 ; d--)
+			if (e->stack[d].is_objiter) {
+				o = e->stack[d].key;
+				break;
+			}
+	}
+	else
+		o = e->selection;
+	switch (o->type) {
+	case Mustach_FastJSON_Array:
+	case Mustach_FastJSON_Object:
+		sbuf->value = mustach_fastjson_print(o, &length);
+		if (sbuf->value == NULL)
+			return MUSTACH_ERROR_SYSTEM;
+		sbuf->freecb = free;
+		sbuf->length = length;
+		break;
+	case Mustach_FastJSON_Number:
+		if (strpbrk(o->u.text, ".eE") != NULL) {
+			sbuf->length = number(e, o);
+			sbuf->value = e->scratch;
+			break;
+		}
+		/*@fallthrough@*/
+	default:
+		sbuf->value = o->u.text;
+		sbuf->length = o->length;
+		break;
+	}
+	return 1;
+}
+
+const struct mustach_wrap_itf mustach_fastjson_wrap_itf = {
+	.start = start,
+	.stop = NULL,
+	.compare = compare,
+	.sel = sel,
+	.subsel = subsel,
+	.enter = enter,
+	.next = next,
+	.leave = leave,
+	.get = get,
+	.compare_lit = compare_lit,
+	.sel_ic = sel_ic,
+	.version = MUSTACH_WRAP_ITF_VERSION_2,
+	.sel_len = sel_len,
+	.subsel_len = subsel_len,
+	.sel_ic_len = sel_ic_len
+};
+
+int mustach_fastjson_file(const char *templstr, size_t length, const mustach_fastjson_value_t *root, int flags, FILE *file)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_file(templstr, length, &mustach_fastjson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, file);
+}
+
+int mustach_fastjson_file_with(const char *templstr, size_t length, const mustach_fastjson_value_t *root, int flags, const mustach_partial_resolver_t *resolver, FILE *file)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_file_with(templstr, length, &mustach_fastjson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, resolver, file);
+}
+
+int mustach_fastjson_fd(const char *templstr, size_t length, const mustach_fastjson_value_t *root, int flags, int fd)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_fd(templstr, length, &mustach_fastjson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, fd);
+}
+
+int mustach_fastjson_fd_with(const char *templstr, size_t length, const mustach_fastjson_value_t *root, int flags, const mustach_partial_resolver_t *resolver, int fd, size_t size)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_fd_with(templstr, length, &mustach_fastjson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, resolver, fd, size);
+}
+
+int mustach_fastjson_mem(const char *templstr, size_t length, const mustach_fastjson_value_t *root, int flags, char **result, size_t *size)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_mem(templstr, length, &mustach_fastjson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, result, size);
+}
+
+int mustach_fastjson_mem_with(const char *templstr, size_t length, const mustach_fastjson_value_t *root, int flags, const mustach_partial_resolver_t *resolver, char **result, size_t *size)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_mem_with(templstr, length, &mustach_fastjson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, resolver, result, size);
+}
+
+int mustach_fastjson_write(const char *templstr, size_t length, const mustach_fastjson_value_t *root, int flags, mustach_write_cb_t *writecb, void *closure)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_write(templstr, length, &mustach_fastjson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, writecb, closure);
+}
+
+int mustach_fastjson_emit(const char *templstr, size_t length, const mustach_fastjson_value_t *root, int flags, mustach_emit_cb_t *emitcb, void *closure)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_emit(templstr, length, &mustach_fastjson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, emitcb, closure);
+}
+
+int mustach_fastjson_apply(
+		mustach_template_t *templstr,
+		const mustach_fastjson_value_t *root,
+		int flags,
+		mustach_write_cb_t *writecb,
+		mustach_emit_cb_t *emitcb,
+		void *closure
+) {
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_apply(templstr, &mustach_fastjson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, writecb, emitcb, closure);
+}
+
+int mustach_fastjson_apply_with(
+		mustach_template_t *templstr,
+		const mustach_fastjson_value_t *root,
+		int flags,
+		const mustach_partial_resolver_t *resolver,
+		mustach_write_cb_t *writecb,
+		mustach_emit_cb_t *emitcb,
+		void *closure
+) {
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_apply_with(templstr, &mustach_fastjson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, resolver, writecb, emitcb, closure);
+}
+
+int mustach_fastjson_apply_begin(
+		mustach_wrap_apply_t **apply,
+		mustach_template_t *templ,
+		const mustach_fastjson_value_t *root,
+		int flags,
+		const mustach_partial_resolver_t *resolver
+) {
+	struct expl *e = malloc(sizeof *e);
+	*apply = NULL;
+	if (e == NULL)
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+	e->root = root;
+	return mustach_wrap_apply_begin(apply, templ, &mustach_fastjson_wrap_itf, e, flags | Mustach_With_ExtendedItf, resolver, free);
+}
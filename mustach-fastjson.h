@@ -0,0 +1,251 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+#ifndef _mustach_fastjson_h_included_
+#define _mustach_fastjson_h_included_
+
+/*
+ * mustach-fastjson is a JSON backend without dependency, its parser
+ * and its representation of values are tuned for mustach.
+ *
+ * The text is parsed in place in one pass: strings are unescaped
+ * and terminated in the parsed text that therefore must be writable
+ * and kept while the document is used. The values are recorded in one
+ * array, in the order of the text, each container being followed by
+ * its items. The keys of the big objects are hashed.
+ *
+ * When a key is duplicated in an object, the first member wins: it is
+ * the one selected by the templates and returned by mustach_fastjson_get.
+ *
+ * The numbers are rendered as written in the JSON text, except the
+ * numbers having a fraction or an exponent that are rendered from their
+ * value with the fewest significant digits, 15, 16 or 17, that give the
+ * value back. So 1.210 is rendered 1.21.
+ */
+
+#include "mustach-wrap.h"
+
+/**
+ * Types of the JSON values
+ */
+#define Mustach_FastJSON_Null     0
+#define Mustach_FastJSON_False    1
+#define Mustach_FastJSON_True     2
+#define Mustach_FastJSON_Number   3
+#define Mustach_FastJSON_String   4
+#define Mustach_FastJSON_Array    5
+#define Mustach_FastJSON_Object   6
+
+/**
+ * A parsed JSON document
+ */
+typedef struct mustach_fastjson mustach_fastjson_t;
+
+/**
+ * A value of a parsed JSON document
+ */
+typedef struct mustach_fastjson_value mustach_fastjson_value_t;
+
+/**
+ * mustach_fastjson_parse - Parses in place the JSON 'text' of 'length'
+ *
+ * The text must be null terminated, when 'length' is zero it is
+ * computed using 'strlen'. The text is modified and must be kept
+ * unchanged while the document is used.
+ *
+ * @doc:    pointer receiving the created document
+ * @text:   the JSON text to parse
+ * @length: length of the text or zero
+ *
+ * Returns 0 in case of success, MUSTACH_ERROR_BAD_DATA if the text
+ * isn't valid JSON or an other negative value in case of error.
+ */
+extern int mustach_fastjson_parse(mustach_fastjson_t **doc, char *text, size_t length);
+
+/**
+ * mustach_fastjson_parse_copy - Same as mustach_fastjson_parse but
+ * parses a copy of the 'text' that needs not to be null terminated
+ * if 'length' isn't zero.
+ */
+extern int mustach_fastjson_parse_copy(mustach_fastjson_t **doc, const char *text, size_t length);
+
+/**
+ * mustach_fastjson_load_file - Same as mustach_fastjson_parse but
+ * parses the content of the file of 'path' or of the standard input
+ * if 'path' is "-"
+ */
+extern int mustach_fastjson_load_file(mustach_fastjson_t **doc, const char *path);
+
+/**
+ * mustach_fastjson_destroy - Destroys the document and its values
+ */
+extern void mustach_fastjson_destroy(mustach_fastjson_t *doc);
+
+/**
+ * mustach_fastjson_root - Returns the root value of the document
+ */
+extern const mustach_fastjson_value_t *mustach_fastjson_root(const mustach_fastjson_t *doc);
+
+/**
+ * mustach_fastjson_type - Returns the type of the value (see Mustach_FastJSON_...)
+ */
+extern int mustach_fastjson_type(const mustach_fastjson_value_t *value);
+
+/**
+ * mustach_fastjson_string - Returns the null terminated text of the
+ * strings and of the numbers, as written in the JSON text, or NULL
+ * for other values. When 'length' isn't NULL, it receives the length
+ * of the text.
+ */
+extern const char *mustach_fastjson_string(const mustach_fastjson_value_t *value, size_t *length);
+
+/**
+ * mustach_fastjson_count - Returns the count of the items of arrays,
+ * of the members of objects or zero for other values
+ */
+extern size_t mustach_fastjson_count(const mustach_fastjson_value_t *value);
+
+/**
+ * mustach_fastjson_get - Returns the value of the member 'key' of the
+ * 'object' or NULL if it doesn't exist. When a key is duplicated,
+ * the first member is returned.
+ */
+extern const mustach_fastjson_value_t *mustach_fastjson_get(const mustach_fastjson_value_t *object, const char *key);
+
+/**
+ * mustach_fastjson_at - Returns the item of 'index' of the 'array'
+ * or NULL if it doesn't exist
+ */
+extern const mustach_fastjson_value_t *mustach_fastjson_at(const mustach_fastjson_value_t *array, size_t index);
+
+/**
+ * mustach_fastjson_print - Returns the compact JSON text of the 'value',
+ * null terminated, that must be freed by the caller, or NULL when out
+ * of memory. When 'length' isn't NULL, it receives the length of the text.
+ */
+extern char *mustach_fastjson_print(const mustach_fastjson_value_t *value, size_t *length);
+
+/**
+ * Wrap interface used internally by mustach fastjson functions.
+ * Can be used for overriding behaviour.
+ */
+extern const struct mustach_wrap_itf mustach_fastjson_wrap_itf;
+
+/**
+ * mustach_fastjson_file - Renders the mustache 'templstr' in 'file' for 'root'.
+ *
+ * @templstr: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @root:     the root json value to render
+ * @file:     the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_fastjson_file(const char *templstr, size_t length, const mustach_fastjson_value_t *root, int flags, FILE *file);
+
+/**
+ * mustach_fastjson_fd - Renders the mustache 'templstr' in 'fd' for 'root'.
+ *
+ * @templstr: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @root:     the root json value to render
+ * @fd:       the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_fastjson_fd(const char *templstr, size_t length, const mustach_fastjson_value_t *root, int flags, int fd);
+
+/**
+ * mustach_fastjson_mem - Renders the mustache 'templstr' in 'result' for 'root'.
+ *
+ * @templstr: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @root:     the root json value to render
+ * @result:   the pointer receiving the result when 0 is returned
+ * @size:     the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_fastjson_mem(const char *templstr, size_t length, const mustach_fastjson_value_t *root, int flags, char **result, size_t *size);
+
+/**
+ * mustach_fastjson_write - Renders the mustache 'templstr' for 'root' to custom writer 'writecb' with 'closure'.
+ *
+ * @templstr: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @root:     the root json value to render
+ * @writecb:  the function that write values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_fastjson_write(const char *templstr, size_t length, const mustach_fastjson_value_t *root, int flags, mustach_write_cb_t *writecb, void *closure);
+
+/**
+ * mustach_fastjson_emit - Renders the mustache 'templstr' for 'root' to custom emiter 'emitcb' with 'closure'.
+ *
+ * @templstr: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @root:     the root json value to render
+ * @emitcb:   the function that emit values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_fastjson_emit(const char *templstr, size_t length, const mustach_fastjson_value_t *root, int flags, mustach_emit_cb_t *emitcb, void *closure);
+
+extern int mustach_fastjson_apply(
+		mustach_template_t *templstr,
+		const mustach_fastjson_value_t *root,
+		int flags,
+		mustach_write_cb_t *writecb,
+		mustach_emit_cb_t *emitcb,
+		void *closure
+);
+
+/**
+ * The functions below are like the functions above without the suffix
+ * "_with" but the partials are got using the 'resolver' first
+ * (see mustach_partial_resolver_t). A NULL 'resolver' is accepted.
+ * The function "_fd_with" collects the output in a buffer of 'size'
+ * bytes before writing it, the size 0 disabling buffering.
+ */
+extern int mustach_fastjson_file_with(const char *templstr, size_t length, const mustach_fastjson_value_t *root, int flags, const mustach_partial_resolver_t *resolver, FILE *file);
+extern int mustach_fastjson_fd_with(const char *templstr, size_t length, const mustach_fastjson_value_t *root, int flags, const mustach_partial_resolver_t *resolver, int fd, size_t size);
+extern int mustach_fastjson_mem_with(const char *templstr, size_t length, const mustach_fastjson_value_t *root, int flags, const mustach_partial_resolver_t *resolver, char **result, size_t *size);
+extern int mustach_fastjson_apply_with(
+		mustach_template_t *templstr,
+		const mustach_fastjson_value_t *root,
+		int flags,
+		const mustach_partial_resolver_t *resolver,
+		mustach_write_cb_t *writecb,
+		mustach_emit_cb_t *emitcb,
+		void *closure
+);
+
+/**
+ * mustach_fastjson_apply_begin - Prepares in '*apply' the pulled rendering
+ * of the prepared template 'templ' for the 'root', getting the partials
+ * using the 'resolver' first when not NULL. The output is pulled using
+ * mustach_wrap_apply_step and the rendering is ended using
+ * mustach_wrap_apply_end (see mustach_wrap_apply_begin).
+ */
+extern int mustach_fastjson_apply_begin(
+		mustach_wrap_apply_t **apply,
+		mustach_template_t *templ,
+		const mustach_fastjson_value_t *root,
+		int flags,
+		const mustach_partial_resolver_t *resolver
+);
+
+#endif
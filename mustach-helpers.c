@@ -18,6 +18,20 @@
 #include <stdint.h>
 #ifdef _WIN32
 #include <malloc.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#endif
+
+#if !defined(MUSTACH_NO_SIMD) && defined(__GNUC__) && defined(__x86_64__)
+# define SCAN_SSE2 1
+# define SCAN_AVX2 1
+# include <immintrin.h>
+#elif !defined(MUSTACH_NO_SIMD) && defined(__SSE2__)
+# define SCAN_SSE2 1
+# include <emmintrin.h>
 #endif
 
 /*********************************************************
@@ -33,6 +47,7 @@ static const char *errtxts[] = {
 	"closing",
 	"bad unescape tag",
 	"invalid interface",
+	"?",
 	"not found",
 	"undefined tag",
 	"too much nesting",
@@ -43,7 +58,7 @@ static const char *errtxts[] = {
 const char *mustach_strerror(int code)
 {
 	int idx = -code;
-	if (idx < 0 || idx > (int)(sizeof errtxts / sizeof *errtxts))
+	if (idx < 0 || idx >= (int)(sizeof errtxts / sizeof *errtxts))
 		idx = 0;
 	return errtxts[idx];
 }
@@ -204,45 +219,351 @@ int mustach_read_file(const char *path, mustach_sbuf_t *sbuf)
 	return rc;
 }
 
+#ifndef _WIN32
+static void unmap_cb(void *value, void *closure)
+{
+	munmap(value, (size_t)(uintptr_t)closure);
+}
+#endif
+
+int mustach_map_file(const char *path, mustach_sbuf_t *sbuf)
+{
+#ifndef _WIN32
+	int fd;
+	void *addr;
+	struct stat st;
+
+	if (strcmp(path, "-") != 0) {
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+			return MUSTACH_ERROR_NOT_FOUND;
+		addr = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+		 && (off_t)(size_t)st.st_size == st.st_size)
+			addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (addr != MAP_FAILED) {
+			sbuf->value = addr;
+			sbuf->length = (size_t)st.st_size;
+			sbuf->releasecb = unmap_cb;
+			sbuf->closure = (void*)(uintptr_t)st.st_size;
+			return MUSTACH_OK;
+		}
+	}
+#endif
+	return mustach_read_file(path, sbuf);
+}
+
+/*********************************************************
+* This section is for scanning
+**********************************************************/
+
+/* portable implementation, a word at a time */
+#define SWAR_ONES   ((uintptr_t)-1 / 255)
+#define SWAR_HIGHS  (SWAR_ONES << 7)
+#define SWAR_HASZERO(x)  (((x) - SWAR_ONES) & ~(x) & SWAR_HIGHS)
+static const char *scan3_scalar(
+		const char *begin,
+		const char *end,
+		char a,
+		char b,
+		char c
+) {
+	const uintptr_t wa = SWAR_ONES * (unsigned char)a;
+	const uintptr_t wb = SWAR_ONES * (unsigned char)b;
+	const uintptr_t wc = SWAR_ONES * (unsigned char)c;
+	uintptr_t x;
+
+	while ((size_t)(end - begin) >= sizeof x) {
+		memcpy(&x, begin, sizeof x);
+		if (SWAR_HASZERO(x ^ wa) | SWAR_HASZERO(x ^ wb) | SWAR_HASZERO(x ^ wc))
+			break;
+		begin += sizeof x;
+	}
+	for ( ; begin != end ; begin++)
+		if (*begin == a || *begin == b || *begin == c)
+			break;
+	return begin;
+}
+
+#if SCAN_SSE2
+/* implementation using SSE2, 16 characters at a time */
+static const char *scan3_sse2(
+		const char *begin,
+		const char *end,
+		char a,
+		char b,
+		char c
+) {
+	const __m128i va = _mm_set1_epi8(a);
+	const __m128i vb = _mm_set1_epi8(b);
+	const __m128i vc = _mm_set1_epi8(c);
+	__m128i x;
+	int mask;
+
+	while (end - begin >= 16) {
+		x = _mm_loadu_si128((const __m128i*)begin);
+		mask = _mm_movemask_epi8(_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb)),
+				_mm_cmpeq_epi8(x, vc)));
+		if (mask != 0)
+			return begin + __builtin_ctz((unsigned)mask);
+		begin += 16;
+	}
+	return scan3_scalar(begin, end, a, b, c);
+}
+#endif
+
+#if SCAN_AVX2
+/* implementation using AVX2, 32 characters at a time */
+__attribute__((target("avx2")))
+static const char *scan3_avx2(
+		const char *begin,
+		const char *end,
+		char a,
+		char b,
+		char c
+) {
+	const __m256i va = _mm256_set1_epi8(a);
+	const __m256i vb = _mm256_set1_epi8(b);
+	const __m256i vc = _mm256_set1_epi8(c);
+	__m256i x;
+	unsigned mask;
+
+	while (end - begin >= 32) {
+		x = _mm256_loadu_si256((const __m256i*)begin);
+		mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(x, vb)),
+				_mm256_cmpeq_epi8(x, vc)));
+		if (mask != 0)
+			return begin + __builtin_ctz(mask);
+		begin += 32;
+	}
+	return scan3_sse2(begin, end, a, b, c);
+}
+#endif
+
+/* selects the implementation at first call */
+static const char *scan3_select(const char *begin, const char *end, char a, char b, char c);
+
+/* the selected implementation */
+static const char *(*scan3)(const char *begin, const char *end, char a, char b, char c) = scan3_select;
+
+static const char *scan3_select(
+		const char *begin,
+		const char *end,
+		char a,
+		char b,
+		char c
+) {
+#if SCAN_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		scan3 = scan3_avx2;
+	else
+		scan3 = scan3_sse2;
+#elif SCAN_SSE2
+	scan3 = scan3_sse2;
+#else
+	scan3 = scan3_scalar;
+#endif
+	return scan3(begin, end, a, b, c);
+}
+
+const char *mustach_scan3(
+		const char *begin,
+		const char *end,
+		char a,
+		char b,
+		char c
+) {
+	return scan3(begin, end, a, b, c);
+}
+
+/*
+ * Scanning of the characters to escape, same as scan3 but
+ * for the 4 characters < > & and "
+ */
+static const char *scanesc_scalar(
+		const char *begin,
+		const char *end
+) {
+	const uintptr_t wlt = SWAR_ONES * '<';
+	const uintptr_t wgt = SWAR_ONES * '>';
+	const uintptr_t wamp = SWAR_ONES * '&';
+	const uintptr_t wquot = SWAR_ONES * '"';
+	uintptr_t x;
+
+	while ((size_t)(end - begin) >= sizeof x) {
+		memcpy(&x, begin, sizeof x);
+		if (SWAR_HASZERO(x ^ wlt) | SWAR_HASZERO(x ^ wgt)
+		  | SWAR_HASZERO(x ^ wamp) | SWAR_HASZERO(x ^ wquot))
+			break;
+		begin += sizeof x;
+	}
+	for ( ; begin != end ; begin++)
+		if (*begin == '<' || *begin == '>' || *begin == '&' || *begin == '"')
+			break;
+	return begin;
+}
+
+#if SCAN_SSE2
+static const char *scanesc_sse2(
+		const char *begin,
+		const char *end
+) {
+	const __m128i vlt = _mm_set1_epi8('<');
+	const __m128i vgt = _mm_set1_epi8('>');
+	const __m128i vamp = _mm_set1_epi8('&');
+	const __m128i vquot = _mm_set1_epi8('"');
+	__m128i x;
+	int mask;
+
+	while (end - begin >= 16) {
+		x = _mm_loadu_si128((const __m128i*)begin);
+		mask = _mm_movemask_epi8(_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(x, vlt), _mm_cmpeq_epi8(x, vgt)),
+				_mm_or_si128(_mm_cmpeq_epi8(x, vamp), _mm_cmpeq_epi8(x, vquot))));
+		if (mask != 0)
+			return begin + __builtin_ctz((unsigned)mask);
+		begin += 16;
+	}
+	return scanesc_scalar(begin, end);
+}
+#endif
+
+#if SCAN_AVX2
+__attribute__((target("avx2")))
+static const char *scanesc_avx2(
+		const char *begin,
+		const char *end
+) {
+	const __m256i vlt = _mm256_set1_epi8('<');
+	const __m256i vgt = _mm256_set1_epi8('>');
+	const __m256i vamp = _mm256_set1_epi8('&');
+	const __m256i vquot = _mm256_set1_epi8('"');
+	__m256i x;
+	unsigned mask;
+
+	while (end - begin >= 32) {
+		x = _mm256_loadu_si256((const __m256i*)begin);
+		mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(x, vlt), _mm256_cmpeq_epi8(x, vgt)),
+				_mm256_or_si256(_mm256_cmpeq_epi8(x, vamp), _mm256_cmpeq_epi8(x, vquot))));
+		if (mask != 0)
+			return begin + __builtin_ctz(mask);
+		begin += 32;
+	}
+	return scanesc_sse2(begin, end);
+}
+#endif
+
+/* selects the implementation at first call */
+static const char *scanesc_select(const char *begin, const char *end);
+
+/* the selected implementation */
+static const char *(*scanesc)(const char *begin, const char *end) = scanesc_select;
+
+static const char *scanesc_select(
+		const char *begin,
+		const char *end
+) {
+#if SCAN_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		scanesc = scanesc_avx2;
+	else
+		scanesc = scanesc_sse2;
+#elif SCAN_SSE2
+	scanesc = scanesc_sse2;
+#else
+	scanesc = scanesc_scalar;
+#endif
+	return scanesc(begin, end);
+}
+
 /*********************************************************
 * This section is for escaping
 **********************************************************/
 
+/* get the entity of the character c and its length */
+static const char *entity(char c, size_t *length)
+{
+	switch(c) {
+	case '<': *length = 4; return "&lt;";
+	case '>': *length = 4; return "&gt;";
+	case '&': *length = 5; return "&amp;";
+	default:  *length = 6; return "&quot;";
+	}
+}
+
 int mustach_escape(
 		const char *buffer,
 		size_t size,
 		int (*emit)(void *, const char *, size_t),
 		void *closure
 ) {
-	const char *p;
-	int r, n = 0;
-	size_t i = 0, j = 0;
+	const char *end = &buffer[size], *p, *ent;
+	size_t n;
+	int r;
+
 	for (;;) {
-		if (j == size)
-			n = -1;
-		else {
-			switch(buffer[j]) {
-			case '<': p = "&lt;"; n = 4; break;
-			case '>': p = "&gt;"; n = 4; break;
-			case '&': p = "&amp;"; n = 5; break;
-			case '"': p = "&quot;"; n = 6; break;
-			default: j++; continue;
-			}
-		}
-		if (i < j) {
-			r = emit(closure, &buffer[i], j - i);
+		p = scanesc(buffer, end);
+		if (p != buffer) {
+			r = emit(closure, buffer, (size_t)(p - buffer));
 			if (r != MUSTACH_OK)
 				return r;
 		}
-		if (n < 0)
+		if (p == end)
 			return MUSTACH_OK;
-		r = emit(closure, p, (size_t)n);
+		ent = entity(*p, &n);
+		r = emit(closure, ent, n);
 		if (r != MUSTACH_OK)
 			return r;
-		i = ++j;
+		buffer = p + 1;
 	}
 }
 
+size_t mustach_escape_copy(
+		char *dest,
+		size_t avail,
+		const char **buffer,
+		const char *end
+) {
+	const char *src = *buffer, *p, *ent;
+	char *iter = dest;
+	size_t n;
+
+	while (src != end) {
+		/* copy the characters not escaped */
+		p = scanesc(src, end);
+		n = (size_t)(p - src);
+		if (n > avail) {
+			memcpy(iter, src, avail);
+			iter += avail;
+			src += avail;
+			break;
+		}
+		memcpy(iter, src, n);
+		iter += n;
+		avail -= n;
+		src = p;
+
+		/* copy the entity if it fits */
+		if (src == end)
+			break;
+		ent = entity(*src, &n);
+		if (n > avail)
+			break;
+		memcpy(iter, ent, n);
+		iter += n;
+		avail -= n;
+		src++;
+	}
+	*buffer = src;
+	return (size_t)(iter - dest);
+}
+
 int mustach_fwrite(
 		FILE *file,
 		const char *buffer,
@@ -304,6 +625,124 @@ int mustach_write_escape(
 	return mustach_escape(buffer, size, mustach_write_cb, closure);
 }
 
+void mustach_fdbuf_init(
+		mustach_fdbuf_t *fdbuf,
+		int fd,
+		char *buffer,
+		size_t size
+) {
+	fdbuf->fd = fd;
+	fdbuf->buffer = buffer;
+	fdbuf->length = 0;
+	fdbuf->size = buffer == NULL ? 0 : size;
+}
+
+int mustach_fdbuf_flush(
+		mustach_fdbuf_t *fdbuf
+) {
+	size_t length = fdbuf->length;
+	fdbuf->length = 0;
+	return mustach_write(fdbuf->fd, fdbuf->buffer, length);
+}
+
+int mustach_fdbuf_write(
+		mustach_fdbuf_t *fdbuf,
+		const char *buffer,
+		size_t size
+) {
+#ifndef _WIN32
+	struct iovec iov[2], *v;
+	ssize_t s;
+	int n;
+#else
+	int rc;
+#endif
+
+	/* fits in the buffer? */
+	if (size <= fdbuf->size - fdbuf->length) {
+		memcpy(&fdbuf->buffer[fdbuf->length], buffer, size);
+		fdbuf->length += size;
+		return MUSTACH_OK;
+	}
+
+#ifndef _WIN32
+	/* write the buffer and the data together */
+	iov[0].iov_base = fdbuf->buffer;
+	iov[0].iov_len = fdbuf->length;
+	iov[1].iov_base = (void*)buffer;
+	iov[1].iov_len = size;
+	fdbuf->length = 0;
+	v = iov;
+	n = 2;
+	while (n > 0) {
+		s = writev(fdbuf->fd, v, n);
+		if (s > 0) {
+			/* skip what is written */
+			while (n > 0 && (size_t)s >= v->iov_len) {
+				s -= (ssize_t)v->iov_len;
+				v++;
+				n--;
+			}
+			if (n > 0) {
+				v->iov_base = (char*)v->iov_base + s;
+				v->iov_len -= (size_t)s;
+			}
+		}
+		else if (errno != EINTR)
+			return MUSTACH_ERROR_SYSTEM;
+	}
+	return MUSTACH_OK;
+#else
+	rc = mustach_fdbuf_flush(fdbuf);
+	return rc != MUSTACH_OK ? rc : mustach_write(fdbuf->fd, buffer, size);
+#endif
+}
+
+int mustach_fdbuf_write_escape(
+		mustach_fdbuf_t *fdbuf,
+		const char *buffer,
+		size_t size
+) {
+	const char *end = &buffer[size];
+	int rc;
+
+	/* too small for holding entities */
+	if (fdbuf->size < 6)
+		return mustach_escape(buffer, size, mustach_fdbuf_write_cb, fdbuf);
+
+	/* escape in the buffer, flushing it when full */
+	for (;;) {
+		fdbuf->length += mustach_escape_copy(&fdbuf->buffer[fdbuf->length],
+				fdbuf->size - fdbuf->length, &buffer, end);
+		if (buffer == end)
+			return MUSTACH_OK;
+		rc = mustach_fdbuf_flush(fdbuf);
+		if (rc != MUSTACH_OK)
+			return rc;
+	}
+}
+
+int mustach_fdbuf_write_cb(
+		void *closure,
+		const char *buffer,
+		size_t size
+) {
+	mustach_fdbuf_t *fdbuf = (mustach_fdbuf_t*)closure;
+	return mustach_fdbuf_write(fdbuf, buffer, size);
+}
+
+int mustach_fdbuf_emit_cb(
+		void *closure,
+		const char *buffer,
+		size_t size,
+		int escape
+) {
+	mustach_fdbuf_t *fdbuf = (mustach_fdbuf_t*)closure;
+	return escape
+		? mustach_fdbuf_write_escape(fdbuf, buffer, size)
+		: mustach_fdbuf_write(fdbuf, buffer, size);
+}
+
 
 
 
@@ -314,7 +753,7 @@ int mustach_write_escape(
 
 
 #define SZBLK  4000
-
+#define SZCHKMIN  64
 
 void mustach_stream_init(mustach_stream_t *stream)
 {
@@ -326,12 +765,19 @@ void mustach_stream_abort(mustach_stream_t *stream)
 	free(stream->buffer);
 }
 
+size_t mustach_stream_length(const mustach_stream_t *stream)
+{
+	return stream->length;
+}
+
 int mustach_stream_end(
 		mustach_stream_t *stream,
 		char **buffer,
 		size_t *size)
 {
-	char *buf = realloc(stream->buffer, stream->length + 1);
+	char *buf;
+
+	buf = realloc(stream->buffer, stream->length + 1);
 	if (buf == NULL)
 		return MUSTACH_ERROR_OUT_OF_MEMORY;
 	*buffer = buf;
@@ -340,28 +786,63 @@ int mustach_stream_end(
 	return MUSTACH_OK;
 }
 
+/* ensure that size bytes can be added to the stream */
+static int stream_reserve(
+		mustach_stream_t *stream,
+		size_t size
+) {
+	size_t nlen = stream->length + size;
+	if (nlen < size)/*detect overflow*/
+		return MUSTACH_ERROR_TOO_BIG;
+	if (nlen > stream->avail) {
+		/* grow geometrically for a linear count of copies */
+		size_t nava = 2 * stream->avail;
+		void *nbuf;
+		if (nava < nlen + SZBLK)
+			nava = nlen + SZBLK;
+		if (nava < nlen || nava + 1 < nava)/*avoid overflow*/
+			nava = SIZE_MAX - 1;
+		nbuf = realloc(stream->buffer, nava + 1);
+		if (nbuf == NULL)
+			return MUSTACH_ERROR_OUT_OF_MEMORY;
+		stream->buffer = nbuf;
+		stream->avail = nava;
+	}
+	return MUSTACH_OK;
+}
+
 int mustach_stream_write(
 		mustach_stream_t *stream,
 		const char *buffer,
 		size_t size
 ) {
-	if (size >0) {
-		size_t nlen = stream->length + size;
-		if (nlen < size)/*detect overflow*/
-			return MUSTACH_ERROR_TOO_BIG;
-		if (nlen > stream->avail) {
-			size_t nava = nlen + SZBLK;
-			void *nbuf;
-			if (nava < nlen || nava + 1 < nava)/*avoid overflow*/
-				nava = SIZE_MAX - 1;
-			nbuf = realloc(stream->buffer, nava + 1);
-			if (nbuf == NULL)
-				return MUSTACH_ERROR_OUT_OF_MEMORY;
-			stream->buffer = nbuf;
-			stream->avail = nava;
-		}
+	int rc;
+
+	if (size > 0) {
+		rc = stream_reserve(stream, size);
+		if (rc != MUSTACH_OK)
+			return rc;
 		memcpy(&stream->buffer[stream->length], buffer, size);
-		stream->length = nlen;
+		stream->length += size;
+	}
+	return MUSTACH_OK;
+}
+
+int mustach_stream_write_escape(
+		mustach_stream_t *stream,
+		const char *buffer,
+		size_t size
+) {
+	const char *end = &buffer[size];
+	int rc;
+
+	while (buffer != end) {
+		/* reserve for the text without entity, then grow by what remains */
+		rc = stream_reserve(stream, (size_t)(end - buffer) + 6);
+		if (rc != MUSTACH_OK)
+			return rc;
+		stream->length += mustach_escape_copy(&stream->buffer[stream->length],
+				stream->avail - stream->length, &buffer, end);
 	}
 	return MUSTACH_OK;
 }
@@ -375,3 +856,191 @@ int mustach_stream_write_cb(
 	return mustach_stream_write(stream, buffer, size);
 }
 
+int mustach_stream_emit_cb(
+		void *closure,
+		const char *buffer,
+		size_t size,
+		int escape
+) {
+	mustach_stream_t *stream = (mustach_stream_t*)closure;
+	return escape
+		? mustach_stream_write_escape(stream, buffer, size)
+		: mustach_stream_write(stream, buffer, size);
+}
+
+/* chunk of memory chunks */
+struct mustach_chunk {
+	struct mustach_chunk *next;
+	size_t length;
+	char data[];
+};
+
+void mustach_chunks_init(mustach_chunks_t *chunks, size_t chunksize)
+{
+	chunks->buffer = NULL;
+	chunks->length = 0;
+	chunks->avail = 0;
+	chunks->chunksize = chunksize == 0 ? MUSTACH_CHUNKS_SIZE
+			: chunksize < SZCHKMIN ? SZCHKMIN : chunksize;
+	chunks->previous = 0;
+	chunks->first = NULL;
+	chunks->last = NULL;
+}
+
+void mustach_chunks_abort(mustach_chunks_t *chunks)
+{
+	struct mustach_chunk *chunk;
+
+	while ((chunk = chunks->first) != NULL) {
+		chunks->first = chunk->next;
+		free(chunk);
+	}
+	chunks->last = NULL;
+}
+
+size_t mustach_chunks_length(const mustach_chunks_t *chunks)
+{
+	return chunks->previous + chunks->length;
+}
+
+int mustach_chunks_end(
+		mustach_chunks_t *chunks,
+		char **buffer,
+		size_t *size)
+{
+	struct mustach_chunk *chunk;
+	size_t length;
+	char *buf;
+
+	/* concatenate the chunks */
+	buf = malloc(chunks->previous + chunks->length + 1);
+	if (buf == NULL)
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+	if (chunks->last != NULL)
+		chunks->last->length = chunks->length;
+	for (length = 0, chunk = chunks->first ; chunk != NULL ; chunk = chunk->next) {
+		memcpy(&buf[length], chunk->data, chunk->length);
+		length += chunk->length;
+	}
+	mustach_chunks_abort(chunks);
+	*buffer = buf;
+	*size = length;
+	buf[length] = 0;
+	return MUSTACH_OK;
+}
+
+#ifndef _WIN32
+size_t mustach_chunks_iovec(
+		mustach_chunks_t *chunks,
+		struct iovec *iov,
+		size_t count)
+{
+	struct mustach_chunk *chunk;
+	size_t n;
+
+	if (chunks->last != NULL)
+		chunks->last->length = chunks->length;
+	for (n = 0, chunk = chunks->first ; chunk != NULL ; chunk = chunk->next) {
+		if (chunk->length != 0) {
+			if (n < count) {
+				iov[n].iov_base = chunk->data;
+				iov[n].iov_len = chunk->length;
+			}
+			n++;
+		}
+	}
+	return n;
+}
+#endif
+
+/* start a new chunk */
+static int chunks_new(
+		mustach_chunks_t *chunks
+) {
+	struct mustach_chunk *chunk;
+
+	chunk = malloc(sizeof *chunk + chunks->chunksize);
+	if (chunk == NULL)
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+	chunk->next = NULL;
+	chunk->length = 0;
+	if (chunks->last == NULL)
+		chunks->first = chunk;
+	else {
+		chunks->last->length = chunks->length;
+		chunks->last->next = chunk;
+		chunks->previous += chunks->length;
+	}
+	chunks->last = chunk;
+	chunks->buffer = chunk->data;
+	chunks->length = 0;
+	chunks->avail = chunks->chunksize;
+	return MUSTACH_OK;
+}
+
+int mustach_chunks_write(
+		mustach_chunks_t *chunks,
+		const char *buffer,
+		size_t size
+) {
+	size_t n;
+	int rc;
+
+	while (size > 0) {
+		if (chunks->length == chunks->avail) {
+			rc = chunks_new(chunks);
+			if (rc != MUSTACH_OK)
+				return rc;
+		}
+		n = chunks->avail - chunks->length;
+		if (n > size)
+			n = size;
+		memcpy(&chunks->buffer[chunks->length], buffer, n);
+		chunks->length += n;
+		buffer += n;
+		size -= n;
+	}
+	return MUSTACH_OK;
+}
+
+int mustach_chunks_write_escape(
+		mustach_chunks_t *chunks,
+		const char *buffer,
+		size_t size
+) {
+	const char *end = &buffer[size];
+	int rc;
+
+	while (buffer != end) {
+		/* start a new chunk if the longest entity doesn't fit */
+		if (chunks->avail - chunks->length < 6) {
+			rc = chunks_new(chunks);
+			if (rc != MUSTACH_OK)
+				return rc;
+		}
+		chunks->length += mustach_escape_copy(&chunks->buffer[chunks->length],
+				chunks->avail - chunks->length, &buffer, end);
+	}
+	return MUSTACH_OK;
+}
+
+int mustach_chunks_write_cb(
+		void *closure,
+		const char *buffer,
+		size_t size
+) {
+	mustach_chunks_t *chunks = (mustach_chunks_t*)closure;
+	return mustach_chunks_write(chunks, buffer, size);
+}
+
+int mustach_chunks_emit_cb(
+		void *closure,
+		const char *buffer,
+		size_t size,
+		int escape
+) {
+	mustach_chunks_t *chunks = (mustach_chunks_t*)closure;
+	return escape
+		? mustach_chunks_write_escape(chunks, buffer, size)
+		: mustach_chunks_write(chunks, buffer, size);
+}
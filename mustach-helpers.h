@@ -14,6 +14,9 @@
 
 #include <stdio.h>
 #include <string.h>
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
 
 /*********************************************************
 * This section has functions for managing instances of mustach_sbuf_t
@@ -57,8 +60,43 @@ extern int mustach_memfile_close(FILE *file, char **buffer, size_t *size);
 **********************************************************/
 extern int mustach_read_file(const char *path, mustach_sbuf_t *sbuf);
 
+/*
+* Maps the file in memory in read only mode when possible or
+* otherwise reads it. Mapped files aren't terminated by a nul.
+*/
+extern int mustach_map_file(const char *path, mustach_sbuf_t *sbuf);
+
+/*********************************************************
+* This section is for scanning
+*
+* The function mustach_scan3 returns a pointer to the first
+* character of [begin, end) equal to one of the characters
+* a, b or c, or end if there is none. It uses vector
+* instructions when the processor has them.
+**********************************************************/
+extern const char *mustach_scan3(
+	const char *begin,
+	const char *end,
+	char a,
+	char b,
+	char c
+);
+
 /*********************************************************
 * This section is for escaping
+*
+* The function mustach_escape calls 'write' for each run of
+* characters not escaped and for each entity.
+*
+* The function mustach_escape_copy writes in 'dest', of
+* 'avail' bytes, the escaped characters of [*buffer, end).
+* It stops when 'dest' is full or without splitting an
+* entity. It returns the count of bytes written in 'dest'
+* and sets *buffer to the first character not escaped.
+*
+* Both find the characters to escape using vector
+* instructions when the processor has them, so text without
+* such characters is written at once.
 **********************************************************/
 extern int mustach_escape(
 	const char *buffer,
@@ -67,6 +105,13 @@ extern int mustach_escape(
 	void *closure
 );
 
+extern size_t mustach_escape_copy(
+	char *dest,
+	size_t avail,
+	const char **buffer,
+	const char *end
+);
+
 extern int mustach_fwrite(FILE *file, const char *buffer, size_t size);
 extern int mustach_fwrite_cb(void *file, const char *buffer, size_t size);
 extern int mustach_fwrite_escape(FILE *file, const char *buffer, size_t size);
@@ -75,8 +120,64 @@ extern int mustach_write(int fd, const char *buffer, size_t size);
 extern int mustach_write_cb(void *fd, const char *buffer, size_t size);
 extern int mustach_write_escape(int fd, const char *buffer, size_t size);
 
+/*********************************************************
+* This section is for buffered writing to file descriptors
+*
+* A mustach_fdbuf_t collects the small writes in the buffer
+* given to mustach_fdbuf_init. The buffer is written to the
+* file descriptor when a write doesn't fit in, in one call
+* to writev that also writes the data not fitting, and
+* when mustach_fdbuf_flush is called. Nothing is written
+* before, so mustach_fdbuf_flush must be called at end,
+* even after errors, for writing what remains. A buffer
+* of size 0 is allowed, data is then written immediately.
+**********************************************************/
+#define MUSTACH_FDBUF_SIZE  8192
+
+typedef
+struct mustach_fdbuf {
+	int fd;
+	char *buffer;
+	size_t length;
+	size_t size;
+}
+	mustach_fdbuf_t;
+
+extern void mustach_fdbuf_init(
+		mustach_fdbuf_t *fdbuf,
+		int fd,
+		char *buffer,
+		size_t size);
+extern int mustach_fdbuf_flush(
+		mustach_fdbuf_t *fdbuf);
+extern int mustach_fdbuf_write(
+		mustach_fdbuf_t *fdbuf,
+		const char *buffer,
+		size_t size);
+extern int mustach_fdbuf_write_escape(
+		mustach_fdbuf_t *fdbuf,
+		const char *buffer,
+		size_t size);
+extern int mustach_fdbuf_write_cb(
+		void *closure,
+		const char *buffer,
+		size_t size);
+extern int mustach_fdbuf_emit_cb(
+		void *closure,
+		const char *buffer,
+		size_t size,
+		int escape);
+
 /*********************************************************
 * This section is for managing memory stream
+*
+* Streams collect the output in memory, in one buffer that
+* grows geometrically.
+*
+* mustach_stream_end gives the output in one buffer
+* terminated by a nul that must be freed by the caller. When
+* not calling mustach_stream_end, mustach_stream_abort must
+* be called for freeing memory.
 *********************************************************/
 typedef
 struct mustach_stream {
@@ -90,6 +191,7 @@ struct mustach_stream {
 
 extern void mustach_stream_init(mustach_stream_t *stream);
 extern void mustach_stream_abort(mustach_stream_t *stream);
+extern size_t mustach_stream_length(const mustach_stream_t *stream);
 extern int mustach_stream_end(
 		mustach_stream_t *stream,
 		char **buffer,
@@ -98,10 +200,86 @@ extern int mustach_stream_write(
 		mustach_stream_t *stream,
 		const char *buffer,
 		size_t size);
+extern int mustach_stream_write_escape(
+		mustach_stream_t *stream,
+		const char *buffer,
+		size_t size);
 extern int mustach_stream_write_cb(
 		void *closure,
 		const char *buffer,
 		size_t size);
+extern int mustach_stream_emit_cb(
+		void *closure,
+		const char *buffer,
+		size_t size,
+		int escape);
+
+/*********************************************************
+* This section is for managing memory chunks
+*
+* Chunks collect the output in memory like streams but in
+* a list of chunks of the size given to mustach_chunks_init
+* (0 for the default MUSTACH_CHUNKS_SIZE) that never move,
+* so the output is copied once. The chunks can be given to
+* writev using mustach_chunks_iovec that fills up to 'count'
+* items of 'iov' and returns the count of chunks, or be
+* concatenated by mustach_chunks_end.
+*
+* For rendering in chunks, give mustach_chunks_emit_cb
+* and the chunks as closure to mustach_wrap_emit or
+* mustach_wrap_apply, or to their equivalent for a backend.
+*
+* mustach_chunks_end gives the output in one buffer
+* terminated by a nul that must be freed by the caller. When
+* not calling mustach_chunks_end, mustach_chunks_abort must
+* be called for freeing memory.
+*********************************************************/
+#define MUSTACH_CHUNKS_SIZE  65536
+
+struct mustach_chunk;
+
+typedef
+struct mustach_chunks {
+	char *buffer;
+	size_t length;
+	size_t avail;
+	size_t chunksize;
+	size_t previous;
+	struct mustach_chunk *first;
+	struct mustach_chunk *last;
+}
+	mustach_chunks_t;
+
+extern void mustach_chunks_init(mustach_chunks_t *chunks, size_t chunksize);
+extern void mustach_chunks_abort(mustach_chunks_t *chunks);
+extern size_t mustach_chunks_length(const mustach_chunks_t *chunks);
+extern int mustach_chunks_end(
+		mustach_chunks_t *chunks,
+		char **buffer,
+		size_t *size);
+#ifndef _WIN32
+extern size_t mustach_chunks_iovec(
+		mustach_chunks_t *chunks,
+		struct iovec *iov,
+		size_t count);
+#endif
+extern int mustach_chunks_write(
+		mustach_chunks_t *chunks,
+		const char *buffer,
+		size_t size);
+extern int mustach_chunks_write_escape(
+		mustach_chunks_t *chunks,
+		const char *buffer,
+		size_t size);
+extern int mustach_chunks_write_cb(
+		void *closure,
+		const char *buffer,
+		size_t size);
+extern int mustach_chunks_emit_cb(
+		void *closure,
+		const char *buffer,
+		size_t size,
+		int escape);
 
 #endif
 
@@ -16,12 +16,16 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 
 struct expl {
 	json_t *root;
 	json_t *selection;
 	int depth;
+	uint64_t stamp;
+	char scratch[MUSTACH_WRAP_FORMAT_SIZE];
 	struct {
+		uint64_t stamp;
 		json_t *cont;
 		json_t *obj;
 		void *iter;
@@ -34,15 +38,18 @@ static int start(void *closure)
 {
 	struct expl *e = closure;
 	e->depth = 0;
+	e->stamp = 1;
 	e->selection = json_null();
+	e->stack[0].stamp = 1;
 	e->stack[0].cont = NULL;
 	e->stack[0].obj = e->root;
+	e->stack[0].is_objiter = 0;
 	e->stack[0].index = 0;
 	e->stack[0].count = 1;
 	return MUSTACH_OK;
 }
 
-static int compare(void *closure, const char *value)
+static int compare_lit(void *closure, const struct mustach_wrap_lit *lit)
 {
 	struct expl *e = closure;
 	json_t *o = e->selection;
@@ -51,62 +58,131 @@ static int compare(void *closure, const char *value)
 
 	switch (json_typeof(o)) {
 	case JSON_REAL:
-		d = json_number_value(o) - atof(value);
+		d = json_number_value(o) - lit->d;
 		return d < 0 ? -1 : d > 0 ? 1 : 0;
 	case JSON_INTEGER:
-		i = (json_int_t)json_integer_value(o) - (json_int_t)atoll(value);
+		i = (json_int_t)json_integer_value(o) - (json_int_t)lit->i;
 		return i < 0 ? -1 : i > 0 ? 1 : 0;
 	case JSON_STRING:
-		return strcmp(json_string_value(o), value);
+		return strcmp(json_string_value(o), lit->string);
 	case JSON_TRUE:
-		return strcmp("true", value);
+		return lit->type == Mustach_Lit_True ? 0 : strcmp("true", lit->string);
 	case JSON_FALSE:
-		return strcmp("false", value);
+		return lit->type == Mustach_Lit_False ? 0 : strcmp("false", lit->string);
 	case JSON_NULL:
-		return strcmp("null", value);
+		return lit->type == Mustach_Lit_Null ? 0 : strcmp("null", lit->string);
 	default:
 		return 1;
 	}
 }
 
-static int sel(void *closure, const char *name)
+static int compare(void *closure, const char *value)
+{
+	struct mustach_wrap_lit lit;
+	mustach_wrap_parse_lit(&lit, value);
+	return compare_lit(closure, &lit);
+}
+
+/* get the member of the object of the name of length, not always null terminated */
+static json_t *getn(json_t *object, const char *name, size_t length)
+{
+#if JANSSON_VERSION_HEX >= 0x020e00
+	return json_object_getn(object, name, length);
+#else
+	if (name[length] == 0)
+		return json_object_get(object, name);
+	char copy[length + 1];
+	memcpy(copy, name, length);
+	copy[length] = 0;
+	return json_object_get(object, copy);
+#endif
+}
+
+/* get the index of the name of length, not always null terminated */
+static int getidx(const char *name, size_t length, size_t *index)
+{
+	char copy[length + 1], *end;
+	memcpy(copy, name, length);
+	copy[length] = 0;
+	*index = (size_t)strtol(copy, &end, 10);
+	return !*end;
+}
+
+static int sel_len(void *closure, const char *name, size_t length)
 {
 	struct expl *e = closure;
 	json_t *o;
 	int i, r;
 
-	if (name == NULL) {
-		o = e->stack[e->depth].obj;
+	i = e->depth;
+	while (i >= 0 && !(o = getn(e->stack[i].obj, name, length)))
+		i--;
+	if (i >= 0)
 		r = 1;
-	} else {
-		i = e->depth;
-		while (i >= 0 && !(o = json_object_get(e->stack[i].obj, name)))
-			i--;
-		if (i >= 0)
-			r = 1;
-		else {
-			o = json_null();
-			r = 0;
-		}
+	else {
+		o = json_null();
+		r = 0;
 	}
 	e->selection = o;
 	return r;
 }
 
-static int subsel(void *closure, const char *name)
+static int sel(void *closure, const char *name)
+{
+	struct expl *e = closure;
+
+	if (name != NULL)
+		return sel_len(closure, name, strlen(name));
+	e->selection = e->stack[e->depth].obj;
+	return 1;
+}
+
+static int sel_ic_len(void *closure, const char *name, size_t length, struct mustach_wrap_ic *ic)
+{
+	struct expl *e = closure;
+	json_t *o = NULL;
+	int i, low, valid;
+
+	/* the cache is valid if the level where the name was found is unchanged */
+	valid = ic->stamp != 0
+		&& ic->depth <= e->depth
+		&& (ic->depth < 0 || e->stack[ic->depth].stamp <= ic->stamp);
+
+	/* when valid, only search the levels changed since the cache was set */
+	low = valid ? ic->depth : -1;
+	for (i = e->depth ; i > low ; i--)
+		if ((!valid || e->stack[i].stamp > ic->stamp)
+		 && (o = getn(e->stack[i].obj, name, length)) != NULL)
+			break;
+	if (i == low)
+		o = valid ? ic->item : NULL;
+
+	/* record the result */
+	ic->stamp = e->stamp;
+	ic->depth = i;
+	ic->item = o;
+	e->selection = i >= 0 ? o : json_null();
+	return i >= 0;
+}
+
+static int sel_ic(void *closure, const char *name, struct mustach_wrap_ic *ic)
+{
+	return sel_ic_len(closure, name, strlen(name), ic);
+}
+
+static int subsel_len(void *closure, const char *name, size_t length)
 {
 	struct expl *e = closure;
 	json_t *o = NULL;
+	size_t idx;
 	int r = 0;
 
 	if (json_is_object(e->selection)) {
-		o = json_object_get(e->selection, name);
+		o = getn(e->selection, name, length);
 		r = o != NULL;
 	}
 	else if (json_is_array(e->selection)) {
-		char *end;
-		size_t idx = (size_t)strtol(name, &end, 10);
-		if (!*end && idx < json_array_size(e->selection)) {
+		if (getidx(name, length, &idx) && idx < json_array_size(e->selection)) {
 			o = json_array_get(e->selection, idx);
 			r = 1;
 		}
@@ -116,6 +192,11 @@ static int subsel(void *closure, const char *name)
 	return r;
 }
 
+static int subsel(void *closure, const char *name)
+{
+	return subsel_len(closure, name, strlen(name));
+}
+
 static int enter(void *closure, int objiter)
 {
 	struct expl *e = closure;
@@ -153,6 +234,7 @@ static int enter(void *closure, int objiter)
 		e->stack[e->depth].index = 0;
 	} else
 		goto not_entering;
+	e->stack[e->depth].stamp = ++e->stamp;
 	return 1;
 
 not_entering:
@@ -172,6 +254,7 @@ static int next(void *closure)
 		if (e->stack[e->depth].iter == NULL)
 			return 0;
 		e->stack[e->depth].obj = json_object_iter_value(e->stack[e->depth].iter);
+		e->stack[e->depth].stamp = ++e->stamp;
 		return 1;
 	}
 
@@ -180,6 +263,7 @@ static int next(void *closure)
 		return 0;
 
 	e->stack[e->depth].obj = json_array_get(e->stack[e->depth].cont, e->stack[e->depth].index);
+	e->stack[e->depth].stamp = ++e->stamp;
 	return 1;
 }
 
@@ -194,6 +278,38 @@ static int leave(void *closure)
 	return 0;
 }
 
+/* format the real as json_dumps does, in the scratch buffer */
+static size_t real(struct expl *e, double value)
+{
+	char *start, *end;
+	size_t length;
+
+	length = mustach_wrap_format_double(e->scratch, value, 17);
+
+	/* keep it a real when read again */
+	if (strchr(e->scratch, '.') == NULL && strchr(e->scratch, 'e') == NULL) {
+		e->scratch[length++] = '.';
+		e->scratch[length++] = '0';
+		e->scratch[length] = 0;
+	}
+
+	/* remove the sign + and the leading zeros of the exponent */
+	start = strchr(e->scratch, 'e');
+	if (start != NULL) {
+		start++;
+		end = start + 1;
+		if (*start == '-')
+			start++;
+		while (*end == '0')
+			end++;
+		if (end != start) {
+			memmove(start, end, length + 1 - (size_t)(end - e->scratch));
+			length -= (size_t)(end - start);
+		}
+	}
+	return length;
+}
+
 static int get(void *closure, struct mustach_sbuf *sbuf, int key)
 {
 	struct expl *e = closure;
@@ -208,11 +324,26 @@ static int get(void *closure, struct mustach_sbuf *sbuf, int key)
 				break;
 			}
 	}
-	else if (json_is_string(e->selection))
+	else if (json_is_string(e->selection)) {
 		s = json_string_value(e->selection);
+		sbuf->length = json_string_length(e->selection);
+	}
 	else if (json_is_null(e->selection))
 		s = "";
+	else if (json_is_true(e->selection))
+		s = "true";
+	else if (json_is_false(e->selection))
+		s = "false";
+	else if (json_is_integer(e->selection)) {
+		sbuf->length = mustach_wrap_format_int(e->scratch, (int64_t)json_integer_value(e->selection));
+		s = e->scratch;
+	}
+	else if (json_is_real(e->selection)) {
+		sbuf->length = real(e, json_real_value(e->selection));
+		s = e->scratch;
+	}
 	else {
+		/* since jansson 2.13, json_dumps doesn't mark the visited values */
 		s = json_dumps(e->selection, JSON_ENCODE_ANY | JSON_COMPACT);
 		if (s == NULL)
 			return MUSTACH_ERROR_SYSTEM;
@@ -231,42 +362,69 @@ const struct mustach_wrap_itf mustach_jansson_wrap_itf = {
 	.enter = enter,
 	.next = next,
 	.leave = leave,
-	.get = get
+	.get = get,
+	.compare_lit = compare_lit,
+	.sel_ic = sel_ic,
+	.version = MUSTACH_WRAP_ITF_VERSION_2,
+	.sel_len = sel_len,
+	.subsel_len = subsel_len,
+	.sel_ic_len = sel_ic_len
 };
 
 int mustach_jansson_file(const char *templstr, size_t length, json_t *root, int flags, FILE *file)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_file(templstr, length, &mustach_jansson_wrap_itf, &e, flags, file);
+	return mustach_wrap_file(templstr, length, &mustach_jansson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, file);
+}
+
+int mustach_jansson_file_with(const char *templstr, size_t length, json_t *root, int flags, const mustach_partial_resolver_t *resolver, FILE *file)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_file_with(templstr, length, &mustach_jansson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, resolver, file);
 }
 
 int mustach_jansson_fd(const char *templstr, size_t length, json_t *root, int flags, int fd)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_fd(templstr, length, &mustach_jansson_wrap_itf, &e, flags, fd);
+	return mustach_wrap_fd(templstr, length, &mustach_jansson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, fd);
+}
+
+int mustach_jansson_fd_with(const char *templstr, size_t length, json_t *root, int flags, const mustach_partial_resolver_t *resolver, int fd, size_t size)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_fd_with(templstr, length, &mustach_jansson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, resolver, fd, size);
 }
 
 int mustach_jansson_mem(const char *templstr, size_t length, json_t *root, int flags, char **result, size_t *size)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_mem(templstr, length, &mustach_jansson_wrap_itf, &e, flags, result, size);
+	return mustach_wrap_mem(templstr, length, &mustach_jansson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, result, size);
+}
+
+int mustach_jansson_mem_with(const char *templstr, size_t length, json_t *root, int flags, const mustach_partial_resolver_t *resolver, char **result, size_t *size)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_mem_with(templstr, length, &mustach_jansson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, resolver, result, size);
 }
 
 int mustach_jansson_write(const char *templstr, size_t length, json_t *root, int flags, mustach_write_cb_t *writecb, void *closure)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_write(templstr, length, &mustach_jansson_wrap_itf, &e, flags, writecb, closure);
+	return mustach_wrap_write(templstr, length, &mustach_jansson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, writecb, closure);
 }
 
 int mustach_jansson_emit(const char *templstr, size_t length, json_t *root, int flags, mustach_emit_cb_t *emitcb, void *closure)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_emit(templstr, length, &mustach_jansson_wrap_itf, &e, flags, emitcb, closure);
+	return mustach_wrap_emit(templstr, length, &mustach_jansson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, emitcb, closure);
 }
 
 int mustach_jansson_apply(
@@ -279,5 +437,34 @@ int mustach_jansson_apply(
 ) {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_apply(templstr, &mustach_jansson_wrap_itf, &e, flags, writecb, emitcb, closure);
+	return mustach_wrap_apply(templstr, &mustach_jansson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, writecb, emitcb, closure);
+}
+
+int mustach_jansson_apply_with(
+		mustach_template_t *templstr,
+		json_t *root,
+		int flags,
+		const mustach_partial_resolver_t *resolver,
+		mustach_write_cb_t *writecb,
+		mustach_emit_cb_t *emitcb,
+		void *closure
+) {
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_apply_with(templstr, &mustach_jansson_wrap_itf, &e, flags | Mustach_With_ExtendedItf, resolver, writecb, emitcb, closure);
+}
+
+int mustach_jansson_apply_begin(
+		mustach_wrap_apply_t **apply,
+		mustach_template_t *templ,
+		json_t *root,
+		int flags,
+		const mustach_partial_resolver_t *resolver
+) {
+	struct expl *e = malloc(sizeof *e);
+	*apply = NULL;
+	if (e == NULL)
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+	e->root = root;
+	return mustach_wrap_apply_begin(apply, templ, &mustach_jansson_wrap_itf, e, flags | Mustach_With_ExtendedItf, resolver, free);
 }
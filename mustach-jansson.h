@@ -101,6 +101,41 @@ extern int mustach_jansson_apply(
 		void *closure
 );
 
+/**
+ * The functions below are like the functions above without the suffix
+ * "_with" but the partials are got using the 'resolver' first
+ * (see mustach_partial_resolver_t). A NULL 'resolver' is accepted.
+ * The function "_fd_with" collects the output in a buffer of 'size'
+ * bytes before writing it, the size 0 disabling buffering.
+ */
+extern int mustach_jansson_file_with(const char *templstr, size_t length, json_t *root, int flags, const mustach_partial_resolver_t *resolver, FILE *file);
+extern int mustach_jansson_fd_with(const char *templstr, size_t length, json_t *root, int flags, const mustach_partial_resolver_t *resolver, int fd, size_t size);
+extern int mustach_jansson_mem_with(const char *templstr, size_t length, json_t *root, int flags, const mustach_partial_resolver_t *resolver, char **result, size_t *size);
+extern int mustach_jansson_apply_with(
+		mustach_template_t *templstr,
+		json_t *root,
+		int flags,
+		const mustach_partial_resolver_t *resolver,
+		mustach_write_cb_t *writecb,
+		mustach_emit_cb_t *emitcb,
+		void *closure
+);
+
+/**
+ * mustach_jansson_apply_begin - Prepares in '*apply' the pulled rendering
+ * of the prepared template 'templ' for the 'root', getting the partials
+ * using the 'resolver' first when not NULL. The output is pulled using
+ * mustach_wrap_apply_step and the rendering is ended using
+ * mustach_wrap_apply_end (see mustach_wrap_apply_begin).
+ */
+extern int mustach_jansson_apply_begin(
+		mustach_wrap_apply_t **apply,
+		mustach_template_t *templ,
+		json_t *root,
+		int flags,
+		const mustach_partial_resolver_t *resolver
+);
+
 
 #endif
 
@@ -13,15 +13,23 @@
 #include "mustach.h"
 #include "mustach-wrap.h"
 #include "mustach-json-c.h"
+#include "mustach-helpers.h"
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <ctype.h>
 
 struct expl {
 	struct json_object *root;
 	struct json_object *selection;
 	int depth;
+	int readonly;
+	uint64_t stamp;
+	char scratch[MUSTACH_WRAP_FORMAT_SIZE];
 	struct {
+		uint64_t stamp;
 		struct json_object *cont;
 		struct json_object *obj;
 		struct json_object_iterator iter;
@@ -36,19 +44,218 @@ struct expl {
 	} stack[MUSTACH_MAX_DEPTH];
 };
 
+/*
+ * With the flag Mustach_With_ReadOnlyData, the values aren't given by
+ * json_object_to_json_string_ext that records their text in the values,
+ * what is a race when many threads render the same values. The text is
+ * produced below, in the buffers of the rendering, the values being
+ * only read. It is the same except for the doubles whose parsed text
+ * isn't their shortest form, like 2.50 or 1.25e9.
+ */
+
+/*
+ * the text of the double, printed from its value with the fewest digits
+ * that give the value back: the text that the parser of json-c keeps in
+ * the user data isn't used because the user data of the values can be
+ * set to anything else
+ */
+static const char *double_text(struct json_object *o, char buffer[MUSTACH_WRAP_FORMAT_SIZE], size_t *length)
+{
+	struct mustach_wrap_lit lit;
+	double d;
+	size_t n;
+	int precision;
+
+	d = json_object_get_double(o);
+	if (isnan(d))
+		n = (size_t)sprintf(buffer, "NaN");
+	else if (isinf(d))
+		n = (size_t)sprintf(buffer, d < 0 ? "-Infinity" : "Infinity");
+	else {
+		for (precision = 15 ; ; precision++) {
+			n = mustach_wrap_format_double(buffer, d, precision);
+			if (precision == 17)
+				break;
+			mustach_wrap_parse_lit(&lit, buffer);
+			if (lit.d == d)
+				break;
+		}
+		/* as json-c, ensure that numbers look like doubles */
+		if (strchr(buffer, '.') == NULL && strchr(buffer, 'e') == NULL
+		 && isdigit((unsigned char)buffer[buffer[0] == '-'])) {
+			buffer[n++] = '.';
+			buffer[n++] = '0';
+			buffer[n] = 0;
+		}
+	}
+	*length = n;
+	return buffer;
+}
+
+/* the text of the integer, as json-c would print it */
+static const char *int_text(struct json_object *o, char buffer[MUSTACH_WRAP_FORMAT_SIZE], size_t *length)
+{
+	int64_t i = json_object_get_int64(o);
+#if JSON_C_VERSION_NUM >= 0x000e00
+	/* the integers above INT64_MAX are unsigned */
+	if (i == INT64_MAX) {
+		*length = (size_t)sprintf(buffer, "%llu", (unsigned long long)json_object_get_uint64(o));
+		return buffer;
+	}
+#endif
+	*length = mustach_wrap_format_int(buffer, i);
+	return buffer;
+}
+
+static int print_string(mustach_stream_t *stream, const char *text, size_t length)
+{
+	static const char hex[] = "0123456789abcdef";
+	char esc[6] = { '\\', 'u', '0', '0', 0, 0 };
+	size_t i, done, n;
+	unsigned char c;
+	int rc;
+
+	rc = mustach_stream_write(stream, "\"", 1);
+	for (done = i = 0 ; rc == MUSTACH_OK && i < length ; i++) {
+		c = (unsigned char)text[i];
+		n = 2;
+		switch (c) {
+		case '\b': esc[1] = 'b'; break;
+		case '\n': esc[1] = 'n'; break;
+		case '\r': esc[1] = 'r'; break;
+		case '\t': esc[1] = 't'; break;
+		case '\f': esc[1] = 'f'; break;
+		case '"': case '\\': case '/': esc[1] = (char)c; break;
+		default:
+			if (c >= ' ')
+				continue;
+			esc[1] = 'u';
+			esc[4] = hex[c >> 4];
+			esc[5] = hex[c & 15];
+			n = 6;
+			break;
+		}
+		rc = mustach_stream_write(stream, &text[done], i - done);
+		if (rc == MUSTACH_OK)
+			rc = mustach_stream_write(stream, esc, n);
+		done = i + 1;
+	}
+	if (rc == MUSTACH_OK)
+		rc = mustach_stream_write(stream, &text[done], length - done);
+	return rc == MUSTACH_OK ? mustach_stream_write(stream, "\"", 1) : rc;
+}
+
+/* as json_object_to_json_string_ext with flags 0 or JSON_C_TO_STRING_SPACED */
+static int print_value(mustach_stream_t *stream, struct json_object *o, int spaced)
+{
+	struct json_object_iterator iter, end;
+	char buffer[MUSTACH_WRAP_FORMAT_SIZE];
+	const char *text;
+	size_t i, n;
+	int rc;
+
+	switch (json_object_get_type(o)) {
+	case json_type_boolean:
+		return json_object_get_boolean(o)
+			? mustach_stream_write(stream, "true", 4)
+			: mustach_stream_write(stream, "false", 5);
+	case json_type_double:
+		text = double_text(o, buffer, &n);
+		return mustach_stream_write(stream, text, n);
+	case json_type_int:
+		text = int_text(o, buffer, &n);
+		return mustach_stream_write(stream, text, n);
+	case json_type_string:
+		return print_string(stream, json_object_get_string(o), (size_t)json_object_get_string_len(o));
+	case json_type_array:
+		rc = mustach_stream_write(stream, "[", 1);
+		n = json_object_array_length(o);
+		for (i = 0 ; rc == MUSTACH_OK && i < n ; i++) {
+			if (i)
+				rc = mustach_stream_write(stream, ",", 1);
+			if (rc == MUSTACH_OK && spaced)
+				rc = mustach_stream_write(stream, " ", 1);
+			if (rc == MUSTACH_OK)
+				rc = print_value(stream, json_object_array_get_idx(o, i), spaced);
+		}
+		if (rc == MUSTACH_OK && spaced)
+			rc = mustach_stream_write(stream, " ", 1);
+		return rc == MUSTACH_OK ? mustach_stream_write(stream, "]", 1) : rc;
+	case json_type_object:
+		rc = mustach_stream_write(stream, "{", 1);
+		iter = json_object_iter_begin(o);
+		end = json_object_iter_end(o);
+		for (i = 0 ; rc == MUSTACH_OK && !json_object_iter_equal(&iter, &end) ; i++) {
+			if (i)
+				rc = mustach_stream_write(stream, ",", 1);
+			if (rc == MUSTACH_OK && spaced)
+				rc = mustach_stream_write(stream, " ", 1);
+			if (rc == MUSTACH_OK) {
+				text = json_object_iter_peek_name(&iter);
+				rc = print_string(stream, text, strlen(text));
+			}
+			if (rc == MUSTACH_OK)
+				rc = mustach_stream_write(stream, ": ", spaced ? 2 : 1);
+			if (rc == MUSTACH_OK)
+				rc = print_value(stream, json_object_iter_peek_value(&iter), spaced);
+			json_object_iter_next(&iter);
+		}
+		if (rc == MUSTACH_OK && spaced)
+			rc = mustach_stream_write(stream, " ", 1);
+		return rc == MUSTACH_OK ? mustach_stream_write(stream, "}", 1) : rc;
+	default:
+		return mustach_stream_write(stream, "null", 4);
+	}
+}
+
+/* the text of the value, allocated when it is an array or an object */
+static int print(struct expl *e, struct json_object *o, struct mustach_sbuf *sbuf, int spaced)
+{
+	mustach_stream_t stream;
+	char *text;
+	int rc;
+
+	switch (json_object_get_type(o)) {
+	case json_type_boolean:
+		sbuf->value = json_object_get_boolean(o) ? "true" : "false";
+		return MUSTACH_OK;
+	case json_type_double:
+		sbuf->value = double_text(o, e->scratch, &sbuf->length);
+		return MUSTACH_OK;
+	case json_type_int:
+		sbuf->value = int_text(o, e->scratch, &sbuf->length);
+		return MUSTACH_OK;
+	default:
+		mustach_stream_init(&stream);
+		rc = print_value(&stream, o, spaced);
+		if (rc == MUSTACH_OK)
+			rc = mustach_stream_end(&stream, &text, &sbuf->length);
+		else
+			mustach_stream_abort(&stream);
+		if (rc == MUSTACH_OK) {
+			sbuf->value = text;
+			sbuf->freecb = free;
+		}
+		return rc;
+	}
+}
+
 static int start(void *closure)
 {
 	struct expl *e = closure;
 	e->depth = 0;
+	e->stamp = 1;
 	e->selection = NULL;
+	e->stack[0].stamp = 1;
 	e->stack[0].cont = NULL;
 	e->stack[0].obj = e->root;
+	e->stack[0].is_objiter = 0;
 	e->stack[0].index = 0;
 	e->stack[0].count = 1;
 	return MUSTACH_OK;
 }
 
-static int compare(void *closure, const char *value)
+static int compare_lit(void *closure, const struct mustach_wrap_lit *lit)
 {
 	struct expl *e = closure;
 	struct json_object *o = e->selection;
@@ -57,16 +264,38 @@ static int compare(void *closure, const char *value)
 
 	switch (json_object_get_type(o)) {
 	case json_type_double:
-		d = json_object_get_double(o) - atof(value);
+		d = json_object_get_double(o) - lit->d;
 		return d < 0 ? -1 : d > 0 ? 1 : 0;
 	case json_type_int:
-		i = json_object_get_int64(o) - (int64_t)atoll(value);
+		i = json_object_get_int64(o) - lit->i;
 		return i < 0 ? -1 : i > 0 ? 1 : 0;
+	case json_type_null:
+		return lit->type == Mustach_Lit_Null ? 0 : strcmp("null", lit->string);
+	case json_type_boolean:
+		return strcmp(json_object_get_boolean(o) ? "true" : "false", lit->string);
+	case json_type_string:
+		return strcmp(json_object_get_string(o), lit->string);
 	default:
-		return strcmp(json_object_get_string(o), value);
+		if (e->readonly) {
+			struct mustach_sbuf sbuf = MUSTACH_SBUF_INIT;
+			int rc = print(e, o, &sbuf, 1);
+			if (rc != MUSTACH_OK)
+				return 1;
+			rc = strcmp(sbuf.value, lit->string);
+			mustach_sbuf_release(&sbuf);
+			return rc;
+		}
+		return strcmp(json_object_get_string(o), lit->string);
 	}
 }
 
+static int compare(void *closure, const char *value)
+{
+	struct mustach_wrap_lit lit;
+	mustach_wrap_parse_lit(&lit, value);
+	return compare_lit(closure, &lit);
+}
+
 static int sel(void *closure, const char *name)
 {
 	struct expl *e = closure;
@@ -91,6 +320,34 @@ static int sel(void *closure, const char *name)
 	return r;
 }
 
+static int sel_ic(void *closure, const char *name, struct mustach_wrap_ic *ic)
+{
+	struct expl *e = closure;
+	struct json_object *o = NULL;
+	int i, low, valid;
+
+	/* the cache is valid if the level where the name was found is unchanged */
+	valid = ic->stamp != 0
+		&& ic->depth <= e->depth
+		&& (ic->depth < 0 || e->stack[ic->depth].stamp <= ic->stamp);
+
+	/* when valid, only search the levels changed since the cache was set */
+	low = valid ? ic->depth : -1;
+	for (i = e->depth ; i > low ; i--)
+		if ((!valid || e->stack[i].stamp > ic->stamp)
+		 && json_object_object_get_ex(e->stack[i].obj, name, &o))
+			break;
+	if (i == low)
+		o = valid ? ic->item : NULL;
+
+	/* record the result */
+	ic->stamp = e->stamp;
+	ic->depth = i;
+	ic->item = o;
+	e->selection = o;
+	return i >= 0;
+}
+
 static int subsel(void *closure, const char *name)
 {
 	struct expl *e = closure;
@@ -112,6 +369,40 @@ static int subsel(void *closure, const char *name)
 	return r;
 }
 
+/*
+ * The lookups of json-c need null terminated names, the names of
+ * the functions below are copied when not terminated.
+ */
+static int sel_len(void *closure, const char *name, size_t length)
+{
+	if (name[length] == 0)
+		return sel(closure, name);
+	char copy[length + 1];
+	memcpy(copy, name, length);
+	copy[length] = 0;
+	return sel(closure, copy);
+}
+
+static int sel_ic_len(void *closure, const char *name, size_t length, struct mustach_wrap_ic *ic)
+{
+	if (name[length] == 0)
+		return sel_ic(closure, name, ic);
+	char copy[length + 1];
+	memcpy(copy, name, length);
+	copy[length] = 0;
+	return sel_ic(closure, copy, ic);
+}
+
+static int subsel_len(void *closure, const char *name, size_t length)
+{
+	if (name[length] == 0)
+		return subsel(closure, name);
+	char copy[length + 1];
+	memcpy(copy, name, length);
+	copy[length] = 0;
+	return subsel(closure, copy);
+}
+
 static int enter(void *closure, int objiter)
 {
 	struct expl *e = closure;
@@ -148,6 +439,7 @@ static int enter(void *closure, int objiter)
 		e->stack[e->depth].index = 0;
 	} else
 		goto not_entering;
+	e->stack[e->depth].stamp = ++e->stamp;
 	return 1;
 
 not_entering:
@@ -167,6 +459,7 @@ static int next(void *closure)
 		if (json_object_iter_equal(&e->stack[e->depth].iter, &e->stack[e->depth].enditer))
 			return 0;
 		e->stack[e->depth].obj = json_object_iter_peek_value(&e->stack[e->depth].iter);
+		e->stack[e->depth].stamp = ++e->stamp;
 		return 1;
 	}
 
@@ -175,6 +468,7 @@ static int next(void *closure)
 		return 0;
 
 	e->stack[e->depth].obj = json_object_array_get_idx(e->stack[e->depth].cont, e->stack[e->depth].index);
+	e->stack[e->depth].stamp = ++e->stamp;
 	return 1;
 }
 
@@ -207,12 +501,21 @@ static int get(void *closure, struct mustach_sbuf *sbuf, int key)
 		switch (json_object_get_type(e->selection)) {
 		case json_type_string:
 			s = json_object_get_string(e->selection);
+			sbuf->length = (size_t)json_object_get_string_len(e->selection);
 			break;
 		case json_type_null:
 			s = "";
 			break;
 		default:
+			if (e->readonly) {
+				d = print(e, e->selection, sbuf, 0);
+				return d == MUSTACH_OK ? 1 : d;
+			}
+#if JSON_C_VERSION_NUM >= 0x000d00
+			s = json_object_to_json_string_length(e->selection, 0, &sbuf->length);
+#else
 			s = json_object_to_json_string_ext(e->selection, 0);
+#endif
 			break;
 		}
 	sbuf->value = s;
@@ -228,42 +531,77 @@ const struct mustach_wrap_itf mustach_json_c_wrap_itf = {
 	.enter = enter,
 	.next = next,
 	.leave = leave,
-	.get = get
+	.get = get,
+	.compare_lit = compare_lit,
+	.sel_ic = sel_ic,
+	.version = MUSTACH_WRAP_ITF_VERSION_2,
+	.sel_len = sel_len,
+	.subsel_len = subsel_len,
+	.sel_ic_len = sel_ic_len
 };
 
 int mustach_json_c_file(const char *templstr, size_t length, struct json_object *root, int flags, FILE *file)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_file(templstr, length, &mustach_json_c_wrap_itf, &e, flags, file);
+	e.readonly = flags & Mustach_With_ReadOnlyData;
+	return mustach_wrap_file(templstr, length, &mustach_json_c_wrap_itf, &e, flags | Mustach_With_ExtendedItf, file);
+}
+
+int mustach_json_c_file_with(const char *templstr, size_t length, struct json_object *root, int flags, const mustach_partial_resolver_t *resolver, FILE *file)
+{
+	struct expl e;
+	e.root = root;
+	e.readonly = flags & Mustach_With_ReadOnlyData;
+	return mustach_wrap_file_with(templstr, length, &mustach_json_c_wrap_itf, &e, flags | Mustach_With_ExtendedItf, resolver, file);
 }
 
 int mustach_json_c_fd(const char *templstr, size_t length, struct json_object *root, int flags, int fd)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_fd(templstr, length, &mustach_json_c_wrap_itf, &e, flags, fd);
+	e.readonly = flags & Mustach_With_ReadOnlyData;
+	return mustach_wrap_fd(templstr, length, &mustach_json_c_wrap_itf, &e, flags | Mustach_With_ExtendedItf, fd);
+}
+
+int mustach_json_c_fd_with(const char *templstr, size_t length, struct json_object *root, int flags, const mustach_partial_resolver_t *resolver, int fd, size_t size)
+{
+	struct expl e;
+	e.root = root;
+	e.readonly = flags & Mustach_With_ReadOnlyData;
+	return mustach_wrap_fd_with(templstr, length, &mustach_json_c_wrap_itf, &e, flags | Mustach_With_ExtendedItf, resolver, fd, size);
 }
 
 int mustach_json_c_mem(const char *templstr, size_t length, struct json_object *root, int flags, char **result, size_t *size)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_mem(templstr, length, &mustach_json_c_wrap_itf, &e, flags, result, size);
+	e.readonly = flags & Mustach_With_ReadOnlyData;
+	return mustach_wrap_mem(templstr, length, &mustach_json_c_wrap_itf, &e, flags | Mustach_With_ExtendedItf, result, size);
+}
+
+int mustach_json_c_mem_with(const char *templstr, size_t length, struct json_object *root, int flags, const mustach_partial_resolver_t *resolver, char **result, size_t *size)
+{
+	struct expl e;
+	e.root = root;
+	e.readonly = flags & Mustach_With_ReadOnlyData;
+	return mustach_wrap_mem_with(templstr, length, &mustach_json_c_wrap_itf, &e, flags | Mustach_With_ExtendedItf, resolver, result, size);
 }
 
 int mustach_json_c_write(const char *templstr, size_t length, struct json_object *root, int flags, mustach_write_cb_t *writecb, void *closure)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_write(templstr, length, &mustach_json_c_wrap_itf, &e, flags, writecb, closure);
+	e.readonly = flags & Mustach_With_ReadOnlyData;
+	return mustach_wrap_write(templstr, length, &mustach_json_c_wrap_itf, &e, flags | Mustach_With_ExtendedItf, writecb, closure);
 }
 
 int mustach_json_c_emit(const char *templstr, size_t length, struct json_object *root, int flags, mustach_emit_cb_t *emitcb, void *closure)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_emit(templstr, length, &mustach_json_c_wrap_itf, &e, flags, emitcb, closure);
+	e.readonly = flags & Mustach_With_ReadOnlyData;
+	return mustach_wrap_emit(templstr, length, &mustach_json_c_wrap_itf, &e, flags | Mustach_With_ExtendedItf, emitcb, closure);
 }
 
 int mustach_json_c_apply(
@@ -276,7 +614,39 @@ int mustach_json_c_apply(
 ) {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_apply(templstr, &mustach_json_c_wrap_itf, &e, flags, writecb, emitcb, closure);
+	e.readonly = flags & Mustach_With_ReadOnlyData;
+	return mustach_wrap_apply(templstr, &mustach_json_c_wrap_itf, &e, flags | Mustach_With_ExtendedItf, writecb, emitcb, closure);
+}
+
+int mustach_json_c_apply_with(
+		mustach_template_t *templstr,
+		struct json_object *root,
+		int flags,
+		const mustach_partial_resolver_t *resolver,
+		mustach_write_cb_t *writecb,
+		mustach_emit_cb_t *emitcb,
+		void *closure
+) {
+	struct expl e;
+	e.root = root;
+	e.readonly = flags & Mustach_With_ReadOnlyData;
+	return mustach_wrap_apply_with(templstr, &mustach_json_c_wrap_itf, &e, flags | Mustach_With_ExtendedItf, resolver, writecb, emitcb, closure);
+}
+
+int mustach_json_c_apply_begin(
+		mustach_wrap_apply_t **apply,
+		mustach_template_t *templ,
+		struct json_object *root,
+		int flags,
+		const mustach_partial_resolver_t *resolver
+) {
+	struct expl *e = malloc(sizeof *e);
+	*apply = NULL;
+	if (e == NULL)
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+	e->root = root;
+	e->readonly = flags & Mustach_With_ReadOnlyData;
+	return mustach_wrap_apply_begin(apply, templ, &mustach_json_c_wrap_itf, e, flags | Mustach_With_ExtendedItf, resolver, free);
 }
 
 int fmustach_json_c(const char *templstr, struct json_object *root, FILE *file)
@@ -0,0 +1,518 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "mustach-registry.h"
+#include "mustach-helpers.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* initial count of buckets, must be a power of 2 */
+#ifndef REGISTRY_INIT_BUCKETS
+# define REGISTRY_INIT_BUCKETS 64
+#endif
+
+/* maximum count of threads */
+#ifndef REGISTRY_MAX_THREADS
+# define REGISTRY_MAX_THREADS 64
+#endif
+
+/* extension of the files of templates */
+#ifndef REGISTRY_EXTENSION
+# define REGISTRY_EXTENSION ".mustache"
+#endif
+
+/* a record of the registry */
+typedef struct record record_t;
+struct record {
+	/* next record of the same bucket */
+	record_t *hnext;
+	/* the recorded template */
+	mustach_template_t *templ;
+	/* hash of the name */
+	uint64_t hash;
+	/* length of the name */
+	size_t length;
+	/* the name */
+	char name[];
+};
+
+/* the registry */
+struct mustach_registry {
+	/* protection against concurrent accesses */
+	pthread_rwlock_t lock;
+	/* build flags */
+	int flags;
+	/* count of threads for building */
+	unsigned nthreads;
+	/* count of records */
+	unsigned count;
+	/* count of buckets (a power of 2) */
+	size_t nbuckets;
+	/* the buckets */
+	record_t **buckets;
+};
+
+/* an item to prepare */
+typedef
+struct {
+	/* name of the template */
+	const char *name;
+	/* path of the file of the template or NULL */
+	const char *path;
+	/* text of the template when path is NULL */
+	mustach_sbuf_t sbuf;
+}
+	item_t;
+
+/* a job of preparation shared by the threads */
+typedef
+struct {
+	/* protection of the fields below */
+	pthread_mutex_t mutex;
+	/* the registry */
+	mustach_registry_t *registry;
+	/* the items to prepare */
+	item_t *items;
+	/* count of items */
+	unsigned count;
+	/* index of the next item to prepare */
+	unsigned next;
+	/* status of the job */
+	int rc;
+}
+	job_t;
+
+/* an entry found in a directory */
+typedef struct entry entry_t;
+struct entry {
+	/* next entry */
+	entry_t *next;
+	/* the name of the template */
+	const char *name;
+	/* path of the file then name */
+	char path[];
+};
+
+/* computes the hash of a name (FNV-1a) */
+static uint64_t hash(const char *name, size_t length)
+{
+	uint64_t h = UINT64_C(14695981039346656037);
+	while (length--) {
+		h ^= (uint64_t)(unsigned char)*name++;
+		h *= UINT64_C(1099511628211);
+	}
+	return h;
+}
+
+/* search the record of name */
+static record_t **search(mustach_registry_t *registry, uint64_t h, const char *name, size_t length)
+{
+	record_t *rec, **prec = &registry->buckets[h & (registry->nbuckets - 1)];
+	while ((rec = *prec) != NULL
+	    && (rec->hash != h || rec->length != length || memcmp(rec->name, name, length)))
+		prec = &rec->hnext;
+	return prec;
+}
+
+/* double the count of buckets if needed */
+static void grow(mustach_registry_t *registry)
+{
+	size_t idx, nbuckets = registry->nbuckets << 1;
+	record_t *rec, *next, **buckets;
+
+	if (registry->count <= registry->nbuckets || nbuckets == 0)
+		return;
+	buckets = calloc(nbuckets, sizeof *buckets);
+	if (buckets == NULL)
+		return; /* not fatal */
+	for (idx = 0 ; idx < registry->nbuckets ; idx++)
+		for (rec = registry->buckets[idx] ; rec != NULL ; rec = next) {
+			next = rec->hnext;
+			rec->hnext = buckets[rec->hash & (nbuckets - 1)];
+			buckets[rec->hash & (nbuckets - 1)] = rec;
+		}
+	free(registry->buckets);
+	registry->buckets = buckets;
+	registry->nbuckets = nbuckets;
+}
+
+/* prepare the item */
+static int prepare(mustach_registry_t *registry, item_t *item)
+{
+	mustach_template_t *templ;
+	int rc;
+
+	if (item->path != NULL) {
+		rc = mustach_read_file(item->path, &item->sbuf);
+		if (rc != MUSTACH_OK)
+			return rc;
+	}
+	rc = mustach_build_template(&templ, registry->flags, &item->sbuf,
+					item->name, 0, NULL, NULL);
+	if (rc == MUSTACH_OK) {
+		rc = mustach_registry_add(registry, item->name, 0, templ);
+		mustach_unref_template(templ, NULL, NULL);
+	}
+	return rc;
+}
+
+/* prepare the items of the job until none remains */
+static void *work(void *closure)
+{
+	job_t *job = closure;
+	unsigned idx;
+	int rc;
+
+	for (;;) {
+		/* get the next item */
+		pthread_mutex_lock(&job->mutex);
+		idx = job->next;
+		if (idx < job->count)
+			job->next = idx + 1;
+		pthread_mutex_unlock(&job->mutex);
+		if (idx >= job->count)
+			return NULL;
+
+		/* prepare it */
+		rc = prepare(job->registry, &job->items[idx]);
+		if (rc != MUSTACH_OK) {
+			pthread_mutex_lock(&job->mutex);
+			if (job->rc == MUSTACH_OK)
+				job->rc = rc;
+			pthread_mutex_unlock(&job->mutex);
+		}
+	}
+}
+
+/* prepare the items using the threads of the registry */
+static int run(mustach_registry_t *registry, item_t *items, unsigned count)
+{
+	pthread_t threads[REGISTRY_MAX_THREADS];
+	unsigned idx, nthr;
+	job_t job;
+
+	/* init the job */
+	pthread_mutex_init(&job.mutex, NULL);
+	job.registry = registry;
+	job.items = items;
+	job.count = count;
+	job.next = 0;
+	job.rc = MUSTACH_OK;
+
+	/* start the threads, the calling thread is also working */
+	nthr = registry->nthreads < count ? registry->nthreads : count;
+	for (idx = 1 ; idx < nthr ; idx++)
+		if (pthread_create(&threads[idx], NULL, work, &job) != 0)
+			break; /* not fatal */
+	nthr = idx;
+	work(&job);
+
+	/* wait termination of threads */
+	for (idx = 1 ; idx < nthr ; idx++)
+		pthread_join(threads[idx], NULL);
+	pthread_mutex_destroy(&job.mutex);
+	return job.rc;
+}
+
+/* a directory being scanned, linked to the directory containing it */
+typedef struct visit visit_t;
+struct visit {
+	/* the containing directory or NULL */
+	const visit_t *up;
+	/* device of the directory */
+	dev_t dev;
+	/* inode of the directory */
+	ino_t ino;
+};
+
+/* add to the list the entries of the directory 'path' of length 'len',
+ * 'root' being the length of the path of the loaded directory and
+ * 'up' the directories being scanned */
+static int scan_dir(entry_t **list, unsigned *count, char path[PATH_MAX], size_t len, size_t root, const visit_t *up)
+{
+	static const char extension[] = REGISTRY_EXTENSION;
+	const size_t lenext = sizeof extension - 1;
+	struct dirent *ent;
+	struct stat st;
+	entry_t *entry;
+	size_t lenent;
+	visit_t here;
+	DIR *dir;
+	int rc = MUSTACH_OK;
+
+	/* symbolic links are followed, avoid scanning
+	 * again a directory that is already being scanned */
+	if (stat(path, &st) < 0)
+		return MUSTACH_ERROR_NOT_FOUND;
+	for (here.up = up ; up != NULL ; up = up->up)
+		if (up->dev == st.st_dev && up->ino == st.st_ino)
+			return MUSTACH_OK;
+	here.dev = st.st_dev;
+	here.ino = st.st_ino;
+
+	/* only the loaded directory must be opened, the
+	 * sub-directories that can't be opened are skipped */
+	dir = opendir(path);
+	if (dir == NULL)
+		return here.up == NULL ? MUSTACH_ERROR_NOT_FOUND : MUSTACH_OK;
+	path[len++] = '/';
+	while (rc == MUSTACH_OK && (ent = readdir(dir)) != NULL) {
+		/* skip hidden entries */
+		if (ent->d_name[0] == '.')
+			continue;
+		lenent = strlen(ent->d_name);
+		if (len + lenent >= PATH_MAX) {
+			rc = MUSTACH_ERROR_TOO_BIG;
+			break;
+		}
+		memcpy(&path[len], ent->d_name, lenent + 1);
+		if (stat(path, &st) < 0)
+			continue;
+		if (S_ISDIR(st.st_mode))
+			rc = scan_dir(list, count, path, len + lenent, root, &here);
+		else if (S_ISREG(st.st_mode)
+		      && lenent > lenext
+		      && memcmp(&ent->d_name[lenent - lenext], extension, lenext) == 0) {
+			/* record path and name */
+			lenent += len;
+			entry = malloc(sizeof *entry + 2 * lenent - root - lenext + 2);
+			if (entry == NULL)
+				rc = MUSTACH_ERROR_OUT_OF_MEMORY;
+			else {
+				memcpy(entry->path, path, lenent + 1);
+				entry->name = &entry->path[lenent + 1];
+				memcpy(&entry->path[lenent + 1], &path[root], lenent - root - lenext);
+				entry->path[2 * lenent - root - lenext + 1] = 0;
+				entry->next = *list;
+				*list = entry;
+				++*count;
+			}
+		}
+	}
+	closedir(dir);
+	return rc;
+}
+
+/* see header file */
+int mustach_registry_create(mustach_registry_t **registry, int flags, unsigned nthreads)
+{
+	mustach_registry_t *r = malloc(sizeof *r);
+	long ncpu;
+
+	if (r != NULL) {
+		r->buckets = calloc(REGISTRY_INIT_BUCKETS, sizeof *r->buckets);
+		if (r->buckets != NULL) {
+			if (nthreads == 0) {
+				ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+				nthreads = ncpu > 0 ? (unsigned)ncpu : 1;
+			}
+			pthread_rwlock_init(&r->lock, NULL);
+			r->flags = flags;
+			r->nthreads = nthreads < REGISTRY_MAX_THREADS ? nthreads : REGISTRY_MAX_THREADS;
+			r->count = 0;
+			r->nbuckets = REGISTRY_INIT_BUCKETS;
+			*registry = r;
+			return MUSTACH_OK;
+		}
+		free(r);
+	}
+	*registry = NULL;
+	return MUSTACH_ERROR_OUT_OF_MEMORY;
+}
+
+/* see header file */
+void mustach_registry_destroy(mustach_registry_t *registry)
+{
+	size_t idx;
+	record_t *rec, *next;
+
+	if (registry != NULL) {
+		for (idx = 0 ; idx < registry->nbuckets ; idx++)
+			for (rec = registry->buckets[idx] ; rec != NULL ; rec = next) {
+				next = rec->hnext;
+				mustach_unref_template(rec->templ, NULL, NULL);
+				free(rec);
+			}
+		pthread_rwlock_destroy(&registry->lock);
+		free(registry->buckets);
+		free(registry);
+	}
+}
+
+/* see header file */
+int mustach_registry_add(mustach_registry_t *registry, const char *name, size_t length, mustach_template_t *templ)
+{
+	record_t *rec, *old, **prec;
+	uint64_t h;
+
+	/* create the record */
+	if (length == 0)
+		length = strlen(name);
+	h = hash(name, length);
+	rec = malloc(sizeof *rec + length + 1);
+	if (rec == NULL)
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+	rec->templ = mustach_ref_template(templ);
+	rec->hash = h;
+	rec->length = length;
+	memcpy(rec->name, name, length);
+	rec->name[length] = 0;
+
+	/* add or replace */
+	pthread_rwlock_wrlock(&registry->lock);
+	prec = search(registry, h, name, length);
+	old = *prec;
+	if (old != NULL) {
+		rec->hnext = old->hnext;
+		*prec = rec;
+	}
+	else {
+		rec->hnext = NULL;
+		*prec = rec;
+		registry->count++;
+		grow(registry);
+	}
+	pthread_rwlock_unlock(&registry->lock);
+
+	/* release the replaced record */
+	if (old != NULL) {
+		mustach_unref_template(old->templ, NULL, NULL);
+		free(old);
+	}
+	return MUSTACH_OK;
+}
+
+/* see header file */
+int mustach_registry_build(mustach_registry_t *registry, unsigned count, const char *const *names, const mustach_sbuf_t *sbufs)
+{
+	unsigned idx;
+	item_t *items;
+	int rc;
+
+	items = malloc(count * sizeof *items);
+	if (items == NULL) {
+		for (idx = 0 ; idx < count ; idx++) {
+			mustach_sbuf_t sbuf = sbufs[idx];
+			mustach_sbuf_release(&sbuf);
+		}
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+	}
+	for (idx = 0 ; idx < count ; idx++) {
+		items[idx].name = names[idx];
+		items[idx].path = NULL;
+		items[idx].sbuf = sbufs[idx];
+	}
+	rc = run(registry, items, count);
+	free(items);
+	return rc;
+}
+
+/* see header file */
+int mustach_registry_load_dir(mustach_registry_t *registry, const char *path)
+{
+	char buffer[PATH_MAX];
+	entry_t *list = NULL, *entry;
+	unsigned idx, count = 0;
+	item_t *items = NULL;
+	size_t len;
+	int rc;
+
+	/* list the files */
+	len = strlen(path);
+	while (len > 1 && path[len - 1] == '/')
+		len--;
+	if (len >= PATH_MAX)
+		return MUSTACH_ERROR_TOO_BIG;
+	memcpy(buffer, path, len);
+	buffer[len] = 0;
+	rc = scan_dir(&list, &count, buffer, len, len + 1, NULL);
+
+	/* prepare them */
+	if (rc == MUSTACH_OK && count != 0) {
+		items = malloc(count * sizeof *items);
+		if (items == NULL)
+			rc = MUSTACH_ERROR_OUT_OF_MEMORY;
+		else {
+			for (idx = 0, entry = list ; entry != NULL ; entry = entry->next, idx++) {
+				items[idx].name = entry->name;
+				items[idx].path = entry->path;
+				mustach_sbuf_reset(&items[idx].sbuf);
+			}
+			rc = run(registry, items, count);
+			free(items);
+		}
+	}
+
+	/* release the list */
+	while (list != NULL) {
+		entry = list;
+		list = entry->next;
+		free(entry);
+	}
+	return rc;
+}
+
+/* see header file */
+int mustach_registry_get(mustach_registry_t *registry, const char *name, size_t length, mustach_template_t **templ)
+{
+	record_t *rec;
+	uint64_t h;
+
+	if (length == 0)
+		length = strlen(name);
+	h = hash(name, length);
+	pthread_rwlock_rdlock(&registry->lock);
+	rec = *search(registry, h, name, length);
+	*templ = rec == NULL ? NULL : mustach_ref_template(rec->templ);
+	pthread_rwlock_unlock(&registry->lock);
+	return rec == NULL ? MUSTACH_ERROR_NOT_FOUND : MUSTACH_OK;
+}
+
+/* see header file */
+void mustach_registry_release(mustach_template_t *templ)
+{
+	mustach_unref_template(templ, NULL, NULL);
+}
+
+/* see header file */
+unsigned mustach_registry_count(mustach_registry_t *registry)
+{
+	unsigned count;
+
+	pthread_rwlock_rdlock(&registry->lock);
+	count = registry->count;
+	pthread_rwlock_unlock(&registry->lock);
+	return count;
+}
+
+/* see header file */
+int mustach_registry_partial_get(void *registry, const char *name, size_t length, mustach_template_t **partial)
+{
+	return length == 0
+		? MUSTACH_ERROR_NOT_FOUND
+		: mustach_registry_get(registry, name, length, partial);
+}
+
+/* see header file */
+void mustach_registry_partial_put(void *registry, mustach_template_t *partial)
+{
+	(void)registry;/*make compiler happy #@!%!!*/
+	mustach_registry_release(partial);
+}
+
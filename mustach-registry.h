@@ -0,0 +1,154 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+#ifndef _mustach_registry_h_included_
+#define _mustach_registry_h_included_
+
+/*
+ * mustach-registry records prepared templates by name.
+ *
+ * It is intended for applications that prepare, at start, many
+ * templates, typically all the templates of a directory, and then
+ * use them many times. The preparation of the templates is done
+ * in parallel by a pool of threads.
+ *
+ * Templates of a registry are reference counted: a template got from
+ * the registry stays valid until it is released using the function
+ * 'mustach_registry_release', even if it is replaced or if the registry
+ * is destroyed in the meantime.
+ *
+ * The registry is optimized for reading: getting templates can be
+ * done concurrently from several threads without blocking each other.
+ *
+ * The registry can provide partials to the applier of templates, using
+ * the functions 'mustach_registry_partial_get' and
+ * 'mustach_registry_partial_put' (see mustach_apply_itf_t) or, for
+ * mustach wrappers, by setting 'mustach_wrap_partial_registry'.
+ */
+#include "mustach2.h"
+
+typedef struct mustach_registry mustach_registry_t;
+
+/**
+ * mustach_registry_create - Creates a registry of templates
+ *
+ * @registry: pointer receiving the created registry
+ * @flags:    build flags of the templates prepared by the registry
+ *            (see Mustach_Build_...)
+ * @nthreads: count of threads used for preparing templates or 0
+ *            for using as many threads as there are processors
+ *
+ * Returns MUSTACH_OK in case of success or MUSTACH_ERROR_OUT_OF_MEMORY.
+ */
+extern int mustach_registry_create(mustach_registry_t **registry, int flags, unsigned nthreads);
+
+/**
+ * mustach_registry_destroy - Destroys the registry, releasing its templates
+ *
+ * @registry: the registry to destroy
+ */
+extern void mustach_registry_destroy(mustach_registry_t *registry);
+
+/**
+ * mustach_registry_add - Records the template under the name
+ *
+ * The registry takes its own reference on the template, the reference
+ * of the caller is not changed.
+ *
+ * When a template is already recorded for the name, it is replaced.
+ *
+ * @registry: the registry
+ * @name:     the name of the template
+ * @length:   length of the name or 0 if null terminated
+ * @templ:    the template to record
+ *
+ * Returns MUSTACH_OK in case of success or MUSTACH_ERROR_OUT_OF_MEMORY.
+ */
+extern int mustach_registry_add(mustach_registry_t *registry, const char *name, size_t length, mustach_template_t *templ);
+
+/**
+ * mustach_registry_build - Prepares and records templates
+ *
+ * The 'count' templates given in the array 'sbufs' are prepared in
+ * parallel and recorded with the names of the array 'names'. As for
+ * 'mustach_build_template', the templates take ownership of the
+ * items of 'sbufs', even in case of error.
+ *
+ * @registry: the registry
+ * @count:    count of templates
+ * @names:    null terminated names of the templates
+ * @sbufs:    texts of the templates
+ *
+ * Returns MUSTACH_OK in case of success or the error code of the
+ * first failure, in which case templates successfully prepared are
+ * recorded anyway.
+ */
+extern int mustach_registry_build(mustach_registry_t *registry, unsigned count, const char *const *names, const mustach_sbuf_t *sbufs);
+
+/**
+ * mustach_registry_load_dir - Prepares and records templates of a directory
+ *
+ * All the files of the directory 'path' and of its subdirectories
+ * whose name ends with ".mustache" are read and prepared in parallel.
+ * The name of the recorded template is the path of the file relative
+ * to the directory without the extension ".mustache". So the file
+ * "dir/header.mustache" is recorded as "dir/header" when loading
+ * the parent directory of "dir". Symbolic links are followed but
+ * a directory is not scanned again inside itself. The entries that
+ * can't be examined and the subdirectories that can't be opened are
+ * skipped.
+ *
+ * @registry: the registry
+ * @path:     path of the directory
+ *
+ * Returns MUSTACH_OK in case of success or the error code of the
+ * first failure, in which case templates successfully prepared are
+ * recorded anyway.
+ */
+extern int mustach_registry_load_dir(mustach_registry_t *registry, const char *path);
+
+/**
+ * mustach_registry_get - Gets the template recorded for the name
+ *
+ * @registry: the registry
+ * @name:     the name of the template
+ * @length:   length of the name or 0 if null terminated
+ * @templ:    pointer receiving the found template
+ *
+ * Returns MUSTACH_OK when found, in which case the returned template
+ * must be released using 'mustach_registry_release', or returns
+ * MUSTACH_ERROR_NOT_FOUND.
+ */
+extern int mustach_registry_get(mustach_registry_t *registry, const char *name, size_t length, mustach_template_t **templ);
+
+/**
+ * mustach_registry_release - Releases a template got from a registry
+ *
+ * @templ:    the template to release
+ */
+extern void mustach_registry_release(mustach_template_t *templ);
+
+/**
+ * mustach_registry_count - Gets the count of recorded templates
+ *
+ * @registry: the registry
+ *
+ * Returns the count of templates recorded in the registry.
+ */
+extern unsigned mustach_registry_count(mustach_registry_t *registry);
+
+/**
+ * Functions providing partials from the registry given as closure.
+ * They are compatible with the fields 'partial_get' and 'partial_put'
+ * of mustach_apply_itf_t.
+ */
+extern int mustach_registry_partial_get(void *registry, const char *name, size_t length, mustach_template_t **partial);
+extern void mustach_registry_partial_put(void *registry, mustach_template_t *partial);
+
+#endif
+
@@ -13,13 +13,19 @@
 #include "mustach.h"
 #include "mustach-wrap.h"
 #include "mustach-helpers.h"
+#include "mustach-cache.h"
+#include "mustach-registry.h"
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <limits.h>
+#include <ctype.h>
+#include <errno.h>
+#include <locale.h>
 #ifdef _WIN32
 #include <malloc.h>
 #endif
@@ -53,11 +59,33 @@
 /* global hook for partials */
 int (*mustach_wrap_get_partial)(const char *name, struct mustach_sbuf *sbuf) = NULL;
 
+/* global cache of partials */
+mustach_cache_t *mustach_wrap_partial_cache = NULL;
+
+/* global registry of partials */
+mustach_registry_t *mustach_wrap_partial_registry = NULL;
+
+/* global cache of templates */
+mustach_cache_t *mustach_wrap_template_cache = NULL;
+
+/* prefixes of keys of partials in the cache */
+#define KEY_HOOK  'h'
+#define KEY_FILE  'f'
+
+/* count of nested templates whose selectors are tracked */
+#define SELDEPTH 8
+
+/* count of the lists of inline caches of partials, by names */
+#define ICNAMES 32
+
 /* internal structure for wrapping */
 struct wrap {
-	/* original interface */
+	/* original interface or its copy */
 	const struct mustach_wrap_itf *itf;
 
+	/* copy of the base fields of an interface not extended */
+	struct mustach_wrap_itf itfbase;
+
 	/* original closure */
 	void *closure;
 
@@ -75,6 +103,36 @@ struct wrap {
 
 	/* the main template */
 	mustach_template_t *templ;
+
+	/* can selectors be precompiled? */
+	int precompile;
+
+	/* is the partial being got shared (from the cache, the registry or the resolver)? */
+	int shared;
+
+	/* depth of applied templates */
+	unsigned seldepth;
+
+	/* count of entered sections */
+	int depth;
+
+	/* tables of selectors of the applied templates */
+	struct seltab *seltabs[SELDEPTH];
+
+	/* inline caches of the selectors of the applied templates */
+	struct icset *sets[SELDEPTH];
+
+	/* inline caches of the rendering */
+	struct icset *icsets;
+
+	/* inline caches of the partials, by hash of their names */
+	struct icset *icnames[ICNAMES];
+
+	/* resolver of partials of the rendering or NULL */
+	const mustach_partial_resolver_t *resolver;
+
+	/* bits of the depths whose partial comes from the resolver */
+	uint64_t resolved;
 };
 
 /* length given by masking with 3 */
@@ -127,7 +185,7 @@ static char *keyval(char *head, int sflags, enum comp *comp)
 	return k == C_no ? NULL : &head[k & 3];
 }
 
-static char *getkey(char **head, int sflags)
+static char *getkey(char **head, int sflags, size_t *length)
 {
 	char *result, *iter, *write, car;
 
@@ -148,6 +206,7 @@ static char *getkey(char **head, int sflags)
 				car = *++iter;
 			}
 			*write = 0;
+			*length = (size_t)(write - result);
 			while (car == '/')
 				car = *++iter;
 		}
@@ -160,6 +219,7 @@ static char *getkey(char **head, int sflags)
 				car = *++iter;
 			}
 			*write = 0;
+			*length = (size_t)(write - result);
 			while (car == '.')
 				car = *++iter;
 		}
@@ -168,21 +228,203 @@ static char *getkey(char **head, int sflags)
 	return result;
 }
 
-static enum sel sel(struct wrap *w, const char *name, size_t length)
+/* is c a digit of the base 16 or 10? */
+static int isdig(char c, int hex)
 {
-	enum sel result;
-	int i, j, sflags, scmp;
-	char *key, *value;
-	enum comp k;
+	return hex ? isxdigit((unsigned char)c) : isdigit((unsigned char)c);
+}
 
-	/* make a local writeable copy */
-	char buffer[1 + length];
-	char *copy = buffer;
-	memcpy(copy, name, length);
-	copy[length] = 0;
+/* parse the double at the begin of string as strtod in the C locale */
+static double todouble(const char *string, char **end)
+{
+	const char *dp = localeconv()->decimal_point;
+	const char *iter, *exp;
+	size_t len, dot, dplen;
+	int hex, digits;
+
+	/* no translation needed for the C locale */
+	if (dp[0] == '.' && dp[1] == 0)
+		return strtod(string, end);
+
+	/* scan the number as in the C locale */
+	iter = string;
+	while (isspace((unsigned char)*iter))
+		iter++;
+	if (*iter == '+' || *iter == '-')
+		iter++;
+	hex = iter[0] == '0' && (iter[1] == 'x' || iter[1] == 'X');
+	if (hex)
+		iter += 2;
+	for (digits = 0 ; isdig(*iter, hex) ; digits++)
+		iter++;
+	dot = (size_t)(iter - string);
+	if (*iter == '.')
+		for (iter++ ; isdig(*iter, hex) ; digits++)
+			iter++;
+	if (digits == 0)
+		/* not a number, or inf or nan */
+		return strtod(string, end);
+	if (*iter == (hex ? 'p' : 'e') || *iter == (hex ? 'P' : 'E')) {
+		exp = &iter[1];
+		if (*exp == '+' || *exp == '-')
+			exp++;
+		if (isdigit((unsigned char)*exp)) {
+			while (isdigit((unsigned char)*++exp));
+			iter = exp;
+		}
+	}
+	if (end != NULL)
+		*end = (char*)iter;
+
+	/* parse a copy translating the decimal point */
+	len = (size_t)(iter - string);
+	dplen = strlen(dp);
+	char buffer[len + dplen + 1];
+	if (dot == len || string[dot] != '.') {
+		memcpy(buffer, string, len);
+		buffer[len] = 0;
+	}
+	else {
+		memcpy(buffer, string, dot);
+		memcpy(&buffer[dot], dp, dplen);
+		memcpy(&buffer[dot + dplen], &string[dot + 1], len - dot - 1);
+		buffer[len + dplen - 1] = 0;
+	}
+	return strtod(buffer, NULL);
+}
+
+/* see header file */
+void mustach_wrap_parse_lit(struct mustach_wrap_lit *lit, const char *string)
+{
+	char *endi, *endd;
+	int overflow;
+
+	lit->string = string;
+	errno = 0;
+	lit->i = (int64_t)strtoll(string, &endi, 10);
+	overflow = errno == ERANGE;
+	lit->d = todouble(string, &endd);
+	if (!strcmp(string, "true"))
+		lit->type = Mustach_Lit_True;
+	else if (!strcmp(string, "false"))
+		lit->type = Mustach_Lit_False;
+	else if (!strcmp(string, "null"))
+		lit->type = Mustach_Lit_Null;
+	else if (*string && !*endi && !overflow)
+		lit->type = Mustach_Lit_Int;
+	else if (*string && !*endd)
+		lit->type = Mustach_Lit_Double;
+	else
+		lit->type = Mustach_Lit_String;
+}
+
+/* see header file */
+size_t mustach_wrap_format_int(char buffer[MUSTACH_WRAP_FORMAT_SIZE], int64_t value)
+{
+	static const char digits[] =
+		"00010203040506070809"
+		"10111213141516171819"
+		"20212223242526272829"
+		"30313233343536373839"
+		"40414243444546474849"
+		"50515253545556575859"
+		"60616263646566676869"
+		"70717273747576777879"
+		"80818283848586878889"
+		"90919293949596979899";
+	char tmp[24], *iter = &tmp[sizeof tmp];
+	uint64_t u = value < 0 ? -(uint64_t)value : (uint64_t)value;
+	unsigned d;
+	size_t length;
+
+	/* two digits at a time, from the end */
+	while (u >= 100) {
+		d = (unsigned)(u % 100) * 2;
+		u /= 100;
+		*--iter = digits[d + 1];
+		*--iter = digits[d];
+	}
+	if (u >= 10) {
+		d = (unsigned)u * 2;
+		*--iter = digits[d + 1];
+		*--iter = digits[d];
+	}
+	else
+		*--iter = (char)('0' + u);
+	if (value < 0)
+		*--iter = '-';
+	length = (size_t)(&tmp[sizeof tmp] - iter);
+	memcpy(buffer, iter, length);
+	buffer[length] = 0;
+	return length;
+}
+
+/* see header file */
+size_t mustach_wrap_format_double(char buffer[MUSTACH_WRAP_FORMAT_SIZE], double value, int precision)
+{
+	const char *dp = localeconv()->decimal_point;
+	char *point;
+	size_t length, dplen;
+	int n;
+
+	n = snprintf(buffer, MUSTACH_WRAP_FORMAT_SIZE, "%.*g", precision, value);
+	length = n < 0 ? 0 : (size_t)n >= MUSTACH_WRAP_FORMAT_SIZE ? MUSTACH_WRAP_FORMAT_SIZE - 1 : (size_t)n;
+	buffer[length] = 0;
+
+	/* translate the decimal point of the locale */
+	if (dp[0] != '.' || dp[1] != 0) {
+		dplen = strlen(dp);
+		point = dplen ? strstr(buffer, dp) : NULL;
+		if (point != NULL) {
+			*point = '.';
+			memmove(&point[1], &point[dplen], length + 1 - (size_t)(point - buffer) - dplen);
+			length -= dplen - 1;
+		}
+	}
+	return length;
+}
+
+/* kinds of selectors */
+enum kind {
+	K_dot,
+	K_keys
+};
+
+/* a precompiled selector */
+struct selector {
+	/* the value to compare or NULL */
+	const char *value;
+	/* the value to compare, parsed */
+	struct mustach_wrap_lit lit;
+	/* the keys of the path */
+	const char **keys;
+	/* the lengths of the keys */
+	const size_t *lengths;
+	/* count of keys */
+	unsigned nkeys;
+	/* kind of selector */
+	unsigned char kind;
+	/* the comparator */
+	unsigned char comp;
+	/* is the comparison negated? */
+	unsigned char negate;
+	/* is the last key the star of object iteration? */
+	unsigned char star;
+};
+
+/* compile the selector from the writeable null terminated copy
+ * of its name, record the keys in keys and their lengths in lengths
+ * if not NULL, returns the count of keys */
+static unsigned compile(struct selector *s, char *copy, int flags, const char **keys, size_t *lengths)
+{
+	unsigned n;
+	int sflags;
+	size_t length;
+	char *key, *last, *value;
+	enum comp k;
 
 	/* check if matches json pointer selection */
-	sflags = w->flags;
+	sflags = flags;
 	if (sflags & Mustach_With_JsonPointer) {
 		if (copy[0] == '/')
 			copy++;
@@ -197,75 +439,536 @@ static enum sel sel(struct wrap *w, const char *name, size_t length)
 		k = C_no;
 		value = NULL;
 	}
+	s->comp = (unsigned char)k;
+	s->negate = value != NULL && value[0] == '!';
+	s->value = value == NULL ? NULL : &value[s->negate];
+	if (value != NULL)
+		mustach_wrap_parse_lit(&s->lit, s->value);
+	s->keys = keys;
+	s->lengths = lengths;
+	s->star = 0;
 
 	/* case of . alone if Mustach_With_SingleDot? */
+	n = 0;
 	if (copy[0] == '.' && copy[1] == 0 /*&& (sflags & Mustach_With_SingleDot)*/)
-		/* yes, select current */
-		result = w->itf->sel(w->closure, NULL) ? S_ok : S_none;
-	else
-	{
-		/* not the single dot, extract the first key */
-		key = getkey(&copy, sflags);
-		if (key == NULL)
-			return 0;
+		s->kind = K_dot;
+	else {
+		/* not the single dot, extract the keys */
+		s->kind = K_keys;
+		last = NULL;
+		while ((key = getkey(&copy, sflags, &length)) != NULL) {
+			if (keys != NULL)
+				keys[n] = key;
+			if (lengths != NULL)
+				lengths[n] = length;
+			last = key;
+			n++;
+		}
+		s->star = last != NULL
+		       && last[0] == '*'
+		       && !last[1]
+		       && !value
+		       && (flags & Mustach_With_ObjectIter);
+	}
+	s->nkeys = n;
+	return n;
+}
+
+/* evaluate the selector using the inline cache ic if not NULL */
+static enum sel eval(struct wrap *w, const struct selector *s, struct mustach_wrap_ic *ic)
+{
+	enum sel result;
+	unsigned i;
+	int j, scmp;
 
+	if (s->kind == K_dot)
+		/* select current */
+		result = w->itf->sel(w->closure, NULL) ? S_ok : S_none;
+	else if (s->nkeys == 0)
+		return S_none;
+	else if (w->itf->version >= MUSTACH_WRAP_ITF_VERSION_2) {
+		/* same as below but giving the lengths of the keys */
+		if (ic != NULL && w->itf->sel_ic_len != NULL
+			? w->itf->sel_ic_len(w->closure, s->keys[0], s->lengths[0], ic)
+			: w->itf->sel_len(w->closure, s->keys[0], s->lengths[0]))
+			result = S_ok;
+		else if (s->star
+		      && s->nkeys == 1
+		      && w->itf->sel(w->closure, NULL))
+			result = S_ok_or_objiter;
+		else
+			result = S_none;
+		for (i = 1 ; result == S_ok && i < s->nkeys ; i++)
+			if (!w->itf->subsel_len(w->closure, s->keys[i], s->lengths[i]))
+				result = s->star && i + 1 == s->nkeys ? S_objiter : S_none;
+	}
+	else {
 		/* select the root item */
-		if (w->itf->sel(w->closure, key))
+		if (ic != NULL
+			? w->itf->sel_ic(w->closure, s->keys[0], ic)
+			: w->itf->sel(w->closure, s->keys[0]))
 			result = S_ok;
-		else if (key[0] == '*'
-		      && !key[1]
-		      && !value
-		      && !*copy
-		      && (w->flags & Mustach_With_ObjectIter)
+		else if (s->star
+		      && s->nkeys == 1
 		      && w->itf->sel(w->closure, NULL))
 			result = S_ok_or_objiter;
 		else
 			result = S_none;
-		if (result == S_ok) {
-			/* iterate the selection of sub items */
-			key = getkey(&copy, sflags);
-			while(result == S_ok && key) {
-				if (w->itf->subsel(w->closure, key))
-					/* nothing */;
-				else if (key[0] == '*'
-				      && !key[1]
-				      && !value
-				      && !*copy
-				      && (w->flags & Mustach_With_ObjectIter))
-					result = S_objiter;
-				else
-					result = S_none;
-				key = getkey(&copy, sflags);
-			}
-		}
+		/* iterate the selection of sub items */
+		for (i = 1 ; result == S_ok && i < s->nkeys ; i++)
+			if (!w->itf->subsel(w->closure, s->keys[i]))
+				result = s->star && i + 1 == s->nkeys ? S_objiter : S_none;
 	}
 	/* should it be compared? */
-	if (result == S_ok && value) {
-		if (!w->itf->compare)
+	if (result == S_ok && s->value) {
+		if (!w->itf->compare_lit && !w->itf->compare)
 			result = S_none;
 		else {
-			i = value[0] == '!';
-			scmp = w->itf->compare(w->closure, &value[i]);
-			switch (k) {
+			scmp = w->itf->compare_lit
+				? w->itf->compare_lit(w->closure, &s->lit)
+				: w->itf->compare(w->closure, s->value);
+			switch ((enum comp)s->comp) {
 			case C_eq: j = scmp == 0; break;
 			case C_lt: j = scmp < 0; break;
 			case C_le: j = scmp <= 0; break;
 			case C_gt: j = scmp > 0; break;
 			case C_ge: j = scmp >= 0; break;
-			default: j = i; break;
+			default: j = s->negate; break;
 			}
-			if (i == j)
+			if (s->negate == j)
 				result = S_none;
 		}
 	}
 	return result;
 }
 
+/*
+ * The selectors of the tags of a template are precompiled in a table
+ * attached to the template as an extension. The tables depend on the
+ * flags, so there is one extension key per set of significant flags.
+ * The tags are found in the table by the address of their name.
+ */
+
+/* the flags changing the compilation of selectors */
+#define SELFLAGS(flags) ((((flags) >> 3) & 15) | (((flags) >> 4) & 16))
+
+/* the extension keys */
+static const char seltab_keys[32];
+
+/* entry of the table of selectors */
+struct selent {
+	/* the name of the tag in the template */
+	const char *name;
+	/* length of the name */
+	size_t length;
+	/* the precompiled selector */
+	struct selector sel;
+};
+
+/* table of precompiled selectors of a template */
+struct seltab {
+	/* lowest name address */
+	uintptr_t low;
+	/* highest name address */
+	uintptr_t high;
+	/* mask of the hash index */
+	size_t mask;
+	/* the entries */
+	struct selent ents[];
+};
+
+/* names of the tags of a template */
+struct names {
+	/* the names */
+	struct selent *ents;
+	/* count of names */
+	size_t count;
+	/* allocated count */
+	size_t alloc;
+	/* greatest length */
+	size_t maxlen;
+	/* total length */
+	size_t total;
+};
+
+static size_t selhash(const struct seltab *tab, const char *name)
+{
+	size_t h = (size_t)((uintptr_t)name - tab->low) * 0x9E3779B1u;
+	return (h ^ (h >> 15)) & tab->mask;
+}
+
+static const struct selent *selfind(const struct seltab *tab, const char *name, size_t length)
+{
+	const struct selent *ent;
+	size_t i;
+
+	if ((uintptr_t)name < tab->low || (uintptr_t)name > tab->high)
+		return NULL;
+	for (i = selhash(tab, name) ;; i = (i + 1) & tab->mask) {
+		ent = &tab->ents[i];
+		if (ent->name == name)
+			return ent->length == length ? ent : NULL;
+		if (ent->name == NULL)
+			return NULL;
+	}
+}
+
+static int addname(void *closure, const char *name, size_t length)
+{
+	struct names *names = closure;
+	struct selent *ents;
+	size_t count;
+
+	if (names->count == names->alloc) {
+		count = names->alloc ? 2 * names->alloc : 32;
+		ents = realloc(names->ents, count * sizeof *ents);
+		if (ents == NULL)
+			return MUSTACH_ERROR_OUT_OF_MEMORY;
+		names->ents = ents;
+		names->alloc = count;
+	}
+	names->ents[names->count].name = name;
+	names->ents[names->count++].length = length;
+	if (length > names->maxlen)
+		names->maxlen = length;
+	names->total += length + 1;
+	return MUSTACH_OK;
+}
+
+static int walk_repl(void *closure, const char *name, size_t length, int escape)
+{
+	(void)escape;/*make compiler happy #@!%!!*/
+	return addname(closure, name, length);
+}
+
+static int walk_enter(void *closure, int kind, const char *name, size_t length)
+{
+	return kind == Mustach_Walk_Section || kind == Mustach_Walk_Inverted
+		? addname(closure, name, length) : MUSTACH_OK;
+}
+
+static const mustach_walk_itf_t walkitf = {
+	.version = MUSTACH_WALK_ITF_VERSION_1,
+	.repl = walk_repl,
+	.partial = addname,
+	.enter = walk_enter
+};
+
+/* make the table of the selectors of the template for the flags */
+static struct seltab *make_seltab(mustach_template_t *templ, int flags)
+{
+	struct names names = { NULL, 0, 0, 0, 0 };
+	struct seltab *tab = NULL;
+	struct selent *ent;
+	struct selector s;
+	const char **keys;
+	size_t *lengths;
+	size_t i, size, nkeys;
+	unsigned n;
+	char *copy;
+
+	/* get the names */
+	if (mustach_walk_template(templ, &walkitf, &names) != MUSTACH_OK)
+		goto end;
+
+	/* count the keys */
+	copy = malloc(names.maxlen + 1);
+	if (copy == NULL)
+		goto end;
+	for (nkeys = i = 0 ; i < names.count ; i++) {
+		ent = &names.ents[i];
+		memcpy(copy, ent->name, ent->length);
+		copy[ent->length] = 0;
+		nkeys += compile(&s, copy, flags, NULL, NULL);
+	}
+	free(copy);
+
+	/* allocate the table with its keys, their lengths and their strings */
+	for (size = 1 ; size < 2 * names.count ; size <<= 1);
+	tab = malloc(sizeof *tab + size * sizeof *tab->ents
+			+ nkeys * (sizeof *keys + sizeof *lengths) + names.total);
+	if (tab == NULL)
+		goto end;
+	tab->low = UINTPTR_MAX;
+	tab->high = 0;
+	tab->mask = size - 1;
+	for (i = 0 ; i < size ; i++)
+		tab->ents[i].name = NULL;
+	for (i = 0 ; i < names.count ; i++) {
+		if ((uintptr_t)names.ents[i].name < tab->low)
+			tab->low = (uintptr_t)names.ents[i].name;
+		if ((uintptr_t)names.ents[i].name > tab->high)
+			tab->high = (uintptr_t)names.ents[i].name;
+	}
+
+	/* compile the selectors */
+	lengths = (size_t*)&tab->ents[size];
+	keys = (const char**)&lengths[nkeys];
+	copy = (char*)&keys[nkeys];
+	for (i = 0 ; i < names.count ; i++) {
+		ent = &tab->ents[selhash(tab, names.ents[i].name)];
+		while (ent->name != NULL && ent->name != names.ents[i].name)
+			ent = &tab->ents[(size_t)(ent - tab->ents + 1) & tab->mask];
+		if (ent->name == NULL) {
+			*ent = names.ents[i];
+			memcpy(copy, ent->name, ent->length);
+			copy[ent->length] = 0;
+			n = compile(&ent->sel, copy, flags, keys, lengths);
+			keys += n;
+			lengths += n;
+			copy += ent->length + 1;
+		}
+	}
+end:
+	free(names.ents);
+	return tab;
+}
+
+/* get the table of the selectors of the template, making it if needed */
+static struct seltab *get_seltab(struct wrap *w, mustach_template_t *templ)
+{
+	const void *key = &seltab_keys[SELFLAGS(w->flags)];
+	struct seltab *tab, *rtab;
+
+	tab = mustach_get_template_ext(templ, key);
+	if (tab == NULL) {
+		tab = make_seltab(templ, w->flags);
+		if (tab != NULL) {
+			rtab = mustach_set_template_ext(templ, key, tab, free);
+			if (rtab != tab) {
+				free(tab);
+				tab = rtab;
+			}
+		}
+	}
+	return tab;
+}
+
+/* inline cache of a selector for a rendering */
+struct icent {
+	/* the cache given to the backend */
+	struct mustach_wrap_ic ic;
+	/* the item whose value is hoisted or NULL */
+	void *item;
+	/* the hoisted value */
+	char *value;
+	/* length of the hoisted value */
+	size_t length;
+};
+
+/* inline caches of the selectors of a table for a rendering */
+struct icset {
+	/* next set */
+	struct icset *next;
+	/* next set of the same hash of name */
+	struct icset *hnext;
+	/* the template of the table, referenced while the set exists
+	 * so that the address of its table isn't reused */
+	mustach_template_t *templ;
+	/* the table of selectors or NULL when cleared */
+	const struct seltab *tab;
+	/* length of the name of the partial */
+	size_t length;
+	/* count of the applied templates using the set */
+	unsigned inuse;
+	/* count of caches */
+	size_t count;
+	/* the caches, one per entry of the table */
+	struct icent *ics;
+	/* name of the partial, empty for the main template */
+	char name[];
+};
+
+/* does the interface use inline caches? */
+static int hasic(const struct mustach_wrap_itf *itf)
+{
+	return itf->version >= MUSTACH_WRAP_ITF_VERSION_2 ? itf->sel_ic_len != NULL : itf->sel_ic != NULL;
+}
+
+/* release the values and the template of the set */
+static void clear_ics(struct icset *set)
+{
+	size_t i;
+
+	if (set->tab != NULL) {
+		for (i = 0 ; i < set->count ; i++)
+			free(set->ics[i].value);
+		mustach_unref_template(set->templ, NULL, NULL);
+		set->templ = NULL;
+		set->tab = NULL;
+	}
+}
+
+/* index of the list of sets of the name */
+static unsigned icname(const char *name, size_t length)
+{
+	uint32_t h = 2166136261u;
+	while (length)
+		h = (h ^ (unsigned char)name[--length]) * 16777619u;
+	return (unsigned)(h ^ (h >> 16)) & (ICNAMES - 1);
+}
+
+/*
+ * Get the inline caches of the table of the template, creating them
+ * if needed. Partials are often got again for each use, in loops, as
+ * templates having new tables. The caches of a partial of the same
+ * name that are no more in use are then reused, so that their count
+ * doesn't grow with the count of uses. The sets of partials are found
+ * by their names, in lists indexed by a hash of the names.
+ */
+static struct icset *get_ics(struct wrap *w, const struct seltab *tab, mustach_template_t *templ, const char *name, size_t length)
+{
+	struct icset *set = NULL, *iter, **head = NULL;
+	struct icent *ics;
+	size_t count = tab->mask + 1;
+
+	if (name != NULL) {
+		/* search the set of the table or an unused set of the same name */
+		head = &w->icnames[icname(name, length)];
+		for (iter = *head ; iter != NULL ; iter = iter->hnext)
+			if (iter->length == length && !memcmp(iter->name, name, length)) {
+				if (iter->tab == tab) {
+					iter->inuse++;
+					return iter;
+				}
+				if (set == NULL && iter->inuse == 0)
+					set = iter;
+			}
+	}
+	if (set != NULL)
+		/* reuse the set of the same partial */
+		clear_ics(set);
+	else {
+		set = calloc(1, sizeof *set + length);
+		if (set == NULL)
+			return NULL;
+		if (head != NULL) {
+			memcpy(set->name, name, length);
+			set->length = length;
+			set->hnext = *head;
+			*head = set;
+		}
+		set->next = w->icsets;
+		w->icsets = set;
+	}
+	if (set->count != count) {
+		ics = realloc(set->ics, count * sizeof *ics);
+		if (ics == NULL)
+			return NULL;
+		set->ics = ics;
+		set->count = count;
+	}
+	memset(set->ics, 0, count * sizeof *set->ics);
+	set->templ = mustach_ref_template(templ);
+	set->tab = tab;
+	set->inuse = 1;
+	return set;
+}
+
+static void free_ics(struct wrap *w)
+{
+	struct icset *set;
+
+	while ((set = w->icsets) != NULL) {
+		w->icsets = set->next;
+		clear_ics(set);
+		free(set->ics);
+		free(set);
+	}
+}
+
+/* record the template as entered, tracking its selectors if it is worth
+ * precompiling them, templates used once aren't worth it, the name
+ * being the name of the partial or NULL for the main template */
+static void push_seltab(struct wrap *w, mustach_template_t *templ, int worth, const char *name, size_t length)
+{
+	struct seltab *tab;
+
+	if (w->seldepth < SELDEPTH) {
+		tab = w->precompile && worth ? get_seltab(w, templ) : NULL;
+		w->seltabs[w->seldepth] = tab;
+		w->sets[w->seldepth] = tab != NULL && hasic(w->itf) ? get_ics(w, tab, templ, name, length) : NULL;
+	}
+	w->seldepth++;
+}
+
+static void pop_seltab(struct wrap *w)
+{
+	w->seldepth--;
+	if (w->seldepth < SELDEPTH && w->sets[w->seldepth] != NULL)
+		w->sets[w->seldepth]->inuse--;
+}
+
+/* search the precompiled selector of the tag, innermost template first,
+ * set ice to its inline cache or to NULL */
+static const struct selent *selsearch(struct wrap *w, const char *name, size_t length, struct icent **ice)
+{
+	const struct selent *ent;
+	unsigned i;
+
+	for (i = w->seldepth < SELDEPTH ? w->seldepth : SELDEPTH ; i ; ) {
+		if (w->seltabs[--i] != NULL) {
+			ent = selfind(w->seltabs[i], name, length);
+			if (ent != NULL) {
+				*ice = w->sets[i] == NULL ? NULL
+					: &w->sets[i]->ics[ent - w->seltabs[i]->ents];
+				return ent;
+			}
+		}
+	}
+	*ice = NULL;
+	return NULL;
+}
+
+/* is the name a single key without escaping, comparison nor star? */
+static int isplain(const char *name, size_t length)
+{
+	size_t i;
+
+	if (length == 0)
+		return 0;
+	for (i = 0 ; i < length ; i++)
+		switch (name[i]) {
+		case '.': case '\\': case '/': case '~': case '*':
+		case '=': case '!': case '<': case '>':
+			return 0;
+		}
+	return 1;
+}
+
+static enum sel sel(struct wrap *w, const char *name, size_t length)
+{
+	const struct selent *ent;
+	struct icent *ice;
+	struct selector local;
+
+	/* search the precompiled selector */
+	ent = selsearch(w, name, length, &ice);
+	if (ent != NULL)
+		return eval(w, &ent->sel, ice == NULL ? NULL : &ice->ic);
+
+	/* not found, a plain name is selected as is when possible */
+	if (w->itf->version >= MUSTACH_WRAP_ITF_VERSION_2 && isplain(name, length))
+		return w->itf->sel_len(w->closure, name, length) ? S_ok : S_none;
+
+	/* otherwise compile it in a local writeable copy */
+	char buffer[1 + length];
+	const char *keys[1 + (length + 1) / 2];
+	size_t lengths[1 + (length + 1) / 2];
+	memcpy(buffer, name, length);
+	buffer[length] = 0;
+	compile(&local, buffer, w->flags, keys, lengths);
+	return eval(w, &local, NULL);
+}
+
 static int enter_cb(void *closure, const char *name, size_t length)
 {
 	struct wrap *w = closure;
 	enum sel s = sel(w, name, length);
-	return s == S_none ? 0 : w->itf->enter(w->closure, s & S_objiter);
+	int rc = s == S_none ? 0 : w->itf->enter(w->closure, s & S_objiter);
+	if (rc > 0)
+		w->depth++;
+	return rc;
 }
 
 static int next_cb(void *closure)
@@ -277,12 +980,71 @@ static int next_cb(void *closure)
 static int leave_cb(void *closure)
 {
 	struct wrap *w = closure;
+	w->depth--;
 	return w->itf->leave(w->closure);
 }
 
+/*
+ * Get the value of the selector using its inline cache, reusing the
+ * value computed for the same found item. As the items don't change
+ * during the rendering, the value of tags not depending on the item of
+ * the loop is computed once and not at each iteration. Only the items
+ * found in a context outside of the innermost section are kept, the
+ * items of the innermost section change at each iteration and may be
+ * given by the backend at the same address.
+ */
+static int gethoisted(struct wrap *w, const struct selector *s, struct icent *ice, struct mustach_sbuf *sbuf)
+{
+	size_t length;
+	char *value;
+	int rc;
+
+	if (!(eval(w, s, &ice->ic) & S_ok))
+		return 0;
+
+	/* not invariant in the innermost section */
+	if (ice->ic.item == NULL || ice->ic.depth >= w->depth)
+		return w->itf->get(w->closure, sbuf, 0);
+
+	/* reuse the value if the item is the same */
+	if (ice->item != NULL && ice->item == ice->ic.item) {
+		sbuf->value = ice->value;
+		sbuf->length = ice->length;
+		return 1;
+	}
+
+	/* get the value and keep a copy of it */
+	rc = w->itf->get(w->closure, sbuf, 0);
+	if (rc > 0) {
+		length = mustach_sbuf_length(sbuf);
+		value = realloc(ice->value, length + 1);
+		if (value != NULL) {
+			memcpy(value, sbuf->value, length);
+			value[length] = 0;
+			mustach_sbuf_release(sbuf);
+			ice->item = ice->ic.item;
+			ice->value = value;
+			ice->length = length;
+			sbuf->value = value;
+			sbuf->length = length;
+			sbuf->freecb = NULL;
+		}
+	}
+	return rc;
+}
+
 static int getoptional(struct wrap *w, const char *name, size_t length, struct mustach_sbuf *sbuf)
 {
-	enum sel s = sel(w, name, length);
+	const struct selent *ent;
+	struct icent *ice;
+	enum sel s;
+
+	if (w->flags & Mustach_With_LoopInvariant) {
+		ent = selsearch(w, name, length, &ice);
+		if (ice != NULL && ent->sel.kind == K_keys && !ent->sel.star)
+			return gethoisted(w, &ent->sel, ice, sbuf);
+	}
+	s = sel(w, name, length);
 	if (!(s & S_ok))
 		return 0;
 	return w->itf->get(w->closure, sbuf, s & S_objiter);
@@ -300,14 +1062,13 @@ static int get_cb(void *closure, const char *name, size_t length, struct mustach
 }
 
 #if MUSTACH_LOAD_TEMPLATE
-static int get_partial_from_file(const char *name, size_t length, struct mustach_sbuf *sbuf)
+static int get_partial_from_file(const char *name, size_t length, struct mustach_sbuf *sbuf, char path[PATH_MAX])
 {
 	static char extension[] = INCLUDE_PARTIAL_EXTENSION;
-	char path[PATH_MAX];
 	int rc;
 
 	/* try without extension first */
-	if (length + sizeof extension > sizeof path)
+	if (length + sizeof extension > PATH_MAX)
 		return MUSTACH_ERROR_TOO_BIG;
 	memcpy(path, name, length);
 	path[length] = 0;
@@ -327,8 +1088,8 @@ static int get_partial_buf(
 		struct mustach_sbuf *sbuf
 ) {
 	int rc;
+	char path[PATH_MAX];
 	if (mustach_wrap_get_partial != NULL) {
-		char path[PATH_MAX];
 		if (length + 1 > sizeof path)
 			return MUSTACH_ERROR_TOO_BIG;
 		memcpy(path, name, length);
@@ -345,11 +1106,11 @@ static int get_partial_buf(
 		if (getoptional(w, name, length, sbuf) > 0)
 			rc = MUSTACH_OK;
 		else
-			rc = get_partial_from_file(name, length, sbuf);
+			rc = get_partial_from_file(name, length, sbuf, path);
 	}
 	else {
-		rc = get_partial_from_file(name, length, sbuf);
-		if (rc != MUSTACH_OK &&  getoptional(w, name, 0, sbuf) > 0)
+		rc = get_partial_from_file(name, length, sbuf, path);
+		if (rc != MUSTACH_OK &&  getoptional(w, name, length, sbuf) > 0)
 			rc = MUSTACH_OK;
 	}
 #else
@@ -360,6 +1121,155 @@ static int get_partial_buf(
 	return MUSTACH_OK;
 }
 
+/* build the partial from sbuf and record it in the cache if key isn't NULL */
+static int make_partial(
+		struct wrap *w,
+		mustach_template_t **partial,
+		struct mustach_sbuf *sbuf,
+		const char *key,
+		size_t keylen,
+		const char *path
+) {
+	int rc = mustach_make_template(partial, 0, sbuf, NULL);
+	if (rc == MUSTACH_OK && key != NULL) {
+		rc = mustach_cache_add(mustach_wrap_partial_cache, key, keylen, *partial, path);
+		if (rc != MUSTACH_OK) {
+			mustach_unref_template(*partial, NULL, NULL);
+			*partial = NULL;
+		}
+		else
+			w->shared = 1;
+	}
+	return rc;
+}
+
+#if MUSTACH_LOAD_TEMPLATE
+/* get the partial of the file, using the cache */
+static int get_cached_partial_from_file(
+		struct wrap *w,
+		const char *name,
+		size_t length,
+		char *key,
+		mustach_template_t **partial
+) {
+	struct mustach_sbuf sbuf = MUSTACH_SBUF_INIT;
+	char path[PATH_MAX];
+	int rc;
+
+	key[0] = KEY_FILE;
+	rc = mustach_cache_get(mustach_wrap_partial_cache, key, 1 + length, partial);
+	if (rc == MUSTACH_OK)
+		w->shared = 1;
+	else {
+		rc = get_partial_from_file(name, length, &sbuf, path);
+		if (rc == MUSTACH_OK)
+			rc = make_partial(w, partial, &sbuf, key, 1 + length, path);
+	}
+	return rc;
+}
+#endif
+
+/* get the partial using the cache, following the same rules than get_partial_buf */
+static int get_cached_partial(
+		struct wrap *w,
+		const char *name,
+		size_t length,
+		mustach_template_t **partial
+) {
+	struct mustach_sbuf sbuf = MUSTACH_SBUF_INIT;
+	char key[1 + length];
+	int rc;
+
+	memcpy(&key[1], name, length);
+	if (mustach_wrap_get_partial != NULL) {
+		char path[PATH_MAX];
+		key[0] = KEY_HOOK;
+		rc = mustach_cache_get(mustach_wrap_partial_cache, key, 1 + length, partial);
+		if (rc == MUSTACH_OK) {
+			w->shared = 1;
+			return rc;
+		}
+		if (length + 1 > sizeof path)
+			return MUSTACH_ERROR_TOO_BIG;
+		memcpy(path, name, length);
+		path[length] = 0;
+		rc = mustach_wrap_get_partial(path, &sbuf);
+		if (rc == MUSTACH_OK)
+			return make_partial(w, partial, &sbuf, key, 1 + length, NULL);
+		if (rc != MUSTACH_ERROR_NOT_FOUND)
+			return rc;
+	}
+#if MUSTACH_LOAD_TEMPLATE
+	if (w->flags & Mustach_With_PartialDataFirst) {
+		if (getoptional(w, name, length, &sbuf) > 0)
+			return make_partial(w, partial, &sbuf, NULL, 0, NULL);
+		rc = get_cached_partial_from_file(w, name, length, key, partial);
+	}
+	else {
+		rc = get_cached_partial_from_file(w, name, length, key, partial);
+		if (rc != MUSTACH_OK &&  getoptional(w, name, length, &sbuf) > 0)
+			return make_partial(w, partial, &sbuf, NULL, 0, NULL);
+	}
+	if (rc == MUSTACH_OK)
+		return rc;
+#else
+	if (getoptional(w, name, length, &sbuf) > 0)
+		return make_partial(w, partial, &sbuf, NULL, 0, NULL);
+#endif
+	sbuf.value = "";
+	return make_partial(w, partial, &sbuf, NULL, 0, NULL);
+}
+
+/* get the partial from the registry, or before, from data if required */
+static int get_registered_partial(
+		struct wrap *w,
+		const char *name,
+		size_t length,
+		mustach_template_t **partial
+) {
+	struct mustach_sbuf sbuf = MUSTACH_SBUF_INIT;
+	int rc;
+
+	if ((w->flags & Mustach_With_PartialDataFirst) != 0
+	 && getoptional(w, name, length, &sbuf) > 0)
+		return mustach_make_template(partial, 0, &sbuf, NULL);
+	rc = mustach_registry_partial_get(mustach_wrap_partial_registry, name, length, partial);
+	if (rc == MUSTACH_OK)
+		w->shared = 1;
+	return rc;
+}
+
+/* get the partial from the resolver of the rendering, recording its origin */
+static int get_resolved_partial(
+		struct wrap *w,
+		const char *name,
+		size_t length,
+		mustach_template_t **partial
+) {
+	struct mustach_sbuf sbuf = MUSTACH_SBUF_INIT;
+	uint64_t bit;
+	int rc;
+
+	if ((w->flags & Mustach_With_PartialDataFirst) != 0
+	 && getoptional(w, name, length, &sbuf) > 0)
+		return mustach_make_template(partial, 0, &sbuf, NULL);
+	rc = w->resolver->get(w->resolver->closure, name, length, partial);
+	if (rc == MUSTACH_OK) {
+		if (w->seldepth >= 64) {
+			/* can't record the origin */
+			if (w->resolver->put != NULL)
+				w->resolver->put(w->resolver->closure, *partial);
+			else
+				mustach_unref_template(*partial, NULL, NULL);
+			return MUSTACH_ERROR_TOO_MUCH_NESTING;
+		}
+		bit = (uint64_t)1 << w->seldepth;
+		w->resolved |= bit;
+		w->shared = 1;
+	}
+	return rc;
+}
+
 static int start_cb(void *closure)
 {
 	struct wrap *w = closure;
@@ -399,20 +1309,48 @@ static int partial_get_cb(
 ) {
 	struct wrap *w = closure;
 	struct mustach_sbuf sbuf = MUSTACH_SBUF_INIT;
-	int rc = get_partial_buf(w, name, length, &sbuf);
+	int rc = MUSTACH_ERROR_NOT_FOUND;
+	w->shared = 0;
+	if (w->seldepth < 64)
+		w->resolved &= ~((uint64_t)1 << w->seldepth);
+	if (w->resolver != NULL)
+		rc = get_resolved_partial(w, name, length, partial);
+	if (rc == MUSTACH_ERROR_NOT_FOUND && mustach_wrap_partial_registry != NULL)
+		rc = get_registered_partial(w, name, length, partial);
+	if (rc != MUSTACH_ERROR_NOT_FOUND)
+		/* nothing */;
+	else if (mustach_wrap_partial_cache != NULL)
+		rc = get_cached_partial(w, name, length, partial);
+	else {
+		rc = get_partial_buf(w, name, length, &sbuf);
+		if (rc == MUSTACH_OK)
+			rc = mustach_make_template(partial, 0, &sbuf, NULL);
+	}
 	if (rc == MUSTACH_OK)
-		rc = mustach_make_template(partial, 0, &sbuf, NULL);
+		push_seltab(w, *partial, w->shared, name, length);
 	return rc;
 }
 
 static void partial_put_cb(void *closure, mustach_template_t *partial)
+{
+	struct wrap *w = closure;
+	pop_seltab(w);
+	if (w->seldepth < 64
+	 && (w->resolved & ((uint64_t)1 << w->seldepth)) != 0
+	 && w->resolver->put != NULL)
+		w->resolver->put(w->resolver->closure, partial);
+	else
+		mustach_unref_template(partial, NULL, NULL);
+}
+
+static int escape_cb(void *closure, const char *buffer, size_t size, mustach_write_cb_t *write, void *wrclosure)
 {
 	(void)closure;/*make compiler happy #@!%!!*/
-	mustach_destroy_template(partial, NULL, NULL);
+	return mustach_escape(buffer, size, write, wrclosure);
 }
 
 static const struct mustach_apply_itf itfw = {
-	.version = MUSTACH_APPLY_ITF_VERSION_1,
+	.version = MUSTACH_APPLY_ITF_VERSION_2,
 	.error = NULL,
 	.start = start_cb,
 	.stop = stop_cb,
@@ -423,9 +1361,82 @@ static const struct mustach_apply_itf itfw = {
 	.next = next_cb,
 	.leave = leave_cb,
 	.partial_get = partial_get_cb,
-	.partial_put = partial_put_cb
+	.partial_put = partial_put_cb,
+	.escape = escape_cb
 };
 
+/* set the interface, the fields after 'get' being read only if
+ * the flags tell the interface is extended */
+static void set_itf(struct wrap *w, const struct mustach_wrap_itf *itf, int flags)
+{
+	if (flags & Mustach_With_ExtendedItf)
+		w->itf = itf;
+	else {
+		memset(&w->itfbase, 0, sizeof w->itfbase);
+		memcpy(&w->itfbase, itf, offsetof(struct mustach_wrap_itf, compare_lit));
+		w->itf = &w->itfbase;
+	}
+}
+
+/* init the wrap data of the application of the template */
+static void wrap_init(
+		struct wrap *w,
+		mustach_template_t *templ,
+		const struct mustach_wrap_itf *itf,
+		void *closure,
+		int flags,
+		const mustach_partial_resolver_t *resolver,
+		mustach_write_cb_t *writecb,
+		mustach_emit_cb_t *emitcb,
+		void *wrclosure,
+		int precompile
+) {
+	if (flags & Mustach_With_Compare)
+		flags |= Mustach_With_Equal;
+	w->templ = templ;
+	set_itf(w, itf, flags);
+	w->closure = closure;
+	w->flags = flags;
+	w->emitcb = emitcb;
+	w->writecb = writecb;
+	w->wrclosure = wrclosure;
+	w->precompile = 1;
+	w->seldepth = 0;
+	w->depth = 0;
+	w->icsets = NULL;
+	memset(w->icnames, 0, sizeof w->icnames);
+	w->resolver = resolver;
+	w->resolved = 0;
+	push_seltab(w, templ, precompile, NULL, 0);
+}
+
+/* the flags of application of the wrap */
+static int wrap_apply_flags(struct wrap *w)
+{
+	return (w->flags & Mustach_With_PartialDataFirst) == 0 ? Mustach_Apply_GlobalPartialFirst : 0;
+}
+
+/* apply the template, precompiling its selectors if required */
+static int wrap_apply(
+		mustach_template_t *templ,
+		const struct mustach_wrap_itf *itf,
+		void *closure,
+		int flags,
+		const mustach_partial_resolver_t *resolver,
+		mustach_write_cb_t *writecb,
+		mustach_emit_cb_t *emitcb,
+		void *wrclosure,
+		int precompile
+) {
+	int rc;
+	struct wrap wrap;
+
+	wrap_init(&wrap, templ, itf, closure, flags, resolver, writecb, emitcb, wrclosure, precompile);
+	rc = mustach_apply_template(wrap.templ, wrap_apply_flags(&wrap), &itfw, &wrap);
+	free_ics(&wrap);
+	return rc;
+}
+
 int mustach_wrap_apply(
 		mustach_template_t *templstr,
 		const struct mustach_wrap_itf *itf,
@@ -435,25 +1446,286 @@ int mustach_wrap_apply(
 		mustach_emit_cb_t *emitcb,
 		void *wrclosure
 ) {
-	int afl;
+	return wrap_apply(templstr, itf, closure, flags, NULL, writecb, emitcb, wrclosure, 1);
+}
+
+int mustach_wrap_apply_with(
+		mustach_template_t *templstr,
+		const struct mustach_wrap_itf *itf,
+		void *closure,
+		int flags,
+		const mustach_partial_resolver_t *resolver,
+		mustach_write_cb_t *writecb,
+		mustach_emit_cb_t *emitcb,
+		void *wrclosure
+) {
+	return wrap_apply(templstr, itf, closure, flags, resolver, writecb, emitcb, wrclosure, 1);
+}
+
+/* a pulled rendering */
+struct mustach_wrap_apply {
+	/* the pulled application of the template */
+	mustach_apply_t *apply;
+	/* the function releasing the closure or NULL */
+	void (*release)(void *closure);
+	/* the wrap data */
 	struct wrap wrap;
+};
+
+/* see header file */
+int mustach_wrap_apply_begin(
+		mustach_wrap_apply_t **apply,
+		mustach_template_t *templ,
+		const struct mustach_wrap_itf *itf,
+		void *closure,
+		int flags,
+		const mustach_partial_resolver_t *resolver,
+		void (*release)(void *closure)
+) {
+	mustach_wrap_apply_t *wa;
+	int rc;
+
+	*apply = NULL;
+	wa = malloc(sizeof *wa);
+	if (wa == NULL)
+		rc = MUSTACH_ERROR_OUT_OF_MEMORY;
+	else {
+		wa->release = release;
+		wrap_init(&wa->wrap, templ, itf, closure, flags, resolver, NULL, NULL, NULL, 1);
+		rc = mustach_apply_begin(&wa->apply, wa->wrap.templ, wrap_apply_flags(&wa->wrap), &itfw, &wa->wrap);
+		if (rc == MUSTACH_OK) {
+			*apply = wa;
+			return MUSTACH_OK;
+		}
+		free_ics(&wa->wrap);
+		free(wa);
+	}
+	if (release != NULL)
+		release(closure);
+	return rc;
+}
+
+/* see header file */
+int mustach_wrap_apply_step(
+		mustach_wrap_apply_t *apply,
+		char *buffer,
+		size_t size,
+		size_t *written
+) {
+	return mustach_apply_step(apply->apply, buffer, size, written);
+}
+
+/* see header file */
+void mustach_wrap_apply_end(
+		mustach_wrap_apply_t *apply
+) {
+	if (apply != NULL) {
+		mustach_apply_end(apply->apply);
+		free_ics(&apply->wrap);
+		if (apply->release != NULL)
+			apply->release(apply->wrap.closure);
+		free(apply);
+	}
+}
+
+/**************************************************************************/
+/* static analysis of the data paths                                      */
+/**************************************************************************/
+
+/* state of the walk of the data paths */
+struct pathwalk {
+	/* a wrap without data for getting the partials */
+	struct wrap wrap;
+	/* the function receiving the paths */
+	mustach_wrap_path_cb_t *pathcb;
+	/* its closure */
+	void *closure;
+	/* path of the innermost section */
+	struct mustach_wrap_path *top;
+	/* count of nested partials */
+	unsigned nesting;
+	/* names of the nested partials */
+	struct { const char *name; size_t length; } partials[MUSTACH_MAX_NESTING];
+};
+
+static int nodata_sel(void *closure, const char *name)
+{
+	(void)closure;/*make compiler happy #@!%!!*/
+	(void)name;/*make compiler happy #@!%!!*/
+	return 0;
+}
+
+static int nodata_get(void *closure, struct mustach_sbuf *sbuf, int key)
+{
+	(void)closure;/*make compiler happy #@!%!!*/
+	(void)sbuf;/*make compiler happy #@!%!!*/
+	(void)key;/*make compiler happy #@!%!!*/
+	return 0;
+}
+
+/* interface of a data without any item */
+static const struct mustach_wrap_itf nodata_itf = {
+	.sel = nodata_sel,
+	.subsel = nodata_sel,
+	.get = nodata_get
+};
+
+/* make the path of the tag, its keys and its strings in one allocation */
+static struct mustach_wrap_path *mkpath(struct pathwalk *pw, const char *name, size_t length, int usage)
+{
+	struct mustach_wrap_path *path;
+	struct selector s;
+	size_t nkeys = 1 + (length + 1) / 2;
+	const char **keys;
+	char *copy;
+
+	path = malloc(sizeof *path + (nkeys + 1) * sizeof *keys + length + 1);
+	if (path != NULL) {
+		keys = (const char**)&path[1];
+		copy = (char*)&keys[nkeys + 1];
+		memcpy(copy, name, length);
+		copy[length] = 0;
+		compile(&s, copy, pw->wrap.flags, keys, NULL);
+		keys[s.nkeys] = NULL;
+		path->parent = pw->top;
+		path->usage = s.value == NULL ? usage : usage | Mustach_Path_Compare;
+		path->name = name;
+		path->length = length;
+		path->keys = keys;
+		path->nkeys = s.nkeys;
+		path->value = s.value;
+	}
+	return path;
+}
+
+/* report the path of the tag, making it the innermost section if push */
+static int report(struct pathwalk *pw, const char *name, size_t length, int usage, int push)
+{
+	struct mustach_wrap_path *path;
+	int rc;
+
+	path = mkpath(pw, name, length, usage);
+	if (path == NULL)
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+	rc = pw->pathcb(pw->closure, path);
+	if (push)
+		pw->top = path;
+	else
+		free(path);
+	return rc;
+}
+
+static void pop_path(struct pathwalk *pw)
+{
+	struct mustach_wrap_path *path = pw->top;
+	pw->top = (struct mustach_wrap_path*)path->parent;
+	free(path);
+}
+
+static const mustach_walk_itf_t pathitf;
+
+/* walk the partial of name if found and not already walked */
+static int walk_partial(struct pathwalk *pw, const char *name, size_t length)
+{
+	mustach_template_t *partial;
+	unsigned i;
+	int rc;
+
+	/* avoid endless recursion */
+	for (i = 0 ; i < pw->nesting ; i++)
+		if (pw->partials[i].length == length
+		 && !memcmp(pw->partials[i].name, name, length))
+			return MUSTACH_OK;
+	if (pw->nesting >= MUSTACH_MAX_NESTING)
+		return MUSTACH_ERROR_TOO_MUCH_NESTING;
+
+	rc = partial_get_cb(&pw->wrap, name, length, &partial);
+	if (rc == MUSTACH_ERROR_NOT_FOUND)
+		return MUSTACH_OK;
+	if (rc == MUSTACH_OK) {
+		pw->partials[pw->nesting].name = name;
+		pw->partials[pw->nesting++].length = length;
+		rc = mustach_walk_template(partial, &pathitf, pw);
+		pw->nesting--;
+		partial_put_cb(&pw->wrap, partial);
+	}
+	return rc;
+}
+
+static int path_repl(void *closure, const char *name, size_t length, int escape)
+{
+	(void)escape;/*make compiler happy #@!%!!*/
+	return report(closure, name, length, Mustach_Path_Value, 0);
+}
+
+static int path_partial(void *closure, const char *name, size_t length)
+{
+	int rc = report(closure, name, length, Mustach_Path_Partial, 0);
+	return rc != MUSTACH_OK ? rc : walk_partial(closure, name, length);
+}
+
+static int path_enter(void *closure, int kind, const char *name, size_t length)
+{
+	switch (kind) {
+	case Mustach_Walk_Section:
+		return report(closure, name, length, Mustach_Path_Section, 1);
+	case Mustach_Walk_Inverted:
+		return report(closure, name, length, Mustach_Path_Inverted, 1);
+	case Mustach_Walk_Parent:
+		return path_partial(closure, name, length);
+	default:
+		return MUSTACH_OK;
+	}
+}
+
+static int path_leave(void *closure, int kind)
+{
+	if (kind == Mustach_Walk_Section || kind == Mustach_Walk_Inverted)
+		pop_path(closure);
+	return MUSTACH_OK;
+}
+
+static const mustach_walk_itf_t pathitf = {
+	.version = MUSTACH_WALK_ITF_VERSION_1,
+	.repl = path_repl,
+	.partial = path_partial,
+	.enter = path_enter,
+	.leave = path_leave
+};
+
+/* see header file */
+int mustach_wrap_template_paths(
+		mustach_template_t *templ,
+		int flags,
+		mustach_wrap_path_cb_t *pathcb,
+		void *closure
+) {
+	struct pathwalk pw;
+	int rc;
 
-	/* init the wrap data */
 	if (flags & Mustach_With_Compare)
 		flags |= Mustach_With_Equal;
-	wrap.templ = templstr;
-	wrap.itf = itf;
-	wrap.closure = closure;
-	wrap.flags = flags;
-	wrap.emitcb = emitcb;
-	wrap.writecb = writecb;
-	wrap.wrclosure = wrclosure;
-
-	/* apply the template */
-	afl = 0;
-	if ((flags & Mustach_With_PartialDataFirst) == 0)
-		afl |= Mustach_Apply_GlobalPartialFirst;
-	return mustach_apply_template(wrap.templ, afl, &itfw, &wrap);
+	pw.wrap.templ = templ;
+	pw.wrap.itf = &nodata_itf;
+	pw.wrap.closure = NULL;
+	pw.wrap.flags = flags;
+	pw.wrap.precompile = 0;
+	pw.wrap.seldepth = 0;
+	pw.wrap.depth = 0;
+	pw.wrap.icsets = NULL;
+	pw.wrap.resolver = NULL;
+	pw.wrap.resolved = 0;
+	pw.pathcb = pathcb;
+	pw.closure = closure;
+	pw.top = NULL;
+	pw.nesting = 0;
+
+	rc = mustach_walk_template(templ, &pathitf, &pw);
+
+	/* release the sections left on error */
+	while (pw.top != NULL)
+		pop_path(&pw);
+	return rc;
 }
 
 /**************************************************************************/
@@ -463,22 +1735,72 @@ int mustach_wrap_apply(
 /**************************************************************************/
 #if MUSTACH_USED == USING_MUSTACH_V2
 
+static int get_build_flags(int flags)
+{
+	int flags2 = 0;
+	if ((flags & Mustach_With_Colon) != 0)
+		flags2 |= Mustach_Build_With_Colon;
+	if ((flags & Mustach_With_EmptyTag) != 0)
+		flags2 |= Mustach_Build_With_EmptyTag;
+	return flags2;
+}
+
 static int get_template(mustach_template_t **templ, int flags, const char *templstr, size_t length)
 {
-	int flags2;
 	mustach_sbuf_t sbuf;
 
 	sbuf.value = templstr;
 	sbuf.length = length;
 	sbuf.freecb = NULL;
 
-	flags2 = 0;
-	if ((flags & Mustach_With_Colon) != 0)
-		flags2 |= Mustach_Build_With_Colon;
-	if ((flags & Mustach_With_EmptyTag) != 0)
-		flags2 |= Mustach_Build_With_EmptyTag;
+	return mustach_make_template(templ, get_build_flags(flags), &sbuf, NULL);
+}
+
+/* release the key holding the copy of the template string */
+static void release_key(void *value, void *closure)
+{
+	(void)value;/*make compiler happy #@!%!!*/
+	free(closure);
+}
+
+/*
+ * get the template using the cache, the key is made of the
+ * build flags followed by the content of the template string
+ */
+static int get_cached_template(mustach_template_t **templ, int flags, const char *templstr, size_t length)
+{
+	mustach_sbuf_t sbuf;
+	char *key, bflags;
+	int rc;
 
-	return mustach_make_template(templ, flags2, &sbuf, NULL);
+	if (length == 0)
+		length = strlen(templstr);
+	bflags = (char)get_build_flags(flags);
+
+	/* look up with the borrowed text, it is copied only on a miss */
+	rc = mustach_cache_get_prefixed(mustach_wrap_template_cache, bflags, templstr, length, templ);
+	if (rc == MUSTACH_OK)
+		return rc;
+
+	key = malloc(length + 2);
+	if (key == NULL)
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+	key[0] = bflags;
+	memcpy(&key[1], templstr, length);
+	key[length + 1] = 0;
+
+	/* the template takes ownership of the key */
+	sbuf.value = &key[1];
+	sbuf.length = length;
+	sbuf.releasecb = release_key;
+	sbuf.closure = key;
+	rc = mustach_make_template(templ, key[0], &sbuf, NULL);
+	if (rc == MUSTACH_OK) {
+		rc = mustach_cache_add(mustach_wrap_template_cache, key, length + 1, *templ, NULL);
+		if (rc != MUSTACH_OK)
+			mustach_unref_template(*templ, NULL, NULL);
+	}
+	return rc;
 }
 
 static int dowrap(
@@ -487,6 +1809,7 @@ static int dowrap(
 		const struct mustach_wrap_itf *itf,
 		void *closure,
 		int flags,
+		const mustach_partial_resolver_t *resolver,
 		mustach_write_cb_t *writecb,
 		mustach_emit_cb_t *emitcb,
 		void *wrclosure
@@ -495,10 +1818,17 @@ static int dowrap(
 	mustach_template_t *templ;
 
 	/* prepare the template */
-	rc = get_template(&templ, flags, templstr, length);
+	if (mustach_wrap_template_cache != NULL)
+		rc = get_cached_template(&templ, flags, templstr, length);
+	else
+		rc = get_template(&templ, flags, templstr, length);
 	if (rc == MUSTACH_OK) {
-		rc = mustach_wrap_apply(templ, itf, closure, flags, writecb, emitcb, wrclosure);
-		mustach_destroy_template(templ, NULL, NULL);
+		/* templates not cached are used once, don't precompile their selectors
+		 * unless values of loop invariant tags are hoisted */
+		rc = wrap_apply(templ, itf, closure, flags, resolver, writecb, emitcb, wrclosure,
+				mustach_wrap_template_cache != NULL
+				|| (flags & Mustach_With_LoopInvariant) != 0);
+		mustach_unref_template(templ, NULL, NULL);
 	}
 	return rc;
 }
@@ -544,6 +1874,7 @@ static int dowrap(
 		const struct mustach_wrap_itf *itf,
 		void *closure,
 		int flags,
+		const mustach_partial_resolver_t *resolver,
 		mustach_write_cb_t *writecb,
 		mustach_emit_cb_t *emitcb,
 		void *wrclosure
@@ -554,12 +1885,19 @@ static int dowrap(
 	/* init the wrap data */
 	if (flags & Mustach_With_Compare)
 		flags |= Mustach_With_Equal;
-	wrap.itf = itf;
+	set_itf(&wrap, itf, flags);
 	wrap.closure = closure;
 	wrap.flags = flags;
 	wrap.emitcb = emitcb;
 	wrap.writecb = writecb;
 	wrap.wrclosure = wrclosure;
+	wrap.precompile = 0;
+	wrap.seldepth = 0;
+	wrap.depth = 0;
+	wrap.icsets = NULL;
+	wrap.resolver = NULL;
+	wrap.resolved = 0;
+	(void)resolver;/*mini mustach doesn't use templates*/
 
 	/* apply the template */
 	rc = wrap.itf->start == NULL ? MUSTACH_OK : wrap.itf->start(wrap.closure);
@@ -573,18 +1911,50 @@ static int dowrap(
 
 int mustach_wrap_file(const char *templstr, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, FILE *file)
 {
-	return dowrap(templstr, length, itf, closure, flags, mustach_fwrite_cb, NULL, file);
+	return mustach_wrap_file_with(templstr, length, itf, closure, flags, NULL, file);
+}
+
+int mustach_wrap_file_with(const char *templstr, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, const mustach_partial_resolver_t *resolver, FILE *file)
+{
+	return dowrap(templstr, length, itf, closure, flags, resolver, mustach_fwrite_cb, NULL, file);
 }
 
 int mustach_wrap_fd(const char *templstr, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, int fd)
 {
-	return dowrap(templstr, length, itf, closure, flags, mustach_write_cb, NULL, (void*)(intptr_t)fd);
+	return mustach_wrap_fd_with(templstr, length, itf, closure, flags, NULL, fd, MUSTACH_FDBUF_SIZE);
+}
+
+int mustach_wrap_fd_with(const char *templstr, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, const mustach_partial_resolver_t *resolver, int fd, size_t size)
+{
+	int rc, rcf;
+	char local[MUSTACH_FDBUF_SIZE], *buffer = local;
+	mustach_fdbuf_t fdbuf;
+
+	/* allocates the buffer if bigger than the local one */
+	if (size > sizeof local) {
+		buffer = malloc(size);
+		if (buffer == NULL) {
+			buffer = local;
+			size = sizeof local;
+		}
+	}
+	mustach_fdbuf_init(&fdbuf, fd, buffer, size);
+	rc = dowrap(templstr, length, itf, closure, flags, resolver, NULL, mustach_fdbuf_emit_cb, &fdbuf);
+	rcf = mustach_fdbuf_flush(&fdbuf);
+	if (buffer != local)
+		free(buffer);
+	return rc != MUSTACH_OK ? rc : rcf;
 }
 
 int mustach_wrap_mem(const char *templstr, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, char **result, size_t *size)
+{
+	return mustach_wrap_mem_with(templstr, length, itf, closure, flags, NULL, result, size);
+}
+
+int mustach_wrap_mem_with(const char *templstr, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, const mustach_partial_resolver_t *resolver, char **result, size_t *size)
 {
 	mustach_stream_t stream = MUSTACH_STREAM_INIT;
-	int rc = dowrap(templstr, length, itf, closure, flags, mustach_stream_write_cb, NULL, &stream);
+	int rc = dowrap(templstr, length, itf, closure, flags, resolver, NULL, mustach_stream_emit_cb, &stream);
 	if (rc == MUSTACH_OK)
 		mustach_stream_end(&stream, result, size);
 	else
@@ -594,11 +1964,10 @@ int mustach_wrap_mem(const char *templstr, size_t length, const struct mustach_w
 
 int mustach_wrap_write(const char *templstr, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_write_cb_t *writecb, void *writeclosure)
 {
-	return dowrap(templstr, length, itf, closure, flags, writecb, NULL, writeclosure);
+	return dowrap(templstr, length, itf, closure, flags, NULL, writecb, NULL, writeclosure);
 }
 
 int mustach_wrap_emit(const char *templstr, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_emit_cb_t *emitcb, void *emitclosure)
 {
-	return dowrap(templstr, length, itf, closure, flags, NULL, emitcb, emitclosure);
+	return dowrap(templstr, length, itf, closure, flags, NULL, NULL, emitcb, emitclosure);
 }
-
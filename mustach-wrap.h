@@ -19,7 +19,11 @@
  * level features coming with extensions implemented by
  * this high level wrapper.
  */
+#include <stdint.h>
+
 #include "mustach.h"
+#include "mustach-cache.h"
+#include "mustach-registry.h"
 /*
  * Definition of the writing callbacks for mustach functions
  * producing output to callbacks.
@@ -62,9 +66,137 @@ typedef int mustach_emit_cb_t(void *closure, const char *buffer, size_t size, in
 #define Mustach_With_EscFirstCmp        256
 #define Mustach_With_PartialDataFirst   512
 #define Mustach_With_ErrorUndefined    1024
+#define Mustach_With_LoopInvariant     2048
+#define Mustach_With_ReadOnlyData      4096
+#define Mustach_With_ExtendedItf       8192
 
 #undef  Mustach_With_AllExtensions
-#define Mustach_With_AllExtensions     1023     /* don't include ErrorUndefined */
+#define Mustach_With_AllExtensions     1023     /* don't include ErrorUndefined, LoopInvariant, ReadOnlyData and ExtendedItf */
+
+/**
+ * The flag Mustach_With_LoopInvariant tells that items selected by
+ * the interface don't change during the rendering. It is then possible
+ * to compute the value of a tag only once while its name resolves to
+ * the same item, for example when, in a loop, the tag doesn't depend
+ * on the iterated item. Only the items found in a context outside of
+ * the innermost section are kept, as told by the inline cache (see
+ * mustach_wrap_ic). It is effective only if the interface
+ * implements 'sel_ic' or 'sel_ic_len' and the flag
+ * Mustach_With_ExtendedItf is set.
+ */
+
+/**
+ * The flag Mustach_With_ReadOnlyData tells that the rendering must not
+ * modify the data, not even the caches that the JSON libraries attach
+ * to their values, so that many threads can render the same data
+ * at the same time. All the state of a rendering is then kept in its
+ * own closure. It changes the behaviour of the backend json-c, that
+ * otherwise records in the values the text given by
+ * json_object_to_json_string_ext. The doubles are then printed from
+ * their value, with the fewest digits (15, 16 or 17) that give the
+ * value back and with ".0" when they look like integers. So the output
+ * differs from the text kept by json-c only for the doubles that were
+ * not written that way: 2.50 is printed 2.5, 1.25e9 is printed
+ * 1250000000.0 and 1e300 is printed 1e+300.
+ */
+
+/**
+ * The flag Mustach_With_ExtendedItf tells that the interface
+ * mustach_wrap_itf given by the caller has the fields following 'get'
+ * (see below). Without it, these fields are not read, so that the
+ * interfaces compiled with headers of previous versions, that end
+ * with 'get', remain usable. The functions of the backends set it
+ * for their own interfaces.
+ */
+
+/**
+ * Types of the literal values of comparisons
+ */
+#define Mustach_Lit_String   0
+#define Mustach_Lit_Int      1
+#define Mustach_Lit_Double   2
+#define Mustach_Lit_True     3
+#define Mustach_Lit_False    4
+#define Mustach_Lit_Null     5
+
+/**
+ * mustach_wrap_lit - literal value of comparisons, as in {{price>=100}}
+ *
+ * The value is parsed once when the tag is compiled. Whatever is its
+ * type, the fields 'i' and 'd' are set with the value of the leading
+ * number of the string, as would atoll and atof do but independently
+ * of the locale, or to 0 if the string doesn't start with a number.
+ *
+ * @type:   the type of the literal (see Mustach_Lit_...)
+ * @i:      the value as an integer
+ * @d:      the value as a double
+ * @string: the literal as a null terminated string
+ */
+struct mustach_wrap_lit {
+	int type;
+	int64_t i;
+	double d;
+	const char *string;
+};
+
+/**
+ * mustach_wrap_parse_lit - parses the 'string' in 'lit'
+ *
+ * The string must be kept valid while 'lit' is used.
+ */
+extern void mustach_wrap_parse_lit(struct mustach_wrap_lit *lit, const char *string);
+
+/**
+ * Size of the buffers receiving numbers formatted by the functions
+ * below, enough for any integer or double
+ */
+#define MUSTACH_WRAP_FORMAT_SIZE 32
+
+/**
+ * mustach_wrap_format_int - writes in 'buffer' the decimal text of
+ * the integer 'value', null terminated, and returns its length
+ */
+extern size_t mustach_wrap_format_int(char buffer[MUSTACH_WRAP_FORMAT_SIZE], int64_t value);
+
+/**
+ * mustach_wrap_format_double - writes in 'buffer' the text of the
+ * double 'value' as printf does for the format "%.*g" with the given
+ * 'precision' but with a dot as decimal point whatever is the locale,
+ * null terminated, and returns its length
+ *
+ * These functions don't allocate memory. The backends use them
+ * for giving the value of numbers in a buffer of their closure.
+ */
+extern size_t mustach_wrap_format_double(char buffer[MUSTACH_WRAP_FORMAT_SIZE], double value, int precision);
+
+/**
+ * mustach_wrap_ic - inline cache of the selection of a tag
+ *
+ * The wrapper provides one inline cache per tag and per rendering
+ * to the function 'sel_ic'. It is zeroed at start of the rendering,
+ * its content is then managed by 'sel_ic'. The fields are suggested
+ * for recording where the name was found and when.
+ *
+ * @stamp: a stamp of the state of the context when cached, 0 if empty
+ * @depth: depth of the context where the name was found, 0 for the
+ *         root and then the count of entered sections, required with
+ *         Mustach_With_LoopInvariant
+ * @item:  the item found, required with Mustach_With_LoopInvariant
+ *         that reuses the value of the tag while 'item' is unchanged
+ *         and not NULL
+ */
+struct mustach_wrap_ic {
+	uint64_t stamp;
+	int depth;
+	void *item;
+};
+
+/**
+ * Versions of the interface mustach_wrap_itf
+ */
+#define MUSTACH_WRAP_ITF_VERSION_1    1
+#define MUSTACH_WRAP_ITF_VERSION_2    2
+#define MUSTACH_WRAP_ITF_VERSION_CUR  MUSTACH_WRAP_ITF_VERSION_2
 
 /**
  * mustach_wrap_itf - high level wrap of mustach - interface for callbacks
@@ -122,6 +254,42 @@ typedef int mustach_emit_cb_t(void *closure, const char *buffer, size_t size, in
  *       the name of key of the current selection, or if no such key
  *       exists, the empty string. Must return 1 if possible or
  *       0 when not possible or an error code.
+ *       Setting 'sbuf->length' when the length is known avoids
+ *       computing it again.
+ *
+ * The fields below are only read when the flag Mustach_With_ExtendedItf
+ * is set.
+ *
+ * @compare_lit: If defined (can be NULL), replaces 'compare'. It does
+ *               the same but receives the value already parsed, so
+ *               it can compare numbers without converting the string
+ *               on each evaluation.
+ *
+ * @sel_ic: If defined (can be NULL), replaces 'sel' for names not NULL
+ *          of precompiled tags. It does the same but receives the inline
+ *          cache 'ic' of the tag, that it can use to avoid searching
+ *          the name in the context again when the context didn't
+ *          change since the last selection.
+ *
+ * @version: Version of the interface. When it is 0 or
+ *           MUSTACH_WRAP_ITF_VERSION_1, the fields below are not used.
+ *           When it is MUSTACH_WRAP_ITF_VERSION_2, 'sel_len' and
+ *           'subsel_len' must be set and are used instead of 'sel'
+ *           (for names not NULL) and 'subsel', and 'sel_ic_len',
+ *           that can be NULL, is used instead of 'sel_ic'.
+ *           Without the flag Mustach_With_ExtendedItf, the version
+ *           is taken as 0, whatever the field holds.
+ *
+ * @sel_len: Same as 'sel' for a name not NULL of the given 'length'.
+ *           The name is not always null terminated but its character
+ *           at 'length' can always be read, so it can be tested for
+ *           avoiding a copy when a terminated string is needed.
+ *
+ * @subsel_len: Same as 'subsel' for a name of the given 'length',
+ *              with the same remark on the termination of the name.
+ *
+ * @sel_ic_len: Same as 'sel_ic' for a name of the given 'length',
+ *              with the same remark on the termination of the name.
  */
 struct mustach_wrap_itf {
 	int (*start)(void *closure);
@@ -133,6 +301,12 @@ struct mustach_wrap_itf {
 	int (*next)(void *closure);
 	int (*leave)(void *closure);
 	int (*get)(void *closure, struct mustach_sbuf *sbuf, int key);
+	int (*compare_lit)(void *closure, const struct mustach_wrap_lit *lit);
+	int (*sel_ic)(void *closure, const char *name, struct mustach_wrap_ic *ic);
+	int version;
+	int (*sel_len)(void *closure, const char *name, size_t length);
+	int (*subsel_len)(void *closure, const char *name, size_t length);
+	int (*sel_ic_len)(void *closure, const char *name, size_t length, struct mustach_wrap_ic *ic);
 };
 
 /**
@@ -154,12 +328,93 @@ extern const struct mustach_itf mustach_wrap_itf;
  */
 extern int (*mustach_wrap_get_partial)(const char *name, struct mustach_sbuf *sbuf);
 
+/**
+ * Global cache of prepared partials. When set to a not NULL value,
+ * the partials got from the hook 'mustach_wrap_get_partial' or read
+ * from files are recorded in the cache under their name and are
+ * then reused without being read and built again.
+ *
+ * Partials given by the data are never recorded because they
+ * can change from one rendering to the other. Conversely, the hook
+ * 'mustach_wrap_get_partial' must always give the same partial for
+ * the same name. For partials read from files, use the flag
+ * Mustach_Cache_Check_MTime when creating the cache for detecting
+ * modifications of the files.
+ *
+ * Example:
+ *
+ *    mustach_cache_create(&mustach_wrap_partial_cache, 1 << 20, Mustach_Cache_Check_MTime);
+ */
+extern mustach_cache_t *mustach_wrap_partial_cache;
+
+/**
+ * Global cache of prepared templates. When set to a not NULL value,
+ * the templates given to the functions mustach_wrap_file, mustach_wrap_fd,
+ * mustach_wrap_mem, mustach_wrap_write and mustach_wrap_emit are recorded
+ * in the cache under a key made of their content and of their build flags.
+ * Later calls with the same template string then skip the preparation
+ * of the template.
+ *
+ * The cache records its own copy of the template string, so the string
+ * given by the caller can be released as usual.
+ *
+ * Example:
+ *
+ *    mustach_cache_create(&mustach_wrap_template_cache, 1 << 20, 0);
+ */
+extern mustach_cache_t *mustach_wrap_template_cache;
+
+/**
+ * Global registry of prepared partials. When set to a not NULL value,
+ * partials are first searched in the registry by their name. If not
+ * found, the partials are got as usual from the hook, the files or
+ * the data. When the flag Mustach_With_PartialDataFirst is set,
+ * partials given by the data are searched before the registry.
+ *
+ * Example:
+ *
+ *    mustach_registry_create(&mustach_wrap_partial_registry, 0, 0);
+ *    mustach_registry_load_dir(mustach_wrap_partial_registry, "templates");
+ */
+extern mustach_registry_t *mustach_wrap_partial_registry;
+
+/**
+ * Resolver of the partials of one rendering.
+ *
+ * When given to the functions mustach_wrap_..._with, partials are first
+ * searched using the function 'get' with the 'closure'. If it returns
+ * MUSTACH_ERROR_NOT_FOUND, partials are got as usual from the registry,
+ * the hook, the files or the data. When the flag
+ * Mustach_With_PartialDataFirst is set, partials given by the data are
+ * searched before the resolver.
+ *
+ * The partials got from the resolver are released using the function
+ * 'put' when not NULL or else using mustach_unref_template. So the
+ * functions mustach_registry_partial_get and mustach_registry_partial_put
+ * with a registry as closure make a resolver.
+ *
+ * Because it is not shared, a resolver lets concurrent renderings use
+ * different sets of partials without locking. The resolver is not
+ * used when mustach-wrap is compiled for mini-mustach.
+ */
+typedef struct mustach_partial_resolver mustach_partial_resolver_t;
+struct mustach_partial_resolver {
+	int (*get)(void *closure, const char *name, size_t length, mustach_template_t **partial);
+	void (*put)(void *closure, mustach_template_t *partial);
+	void *closure;
+};
+
 /**
  * mustach_wrap_apply - Renders the prepared mustache 'templstr'
  * for an abstract wrapper of interface 'itf' and 'closure'
  * and being writen using one or both of the emitters 'writecb'
  * or 'emitcb' and the closure 'wrclosure'.
  *
+ * On first use with a given set of flags, the names of the tags of the
+ * template and of its partials are compiled once in selectors attached
+ * to the templates (see mustach_set_template_ext). Later renderings only
+ * walk the keys of the selectors.
+ *
  * @templstr:  the template string to instantiate
  * @itf:       the interface of the abstract wrapper
  * @closure:   the closure for itf
@@ -181,6 +436,134 @@ extern int mustach_wrap_apply(
 		void *wrclosure
 );
 
+/**
+ * mustach_wrap_apply_with - Like mustach_wrap_apply but getting
+ * the partials using the 'resolver' first (see mustach_partial_resolver_t).
+ * A NULL 'resolver' is accepted.
+ */
+extern int mustach_wrap_apply_with(
+		mustach_template_t *templstr,
+		const struct mustach_wrap_itf *itf,
+		void *closure,
+		int flags,
+		const mustach_partial_resolver_t *resolver,
+		mustach_write_cb_t *writecb,
+		mustach_emit_cb_t *emitcb,
+		void *wrclosure
+);
+
+/**
+ * Pulled renderings.
+ *
+ * mustach_wrap_apply_begin - Prepares in '*apply' the rendering of
+ * the prepared template 'templ' for the interface 'itf' and 'closure',
+ * as mustach_wrap_apply_with does, but whose output is pulled by the
+ * caller using mustach_wrap_apply_step. The 'closure' must be kept
+ * until the end of the rendering. When 'release' is not NULL, it is
+ * called with 'closure' when the rendering ends or when its beginning
+ * fails.
+ *
+ * mustach_wrap_apply_step - Fills the 'buffer' of 'size' bytes with
+ * the next bytes of the output and sets in '*written' the count of
+ * bytes written. Returns 1 when the output continues after what was
+ * written, MUSTACH_OK when all the output was written or a negative
+ * error code (see mustach_apply_step).
+ *
+ * mustach_wrap_apply_end - Ends the rendering, even when not complete,
+ * and releases it.
+ *
+ * The values are escaped by mustach_escape.
+ */
+typedef struct mustach_wrap_apply mustach_wrap_apply_t;
+
+extern int mustach_wrap_apply_begin(
+		mustach_wrap_apply_t **apply,
+		mustach_template_t *templ,
+		const struct mustach_wrap_itf *itf,
+		void *closure,
+		int flags,
+		const mustach_partial_resolver_t *resolver,
+		void (*release)(void *closure)
+);
+
+extern int mustach_wrap_apply_step(
+		mustach_wrap_apply_t *apply,
+		char *buffer,
+		size_t size,
+		size_t *written
+);
+
+extern void mustach_wrap_apply_end(
+		mustach_wrap_apply_t *apply
+);
+
+/**
+ * Usages of the data paths reported by mustach_wrap_template_paths
+ */
+#define Mustach_Path_Value     1   /* value of a tag {{path}} */
+#define Mustach_Path_Section   2   /* section {{#path}} */
+#define Mustach_Path_Inverted  4   /* inverted section {{^path}} */
+#define Mustach_Path_Compare   8   /* compared to a value {{path=value}} */
+#define Mustach_Path_Partial  16   /* name of a partial {{>path}} */
+
+/**
+ * mustach_wrap_path - a data path read by a template
+ *
+ * @parent: the path of the enclosing section or NULL at top level
+ * @usage:  how the path is used (see Mustach_Path_...)
+ * @name:   the name of the tag, not null terminated
+ * @length: the length of the name of the tag
+ * @keys:   the keys of the path, null terminated, for example the
+ *          keys of {{a.b}} are "a" and "b", {{.}} has no keys
+ * @nkeys:  the count of keys
+ * @value:  the value of the comparison or NULL
+ *
+ * The keys are relative to the context of the section 'parent' where
+ * they are searched from the innermost item to the root item.
+ */
+struct mustach_wrap_path {
+	const struct mustach_wrap_path *parent;
+	int usage;
+	const char *name;
+	size_t length;
+	const char *const *keys;
+	unsigned nkeys;
+	const char *value;
+};
+
+typedef int mustach_wrap_path_cb_t(void *closure, const struct mustach_wrap_path *path);
+
+/**
+ * mustach_wrap_template_paths - Reports the data paths that can be read
+ * when rendering the prepared template 'templ' with the 'flags'.
+ *
+ * The template is walked without data, including the partials and the
+ * parents whose names are statically found in the registry, the hook
+ * or the files, as during rendering. Partials that only exist in the data
+ * are not walked. A partial already walked in the current nesting is not
+ * walked again, so recursive partials end. Native templates have no
+ * path to report.
+ *
+ * The function 'pathcb' is called with 'closure' for each tag in the
+ * order of the template, so a path can be reported more than once.
+ * The paths of the blocks of a parent template are reported even
+ * when overridden. When 'pathcb' returns a value other than MUSTACH_OK,
+ * the walk stops and that value is returned.
+ *
+ * @templ:   the prepared template
+ * @flags:   rendering flags
+ * @pathcb:  the function receiving the paths
+ * @closure: the closure for pathcb
+ *
+ * Returns 0 in case of success or a negative error code.
+ */
+extern int mustach_wrap_template_paths(
+		mustach_template_t *templ,
+		int flags,
+		mustach_wrap_path_cb_t *pathcb,
+		void *closure
+);
+
 /**
  * mustach_wrap_file - Renders the mustache 'templstr' in 'file' for an abstract
  * wrapper of interface 'itf' and 'closure'.
@@ -196,6 +579,12 @@ extern int mustach_wrap_apply(
  */
 extern int mustach_wrap_file(const char *templstr, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, FILE *file);
 
+/**
+ * mustach_wrap_file_with - Like mustach_wrap_file but getting
+ * the partials using the 'resolver' first.
+ */
+extern int mustach_wrap_file_with(const char *templstr, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, const mustach_partial_resolver_t *resolver, FILE *file);
+
 /**
  * mustach_wrap_fd - Renders the mustache 'templstr' in 'fd' for an abstract
  * wrapper of interface 'itf' and 'closure'.
@@ -206,11 +595,22 @@ extern int mustach_wrap_file(const char *templstr, size_t length, const struct m
  * @closure:  the closure of the abstract wrapper
  * @fd:       the file descriptor number where to write the result
  *
+ * The result is written by blocks of MUSTACH_FDBUF_SIZE bytes.
+ * What is produced before an error is written.
+ *
  * Returns 0 in case of success, -1 with errno set in case of system error
  * a other negative value in case of error.
  */
 extern int mustach_wrap_fd(const char *templstr, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, int fd);
 
+/**
+ * mustach_wrap_fd_with - Like mustach_wrap_fd but getting
+ * the partials using the 'resolver' first and collecting the output
+ * in a buffer of 'size' bytes before writing it (see mustach_fdbuf_t).
+ * The size 0 disables buffering.
+ */
+extern int mustach_wrap_fd_with(const char *templstr, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, const mustach_partial_resolver_t *resolver, int fd, size_t size);
+
 /**
  * mustach_wrap_mem - Renders the mustache 'templstr' in 'result' for an abstract
  * wrapper of interface 'itf' and 'closure'.
@@ -227,6 +627,12 @@ extern int mustach_wrap_fd(const char *templstr, size_t length, const struct mus
  */
 extern int mustach_wrap_mem(const char *templstr, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, char **result, size_t *size);
 
+/**
+ * mustach_wrap_mem_with - Like mustach_wrap_mem but getting
+ * the partials using the 'resolver' first.
+ */
+extern int mustach_wrap_mem_with(const char *templstr, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, const mustach_partial_resolver_t *resolver, char **result, size_t *size);
+
 /**
  * mustach_wrap_write - Renders the mustache 'templstr' for an abstract
  * wrapper of interface 'itf' and 'closure' to custom writer
@@ -33,6 +33,11 @@
 # define GUARD_SIZE    (2 * sizeof(void*))
 #endif
 
+/* size of cache lines, compact templates are aligned on it */
+#ifndef CACHE_LINE_SIZE
+# define CACHE_LINE_SIZE 64
+#endif
+
 /* a simple print buffer for text of error */
 #ifndef PBUFLEN
 # define PBUFLEN 400
@@ -100,6 +105,9 @@ enum op {
 
 	/* 13. TODO */
 	op_unprefix,
+
+	/* 14. text copied in the code: TEXTCOPY(LENTXT) TXT */
+	op_text_copy,
 }
 	op_t;
 
@@ -151,9 +159,15 @@ typedef uint32_t word_t;
 * using the lower 10 bits for offset in the block and
 * the 22 upper bits for the index of the block.
 *
-* Note that no specific attention is made at the moment
-* quickly access blocks, the search is linear. So for
-* very big templates it could be optimized.
+* When a template has more than one block, it also records
+* an index of its blocks, so that accessing a block from
+* its index is immediate.
+*
+* Blocks are allocated separately while the template is built.
+* When the template is complete, a template having more than
+* one block is made compact: the template, its first block,
+* the index of blocks, the other blocks and the name are
+* packed in a single allocation aligned on cache lines.
 */
 
 /* bit count of block offset */
@@ -198,18 +212,47 @@ struct block {
 * The first encoded block is allocated with the structure
 */
 
+/* extension attached to a template */
+typedef struct ext ext_t;
+struct ext {
+	/* next extension */
+	ext_t *next;
+	/* the key identifying the extension */
+	const void *key;
+	/* the value */
+	void *value;
+	/* function destroying the value or NULL */
+	void (*destroy)(void *value);
+};
+
 /* a prepared template for mains or partials */
 struct mustach_template {
 	/* the reference text */
 	mustach_sbuf_t sbuf;
+	/* base of the text referenced by the code */
+	const char *base;
+	/* length of the text referenced by the code */
+	word_t textlen;
 	/* flags */
 	int flags;
+	/* count of references */
+	unsigned refcount;
 	/* length of the name (without nul) */
 	word_t length;
 	/* null terminated name or NULL */
 	const char *name;
 	/* some user data */
 	void *data[DATA_COUNT];
+	/* the extensions */
+	ext_t *exts;
+	/* the allocated memory holding the template */
+	void *memory;
+	/* size of the memory of a compact template or 0 if not compact */
+	size_t compact;
+	/* rendering function of native templates or NULL */
+	mustach_native_render_t *native;
+	/* index of the blocks or NULL if only one block */
+	block_t **blocks;
 	/* the first block */
 	block_t first_block;
 };
@@ -264,13 +307,22 @@ struct ap {
 	ap_t *parent;
 	/* the template if any */
 	mustach_template_t *templ;
+	/* the pulled application receiving the output or NULL */
+	mustach_apply_t *pull;
 };
 
+/* maximum count of texts encoded together */
+#ifndef RUN_MAX
+# define RUN_MAX 16
+#endif
+
 /* structure for extraction */
 typedef struct ex ex_t;
 struct ex {
 	/* the reference text */
 	mustach_sbuf_t sbuf;
+	/* length of the text */
+	word_t textlen;
 
 	/* the interface */
 	const mustach_build_itf_t *itf;
@@ -292,6 +344,13 @@ struct ex {
 	/* the pending text base */
 	const char *text;
 
+	/* count of texts waiting to be encoded together */
+	unsigned nrun;
+	/* the texts waiting to be encoded together */
+	const char *runtxt[RUN_MAX];
+	/* lengths of the texts waiting to be encoded together */
+	word_t runlen[RUN_MAX];
+
 	/* last line encoded */
 	word_t curline;
 	/* not zero if in parent (used for tracking blocks only) */
@@ -304,6 +363,8 @@ struct ex {
 	word_t curblk;
 	/* previous block of words or NULL */
 	block_t *prvblk;
+	/* allocated count of entries of the index of blocks */
+	word_t blkalloc;
 
 	/* next top stack index */
 	unsigned stacktop;
@@ -325,11 +386,6 @@ struct ex {
 	word_t stack[3 * MUSTACH_MAX_DEPTH];
 };
 
-int (*mustach_global_partial_get)(
-		const char *name,
-		size_t length,
-		struct mustach_sbuf *sbuf);
-
 /*******************************************************************/
 /*******************************************************************/
 /** PART interface  ************************************************/
@@ -569,11 +625,14 @@ static void initex(
 
 	/* initial state */
 	ex->pending = 0;
+	ex->nrun = 0;
 	ex->curline = 0;
 	ex->inpar = 0;
 	ex->curoff = 0;
 	ex->curblk = 0;
 	ex->prvblk = NULL;
+	ex->textlen = 0;
+	ex->blkalloc = 0;
 	ex->stacktop = 0;
 
 	/* compute sizes */
@@ -581,10 +640,46 @@ static void initex(
 	set_reserved(ex, namelen + sizeof *ex->templ);
 }
 
+/* get the stored block of index iblk */
+static block_t *ex_get_block(ex_t *ex, word_t iblk)
+{
+	return iblk == 0 ? &ex->templ->first_block : ex->templ->blocks[iblk];
+}
+
+/* record the block in the index of blocks of the template
+ * the index is only created when a second block is added */
+static int ex_add_block(ex_t *ex, block_t *blk)
+{
+	mustach_template_t *templ = ex->templ;
+	word_t count, iblk = ex->curblk;
+	block_t **blocks;
+
+	if (iblk == 0)
+		return MUSTACH_OK;
+	if (iblk >= ex->blkalloc) {
+		/* grow the index */
+		count = ex->blkalloc == 0 ? 8 : 2 * ex->blkalloc;
+		blocks = alloc(count * sizeof *blocks, ex->itf, ex->closure);
+		if (blocks == NULL)
+			return exerr_oom(ex);
+		if (templ->blocks == NULL)
+			blocks[0] = &templ->first_block;
+		else {
+			memcpy(blocks, templ->blocks, iblk * sizeof *blocks);
+			dealloc(templ->blocks, ex->itf, ex->closure);
+		}
+		templ->blocks = blocks;
+		ex->blkalloc = count;
+	}
+	templ->blocks[iblk] = blk;
+	return MUSTACH_OK;
+}
+
 /* Create a block from the current state
  * The block is either a template or a block */
 static int store(ex_t *ex)
 {
+	int rc;
 	char *name;
 	block_t *blk;
 	word_t count;
@@ -610,7 +705,14 @@ static int store(ex_t *ex)
 		ex->templ = templ;
 		/* copy the buffer */
 		templ->sbuf = ex->sbuf;
+		templ->base = ex->sbuf.value;
+		templ->textlen = ex->textlen;
 		templ->flags = ex->flags;
+		templ->refcount = 1;
+		templ->memory = ptr;
+		templ->compact = 0;
+		templ->native = NULL;
+		templ->blocks = NULL;
 		/* copy the name */
 		if (ex->name == NULL) {
 			templ->name = NULL;
@@ -625,6 +727,7 @@ static int store(ex_t *ex)
 		}
 		/* user data */
 		memset(templ->data, 0 , sizeof ex->templ->data);
+		templ->exts = NULL;
 		/* get the block */
 		blk = &templ->first_block;
 	}
@@ -636,6 +739,9 @@ static int store(ex_t *ex)
 		ex->prvblk->next = blk;
 	blk->count = count;
 	memcpy(blk->words, ex->words, count * sizeof(word_t));
+	rc = ex_add_block(ex, blk);
+	if (rc != MUSTACH_OK)
+		return rc;
 
 	/* prepare new block */
 	ex->curblk++;
@@ -648,6 +754,143 @@ static int store(ex_t *ex)
 	return MUSTACH_OK;
 }
 
+/* round the size to the alignment of pointers */
+#define PTRALIGN(size) (((size) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+/* size of the block of index iblk with count words in a compact
+ * template, the first block comes with the template structure */
+static size_t compact_block_size(word_t iblk, word_t count)
+{
+	size_t size = count * sizeof(word_t);
+	size += iblk == 0 ? sizeof(mustach_template_t) : sizeof(block_t);
+	return PTRALIGN(size);
+}
+
+/* allocate a compact template of nblocks blocks, size being the sum
+ * of the sizes of its blocks and of its name */
+static mustach_template_t *compact_alloc(
+		size_t size,
+		word_t nblocks,
+		const mustach_build_itf_t *itf,
+		void *closure
+) {
+	mustach_template_t *templ;
+	char *mem;
+
+	size += nblocks * sizeof(block_t*) + CACHE_LINE_SIZE - 1;
+	mem = alloc(size, itf, closure);
+	if (mem == NULL)
+		return NULL;
+	templ = (void*)&mem[-(uintptr_t)mem & (CACHE_LINE_SIZE - 1)];
+	templ->memory = mem;
+	templ->compact = size;
+	return templ;
+}
+
+/* set the block of index iblk with count words of the compact template
+ * of nblocks blocks, blocks must be set in increasing index order */
+static block_t *compact_set_block(
+		mustach_template_t *templ,
+		word_t nblocks,
+		word_t iblk,
+		word_t count
+) {
+	block_t *blk, *prv;
+
+	if (iblk == 0) {
+		/* first block with the template, followed by the index */
+		blk = &templ->first_block;
+		blk->prev = NULL;
+		templ->blocks = (void*)((char*)templ + compact_block_size(0, count));
+	}
+	else {
+		/* block after the index or after the previous block */
+		prv = templ->blocks[iblk - 1];
+		blk = iblk == 1 ? (void*)&templ->blocks[nblocks]
+			: (void*)((char*)prv + compact_block_size(iblk - 1, prv->count));
+		blk->prev = prv;
+		prv->next = blk;
+	}
+	blk->next = NULL;
+	blk->count = count;
+	templ->blocks[iblk] = blk;
+	return blk;
+}
+
+/* return the memory after the last block of a compact template */
+static char *compact_end(
+		mustach_template_t *templ,
+		word_t nblocks
+) {
+	block_t *blk = templ->blocks[nblocks - 1];
+	return (char*)blk + compact_block_size(nblocks - 1, blk->count);
+}
+
+/* release the memory of the template but not its text */
+static void release_memory(
+		mustach_template_t *templ,
+		const mustach_build_itf_t *itf,
+		void *closure
+) {
+	if (templ->compact == 0) {
+		/* destroy blocks of the template */
+		block_t *blk = templ->first_block.next;
+		while (blk != NULL) {
+			block_t *b = blk;
+			blk = blk->next;
+			dealloc(b, itf, closure);
+		}
+		/* destroy the index of blocks */
+		if (templ->blocks != NULL)
+			dealloc(templ->blocks, itf, closure);
+	}
+	dealloc(templ->memory, itf, closure);
+}
+
+/* make the built template compact if it has more than one block */
+static void ex_compact(ex_t *ex)
+{
+	mustach_template_t *templ, *old = ex->templ;
+	word_t iblk, nblocks = ex->curblk;
+	block_t *blk;
+	size_t size;
+
+	if (nblocks <= 1)
+		return;
+
+	/* allocate */
+	size = old->name == NULL ? 0 : 1 + old->length;
+	for (iblk = 0 ; iblk < nblocks ; iblk++)
+		size += compact_block_size(iblk, old->blocks[iblk]->count);
+	templ = compact_alloc(size, nblocks, ex->itf, ex->closure);
+	if (templ == NULL)
+		return; /* not fatal */
+
+	/* copy */
+	templ->sbuf = old->sbuf;
+	templ->base = old->base;
+	templ->textlen = old->textlen;
+	templ->flags = old->flags;
+	templ->refcount = old->refcount;
+	templ->length = old->length;
+	templ->native = NULL;
+	memcpy(templ->data, old->data, sizeof templ->data);
+	templ->exts = old->exts;
+	for (iblk = 0 ; iblk < nblocks ; iblk++) {
+		blk = old->blocks[iblk];
+		memcpy(compact_set_block(templ, nblocks, iblk, blk->count)->words,
+				blk->words, blk->count * sizeof(word_t));
+	}
+	if (old->name == NULL)
+		templ->name = NULL;
+	else
+		templ->name = memcpy(compact_end(templ, nblocks), old->name, 1 + old->length);
+
+	/* replace */
+	release_memory(old, ex->itf, ex->closure);
+	ex->templ = templ;
+}
+
 /* advance write pointer, flush the block at block end */
 static int nextput(ex_t *ex)
 {
@@ -688,7 +931,7 @@ static void invalid_line(ex_t *ex)
 static int put_line(ex_t *ex, word_t line)
 {
 	/* check if line already set or not */
-	if (ex->curline == line)
+	if (ex->curline == line || (ex->flags & Mustach_Build_Strip_Lines) != 0)
 	       return MUSTACH_OK;
 	/* record it and code it */
 	ex->curline = line;
@@ -716,17 +959,21 @@ static int put_text_ref(
 	return rc;
 }
 
-/* encode a copy of a text of the template text */
-static int put_text_copy(
+/* encode a copy of the concatenation of count texts of the template text */
+static int put_texts_copy(
 		ex_t *ex,
-		const char *text,
+		unsigned count,
+		const char *const *texts,
+		const word_t *lengths,
 		word_t length,
 		op_t op
 ) {
 	int rc;
+	unsigned idx;
 	word_t nrw, *pw;
 	size_t size;
 	block_t *blk;
+	char *dst;
 
 	/* check the length */
 	if (length > WVAL_MAX)
@@ -747,10 +994,12 @@ static int put_text_copy(
 		ex->curoff += nrw;
 	}
 	else {
-		/* not enough, store current work */
-		rc = store(ex);
-		if (rc != MUSTACH_OK)
-			return rc;
+		/* not enough, store current work unless empty */
+		if (ex->curoff != 0) {
+			rc = store(ex);
+			if (rc != MUSTACH_OK)
+				return rc;
+		}
 
 		/* is there enough spece now?
 		 * (it is asserted that ex->curoff==0) */
@@ -773,6 +1022,9 @@ static int put_text_copy(
 				ex->prvblk->next = blk;
 			blk->count = nrw;
 			ex->prvblk = blk;
+			rc = ex_add_block(ex, blk);
+			if (rc != MUSTACH_OK)
+				return rc;
 			ex->curblk++;
 
 			/* copy in created block */
@@ -782,10 +1034,21 @@ static int put_text_copy(
 
 	/* copy the text */
 	pw[nrw - 1] = 0; /* terminating nul */
-	memcpy(pw, text, length);
+	for (dst = (char*)pw, idx = 0 ; idx < count ; dst += lengths[idx++])
+		memcpy(dst, texts[idx], lengths[idx]);
 	return ex->curoff < ex->offmax ? MUSTACH_OK : store(ex);
 }
 
+/* encode a copy of a text of the template text */
+static int put_text_copy(
+		ex_t *ex,
+		const char *text,
+		word_t length,
+		op_t op
+) {
+	return put_texts_copy(ex, 1, &text, &length, length, op);
+}
+
 /* code the text of a mustach tag */
 static int put_tag(
 		ex_t *ex,
@@ -887,7 +1150,7 @@ static int put_end(ex_t *ex, const char *tag, word_t length)
 	/* values of section's begin */
 	op_t op;
 	const char *txtptr;
-	word_t txtlen, *pjend;
+	word_t txtlen, *pjend = NULL, jblk = 0;
 
 	/* retrieve saved addr of section's begin */
 	rc = ex_pop(ex, &addr);
@@ -910,10 +1173,7 @@ static int put_end(ex_t *ex, const char *tag, word_t length)
 	}
 	else {
 		/* existing stored block */
-		it = ex->prvblk;
-		while(++blk != ex->curblk)
-			it = it->prev;
-		blk = ABLK(addr);
+		it = ex_get_block(ex, blk);
 		wcnt = it->count;
 		words = it->words;
 	}
@@ -940,6 +1200,7 @@ static int put_end(ex_t *ex, const char *tag, word_t length)
 		case 2:
 			/* address of end */
 			pjend = &words[off];
+			jblk = blk;
 			break;
 		}
 		/* compute next address */
@@ -964,6 +1225,15 @@ static int put_end(ex_t *ex, const char *tag, word_t length)
 	if (txtlen != length || memcmp(tag, txtptr, txtlen))
 		return exerr_mismatch_closing(ex);
 
+	/* remove empty sections when their begin is still in the current block */
+	if ((op == op_while || op == op_unless)
+	 && MKA(blk, off) == get_put_addr(ex)
+	 && ABLK(addr) == ex->curblk) {
+		ex->curoff = AOFF(addr);
+		invalid_line(ex);
+		return MUSTACH_OK;
+	}
+
 	/* set next or end op if needed */
 	switch (op) {
 	case op_while:
@@ -991,7 +1261,10 @@ static int put_end(ex_t *ex, const char *tag, word_t length)
 		break;
 	}
 
-	/* record the jump to end address */
+	/* record the jump to end address, if it was in the current
+	 * block, this block may have been stored by the put above */
+	if (jblk != ex->curblk && pjend >= ex->words && pjend < &ex->words[1 << BOFFBITS])
+		pjend = &ex_get_block(ex, jblk)->words[pjend - ex->words];
 	*pjend = get_put_addr(ex);
 
 	/* ensure line is set on continuation */
@@ -1023,7 +1296,48 @@ static int ex_text(
 	return MUSTACH_OK;
 }
 
-/* encode the pending text if any */
+/* encode the texts waiting to be encoded together
+ * as a single text: when the texts are contiguous in the
+ * template, they are encoded as usual, otherwise the
+ * concatenation of the texts is copied in the code */
+static int ex_flush_run(ex_t *ex)
+{
+	unsigned idx, nrun = ex->nrun;
+	word_t length = ex->runlen[0];
+	int contiguous = 1;
+
+	if (nrun == 0)
+		return MUSTACH_OK;
+	ex->nrun = 0;
+	for (idx = 1 ; idx < nrun ; idx++) {
+		if (&ex->runtxt[idx - 1][ex->runlen[idx - 1]] != ex->runtxt[idx])
+			contiguous = 0;
+		length += ex->runlen[idx];
+	}
+	return contiguous
+		? put_text(ex, ex->runtxt[0], length, op_text)
+		: put_texts_copy(ex, nrun, ex->runtxt, ex->runlen, length, op_text_copy);
+}
+
+/* add the text to the texts waiting to be encoded together */
+static int ex_add_run(ex_t *ex, const char *text, word_t length)
+{
+	int rc = MUSTACH_OK;
+	unsigned idx;
+	word_t total = length;
+
+	for (idx = 0 ; idx < ex->nrun ; idx++)
+		total += ex->runlen[idx];
+	if (ex->nrun == RUN_MAX || total > WVAL_MAX || total < length)
+		rc = ex_flush_run(ex);
+	if (rc == MUSTACH_OK) {
+		ex->runtxt[ex->nrun] = text;
+		ex->runlen[ex->nrun++] = length;
+	}
+	return rc;
+}
+
+/* record the pending text if any for being encoded */
 static int ex_code_pending_text(ex_t *ex)
 {
 	int rc = MUSTACH_OK;
@@ -1032,12 +1346,21 @@ static int ex_code_pending_text(ex_t *ex)
 		if (!ex->alone)
 			length += ex->length2;
 		if (length > 0)
-			rc = put_text(ex, ex->text, length, op_text);
+			rc = ex_add_run(ex, ex->text, length);
 		ex->pending = 0;
 	}
 	return rc;
 }
 
+/* encode the pending texts if any */
+static int ex_flush_text(ex_t *ex)
+{
+	int rc = ex_code_pending_text(ex);
+	if (rc == MUSTACH_OK)
+		rc = ex_flush_run(ex);
+	return rc;
+}
+
 /* encode a simple tag: replacement with or without escaping
  * and partials */
 static int ex_simple(
@@ -1047,7 +1370,7 @@ static int ex_simple(
 		word_t txtlen,
 		op_t op
 ) {
-	int rc = ex_code_pending_text(ex);
+	int rc = ex_flush_text(ex);
 	if (rc == MUSTACH_OK) {
 		rc = put_line(ex, line);
 		if (rc == MUSTACH_OK)
@@ -1064,7 +1387,7 @@ static int ex_begin(
 		word_t txtlen,
 		op_t op
 ) {
-	int rc = ex_code_pending_text(ex);
+	int rc = ex_flush_text(ex);
 	if (rc == MUSTACH_OK) {
 		rc = put_line(ex, line);
 		if (rc == MUSTACH_OK)
@@ -1077,7 +1400,7 @@ static int ex_begin(
 static int ex_end(ex_t *ex, word_t line, const char *txt, word_t txtlen)
 {
 	(void)line;/*make compiler happy #@!%!!*/
-	int rc = ex_code_pending_text(ex);
+	int rc = ex_flush_text(ex);
 	if (rc == MUSTACH_OK)
 		rc = put_end(ex, txt, txtlen);
 	return rc;
@@ -1101,7 +1424,7 @@ static int ex_prefix(ex_t *ex)
 	}
 
 	/* encode pending */
-	rc = ex_code_pending_text(ex);
+	rc = ex_flush_text(ex);
 	if (rc == MUSTACH_OK && length != 0)
 		/* encode the computed prefix */
 		rc = put_text(ex, text, length, op_prefix);
@@ -1175,6 +1498,7 @@ static int ex_build(ex_t *ex)
 	len = mustach_sbuf_length(&ex->sbuf);
 	if (len > WORD_MAX)
 		return exerr_too_big(ex);
+	ex->textlen = (word_t)len;
 
 	/* init */
 	templ = ex->sbuf.value;
@@ -1188,6 +1512,11 @@ static int ex_build(ex_t *ex)
 		beg = bop = templ;
 		line = lincptr;
 		for (;;) {
+			/* out of standalone state, only opening delimiter
+			 * and end of lines are of interest, skip the rest */
+			if (!stdalone)
+				beg = mustach_scan3(beg, end, *opstr, '\r', '\n');
+
 			/* check not at end */
 			if (beg == end) {
 				/* add the text segment */
@@ -1246,7 +1575,9 @@ static int ex_build(ex_t *ex)
 		/* search next closing delimiter */
 		term = tag;
 		for (;;) {
-			if (term == end)
+			if (term != end)
+				term = memchr(term, *clstr, (size_t)(end - term));
+			if (term == NULL || term == end)
 				return exerr_bad_end(ex);
 			if (*term++ == *clstr
 			 && (end - term) >= (ssize_t)(cllen - 1)
@@ -1421,7 +1752,7 @@ static int ex_make(ex_t *ex)
 		return rc;
 
 	/* force emission of text */
-	rc = ex_code_pending_text(ex);
+	rc = ex_flush_text(ex);
 	if (rc != MUSTACH_OK)
 		return rc;
 
@@ -1442,7 +1773,10 @@ static int ex_make(ex_t *ex)
 		return rc;
 
 	/* store everything */
-	return store(ex);
+	rc = store(ex);
+	if (rc == MUSTACH_OK)
+		ex_compact(ex);
+	return rc;
 }
 
 /*******************************************************************/
@@ -1451,9 +1785,13 @@ static int ex_make(ex_t *ex)
 /*******************************************************************/
 /*******************************************************************/
 
-/* predeclaration of the 2 evaluation primitives */
+/* predeclaration of the 3 evaluation primitives */
 static int ap_single(ap_t *ap);
 static int ap_loop(ap_t *ap);
+static int ap_run(ap_t *ap);
+
+/* predeclaration of the output of pulled applications */
+static int pl_write(void *closure, const char *text, size_t length);
 
 /* extract the word at current read position and
  * advance the read position to the next word to be read.
@@ -1529,15 +1867,9 @@ static void ap_goto(ap_t *ap, unsigned addr)
 	ap->off = AOFF(addr);
 	/* move to block */
 	if (iblk != ap->iblk) {
-		/* search the block */
-		if (iblk < ap->iblk)
-			do {
-				ap->blk = ap->blk->prev;
-			} while (iblk < --ap->iblk);
-		else
-			do {
-				ap->blk = ap->blk->next;
-			} while (iblk < ++ap->iblk);
+		/* get the block from the index */
+		ap->iblk = iblk;
+		ap->blk = ap->templ->blocks[iblk];
 		/* update copies */
 		ap->words = ap->blk->words;
 		ap->count = ap->blk->count;		
@@ -1547,20 +1879,35 @@ static void ap_goto(ap_t *ap, unsigned addr)
 /* emit unescaped text */
 static int ap_emit_raw(ap_t *ap, const char *text, size_t length)
 {
+	if (ap->pull != NULL)
+		return pl_write(ap->pull, text, length);
 	return ap->itf->emit_raw != NULL
 		? ap->itf->emit_raw(ap->closure, text, length)
 		: ap->itf->emit_esc(ap->closure, text, length, 0);
 }
 
+/* escape the text using the function 'escape' of the interface if any */
+static int ap_escape(ap_t *ap, const char *text, size_t length,
+		int (*write)(void *, const char *, size_t), void *closure)
+{
+	if (ap->itf->version >= MUSTACH_APPLY_ITF_VERSION_2 && ap->itf->escape != NULL)
+		return ap->itf->escape(ap->closure, text, length, write, closure);
+	return mustach_escape(text, length, write, closure);
+}
+
 /* emit escaped text */
 static int ap_emit_esc(ap_t *ap, const char *text, size_t length, int esc)
 {
+	if (ap->pull != NULL)
+		return esc
+			? ap_escape(ap, text, length, pl_write, ap->pull)
+			: pl_write(ap->pull, text, length);
 	if (ap->itf->emit_esc != NULL)
 		return ap->itf->emit_esc(ap->closure, text, length, esc);
 	if (esc == 0)
 		return ap->itf->emit_raw(ap->closure, text, length);
 
-	return mustach_escape(text, length, ap->itf->emit_raw, ap->closure);
+	return ap_escape(ap, text, length, ap->itf->emit_raw, ap->closure);
 }
 
 /* emit the prefixes if it is required */
@@ -1641,6 +1988,13 @@ static int ap_text(ap_t *ap, word_t length)
 	return ap_any_text(ap, text, length, 0, 1);
 }
 
+/* emit the text copied in the code */
+static int ap_text_copy(ap_t *ap, word_t length)
+{
+	const char *text = get_text_copy(ap, length);
+	return ap_any_text(ap, text, length, 0, 1);
+}
+
 /* emit the value of the tag with or without escaping */
 static int ap_repl(ap_t *ap, word_t length, int escape)
 {
@@ -1655,6 +2009,17 @@ static int ap_repl(ap_t *ap, word_t length, int escape)
 	return rc;
 }
 
+/* append the prefix to the list of prefixes,
+ * returns the link to reset for removing it */
+static pref_t **ap_push_prefix(ap_t *ap, pref_t *prefix)
+{
+	pref_t **lppref = &ap->prefix;
+	while (*lppref != NULL)
+		lppref = &(*lppref)->next;
+	*lppref = prefix;
+	return lppref;
+}
+
 /* append the prefix to the list of prefixes
  * and eval a single item with it */
 static int ap_prefix(ap_t *ap, word_t length, unsigned add)
@@ -1666,10 +2031,7 @@ static int ap_prefix(ap_t *ap, word_t length, unsigned add)
 		.start = get_text(ap, length),
 		.next = NULL
 	};
-	pref_t **lppref = &ap->prefix;
-	while (*lppref != NULL)
-		lppref = &(*lppref)->next;
-	*lppref = &prefix;
+	pref_t **lppref = ap_push_prefix(ap, &prefix);
 	rc = ap_single(ap);
 	*lppref = NULL;
 	return rc;
@@ -1719,7 +2081,7 @@ static int ap_while(ap_t *ap, word_t length)
 }
 
 /* check next case of while */
-static int ap_next(ap_t *ap, unsigned addr)
+static int ap_next(ap_t *ap, word_t addr)
 {
 	/* try enter next item of the section */
 	int rc = ap->itf->next(ap->closure);
@@ -1762,6 +2124,18 @@ static void ap_unmake_partial(ap_t *ap, mustach_template_t *part)
 	mustach_destroy_template(part, NULL, NULL);
 }
 
+/* query interface for retriving the partial of name */
+static int ap_partial_get_name(
+		ap_t *ap,
+		const char *name,
+		word_t length,
+		mustach_template_t **part
+) {
+	return ap->itf->partial_get != NULL
+		? ap->itf->partial_get(ap->closure, name, length, part)
+		: ap_make_partial(ap, name, length, part);
+}
+
 /* read the current partial name as a tag of given length
  * and query interface for retriving it */
 static int ap_partial_get(
@@ -1773,9 +2147,7 @@ static int ap_partial_get(
 	const char *name = get_tag(ap, length);
 
 	/* try to get it */
-	return ap->itf->partial_get != NULL
-		? ap->itf->partial_get(ap->closure, name, length, part)
-		: ap_make_partial(ap, name, length, part);
+	return ap_partial_get_name(ap, name, length, part);
 }
 
 /* read the current partial name as a tag of given length
@@ -1789,6 +2161,33 @@ static void ap_partial_put(ap_t *ap, mustach_template_t *part)
 		ap_unmake_partial(ap, part);
 }
 
+/* init the application 'ap' of the partial 'part' of given 'parent' */
+static void ap_partial_init(
+		ap_t *ap,
+		ap_t *pap,
+		mustach_template_t *part,
+		ap_t *parent
+) {
+	ap->base = part->base;
+	ap->blk = &part->first_block;
+	ap->count = ap->blk->count;
+	ap->words = ap->blk->words;
+	ap->off = 0;
+	ap->iblk = 0;
+	ap->line = 1;
+	ap->beoflin = pap->beoflin;
+	ap->nesting = pap->nesting + 1;
+	ap->orig = 0;
+	ap->aflags = pap->aflags;
+	ap->prefix = pap->prefix;
+	ap->itf = pap->itf;
+	ap->closure = pap->closure;
+	ap->parent = parent;
+	ap->tflags = part->flags;
+	ap->templ = part;
+	ap->pull = pap->pull;
+}
+
 /* apply the partial 'part' of given 'parent' */
 static int ap_partial_eval(
 		ap_t *pap,
@@ -1802,27 +2201,9 @@ static int ap_partial_eval(
 	if (pap->nesting >= MUSTACH_MAX_NESTING)
 		return MUSTACH_ERROR_TOO_MUCH_NESTING;
 
-	/* init local application structure */
-	ap.base = part->sbuf.value;
-	ap.blk = &part->first_block;
-	ap.count = ap.blk->count;
-	ap.words = ap.blk->words;
-	ap.off = 0;
-	ap.iblk = 0;
-	ap.line = 1;
-	ap.nesting = pap->nesting + 1;
-	ap.orig = 0;
-	ap.aflags = pap->aflags;
-	ap.prefix = pap->prefix;
-	ap.itf = pap->itf;
-	ap.closure = pap->closure;
-	ap.parent = parent;
-	ap.tflags = part->flags;
-	ap.templ = part;
-
 	/* apply the partial */
-	ap.beoflin = pap->beoflin;
-	rc = ap_loop(&ap);
+	ap_partial_init(&ap, pap, part, parent);
+	rc = ap_run(&ap);
 	pap->beoflin = ap.beoflin;
 	return rc;
 }
@@ -1904,51 +2285,247 @@ static int ap_block(ap_t *ap, word_t length)
 	return rc;
 }
 
-/* evaluate application of one operation */
+/*
+* Evaluation of operations is dispatched using a table of
+* functions indexed by the operator. Values returned are
+* MUSTACH_OK for continuing the evaluation, a negative error
+* code or a positive value for stopping it.
+*/
+
+/* set the current line */
+static int ap_op_line(ap_t *ap, word_t arg)
+{
+	ap->line = arg;
+	return MUSTACH_OK;
+}
+
+/* replace without escaping */
+static int ap_op_repl_raw(ap_t *ap, word_t arg)
+{
+	return ap_repl(ap, arg, 0);
+}
+
+/* replace with escaping */
+static int ap_op_repl_esc(ap_t *ap, word_t arg)
+{
+	return ap_repl(ap, arg, 1);
+}
+
+/* add a prefix */
+static int ap_op_prefix(ap_t *ap, word_t arg)
+{
+	return ap_prefix(ap, arg, 1);
+}
+
+/* remove a prefix */
+static int ap_op_unprefix(ap_t *ap, word_t arg)
+{
+	return ap_prefix(ap, arg, 0);
+}
+
+/* stop evaluation */
+static int ap_op_stop(ap_t *ap, word_t arg)
+{
+	(void)ap; (void)arg;/*make compiler happy #@!%!!*/
+	return MUSTACH_OK + 1;
+}
+
+/* table of operations */
+static int (*const ap_ops[1 << WOPBITS])(ap_t *ap, word_t arg) = {
+	[op_stop] = ap_op_stop,
+	[op_line] = ap_op_line,
+	[op_text] = ap_text,
+	[op_repl_raw] = ap_op_repl_raw,
+	[op_repl_esc] = ap_op_repl_esc,
+	[op_partial] = ap_partial,
+	[op_while] = ap_while,
+	[op_next] = ap_next,
+	[op_unless] = ap_unless,
+	[op_parent] = ap_parent,
+	[op_block] = ap_block,
+	[op_end] = ap_op_stop,
+	[op_prefix] = ap_op_prefix,
+	[op_unprefix] = ap_op_unprefix,
+	[op_text_copy] = ap_text_copy,
+	[15] = ap_op_stop
+};
+
+/* evaluate application of one operation, lines excepted */
 static int ap_single(ap_t *ap)
 {
 	word_t code = get_word(ap);
-	unsigned arg = WVAL(code);
-	switch (WOP(code)) {
-	case op_line:
-		ap->line = arg;
-		return ap_single(ap);
-	case op_text:
-		return ap_text(ap, arg);
-	case op_repl_raw:
-		return ap_repl(ap, arg, 0);
-	case op_repl_esc:
-		return ap_repl(ap, arg, 1);
-	case op_partial:
-		return ap_partial(ap, arg);
-	case op_while:
-		return ap_while(ap, arg);
-	case op_next:
-		return ap_next(ap, arg);
-	case op_unless:
-		return ap_unless(ap, arg);
-	case op_block:
-		return ap_block(ap, arg);
-	case op_parent:
-		return ap_parent(ap, arg);
-	case op_prefix:
-		return ap_prefix(ap, arg, 1);
-	case op_unprefix:
-		return ap_prefix(ap, arg, 0);
-	case op_stop:
-	case op_end:
-	default:
-		return MUSTACH_OK + 1;
+	while (WOP(code) == op_line) {
+		ap->line = WVAL(code);
+		code = get_word(ap);
 	}
+	return ap_ops[WOP(code)](ap, WVAL(code));
 }
 
+#if defined(__GNUC__) && !defined(MUSTACH_NO_COMPUTED_GOTO)
+/* evaluate operations until stop or end using computed gotos */
 static int ap_loop(ap_t *ap)
+{
+	static const void *const labels[1 << WOPBITS] = {
+		[op_stop] = &&stop,
+		[op_line] = &&line,
+		[op_text] = &&text,
+		[op_repl_raw] = &&repl_raw,
+		[op_repl_esc] = &&repl_esc,
+		[op_partial] = &&partial,
+		[op_while] = &&while_,
+		[op_next] = &&next,
+		[op_unless] = &&unless,
+		[op_parent] = &&parent,
+		[op_block] = &&block,
+		[op_end] = &&stop,
+		[op_prefix] = &&prefix,
+		[op_unprefix] = &&unprefix,
+		[op_text_copy] = &&text_copy,
+		[15] = &&stop
+	};
+	word_t code;
+	int rc;
+
+#define DISPATCH() do { code = get_word(ap); goto *labels[WOP(code)]; } while(0)
+#define CHECK(x)   do { rc = (x); if (rc != MUSTACH_OK) goto end; DISPATCH(); } while(0)
+
+	DISPATCH();
+line:
+	ap->line = WVAL(code);
+	DISPATCH();
+text:
+	CHECK(ap_text(ap, WVAL(code)));
+text_copy:
+	CHECK(ap_text_copy(ap, WVAL(code)));
+repl_raw:
+	CHECK(ap_repl(ap, WVAL(code), 0));
+repl_esc:
+	CHECK(ap_repl(ap, WVAL(code), 1));
+partial:
+	CHECK(ap_partial(ap, WVAL(code)));
+while_:
+	CHECK(ap_while(ap, WVAL(code)));
+next:
+	CHECK(ap_next(ap, WVAL(code)));
+unless:
+	CHECK(ap_unless(ap, WVAL(code)));
+parent:
+	CHECK(ap_parent(ap, WVAL(code)));
+block:
+	CHECK(ap_block(ap, WVAL(code)));
+prefix:
+	CHECK(ap_prefix(ap, WVAL(code), 1));
+unprefix:
+	CHECK(ap_prefix(ap, WVAL(code), 0));
+stop:
+	return MUSTACH_OK;
+end:
+	return rc < MUSTACH_OK ? rc : MUSTACH_OK;
+
+#undef CHECK
+#undef DISPATCH
+}
+#else
+/* evaluate operations until stop or end using the table */
+static int ap_loop(ap_t *ap)
+{
+	word_t code;
+	int rc;
+	do {
+		code = get_word(ap);
+		rc = ap_ops[WOP(code)](ap, WVAL(code));
+	} while (rc == MUSTACH_OK);
+	return rc < MUSTACH_OK ? rc : MUSTACH_OK;
+}
+#endif
+
+/* evaluate the template of ap, native or not */
+static int ap_run(ap_t *ap)
 {
 	int rc;
-	do { rc = ap_single(ap); } while (rc == MUSTACH_OK);
+
+	if (ap->templ->native == NULL)
+		return ap_loop(ap);
+	rc = ap->templ->native((mustach_native_t*)ap);
 	return rc < MUSTACH_OK ? rc : MUSTACH_OK;
 }
 
+/*******************************************************************/
+/*******************************************************************/
+/** PART walking of templates  *************************************/
+/*******************************************************************/
+/*******************************************************************/
+
+/* walk the code of ap until stop or the address 'until' */
+static int wk_seq(
+		ap_t *ap,
+		const mustach_walk_itf_t *itf,
+		void *closure,
+		word_t until
+) {
+	int rc = MUSTACH_OK, kind;
+	word_t code, length, addr;
+	const char *text;
+
+	while (rc == MUSTACH_OK && MKA(ap->iblk, ap->off) != until) {
+		code = get_word(ap);
+		length = WVAL(code);
+		switch (WOP(code)) {
+		case op_line:
+			if (itf->line != NULL)
+				rc = itf->line(closure, length);
+			break;
+		case op_text:
+		case op_text_copy:
+			text = WOP(code) == op_text ? get_text(ap, length) : get_text_copy(ap, length);
+			if (itf->text != NULL)
+				rc = itf->text(closure, text, length);
+			break;
+		case op_repl_raw:
+		case op_repl_esc:
+			text = get_tag(ap, length);
+			if (itf->repl != NULL)
+				rc = itf->repl(closure, text, length, WOP(code) == op_repl_esc);
+			break;
+		case op_prefix:
+		case op_unprefix:
+			text = get_text(ap, length);
+			if (itf->prefix != NULL)
+				rc = itf->prefix(closure, text, length);
+			break;
+		case op_partial:
+			text = get_tag(ap, length);
+			if (itf->partial != NULL)
+				rc = itf->partial(closure, text, length);
+			break;
+		case op_while:
+		case op_unless:
+		case op_parent:
+		case op_block:
+			kind = WOP(code) == op_while ? Mustach_Walk_Section
+			     : WOP(code) == op_unless ? Mustach_Walk_Inverted
+			     : WOP(code) == op_parent ? Mustach_Walk_Parent
+			     : Mustach_Walk_Block;
+			text = get_tag(ap, length);
+			addr = get_word(ap);
+			if (itf->enter != NULL)
+				rc = itf->enter(closure, kind, text, length);
+			if (rc == MUSTACH_OK)
+				rc = wk_seq(ap, itf, closure, addr);
+			if (rc == MUSTACH_OK && itf->leave != NULL)
+				rc = itf->leave(closure, kind);
+			break;
+		case op_next:
+		case op_end:
+			/* end of sections, parents and blocks */
+			break;
+		default:
+			return MUSTACH_OK;
+		}
+	}
+	return rc;
+}
+
 /*******************************************************************/
 /*******************************************************************/
 /** PART public functions  *****************************************/
@@ -1961,20 +2538,66 @@ void mustach_destroy_template(
 		const mustach_build_itf_t *itf,
 		void *closure
 ) {
+	ext_t *ext;
+
 	if (templ != NULL) {
-		/* destroy blocks of the template */
-		block_t *blk = templ->first_block.next;
-		while (blk != NULL) {
-			block_t *b = blk;
-			blk = blk->next;
-			dealloc(b, itf, closure);
+		while ((ext = templ->exts) != NULL) {
+			templ->exts = ext->next;
+			if (ext->destroy != NULL)
+				ext->destroy(ext->value);
+			free(ext);
 		}
-		/* destroy main of the template */
 		mustach_sbuf_release(&templ->sbuf);
-		dealloc(templ, itf, closure);
+		release_memory(templ, itf, closure);
 	}
 }
 
+/* see header file */
+mustach_template_t *mustach_ref_template(
+		mustach_template_t *templ
+) {
+#if defined(__GNUC__)
+	__atomic_add_fetch(&templ->refcount, 1, __ATOMIC_RELAXED);
+#else
+	templ->refcount++;
+#endif
+	return templ;
+}
+
+/* see header file */
+void mustach_unref_template(
+		mustach_template_t *templ,
+		const mustach_build_itf_t *itf,
+		void *closure
+) {
+	if (templ != NULL
+#if defined(__GNUC__)
+	 && __atomic_sub_fetch(&templ->refcount, 1, __ATOMIC_ACQ_REL) == 0
+#else
+	 && --templ->refcount == 0
+#endif
+	)
+		mustach_destroy_template(templ, itf, closure);
+}
+
+/* see header file */
+size_t mustach_get_template_size(
+		mustach_template_t *templ
+) {
+	const block_t *blk = &templ->first_block;
+	size_t size = templ->compact;
+	if (size == 0) {
+		size = sizeof *templ + blk->count * sizeof(word_t);
+		if (templ->name != NULL)
+			size += 1 + templ->length;
+		while ((blk = blk->next) != NULL)
+			size += sizeof *blk + sizeof(block_t*) + blk->count * sizeof(word_t);
+	}
+	if (templ->sbuf.releasecb != NULL)
+		size += mustach_sbuf_length(&templ->sbuf);
+	return size;
+}
+
 /* see header file */
 int mustach_build_template(
 		mustach_template_t **templ,
@@ -2041,6 +2664,61 @@ void *mustach_get_template_data(
 		? templ->data[index] : NULL;
 }
 
+/* see header file */
+void *mustach_get_template_ext(
+		mustach_template_t *templ,
+		const void *key
+) {
+	ext_t *ext;
+
+#if defined(__GNUC__)
+	ext = __atomic_load_n(&templ->exts, __ATOMIC_ACQUIRE);
+#else
+	ext = templ->exts;
+#endif
+	while (ext != NULL && ext->key != key)
+		ext = ext->next;
+	return ext == NULL ? NULL : ext->value;
+}
+
+/* see header file */
+void *mustach_set_template_ext(
+		mustach_template_t *templ,
+		const void *key,
+		void *value,
+		void (*destroy)(void *value)
+) {
+	ext_t *ext, *head;
+
+	ext = malloc(sizeof *ext);
+	if (ext == NULL)
+		return NULL;
+	ext->key = key;
+	ext->value = value;
+	ext->destroy = destroy;
+#if defined(__GNUC__)
+	head = __atomic_load_n(&templ->exts, __ATOMIC_ACQUIRE);
+	do {
+		for (ext->next = head ; head != NULL ; head = head->next)
+			if (head->key == key) {
+				free(ext);
+				return head->value;
+			}
+		head = ext->next;
+	} while (!__atomic_compare_exchange_n(&templ->exts, &head, ext, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+#else
+	for (head = templ->exts ; head != NULL ; head = head->next)
+		if (head->key == key) {
+			free(ext);
+			return head->value;
+		}
+	ext->next = templ->exts;
+	templ->exts = ext;
+#endif
+	return value;
+}
+
 unsigned mustach_get_template_data_count(
 		mustach_template_t *templ
 ) {
@@ -2062,6 +2740,52 @@ int mustach_get_template_flags(
 	return templ->flags;
 }
 
+/* check validity of the interface, its emit functions only if 'emits'
+ * and otherwise that its escaping isn't only done by 'emit_esc' */
+static int ap_check_itf(const mustach_apply_itf_t *itf, int emits)
+{
+	return itf != NULL
+	    && itf->version >= MUSTACH_APPLY_ITF_VERSION_MIN
+	    && itf->version <= MUSTACH_APPLY_ITF_VERSION_MAX
+	    && (emits
+		? itf->emit_raw != NULL || itf->emit_esc != NULL
+		: itf->emit_esc == NULL
+		  || (itf->version >= MUSTACH_APPLY_ITF_VERSION_2 && itf->escape != NULL))
+	    && itf->get != NULL
+	    && itf->enter != NULL
+	    && itf->next != NULL
+	    && itf->leave != NULL
+	    && (itf->partial_get == NULL) == (itf->partial_put == NULL);
+}
+
+/* init the application 'ap' of the main template 'templ' */
+static void ap_init(
+		ap_t *ap,
+		mustach_template_t *templ,
+		int flags,
+		const mustach_apply_itf_t *itf,
+		void *closure
+) {
+	ap->aflags = flags;
+	ap->base = templ->base;
+	ap->blk = &templ->first_block;
+	ap->count = ap->blk->count;
+	ap->words = ap->blk->words;
+	ap->off = 0;
+	ap->iblk = 0;
+	ap->line = 1;
+	ap->beoflin = 1;
+	ap->nesting = 0;
+	ap->orig = 0;
+	ap->prefix = NULL;
+	ap->itf = itf;
+	ap->closure = closure;
+	ap->parent = NULL;
+	ap->templ = templ;
+	ap->tflags = templ->flags;
+	ap->pull = NULL;
+}
+
 /* see header file */
 int mustach_apply_template(
 		mustach_template_t *templ,
@@ -2073,41 +2797,954 @@ int mustach_apply_template(
 	int rc;
 
 	/* check interface validity */
-	if (itf == NULL
-	 || itf->version != MUSTACH_APPLY_ITF_VERSION_1
-	 || (itf->emit_raw == NULL && itf->emit_esc == NULL)
-	 || itf->get == NULL
-	 || itf->enter == NULL
-	 || itf->next == NULL
-	 || itf->leave == NULL
-	 || ((itf->partial_get == NULL) != (itf->partial_put == NULL)))
+	if (!ap_check_itf(itf, 1))
 		return MUSTACH_ERROR_INVALID_ITF;
 
 	/* process */
 	rc = itf->start == NULL ? MUSTACH_OK : itf->start(closure);
 	if (rc == MUSTACH_OK) {
-		ap.aflags = flags;
-		ap.base = templ->sbuf.value;
-		ap.blk = &templ->first_block;
-		ap.count = ap.blk->count;
-		ap.words = ap.blk->words;
-		ap.off = 0;
-		ap.iblk = 0;
-		ap.line = 1;
-		ap.beoflin = 1;
-		ap.nesting = 0;
-		ap.orig = 0;
-		ap.prefix = NULL;
-		ap.itf = itf;
-		ap.closure = closure;
-		ap.parent = NULL;
-		ap.templ = templ;
-		ap.tflags = templ->flags;
-		rc = ap_loop(&ap);
+		ap_init(&ap, templ, flags, itf, closure);
+		rc = ap_run(&ap);
 	}
 	if (itf->stop)
 		itf->stop(closure, rc);
 	return rc;
 }
 
+/*******************************************************************/
+/*******************************************************************/
+/** PART pulled application of template ****************************/
+/*******************************************************************/
+/*******************************************************************/
+
+/*
+* A pulled application evaluates the code one operation at a time
+* and stops when the buffer of the step is full. It can't recurse
+* as ap_loop does for partials, parents, blocks and prefixes, so
+* these are recorded in a stack of frames. The top frame gives the
+* application whose next operation is evaluated.
+*
+* The output that doesn't fit in the buffer of the step is kept
+* for the next step. So the memory used is the frames and the
+* output of one operation.
+*/
+
+/* kinds of frames */
+#define FR_RUN     0  /* evaluation of a template, a partial or a parent */
+#define FR_BLOCK   1  /* evaluation of a block */
+#define FR_PREFIX  2  /* evaluation of one operation with a prefix */
+
+/* a frame of a pulled application */
+typedef struct fr fr_t;
+struct fr {
+	/* the frame below or the next free frame */
+	fr_t *prev;
+	/* kind of the frame, FR_... */
+	int kind;
+	/* for prefixes, is the operation evaluated? */
+	int done;
+	/* should the caller go to 'addr' when leaving? */
+	int jump;
+	/* address of continuation in the caller */
+	word_t addr;
+	/* the evaluated application */
+	ap_t *ap;
+	/* the application that pushed the frame or NULL */
+	ap_t *caller;
+	/* the partial to put back when leaving or NULL */
+	mustach_template_t *part;
+	/* the prefix and the link for removing it */
+	pref_t pref;
+	pref_t **lppref;
+	/* the application of partials and parents */
+	ap_t own;
+};
+
+/* a pulled application */
+struct mustach_apply {
+	/* the top frame or NULL when evaluation is complete */
+	fr_t *top;
+	/* the frames freed for reuse */
+	fr_t *free;
+	/* the status of the evaluation */
+	int status;
+	/* was the interface stopped? */
+	int stopped;
+	/* the buffer of the step, its size and its filled length */
+	char *buffer;
+	size_t size;
+	size_t length;
+	/* the output kept for next steps, its offset, length and allocated size */
+	char *kept;
+	size_t koff;
+	size_t klen;
+	size_t kalloc;
+	/* the frame of the main template */
+	fr_t main;
+};
+
+/* write the text in the buffer of the step, keeping what doesn't fit */
+static int pl_write(void *closure, const char *text, size_t length)
+{
+	mustach_apply_t *pl = closure;
+	size_t n;
+	char *kept;
+
+	/* copy what fits in the buffer */
+	if (pl->klen == 0) {
+		n = pl->size - pl->length;
+		if (n > length)
+			n = length;
+		memcpy(&pl->buffer[pl->length], text, n);
+		pl->length += n;
+		text += n;
+		length -= n;
+	}
+	if (length == 0)
+		return MUSTACH_OK;
+
+	/* keep the remaining, the kept output is never read while growing */
+	if (pl->klen + length > pl->kalloc) {
+		n = pl->kalloc ? pl->kalloc : 4096;
+		while (n < pl->klen + length)
+			n <<= 1;
+		kept = realloc(pl->kept, n);
+		if (kept == NULL)
+			return MUSTACH_ERROR_OUT_OF_MEMORY;
+		pl->kept = kept;
+		pl->kalloc = n;
+	}
+	memcpy(&pl->kept[pl->klen], text, length);
+	pl->klen += length;
+	return MUSTACH_OK;
+}
+
+/* push a new frame of 'kind' for the 'caller' */
+static fr_t *pl_push(mustach_apply_t *pl, int kind, ap_t *caller)
+{
+	fr_t *fr = pl->free;
+
+	if (fr != NULL)
+		pl->free = fr->prev;
+	else {
+		fr = malloc(sizeof *fr);
+		if (fr == NULL)
+			return NULL;
+	}
+	fr->prev = pl->top;
+	fr->kind = kind;
+	fr->done = 0;
+	fr->jump = 0;
+	fr->addr = 0;
+	fr->ap = caller;
+	fr->caller = caller;
+	fr->part = NULL;
+	pl->top = fr;
+	return fr;
+}
+
+/* pop the top frame, doing what its caller does after its evaluation */
+static void pl_pop(mustach_apply_t *pl)
+{
+	fr_t *fr = pl->top;
+
+	pl->top = fr->prev;
+	if (fr->kind == FR_PREFIX)
+		*fr->lppref = NULL;
+	else if (fr->kind == FR_RUN && fr->caller != NULL)
+		fr->caller->beoflin = fr->own.beoflin;
+	if (fr->jump)
+		ap_goto(fr->caller, fr->addr);
+	if (fr->part != NULL)
+		ap_partial_put(fr->caller, fr->part);
+	if (fr != &pl->main) {
+		fr->prev = pl->free;
+		pl->free = fr;
+	}
+}
+
+/* pop all the frames and stop the interface with 'status' */
+static void pl_stop(mustach_apply_t *pl, int status)
+{
+	const mustach_apply_itf_t *itf = pl->main.own.itf;
+
+	while (pl->top != NULL)
+		pl_pop(pl);
+	if (status < MUSTACH_OK)
+		pl->status = status;
+	if (!pl->stopped) {
+		pl->stopped = 1;
+		if (itf->stop)
+			itf->stop(pl->main.own.closure, status);
+	}
+}
+
+/* push the prefix for the next operation */
+static int pl_prefix(mustach_apply_t *pl, ap_t *ap, word_t length, unsigned add)
+{
+	fr_t *fr = pl_push(pl, FR_PREFIX, ap);
+	if (fr == NULL)
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+	fr->pref.add = add;
+	fr->pref.len = length;
+	fr->pref.start = get_text(ap, length);
+	fr->pref.next = NULL;
+	fr->lppref = ap_push_prefix(ap, &fr->pref);
+	return MUSTACH_OK;
+}
+
+/* push the evaluation of the partial or of the parent */
+static int pl_partial(mustach_apply_t *pl, ap_t *ap, word_t length, int isparent)
+{
+	mustach_template_t *part;
+	ap_t *parent = ap->parent;
+	word_t addr = 0;
+	fr_t *fr;
+	int rc = ap_partial_get(ap, length, &part);
+
+	if (rc != MUSTACH_OK)
+		return rc;
+	if (isparent) {
+		addr = get_word(ap);
+		ap->orig = MKA(ap->iblk, ap->off);
+		parent = ap;
+	}
+
+	/* native partials are evaluated at once, too nested ones fail */
+	if (part->native != NULL || ap->nesting >= MUSTACH_MAX_NESTING) {
+		rc = ap_partial_eval(ap, part, parent);
+		if (isparent)
+			ap_goto(ap, addr);
+		ap_partial_put(ap, part);
+		return rc;
+	}
+	fr = pl_push(pl, FR_RUN, ap);
+	if (fr == NULL) {
+		ap_partial_put(ap, part);
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+	}
+	ap_partial_init(&fr->own, ap, part, parent);
+	fr->ap = &fr->own;
+	fr->part = part;
+	fr->jump = isparent;
+	fr->addr = addr;
+	return MUSTACH_OK;
+}
+
+/* push the evaluation of the block, from the parent if it defines it */
+static int pl_block(mustach_apply_t *pl, ap_t *ap, word_t length)
+{
+	const char *text = get_tag(ap, length);
+	word_t addr = get_word(ap);
+	ap_t *parent = ap_block_parent(ap->parent, text, length);
+	fr_t *fr = pl_push(pl, FR_BLOCK, ap);
+
+	if (fr == NULL)
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+	if (parent != NULL) {
+		fr->ap = parent;
+		fr->jump = 1;
+		fr->addr = addr;
+	}
+	return MUSTACH_OK;
+}
+
+/* evaluate the next operation of the top frame */
+static int pl_single(mustach_apply_t *pl)
+{
+	fr_t *fr = pl->top;
+	ap_t *ap = fr->ap;
+	word_t code;
+	int rc;
+
+	/* the prefix is removed when its operation is evaluated */
+	if (fr->done) {
+		pl_pop(pl);
+		return MUSTACH_OK;
+	}
+
+	/* only the main template can be native */
+	if (ap->templ->native != NULL && fr->kind == FR_RUN) {
+		rc = ap_run(ap);
+		pl_pop(pl);
+		return rc;
+	}
+
+	code = get_word(ap);
+	switch (WOP(code)) {
+	case op_line:
+		ap->line = WVAL(code);
+		return MUSTACH_OK;
+	case op_text:
+		rc = ap_text(ap, WVAL(code));
+		break;
+	case op_text_copy:
+		rc = ap_text_copy(ap, WVAL(code));
+		break;
+	case op_repl_raw:
+		rc = ap_repl(ap, WVAL(code), 0);
+		break;
+	case op_repl_esc:
+		rc = ap_repl(ap, WVAL(code), 1);
+		break;
+	case op_while:
+		rc = ap_while(ap, WVAL(code));
+		break;
+	case op_next:
+		rc = ap_next(ap, WVAL(code));
+		break;
+	case op_unless:
+		rc = ap_unless(ap, WVAL(code));
+		break;
+	case op_partial:
+		rc = pl_partial(pl, ap, WVAL(code), 0);
+		break;
+	case op_parent:
+		rc = pl_partial(pl, ap, WVAL(code), 1);
+		break;
+	case op_block:
+		rc = pl_block(pl, ap, WVAL(code));
+		break;
+	case op_prefix:
+		rc = pl_prefix(pl, ap, WVAL(code), 1);
+		break;
+	case op_unprefix:
+		rc = pl_prefix(pl, ap, WVAL(code), 0);
+		break;
+	default:
+		rc = MUSTACH_OK + 1;
+		break;
+	}
+	if (fr->kind == FR_PREFIX)
+		fr->done = 1;
+	if (rc > MUSTACH_OK) {
+		/* as ap_loop, stop the evaluation of the frame */
+		if (fr->kind == FR_PREFIX)
+			pl_pop(pl);
+		pl_pop(pl);
+		rc = MUSTACH_OK;
+	}
+	return rc;
+}
+
+/* see header file */
+int mustach_apply_begin(
+		mustach_apply_t **apply,
+		mustach_template_t *templ,
+		int flags,
+		const mustach_apply_itf_t *itf,
+		void *closure
+) {
+	mustach_apply_t *pl;
+	int rc;
+
+	/* check interface validity */
+	*apply = NULL;
+	if (!ap_check_itf(itf, 0))
+		return MUSTACH_ERROR_INVALID_ITF;
+
+	/* allocate */
+	pl = malloc(sizeof *pl);
+	if (pl == NULL)
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+	pl->top = &pl->main;
+	pl->free = NULL;
+	pl->status = MUSTACH_OK;
+	pl->stopped = 0;
+	pl->buffer = NULL;
+	pl->size = pl->length = 0;
+	pl->kept = NULL;
+	pl->koff = pl->klen = pl->kalloc = 0;
+	pl->main.prev = NULL;
+	pl->main.kind = FR_RUN;
+	pl->main.done = 0;
+	pl->main.jump = 0;
+	pl->main.ap = &pl->main.own;
+	pl->main.caller = NULL;
+	pl->main.part = NULL;
+	ap_init(&pl->main.own, templ, flags, itf, closure);
+	pl->main.own.pull = pl;
+
+	/* start */
+	rc = itf->start == NULL ? MUSTACH_OK : itf->start(closure);
+	if (rc != MUSTACH_OK) {
+		if (itf->stop)
+			itf->stop(closure, rc);
+		free(pl);
+		return rc;
+	}
+	*apply = pl;
+	return MUSTACH_OK;
+}
+
+/* see header file */
+int mustach_apply_step(
+		mustach_apply_t *apply,
+		char *buffer,
+		size_t size,
+		size_t *written
+) {
+	size_t n;
+	int rc;
+
+	/* give first the kept output */
+	n = apply->klen < size ? apply->klen : size;
+	if (n != 0) {
+		memcpy(buffer, &apply->kept[apply->koff], n);
+		apply->klen -= n;
+		apply->koff = apply->klen == 0 ? 0 : apply->koff + n;
+	}
+
+	/* evaluate until the buffer is full */
+	apply->buffer = buffer;
+	apply->size = size;
+	apply->length = n;
+	while (apply->top != NULL && apply->klen == 0 && apply->length < size) {
+		rc = pl_single(apply);
+		if (rc != MUSTACH_OK)
+			pl_stop(apply, rc);
+		else if (apply->top == NULL)
+			pl_stop(apply, MUSTACH_OK);
+	}
+	*written = apply->length;
+	apply->buffer = NULL;
+	apply->size = apply->length = 0;
+
+	if (apply->status != MUSTACH_OK)
+		return apply->status;
+	return apply->top != NULL || apply->klen != 0 ? 1 : MUSTACH_OK;
+}
+
+/* see header file */
+void mustach_apply_end(mustach_apply_t *apply)
+{
+	fr_t *fr;
+
+	if (apply != NULL) {
+		pl_stop(apply, MUSTACH_OK + 1);
+		while ((fr = apply->free) != NULL) {
+			apply->free = fr->prev;
+			free(fr);
+		}
+		free(apply->kept);
+		free(apply);
+	}
+}
+
+/*******************************************************************/
+/*******************************************************************/
+/** PART saving and loading templates ******************************/
+/*******************************************************************/
+/*******************************************************************/
+
+/*
+* The image of a saved template is made of 32 bits words
+* in the byte order of the host, as below:
+*
+*   - magic:    the 4 characters M S T C
+*   - order:    the value 0x01020304 for checking byte order
+*   - version:  the version of the format of images
+*   - boffbits: the value of BOFFBITS
+*   - flags:    the build flags of the template
+*   - namelen:  length of the name plus one or zero if no name
+*   - textlen:  length of the text
+*   - nblocks:  count of blocks
+*   - counts:   count of words of each block (nblocks words)
+*   - code:     the words of the blocks, one block after the other
+*   - text:     the text followed by a nul
+*   - name:     the name followed by a nul, if any
+*
+* Addresses in the code are made of a block index and of an
+* offset, and texts are referenced by their offset in the
+* text. So images don't depend on their location in memory.
+*/
+
+/* the magic of images */
+#define IMAGE_MAGIC     "MSTC"
+/* the value for checking byte order */
+#define IMAGE_ORDER     0x01020304
+/* the current version of images (version 2 adds op_text_copy) */
+#define IMAGE_VERSION   2
+/* the oldest version of images still readable */
+#define IMAGE_VERSION_MIN 1
+/* count of words of the header of images */
+#define IMAGE_HEADER    8
+
+/* see header file */
+int mustach_save_template(
+		mustach_template_t *templ,
+		int (*write)(void *closure, const char *buffer, size_t size),
+		void *closure
+) {
+	word_t head[IMAGE_HEADER], count;
+	const block_t *blk;
+	int rc;
+
+	/* native templates have no code */
+	if (templ->native != NULL)
+		return MUSTACH_ERROR_BAD_DATA;
+
+	/* make the header */
+	memcpy(&head[0], IMAGE_MAGIC, sizeof(word_t));
+	head[1] = IMAGE_ORDER;
+	head[2] = IMAGE_VERSION;
+	head[3] = BOFFBITS;
+	head[4] = (word_t)templ->flags;
+	head[5] = templ->name == NULL ? 0 : templ->length + 1;
+	head[6] = templ->textlen;
+	head[7] = 0;
+	for (blk = &templ->first_block ; blk != NULL ; blk = blk->next)
+		head[7]++;
+	rc = write(closure, (const char*)head, sizeof head);
+
+	/* write counts of words of blocks */
+	for (blk = &templ->first_block ; rc == MUSTACH_OK && blk != NULL ; blk = blk->next) {
+		count = blk->count;
+		rc = write(closure, (const char*)&count, sizeof count);
+	}
+
+	/* write the code */
+	for (blk = &templ->first_block ; rc == MUSTACH_OK && blk != NULL ; blk = blk->next)
+		rc = write(closure, (const char*)blk->words, blk->count * sizeof(word_t));
+
+	/* write the text and the name */
+	if (rc == MUSTACH_OK)
+		rc = write(closure, templ->base, templ->textlen);
+	if (rc == MUSTACH_OK)
+		rc = write(closure, "", 1);
+	if (rc == MUSTACH_OK && templ->name != NULL)
+		rc = write(closure, templ->name, templ->length + 1);
+	return rc;
+}
+
+/*
+* The code of an image is verified before being used: its reading
+* never goes past the last word of the last block, its texts are
+* in the text of the image or nul terminated in the code, its
+* sections are well nested and the addresses of their code are
+* the ones reached when reading it.
+*/
+
+/* reading state of the verification */
+typedef
+struct {
+	/* the verified template */
+	mustach_template_t *templ;
+	/* count of blocks of the template */
+	word_t nblocks;
+	/* the current block */
+	const block_t *blk;
+	/* index of the current block */
+	word_t iblk;
+	/* offset in the current block */
+	word_t off;
+}
+	vf_t;
+
+/* check that count words can be read and skip them
+ * as done by get_word and get_text_copy */
+static int vf_skip(vf_t *vf, word_t count)
+{
+	word_t avail = vf->blk->count - vf->off;
+	if (count > avail || (count == avail && vf->iblk + 1 == vf->nblocks))
+		return 0;
+	vf->off += count;
+	if (count == avail) {
+		vf->iblk++;
+		vf->blk = vf->blk->next;
+		vf->off = 0;
+	}
+	return 1;
+}
+
+/* read a word */
+static int vf_word(vf_t *vf, word_t *word)
+{
+	const word_t *pw = &vf->blk->words[vf->off];
+	if (!vf_skip(vf, 1))
+		return 0;
+	*word = *pw;
+	return 1;
+}
+
+/* check a text of length, copied in the code or not */
+static int vf_text(vf_t *vf, word_t length, int copied)
+{
+	const char *text;
+	word_t offset;
 
+	if (!copied)
+		return vf_word(vf, &offset)
+			&& offset <= vf->templ->textlen
+			&& length <= vf->templ->textlen - offset;
+	text = (const char*)&vf->blk->words[vf->off];
+	return vf_skip(vf, 1 + length / sizeof(word_t)) && text[length] == 0;
+}
+
+/* verify the code of the template of nblocks blocks, returns 0 if invalid */
+static int vf_code(mustach_template_t *templ, word_t nblocks)
+{
+	/* sections use at least 2 of the 3 * MUSTACH_MAX_DEPTH words of the build stack */
+	struct { op_t op; word_t body, end; } stack[3 * MUSTACH_MAX_DEPTH / 2];
+	int tags = (templ->flags & Mustach_Build_Null_Term_Tag) != 0;
+	int texts = (templ->flags & Mustach_Build_Null_Term_Text) != 0;
+	vf_t vf = { templ, nblocks, &templ->first_block, 0, 0 };
+	word_t code, addr, top = 0;
+
+	for (;;) {
+		/* operations must be addressable */
+		if (vf.off >= (1 << BOFFBITS) || vf.iblk > ABLK(WORD_MAX))
+			return 0;
+		addr = MKA(vf.iblk, vf.off);
+
+		/* inverted sections have no closing operation */
+		while (top > 0 && stack[top - 1].op == op_unless && stack[top - 1].end == addr)
+			top--;
+		if (top > 0 && stack[top - 1].end <= addr)
+			return 0;
+
+		if (!vf_word(&vf, &code))
+			return 0;
+		switch (WOP(code)) {
+		case op_stop:
+			return top == 0;
+		case op_line:
+			break;
+		case op_text:
+		case op_prefix:
+		case op_unprefix:
+			if (!vf_text(&vf, WVAL(code), texts))
+				return 0;
+			break;
+		case op_text_copy:
+			if (!vf_text(&vf, WVAL(code), 1))
+				return 0;
+			break;
+		case op_repl_raw:
+		case op_repl_esc:
+		case op_partial:
+			if (!vf_text(&vf, WVAL(code), tags))
+				return 0;
+			break;
+		case op_while:
+		case op_unless:
+		case op_parent:
+		case op_block:
+			if (top == sizeof stack / sizeof *stack
+			 || !vf_text(&vf, WVAL(code), tags)
+			 || !vf_word(&vf, &addr))
+				return 0;
+			stack[top].op = WOP(code);
+			stack[top].body = MKA(vf.iblk, vf.off);
+			stack[top].end = addr;
+			top++;
+			break;
+		case op_next:
+			if (top == 0
+			 || stack[top - 1].op != op_while
+			 || stack[top - 1].body != WVAL(code)
+			 || stack[top - 1].end != MKA(vf.iblk, vf.off))
+				return 0;
+			top--;
+			break;
+		case op_end:
+			if (top == 0
+			 || (stack[top - 1].op != op_parent && stack[top - 1].op != op_block)
+			 || stack[top - 1].end != MKA(vf.iblk, vf.off))
+				return 0;
+			top--;
+			break;
+		default:
+			return 0;
+		}
+	}
+}
+
+/* see header file */
+int mustach_load_template(
+		mustach_template_t **templ,
+		const mustach_sbuf_t *sbuf,
+		const mustach_build_itf_t *itf,
+		void *closure
+) {
+	const char *image = sbuf->value, *code, *text, *name;
+	word_t head[IMAGE_HEADER], count, iblk, nblocks, namelen, textlen;
+	size_t size = sbuf->length, total;
+	mustach_template_t *result = NULL;
+	block_t *blk = NULL;
+	int rc;
+
+	/* check the header */
+	if (image == NULL || size < sizeof head)
+		goto invalid;
+	memcpy(head, image, sizeof head);
+	if (memcmp(&head[0], IMAGE_MAGIC, sizeof(word_t))
+	 || head[1] != IMAGE_ORDER
+	 || head[2] < IMAGE_VERSION_MIN
+	 || head[2] > IMAGE_VERSION
+	 || head[3] != BOFFBITS
+	 || (head[4] & ~(word_t)Mustach_Build_All_Flags_Mask) != 0
+	 || head[7] == 0)
+		goto invalid;
+	namelen = head[5];
+	textlen = head[6];
+	nblocks = head[7];
+
+	/* check the size */
+	total = sizeof head;
+	if ((size - total) / sizeof(word_t) < nblocks)
+		goto invalid;
+	code = &image[total + nblocks * sizeof(word_t)];
+	total += nblocks * sizeof(word_t);
+	for (iblk = 0 ; iblk < nblocks ; iblk++) {
+		memcpy(&count, &image[sizeof head + iblk * sizeof count], sizeof count);
+		if ((size - total) / sizeof(word_t) < count)
+			goto invalid;
+		total += count * sizeof(word_t);
+	}
+	if (size - total <= textlen || size - total - textlen - 1 < namelen)
+		goto invalid;
+	text = &image[total];
+	name = namelen == 0 ? NULL : &text[textlen + 1];
+	if (text[textlen] != 0 || (name != NULL && name[namelen - 1] != 0))
+		goto invalid;
+
+	/* create the template, compact if it has more than one block */
+	memcpy(&count, &image[sizeof head], sizeof count);
+	if (nblocks == 1) {
+		result = alloc(sizeof *result + count * sizeof(word_t), itf, closure);
+		if (result == NULL)
+			goto oom;
+		result->memory = result;
+		result->compact = 0;
+		result->blocks = NULL;
+		blk = &result->first_block;
+		blk->prev = blk->next = NULL;
+		blk->count = count;
+	}
+	else {
+		total = 0;
+		for (iblk = 0 ; iblk < nblocks ; iblk++) {
+			memcpy(&count, &image[sizeof head + iblk * sizeof count], sizeof count);
+			total += compact_block_size(iblk, count);
+		}
+		result = compact_alloc(total, nblocks, itf, closure);
+		if (result == NULL)
+			goto oom;
+	}
+	result->sbuf = *sbuf;
+	result->native = NULL;
+	result->base = text;
+	result->textlen = textlen;
+	result->flags = (int)head[4];
+	result->refcount = 1;
+	result->length = namelen == 0 ? 0 : namelen - 1;
+	result->name = name;
+	memset(result->data, 0 , sizeof result->data);
+	result->exts = NULL;
+
+	/* copy the code of the blocks */
+	for (iblk = 0 ; iblk < nblocks ; iblk++) {
+		memcpy(&count, &image[sizeof head + iblk * sizeof count], sizeof count);
+		if (nblocks > 1)
+			blk = compact_set_block(result, nblocks, iblk, count);
+		memcpy(blk->words, code, count * sizeof(word_t));
+		code += count * sizeof(word_t);
+	}
+	if (!vf_code(result, nblocks))
+		goto invalid;
+	*templ = result;
+	return MUSTACH_OK;
+
+invalid:
+	rc = MUSTACH_ERROR_BAD_DATA;
+	if (itf != NULL && itf->error != NULL)
+		itf->error(closure, rc, "invalid template image");
+	goto error;
+
+oom:
+	rc = MUSTACH_ERROR_OUT_OF_MEMORY;
+	if (itf != NULL && itf->error != NULL)
+		itf->error(closure, rc, "out of memory");
+
+error:
+	if (result != NULL)
+		mustach_destroy_template(result, itf, closure);
+	else {
+		mustach_sbuf_t copy = *sbuf;
+		mustach_sbuf_release(&copy);
+	}
+	*templ = NULL;
+	return rc;
+}
+
+/* see header file */
+int mustach_walk_template(
+		mustach_template_t *templ,
+		const mustach_walk_itf_t *itf,
+		void *closure
+) {
+	ap_t ap;
+
+	if (itf == NULL || itf->version != MUSTACH_WALK_ITF_VERSION_1)
+		return MUSTACH_ERROR_INVALID_ITF;
+
+	ap.base = templ->base;
+	ap.blk = &templ->first_block;
+	ap.count = ap.blk->count;
+	ap.words = ap.blk->words;
+	ap.off = 0;
+	ap.iblk = 0;
+	ap.tflags = templ->flags;
+	ap.templ = templ;
+	return wk_seq(&ap, itf, closure, WORD_MAX);
+}
+
+/* see header file */
+int mustach_make_native_template(
+		mustach_template_t **templ,
+		mustach_native_render_t *render,
+		const char *name,
+		const mustach_build_itf_t *itf,
+		void *closure
+) {
+	mustach_template_t *result;
+	size_t namelen = name == NULL ? 0 : 1 + strlen(name);
+
+	/* allocates with code of 2 stops */
+	result = alloc(sizeof *result + 2 * sizeof(word_t) + namelen, itf, closure);
+	*templ = result;
+	if (result == NULL) {
+		if (itf != NULL && itf->error != NULL)
+			itf->error(closure, MUSTACH_ERROR_OUT_OF_MEMORY, "out of memory");
+		return MUSTACH_ERROR_OUT_OF_MEMORY;
+	}
+
+	/* initialize */
+	mustach_sbuf_reset(&result->sbuf);
+	result->base = "";
+	result->textlen = 0;
+	result->flags = 0;
+	result->refcount = 1;
+	result->memory = result;
+	result->compact = 0;
+	result->native = render;
+	memset(result->data, 0 , sizeof result->data);
+	result->exts = NULL;
+	result->blocks = NULL;
+	result->first_block.next = result->first_block.prev = NULL;
+	result->first_block.count = 2;
+	result->first_block.words[0] = MKW(op_stop, 0);
+	result->first_block.words[1] = MKW(op_stop, 0);
+	if (name == NULL) {
+		result->name = NULL;
+		result->length = 0;
+	}
+	else {
+		result->name = memcpy(&result->first_block.words[2], name, namelen);
+		result->length = (word_t)(namelen - 1);
+	}
+	return MUSTACH_OK;
+}
+
+/* see header file */
+int mustach_native_text(mustach_native_t *native, const char *text, size_t length)
+{
+	return ap_any_text((ap_t*)native, text, length, 0, 1);
+}
+
+/* see header file */
+int mustach_native_repl(mustach_native_t *native, const char *name, size_t length, int escape)
+{
+	ap_t *ap = (ap_t*)native;
+	mustach_sbuf_t sbuf = MUSTACH_SBUF_INIT;
+	int rc = ap->itf->get(ap->closure, name, length, &sbuf);
+	if (rc == MUSTACH_OK) {
+		rc = ap_any_text(ap, sbuf.value, mustach_sbuf_length(&sbuf), escape, 0);
+		mustach_sbuf_release(&sbuf);
+	}
+	return rc;
+}
+
+/* see header file */
+int mustach_native_enter(mustach_native_t *native, const char *name, size_t length)
+{
+	ap_t *ap = (ap_t*)native;
+	return ap->itf->enter(ap->closure, name, length);
+}
+
+/* see header file */
+int mustach_native_next(mustach_native_t *native)
+{
+	ap_t *ap = (ap_t*)native;
+	return ap->itf->next(ap->closure);
+}
+
+/* see header file */
+int mustach_native_leave(mustach_native_t *native)
+{
+	return ap_leave((ap_t*)native);
+}
+
+/* see header file */
+int mustach_native_partial(
+		mustach_native_t *native,
+		const char *name,
+		size_t length,
+		const char *prefix,
+		size_t preflen
+) {
+	ap_t *ap = (ap_t*)native;
+	pref_t pref, **lppref = NULL;
+	mustach_template_t *part;
+	int rc;
+
+	/* get the partial */
+	rc = ap_partial_get_name(ap, name, (word_t)length, &part);
+	if (rc == MUSTACH_OK) {
+		/* apply it with its prefix */
+		if (preflen != 0) {
+			pref.add = 1;
+			pref.len = (unsigned)preflen;
+			pref.start = prefix;
+			pref.next = NULL;
+			lppref = ap_push_prefix(ap, &pref);
+		}
+		rc = ap_partial_eval(ap, part, ap->parent);
+		if (lppref != NULL)
+			*lppref = NULL;
+		ap_partial_put(ap, part);
+	}
+	return rc;
+}
+
+/* see header file */
+int mustach_native_call(
+		mustach_native_t *native,
+		mustach_native_render_t *render,
+		const char *prefix,
+		size_t preflen
+) {
+	ap_t *ap = (ap_t*)native;
+	pref_t pref, **lppref = NULL;
+	int rc;
+
+	/* check nesting depth */
+	if (ap->nesting >= MUSTACH_MAX_NESTING)
+		return MUSTACH_ERROR_TOO_MUCH_NESTING;
+
+	/* call it with its prefix */
+	if (preflen != 0) {
+		pref.add = 1;
+		pref.len = (unsigned)preflen;
+		pref.start = prefix;
+		pref.next = NULL;
+		lppref = ap_push_prefix(ap, &pref);
+	}
+	ap->nesting++;
+	rc = render(native);
+	ap->nesting--;
+	if (lppref != NULL)
+		*lppref = NULL;
+	return rc < MUSTACH_OK ? rc : MUSTACH_OK;
+}
@@ -24,6 +24,11 @@ typedef struct mustach_template mustach_template_t;
  */
 typedef struct mustach_build_itf mustach_build_itf_t;
 typedef struct mustach_apply_itf mustach_apply_itf_t;
+/**
+ * The type 'mustach_apply_t' is for an opaque structure
+ * recording the state of pulled applications.
+ */
+typedef struct mustach_apply mustach_apply_t;
 
 
 /**
@@ -33,7 +38,8 @@ typedef struct mustach_apply_itf mustach_apply_itf_t;
 #define Mustach_Build_With_EmptyTag       2
 #define Mustach_Build_Null_Term_Tag       4
 #define Mustach_Build_Null_Term_Text      8
-#define Mustach_Build_All_Flags_Mask     15
+#define Mustach_Build_Strip_Lines        16
+#define Mustach_Build_All_Flags_Mask     31
 
 /**
  * Flags specific to mustach applier
@@ -70,10 +76,18 @@ struct mustach_build_itf {
 		void *closure);
 };
 
+/*
+ * The version 2 of the apply interface adds the function 'escape'
+ * that writes the escaped 'buffer' of 'size' bytes using 'write'
+ * with 'wrclosure'. It is used when 'emit_esc' is NULL and by the
+ * pulled applications, so that both escape the same way. It can be
+ * NULL, then escaping is done by 'mustach_escape'.
+ */
 #define MUSTACH_APPLY_ITF_VERSION_1      1
-#define MUSTACH_APPLY_ITF_VERSION_CUR    MUSTACH_APPLY_ITF_VERSION_1
+#define MUSTACH_APPLY_ITF_VERSION_2      2
+#define MUSTACH_APPLY_ITF_VERSION_CUR    MUSTACH_APPLY_ITF_VERSION_2
 #define MUSTACH_APPLY_ITF_VERSION_MIN    MUSTACH_APPLY_ITF_VERSION_1
-#define MUSTACH_APPLY_ITF_VERSION_MAX    MUSTACH_APPLY_ITF_VERSION_1
+#define MUSTACH_APPLY_ITF_VERSION_MAX    MUSTACH_APPLY_ITF_VERSION_2
 
 struct mustach_apply_itf {
 	int version;
@@ -116,6 +130,13 @@ struct mustach_apply_itf {
 	void (*partial_put)(
 		void *closure,
 		mustach_template_t *partial);
+	/* since version 2 */
+	int (*escape)(
+		void *closure,
+		const char *buffer,
+		size_t size,
+		int (*write)(void *wrclosure, const char *buffer, size_t size),
+		void *wrclosure);
 };
 
 
@@ -142,6 +163,32 @@ int mustach_make_template(
 		const mustach_sbuf_t *sbuf,
 		const char *name);
 
+/*
+ * Templates are reference counted. A built template has one reference
+ * owned by its creator. The function 'mustach_ref_template' adds a
+ * reference and returns the template. The function 'mustach_unref_template'
+ * removes a reference and destroys the template when no more reference
+ * exists. Note that 'mustach_destroy_template' always destroys the
+ * template, regardless of its references.
+ */
+extern
+mustach_template_t *mustach_ref_template(
+		mustach_template_t *templ);
+
+extern
+void mustach_unref_template(
+		mustach_template_t *templ,
+		const mustach_build_itf_t *itf,
+		void *closure);
+
+/*
+ * Returns the count of bytes of memory used by the template,
+ * including its text when owned by the template.
+ */
+extern
+size_t mustach_get_template_size(
+		mustach_template_t *templ);
+
 extern
 int mustach_apply_template(
 		mustach_template_t *templ,
@@ -149,6 +196,213 @@ int mustach_apply_template(
 		const mustach_apply_itf_t *itf,
 		void *closure);
 
+/*
+ * Pulled application of templates.
+ *
+ * The function 'mustach_apply_begin' prepares in '*apply' the application
+ * of the template 'templ' with the interface 'itf' and its 'closure', as
+ * 'mustach_apply_template' does, but nothing is evaluated until pulled.
+ * The function 'start' of the interface is called.
+ *
+ * The function 'mustach_apply_step' fills the 'buffer' of 'size' bytes
+ * with the next bytes of the output and sets in '*written' the count of
+ * bytes written. It returns 1 when the output continues after what was
+ * written, MUSTACH_OK when all the output was written or a negative error
+ * code. The evaluation stops when the buffer is full, the output of the
+ * last operation that doesn't fit is kept for the next step. Native
+ * templates and partials are evaluated in one step.
+ *
+ * The function 'mustach_apply_end' releases the application, even when
+ * not complete. The function 'stop' of the interface is called with the
+ * status when the evaluation completes or fails, or with 1 when the
+ * application ends before.
+ *
+ * The functions 'emit_raw' and 'emit_esc' of the interface are not
+ * used and can be NULL: the escaped texts are escaped by the function
+ * 'escape' of the interface or else by 'mustach_escape'. Because its
+ * escaping would be lost, an interface having 'emit_esc' but not
+ * 'escape' is refused with MUSTACH_ERROR_INVALID_ITF.
+ * The template must not be destroyed before the end of the application.
+ */
+extern
+int mustach_apply_begin(
+		mustach_apply_t **apply,
+		mustach_template_t *templ,
+		int flags,
+		const mustach_apply_itf_t *itf,
+		void *closure);
+
+extern
+int mustach_apply_step(
+		mustach_apply_t *apply,
+		char *buffer,
+		size_t size,
+		size_t *written);
+
+extern
+void mustach_apply_end(
+		mustach_apply_t *apply);
+
+/*
+ * Saving and loading of prepared templates.
+ *
+ * The function 'mustach_save_template' writes, using the callback
+ * 'write', an image of the prepared template 'templ'. The callback
+ * returns MUSTACH_OK on success or an error code that stops the saving
+ * and is returned.
+ *
+ * The function 'mustach_load_template' creates the template of the
+ * image given by 'sbuf', without preparing it again. The image must
+ * have been saved by a host of same byte order and a compatible version
+ * of mustach, otherwise MUSTACH_ERROR_BAD_DATA is returned. The code
+ * of the image is verified: images whose texts or addresses are out
+ * of their bounds or whose sections are badly nested are refused with
+ * MUSTACH_ERROR_BAD_DATA. The length of 'sbuf' must be set. As for 'mustach_build_template', the
+ * template takes ownership of 'sbuf' and refers to its content
+ * until destroyed. The image can be mapped in memory using the
+ * function 'mustach_map_file' of mustach-helpers.
+ */
+extern
+int mustach_save_template(
+		mustach_template_t *templ,
+		int (*write)(void *closure, const char *buffer, size_t size),
+		void *closure);
+
+extern
+int mustach_load_template(
+		mustach_template_t **templ,
+		const mustach_sbuf_t *sbuf,
+		const mustach_build_itf_t *itf,
+		void *closure);
+
+/*
+ * Walking prepared templates.
+ *
+ * The function 'mustach_walk_template' reports the structure of the
+ * prepared template 'templ' by calling, in the order of the template,
+ * the functions of the interface 'itf' with the given 'closure'.
+ * Functions of the interface can be NULL when not needed.
+ *
+ *  - line: the current line of the template is 'line'
+ *  - text: a text of the template
+ *  - repl: a replacement of the tag 'name', escaped or not
+ *  - prefix: the indentation of the partial or parent that follows
+ *  - partial: inclusion of the partial 'name'
+ *  - enter: begin of a section, inverted section, parent or
+ *           block (see Mustach_Walk_...)
+ *  - leave: end of what was entered
+ *
+ * When a function returns a value other than MUSTACH_OK, the walk
+ * stops and that value is returned.
+ */
+#define Mustach_Walk_Section   1
+#define Mustach_Walk_Inverted  2
+#define Mustach_Walk_Parent    3
+#define Mustach_Walk_Block     4
+
+#define MUSTACH_WALK_ITF_VERSION_1       1
+#define MUSTACH_WALK_ITF_VERSION_CUR     MUSTACH_WALK_ITF_VERSION_1
+
+typedef struct mustach_walk_itf mustach_walk_itf_t;
+
+struct mustach_walk_itf {
+	int version;
+	int (*line)(
+		void *closure,
+		unsigned line);
+	int (*text)(
+		void *closure,
+		const char *text,
+		size_t length);
+	int (*repl)(
+		void *closure,
+		const char *name,
+		size_t length,
+		int escape);
+	int (*prefix)(
+		void *closure,
+		const char *text,
+		size_t length);
+	int (*partial)(
+		void *closure,
+		const char *name,
+		size_t length);
+	int (*enter)(
+		void *closure,
+		int kind,
+		const char *name,
+		size_t length);
+	int (*leave)(
+		void *closure,
+		int kind);
+};
+
+extern
+int mustach_walk_template(
+		mustach_template_t *templ,
+		const mustach_walk_itf_t *itf,
+		void *closure);
+
+/*
+ * Native templates.
+ *
+ * A native template is rendered by a C function instead of being
+ * prepared from a text, typically a function generated by the tool
+ * mustach-cgen. Native templates are applied like other templates,
+ * can be recorded in caches or registries and be given as partials.
+ * As for 'mustach_build_template', the memory of a native template
+ * is allocated using 'itf' and 'closure' (both can be NULL) and the
+ * template must be destroyed with the same interface.
+ *
+ * The rendering function receives an opaque 'mustach_native_t'
+ * and uses the functions 'mustach_native_...' to produce its result.
+ * These functions return MUSTACH_OK on success or an other value that
+ * the render function must return immediately.
+ *
+ *  - mustach_native_text: emits the text of the template
+ *  - mustach_native_repl: emits the value of the tag 'name'
+ *  - mustach_native_enter: enters the section 'name', returns 1 if
+ *    entered, 0 if not entered or a negative error code
+ *  - mustach_native_next: goes to the next item of the section,
+ *    returns 1 if there is one, 0 if not or a negative error code
+ *  - mustach_native_leave: leaves the entered section
+ *  - mustach_native_partial: renders the partial 'name' with the
+ *    indentation 'prefix' (can be NULL)
+ *  - mustach_native_call: renders as a partial the native function
+ *    'render' with the indentation 'prefix' (can be NULL)
+ *
+ * The structure 'mustach_native_entry' associates a name to a
+ * rendering function, mustach-cgen emits a table of it terminated
+ * by an entry whose name is NULL.
+ *
+ * Native templates can not be saved.
+ */
+typedef struct mustach_native mustach_native_t;
+typedef int mustach_native_render_t(mustach_native_t *native);
+
+struct mustach_native_entry {
+	const char *name;
+	mustach_native_render_t *render;
+};
+
+extern
+int mustach_make_native_template(
+		mustach_template_t **templ,
+		mustach_native_render_t *render,
+		const char *name,
+		const mustach_build_itf_t *itf,
+		void *closure);
+
+extern int mustach_native_text(mustach_native_t *native, const char *text, size_t length);
+extern int mustach_native_repl(mustach_native_t *native, const char *name, size_t length, int escape);
+extern int mustach_native_enter(mustach_native_t *native, const char *name, size_t length);
+extern int mustach_native_next(mustach_native_t *native);
+extern int mustach_native_leave(mustach_native_t *native);
+extern int mustach_native_partial(mustach_native_t *native, const char *name, size_t length,
+				const char *prefix, size_t preflen);
+extern int mustach_native_call(mustach_native_t *native, mustach_native_render_t *render,
+				const char *prefix, size_t preflen);
+
 #define MUSTACHE_DATA_COUNT_MIN 2
 
 extern
@@ -166,6 +420,34 @@ void *mustach_get_template_data(
 		mustach_template_t *templ,
 		unsigned index);
 
+/*
+ * Extensions are values attached to a template by libraries for
+ * caching things derived from the template, like precompiled tags.
+ * Each extension is identified by a key that is an address owned by
+ * the library. The extensions are destroyed, using their 'destroy'
+ * function if not NULL, when the template is destroyed.
+ *
+ * mustach_get_template_ext returns the value recorded for 'key' or NULL.
+ *
+ * mustach_set_template_ext records 'value' for 'key' if no value is
+ * already recorded for it. It can be called concurrently from several
+ * threads. It returns the value recorded for the key, that is either
+ * 'value' or the value recorded before, or NULL when out of memory.
+ * When the returned value is not 'value', the caller keeps the
+ * ownership of 'value'.
+ */
+extern
+void *mustach_get_template_ext(
+		mustach_template_t *templ,
+		const void *key);
+
+extern
+void *mustach_set_template_ext(
+		mustach_template_t *templ,
+		const void *key,
+		void *value,
+		void (*destroy)(void *value));
+
 extern
 const char *mustach_get_template_name(
 		mustach_template_t *templ,
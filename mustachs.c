@@ -131,6 +131,7 @@ int main(int ac, char **av)
 #define MUSTACH_TOOL_JSON_C  1
 #define MUSTACH_TOOL_JANSSON 2
 #define MUSTACH_TOOL_CJSON   3
+#define MUSTACH_TOOL_FASTJSON 4
 
 #if TOOL == MUSTACH_TOOL_JSON_C
 
@@ -206,6 +207,29 @@ static void close_json()
 	cJSON_Delete(o);
 }
 
+#elif TOOL == MUSTACH_TOOL_FASTJSON
+
+#include "mustach-fastjson.h"
+
+static mustach_fastjson_t *o;
+static int load_json(const char *filename)
+{
+	int s = mustach_fastjson_load_file(&o, filename);
+	if (s != MUSTACH_OK) {
+		errmsg = mustach_strerror(s);
+		return -1;
+	}
+	return 0;
+}
+static int apply()
+{
+	return mustach_fastjson_apply(templ, mustach_fastjson_root(o), flags, mustach_fwrite_cb, NULL, output);
+}
+static void close_json()
+{
+	mustach_fastjson_destroy(o);
+}
+
 #else
 #error "no defined json library"
 #endif
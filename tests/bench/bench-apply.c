@@ -0,0 +1,128 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+/*
+ * Measures the speed of the evaluation of templates with
+ * a trivial interface, for templates made mostly of text
+ * and for templates made mostly of tags.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "mustach2.h"
+#include "mustach-helpers.h"
+
+#define ITERATIONS 200000
+#define REPEAT     50
+
+static unsigned remain;
+static size_t ops;
+
+static int emit(void *closure, const char *buffer, size_t size, int escape)
+{
+	(void)closure; (void)buffer; (void)size; (void)escape;/*make compiler happy #@!%!!*/
+	ops++;
+	return MUSTACH_OK;
+}
+
+static int get(void *closure, const char *name, size_t length, mustach_sbuf_t *sbuf)
+{
+	(void)closure; (void)name; (void)length;/*make compiler happy #@!%!!*/
+	sbuf->value = "value";
+	sbuf->length = 5;
+	return MUSTACH_OK;
+}
+
+static int enter(void *closure, const char *name, size_t length)
+{
+	(void)closure; (void)name; (void)length;/*make compiler happy #@!%!!*/
+	remain = ITERATIONS;
+	return 1;
+}
+
+static int next(void *closure)
+{
+	(void)closure;/*make compiler happy #@!%!!*/
+	return --remain != 0;
+}
+
+static int leave(void *closure)
+{
+	(void)closure;/*make compiler happy #@!%!!*/
+	return MUSTACH_OK;
+}
+
+static const mustach_apply_itf_t itf = {
+	.version = MUSTACH_APPLY_ITF_VERSION_CUR,
+	.emit_esc = emit,
+	.get = get,
+	.enter = enter,
+	.next = next,
+	.leave = leave
+};
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+static void bench(const char *title, const char *item)
+{
+	mustach_template_t *templ;
+	mustach_sbuf_t sbuf = MUSTACH_SBUF_INIT;
+	char *text, *iter;
+	double t0, t1;
+	int i, rc;
+
+	/* make the template */
+	text = malloc(20 + REPEAT * strlen(item));
+	if (text == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	iter = stpcpy(text, "{{#rows}}");
+	for (i = 0 ; i < REPEAT ; i++)
+		iter = stpcpy(iter, item);
+	stpcpy(iter, "{{/rows}}");
+	sbuf.value = text;
+	rc = mustach_make_template(&templ, 0, &sbuf, NULL);
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "can't make template: %d\n", rc);
+		exit(1);
+	}
+
+	/* measure */
+	ops = 0;
+	t0 = now();
+	rc = mustach_apply_template(templ, 0, &itf, NULL);
+	t1 = now();
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "can't apply template: %d\n", rc);
+		exit(1);
+	}
+	printf("%-12s %7.2f M emits/s\n", title, (double)ops / (t1 - t0) / 1e6);
+	mustach_destroy_template(templ, NULL, NULL);
+	free(text);
+}
+
+int main(int ac, char **av)
+{
+	(void)ac; (void)av;/*make compiler happy #@!%!!*/
+	bench("text-heavy", "<p class=\"para\">Lorem ipsum dolor sit amet, consectetur adipiscing elit.</p>\n");
+	bench("tag-heavy", "{{a}}{{b}}{{{c}}}{{d}}");
+	return 0;
+}
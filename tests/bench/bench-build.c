@@ -0,0 +1,87 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+/*
+ * Measures the throughput of the preparation of templates
+ * made mostly of plain HTML text.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "mustach2.h"
+#include "mustach-helpers.h"
+
+#define SIZE     (8 << 20)
+#define ROUNDS   20
+
+static const char chunk[] =
+	"<tr class=\"row\">\n"
+	"  <td class=\"name\">{{name}}</td>\n"
+	"  <td class=\"value\"><p style=\"margin:0;padding:4px 8px;font-family:Arial,sans-serif\">"
+	"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor"
+	" incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis"
+	" nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat."
+	" Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore"
+	" eu fugiat nulla pariatur. Excepteur sint occaecat cupidatat non proident,"
+	" sunt in culpa qui officia deserunt mollit anim id est laborum.</p></td>\n"
+	"  {{#flag}}<td class=\"flag\">yes</td>{{/flag}}\n"
+	"</tr>\n";
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+int main(int ac, char **av)
+{
+	mustach_template_t *templ;
+	mustach_sbuf_t sbuf = MUSTACH_SBUF_INIT;
+	char *text, *iter;
+	size_t length;
+	double t0, t1;
+	int rc, i;
+
+	(void)ac; (void)av;/*make compiler happy #@!%!!*/
+
+	/* make the template */
+	text = malloc(SIZE + sizeof chunk);
+	if (text == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for (iter = text ; iter < &text[SIZE] ; )
+		iter = stpcpy(iter, chunk);
+	length = (size_t)(iter - text);
+	sbuf.value = text;
+	sbuf.length = length;
+
+	/* measure */
+	t0 = now();
+	for (i = 0 ; i < ROUNDS ; i++) {
+		rc = mustach_make_template(&templ, 0, &sbuf, NULL);
+		if (rc != MUSTACH_OK) {
+			fprintf(stderr, "can't make template: %d\n", rc);
+			return 1;
+		}
+		mustach_destroy_template(templ, NULL, NULL);
+	}
+	t1 = now();
+	printf("build of %zu bytes: %7.1f MB/s\n",
+		length, (double)length * ROUNDS / (t1 - t0) / 1e6);
+	free(text);
+	return 0;
+}
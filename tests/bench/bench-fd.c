@@ -0,0 +1,193 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+/*
+ * Counts the system calls made for writing a rendered page
+ * to a file descriptor, unbuffered as with mustach_write_cb
+ * and buffered with mustach_fdbuf_t, and measures the time.
+ * The buffered output is also measured with escaping done by
+ * the callbacks of mustach_escape or directly in the buffer.
+ *
+ * The calls to write and writev are counted by wrapping them
+ * at link time (see the option --wrap of the linker).
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "mustach2.h"
+#include "mustach-helpers.h"
+
+#define PAGES  2000
+#define ROWS   100
+
+static unsigned remain;
+static size_t syscalls;
+
+ssize_t __real_write(int fd, const void *buffer, size_t size);
+ssize_t __real_writev(int fd, const struct iovec *iov, int iovcnt);
+
+ssize_t __wrap_write(int fd, const void *buffer, size_t size)
+{
+	syscalls++;
+	return __real_write(fd, buffer, size);
+}
+
+ssize_t __wrap_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	syscalls++;
+	return __real_writev(fd, iov, iovcnt);
+}
+
+/* the output, as in mustach-wrap */
+static int (*writecb)(void *closure, const char *buffer, size_t size);
+static int (*emitcb)(void *closure, const char *buffer, size_t size, int escape);
+static void *wrclosure;
+
+static int emit_raw(void *closure, const char *buffer, size_t size)
+{
+	(void)closure;/*make compiler happy #@!%!!*/
+	return writecb(wrclosure, buffer, size);
+}
+
+static int emit_esc(void *closure, const char *buffer, size_t size, int escape)
+{
+	(void)closure;/*make compiler happy #@!%!!*/
+	if (emitcb != NULL)
+		return emitcb(wrclosure, buffer, size, escape);
+	return escape
+		? mustach_escape(buffer, size, writecb, wrclosure)
+		: writecb(wrclosure, buffer, size);
+}
+
+static int get(void *closure, const char *name, size_t length, mustach_sbuf_t *sbuf)
+{
+	(void)closure;/*make compiler happy #@!%!!*/
+	if (length == 5 && !memcmp(name, "title", 5))
+		sbuf->value = "Fruits & <vegetables>";
+	else if (length == 4 && !memcmp(name, "name", 4))
+		sbuf->value = "\"apple\" & <pear>";
+	else
+		sbuf->value = "1.50";
+	return MUSTACH_OK;
+}
+
+static int enter(void *closure, const char *name, size_t length)
+{
+	(void)closure; (void)name; (void)length;/*make compiler happy #@!%!!*/
+	remain = ROWS;
+	return 1;
+}
+
+static int next(void *closure)
+{
+	(void)closure;/*make compiler happy #@!%!!*/
+	return --remain != 0;
+}
+
+static int leave(void *closure)
+{
+	(void)closure;/*make compiler happy #@!%!!*/
+	return MUSTACH_OK;
+}
+
+static const mustach_apply_itf_t itf = {
+	.version = MUSTACH_APPLY_ITF_VERSION_CUR,
+	.emit_raw = emit_raw,
+	.emit_esc = emit_esc,
+	.get = get,
+	.enter = enter,
+	.next = next,
+	.leave = leave
+};
+
+static const char page[] =
+	"<html><head><title>{{title}}</title></head><body>\n"
+	"<h1>{{title}}</h1>\n<table>\n"
+	"{{#rows}}<tr><td>{{name}}</td><td class=\"price\">{{price}}</td></tr>\n{{/rows}}"
+	"</table></body></html>\n";
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+static void bench(const char *title, mustach_template_t *templ, int fd, size_t size, int kernel)
+{
+	char *buffer = size ? malloc(size) : NULL;
+	mustach_fdbuf_t fdbuf;
+	double t0, t1;
+	int i, rc = MUSTACH_OK;
+
+	syscalls = 0;
+	t0 = now();
+	for (i = 0 ; rc == MUSTACH_OK && i < PAGES ; i++) {
+		if (size == 0) {
+			writecb = mustach_write_cb;
+			emitcb = NULL;
+			wrclosure = (void*)(intptr_t)fd;
+			rc = mustach_apply_template(templ, 0, &itf, NULL);
+		}
+		else {
+			mustach_fdbuf_init(&fdbuf, fd, buffer, size);
+			writecb = mustach_fdbuf_write_cb;
+			emitcb = kernel ? mustach_fdbuf_emit_cb : NULL;
+			wrclosure = &fdbuf;
+			rc = mustach_apply_template(templ, 0, &itf, NULL);
+			if (rc == MUSTACH_OK)
+				rc = mustach_fdbuf_flush(&fdbuf);
+		}
+	}
+	t1 = now();
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "can't apply template: %d\n", rc);
+		exit(1);
+	}
+	printf("%-16s %8.1f syscalls/page %8.1f us/page\n", title,
+		(double)syscalls / PAGES, (t1 - t0) * 1e6 / PAGES);
+	free(buffer);
+}
+
+int main(int ac, char **av)
+{
+	mustach_template_t *templ;
+	mustach_sbuf_t sbuf = MUSTACH_SBUF_INIT;
+	int fd, rc;
+
+	(void)ac; (void)av;/*make compiler happy #@!%!!*/
+	fd = open("/dev/null", O_WRONLY);
+	if (fd < 0) {
+		perror("/dev/null");
+		return 1;
+	}
+	sbuf.value = page;
+	rc = mustach_make_template(&templ, 0, &sbuf, NULL);
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "can't make template: %d\n", rc);
+		return 1;
+	}
+	bench("unbuffered", templ, fd, 0, 0);
+	bench("buffered 1024", templ, fd, 1024, 0);
+	bench("buffered 8192", templ, fd, MUSTACH_FDBUF_SIZE, 0);
+	bench("buffered 65536", templ, fd, 65536, 0);
+	bench("escaped in 8192", templ, fd, MUSTACH_FDBUF_SIZE, 1);
+	mustach_destroy_template(templ, NULL, NULL);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+/*
+ * Measures the time of looping on a section whose body skips
+ * a false section of growing size. As jumps are done using
+ * the index of blocks, the time per iteration should not
+ * depend on the size of the skipped section.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "mustach2.h"
+#include "mustach-helpers.h"
+
+#define ITERATIONS 1000000
+
+static unsigned remain;
+
+static int emit(void *closure, const char *buffer, size_t size, int escape)
+{
+	(void)closure; (void)buffer; (void)size; (void)escape;/*make compiler happy #@!%!!*/
+	return MUSTACH_OK;
+}
+
+static int get(void *closure, const char *name, size_t length, mustach_sbuf_t *sbuf)
+{
+	(void)closure; (void)name; (void)length;/*make compiler happy #@!%!!*/
+	sbuf->value = "v";
+	return MUSTACH_OK;
+}
+
+static int enter(void *closure, const char *name, size_t length)
+{
+	(void)closure;/*make compiler happy #@!%!!*/
+	if (length != 4 || memcmp(name, "rows", 4))
+		return 0;
+	remain = ITERATIONS;
+	return 1;
+}
+
+static int next(void *closure)
+{
+	(void)closure;/*make compiler happy #@!%!!*/
+	return --remain != 0;
+}
+
+static int leave(void *closure)
+{
+	(void)closure;/*make compiler happy #@!%!!*/
+	return MUSTACH_OK;
+}
+
+static const mustach_apply_itf_t itf = {
+	.version = MUSTACH_APPLY_ITF_VERSION_CUR,
+	.emit_esc = emit,
+	.get = get,
+	.enter = enter,
+	.next = next,
+	.leave = leave
+};
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+static void bench(unsigned ntags)
+{
+	static const char head[] = "{{#rows}}{{#never}}", tail[] = "{{/never}}{{v}}{{/rows}}";
+	mustach_template_t *templ;
+	mustach_sbuf_t sbuf = MUSTACH_SBUF_INIT;
+	char *text, *iter;
+	unsigned i;
+	double t0, t1;
+	int rc;
+
+	/* make the template */
+	text = malloc(sizeof head + sizeof tail + 5 * ntags);
+	if (text == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	iter = stpcpy(text, head);
+	for (i = 0 ; i < ntags ; i++)
+		iter = stpcpy(iter, "{{v}}");
+	stpcpy(iter, tail);
+	sbuf.value = text;
+	rc = mustach_make_template(&templ, 0, &sbuf, NULL);
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "can't make template: %d\n", rc);
+		exit(1);
+	}
+
+	/* measure */
+	t0 = now();
+	rc = mustach_apply_template(templ, 0, &itf, NULL);
+	t1 = now();
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "can't apply template: %d\n", rc);
+		exit(1);
+	}
+	printf("skipped tags %8u: %7.2f ns per iteration\n",
+		ntags, 1e9 * (t1 - t0) / ITERATIONS);
+	mustach_destroy_template(templ, NULL, NULL);
+	free(text);
+}
+
+int main(int ac, char **av)
+{
+	(void)ac; (void)av;/*make compiler happy #@!%!!*/
+	bench(1);
+	bench(100);
+	bench(10000);
+	bench(100000);
+	bench(1000000);
+	return 0;
+}
@@ -0,0 +1,240 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+/*
+ * Measures the speed of parsing a JSON text and of rendering
+ * a template for the parsed data with the JSON backends.
+ * The backend fastjson is always measured, the others are
+ * measured when compiled with WITH_JSON_C, WITH_CJSON or
+ * WITH_JANSSON.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "mustach-fastjson.h"
+#if WITH_JSON_C
+#include "mustach-json-c.h"
+#endif
+#if WITH_CJSON
+#include "mustach-cjson.h"
+#endif
+#if WITH_JANSSON
+#include "mustach-jansson.h"
+#endif
+
+#define ROWS       2000
+#define PARSES     50
+#define RENDERS    50
+
+static const char template[] =
+	"{{#rows}}<tr id=\"{{id}}\"><td>{{name}}</td><td>{{price}}</td>"
+	"{{#tags}}<i>{{.}}</i>{{/tags}}"
+	"{{#available}}<b>yes</b>{{/available}}"
+	"<td>{{attrs.k3}} {{attrs.k11}}</td></tr>\n{{/rows}}";
+
+static char *text;
+static size_t length;
+static size_t written;
+
+static int count(void *closure, const char *buffer, size_t size)
+{
+	(void)closure; (void)buffer;/*make compiler happy #@!%!!*/
+	written += size;
+	return MUSTACH_OK;
+}
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+static void oom()
+{
+	fprintf(stderr, "out of memory\n");
+	exit(1);
+}
+
+/* make a document of ROWS rows, each having an object of 12 attributes */
+static void make_text()
+{
+	size_t size = ROWS * 400;
+	int i, j, n;
+
+	text = malloc(size);
+	if (text == NULL)
+		oom();
+	length = (size_t)sprintf(text, "{\"title\":\"bench\",\"rows\":[");
+	for (i = 0 ; i < ROWS ; i++) {
+		n = sprintf(&text[length],
+			"%s{\"id\":%d,\"name\":\"item \\\"%d\\\" <%d>\",\"price\":%d.%02d,"
+			"\"available\":%s,\"tags\":[\"a%d\",\"b%d\",\"c\\u00e9\"],\"attrs\":{",
+			i ? "," : "", i, i, i * 7, i % 97, i % 100,
+			i & 1 ? "true" : "false", i % 13, i % 17);
+		length += (size_t)n;
+		for (j = 0 ; j < 12 ; j++) {
+			n = sprintf(&text[length], "%s\"k%d\":\"v%d.%d\"", j ? "," : "", j, i, j);
+			length += (size_t)n;
+		}
+		text[length++] = '}';
+		text[length++] = '}';
+	}
+	length += (size_t)sprintf(&text[length], "]}");
+}
+
+static void result(const char *name, double tparse, double trender)
+{
+	printf("%-10s parse %7.1f MB/s   render %7.1f MB/s\n", name,
+		(double)length * PARSES / tparse / 1e6,
+		(double)written / trender / 1e6);
+}
+
+static void check(int rc, const char *name, const char *what)
+{
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "%s: can't %s: %d\n", name, what, rc);
+		exit(1);
+	}
+}
+
+static void bench_fastjson()
+{
+	mustach_fastjson_t *doc;
+	double t0, t1, tp;
+	int i;
+
+	t0 = now();
+	for (i = 0 ; i < PARSES ; i++) {
+		check(mustach_fastjson_parse_copy(&doc, text, length), "fastjson", "parse");
+		if (i + 1 < PARSES)
+			mustach_fastjson_destroy(doc);
+	}
+	t1 = now();
+	tp = t1 - t0;
+	written = 0;
+	t0 = now();
+	for (i = 0 ; i < RENDERS ; i++)
+		check(mustach_fastjson_write(template, sizeof template - 1,
+				mustach_fastjson_root(doc), 0, count, NULL), "fastjson", "render");
+	t1 = now();
+	mustach_fastjson_destroy(doc);
+	result("fastjson", tp, t1 - t0);
+}
+
+#if WITH_JSON_C
+static void bench_json_c()
+{
+	struct json_object *doc;
+	double t0, t1, tp;
+	int i;
+
+	t0 = now();
+	for (i = 0 ; i < PARSES ; i++) {
+		doc = json_tokener_parse(text);
+		if (doc == NULL)
+			check(MUSTACH_ERROR_BAD_DATA, "json-c", "parse");
+		if (i + 1 < PARSES)
+			json_object_put(doc);
+	}
+	t1 = now();
+	tp = t1 - t0;
+	written = 0;
+	t0 = now();
+	for (i = 0 ; i < RENDERS ; i++)
+		check(mustach_json_c_write(template, sizeof template - 1,
+				doc, 0, count, NULL), "json-c", "render");
+	t1 = now();
+	json_object_put(doc);
+	result("json-c", tp, t1 - t0);
+}
+#endif
+
+#if WITH_CJSON
+static void bench_cjson()
+{
+	cJSON *doc;
+	double t0, t1, tp;
+	int i;
+
+	t0 = now();
+	for (i = 0 ; i < PARSES ; i++) {
+		doc = cJSON_ParseWithLength(text, length);
+		if (doc == NULL)
+			check(MUSTACH_ERROR_BAD_DATA, "cjson", "parse");
+		if (i + 1 < PARSES)
+			cJSON_Delete(doc);
+	}
+	t1 = now();
+	tp = t1 - t0;
+	written = 0;
+	t0 = now();
+	for (i = 0 ; i < RENDERS ; i++)
+		check(mustach_cJSON_write(template, sizeof template - 1,
+				doc, 0, count, NULL), "cjson", "render");
+	t1 = now();
+	cJSON_Delete(doc);
+	result("cjson", tp, t1 - t0);
+}
+#endif
+
+#if WITH_JANSSON
+static void bench_jansson()
+{
+	json_t *doc;
+	json_error_t error;
+	double t0, t1, tp;
+	int i;
+
+	t0 = now();
+	for (i = 0 ; i < PARSES ; i++) {
+		doc = json_loadb(text, length, 0, &error);
+		if (doc == NULL)
+			check(MUSTACH_ERROR_BAD_DATA, "jansson", "parse");
+		if (i + 1 < PARSES)
+			json_decref(doc);
+	}
+	t1 = now();
+	tp = t1 - t0;
+	written = 0;
+	t0 = now();
+	for (i = 0 ; i < RENDERS ; i++)
+		check(mustach_jansson_write(template, sizeof template - 1,
+				doc, 0, count, NULL), "jansson", "render");
+	t1 = now();
+	json_decref(doc);
+	result("jansson", tp, t1 - t0);
+}
+#endif
+
+int main(int ac, char **av)
+{
+	(void)ac; (void)av;/*make compiler happy #@!%!!*/
+	make_text();
+	printf("document of %u bytes, %d parses, %d renders\n",
+		(unsigned)length, PARSES, RENDERS);
+	bench_fastjson();
+#if WITH_JSON_C
+	bench_json_c();
+#endif
+#if WITH_CJSON
+	bench_cjson();
+#endif
+#if WITH_JANSSON
+	bench_jansson();
+#endif
+	free(text);
+	return 0;
+}
@@ -12,6 +12,9 @@ then
 	NOVALGRIND=1
 fi
 mustach="${mustach:-../../mustach}"
+# the reference can depend on the library of the tool
+ref=resu.ref
+[ -n "$tool" ] && [ -f "resu.$tool.ref" ] && ref="resu.$tool.ref"
 echo "starting test"
 if [ "$NOVALGRIND" = 1 ]
 then
@@ -21,7 +24,7 @@ else
 	sed -i 's:^==[0-9]*== ::' vg.last
 	awk '/^ *total heap usage: .* allocs, .* frees,.*/{if($$4-$$6)exit(1)}' vg.last || exit_fail "ERROR! Alloc/Free issue"
 fi
-if diff -w resu.ref resu.last
+if diff -w "$ref" resu.last
 then
 	echo "result ok"
 else
@@ -24,6 +24,8 @@
 #define TEST_JANSSON 2
 #define TEST_CJSON   3
 #define TEST_TEXT    4
+#define TEST_FASTJSON 5
+#define TEST_CGEN    6
 
 #define MUSTACH_DEFLIB_JSON_C  1
 #define MUSTACH_DEFLIB_JANSSON 2
@@ -53,6 +55,8 @@ const char *mustach_error_string(int status)
 static const char *errmsg = 0;
 static int flags = 0;
 static FILE *output = 0;
+static const char *extract = 0;
+static unsigned serial = 0;
 
 static void help(char *prog)
 {
@@ -60,11 +64,12 @@ static void help(char *prog)
 #define STR(x) #x
 	printf("%s version %s\n", name, STR(VERSION));
 #undef STR
-	printf("usage: %s test-files...\n", name);
+	printf("usage: %s [-x directory] test-files...\n", name);
+	printf("    -x: also writes the template of each test in the directory\n");
 	exit(0);
 }
 
-#if TEST == TEST_CJSON || (TEST == TEST_TEXT && DEFLIB == MUSTACH_DEFLIB_CJSON)
+#if TEST == TEST_CJSON || TEST == TEST_FASTJSON || TEST == TEST_CGEN || (TEST == TEST_TEXT && DEFLIB == MUSTACH_DEFLIB_CJSON)
 
 static const size_t BLOCKSIZE = 8192;
 
@@ -157,6 +162,10 @@ int main(int ac, char **av)
 	while (*++av) {
 		if (!strcmp(*av, "-h") || !strcmp(*av, "--help"))
 			help(prog);
+		if (!strcmp(*av, "-x") && av[1]) {
+			extract = *++av;
+			continue;
+		}
 		f = (av[0][0] == '-' && !av[0][1]) ? "/dev/stdin" : av[0];
 		fprintf(output, "\nloading %s\n", f);
 		s = load_json(f);
@@ -553,6 +562,167 @@ static void close_json()
 	cJSON_Delete(o);
 }
 
+#elif TEST == TEST_FASTJSON || TEST == TEST_CGEN
+
+#include "mustach-fastjson.h"
+
+#if TEST == TEST_CGEN
+#include "mustach-helpers.h"
+
+/* the templates of the tests translated by mustach-cgen */
+extern const struct mustach_native_entry mustach_cgen_templates[];
+
+/* render the translation of the template of the test of number serial */
+static int render_native(const mustach_fastjson_value_t *data, char **result, size_t *length)
+{
+	mustach_stream_t stream = MUSTACH_STREAM_INIT;
+	const struct mustach_native_entry *entry;
+	mustach_template_t *templ;
+	char name[40];
+	int s;
+
+	*result = NULL;
+	snprintf(name, sizeof name, "spec-%u", serial);
+	for (entry = mustach_cgen_templates ; entry->name && strcmp(entry->name, name) ; entry++);
+	if (entry->name == NULL)
+		return MUSTACH_ERROR_PARTIAL_NOT_FOUND;
+	s = mustach_make_native_template(&templ, entry->render, entry->name, NULL, NULL);
+	if (s != MUSTACH_OK)
+		return s;
+	s = mustach_fastjson_apply(templ, data, flags, mustach_stream_write_cb, NULL, &stream);
+	mustach_destroy_template(templ, NULL, NULL);
+	if (s == MUSTACH_OK)
+		return mustach_stream_end(&stream, result, length);
+	mustach_stream_abort(&stream);
+	return s;
+}
+#endif
+
+/* write the template of the test of number serial in the directory extract */
+static void extract_template(const char *t)
+{
+	char path[1024];
+	FILE *f;
+
+	snprintf(path, sizeof path, "%s/spec-%u.mustache", extract, serial);
+	f = fopen(path, "w");
+	if (f == NULL || fputs(t, f) < 0 || fclose(f) != 0) {
+		fprintf(stderr, "Can't write file: %s\n", path);
+		exit(1);
+	}
+}
+
+static mustach_fastjson_t *d;
+static const mustach_fastjson_value_t *partials;
+static int get_partial(const char *name, struct mustach_sbuf *sbuf)
+{
+	const mustach_fastjson_value_t *x;
+	if (partials == NULL || !(x = mustach_fastjson_get(partials, name)))
+		return MUSTACH_ERROR_PARTIAL_NOT_FOUND;
+	sbuf->value = mustach_fastjson_string(x, NULL);
+	return MUSTACH_OK;
+}
+
+static int load_json(const char *filename)
+{
+	char *t;
+	size_t length;
+	int s;
+
+	t = readfile(filename, &length);
+	s = mustach_fastjson_parse_copy(&d, t, length);
+	free(t);
+	return -(s != MUSTACH_OK);
+}
+static int process(counters *c)
+{
+	const char *t, *e;
+	char *got, *tmp;
+	size_t i, n;
+	size_t length;
+	int s;
+	const mustach_fastjson_value_t *o, *tests, *unit, *name, *desc, *data, *template, *expected;
+
+	o = mustach_fastjson_root(d);
+	tests = mustach_fastjson_get(o, "tests");
+	if (!tests || mustach_fastjson_type(tests) != Mustach_FastJSON_Array)
+		return -1;
+
+	i = 0;
+	n = mustach_fastjson_count(tests);
+	while (i < n) {
+		unit = mustach_fastjson_at(tests, i);
+		if (!unit || mustach_fastjson_type(unit) != Mustach_FastJSON_Object
+		 || !(name = mustach_fastjson_get(unit, "name"))
+		 || !(desc = mustach_fastjson_get(unit, "desc"))
+		 || !(data = mustach_fastjson_get(unit, "data"))
+		 || !(template = mustach_fastjson_get(unit, "template"))
+		 || !(expected = mustach_fastjson_get(unit, "expected"))
+		 || mustach_fastjson_type(name) != Mustach_FastJSON_String
+		 || mustach_fastjson_type(desc) != Mustach_FastJSON_String
+		 || mustach_fastjson_type(template) != Mustach_FastJSON_String
+		 || mustach_fastjson_type(expected) != Mustach_FastJSON_String) {
+			fprintf(stderr, "invalid test %u\n", (unsigned)i);
+			c->ninvalid++;
+		}
+		else {
+			fprintf(output, "[%u] %s\n", (unsigned)i, mustach_fastjson_string(name, NULL));
+			fprintf(output, "\t%s\n", mustach_fastjson_string(desc, NULL));
+			partials = mustach_fastjson_get(unit, "partials");
+			t = mustach_fastjson_string(template, NULL);
+			e = mustach_fastjson_string(expected, NULL);
+			serial++;
+			if (extract)
+				extract_template(t);
+#if TEST == TEST_CGEN
+			s = render_native(data, &got, &length);
+#else
+			s = mustach_fastjson_mem(t, 0, data, flags, &got, &length);
+#endif
+			if (s == 0 && strcmp(got, e) == 0) {
+				fprintf(output, "\t=> SUCCESS\n");
+				c->nsuccess++;
+			}
+			else {
+				if (s < 0) {
+					fprintf(output, "\t=> ERROR %s\n", mustach_error_string(s));
+					c->nerror++;
+				}
+				else {
+					fprintf(output, "\t=> DIFFERS\n");
+					c->ndiffers++;
+				}
+				if (partials) {
+					tmp = mustach_fastjson_print(partials, NULL);
+					fprintf(output, "\t.. PARTIALS[%s]\n", tmp);
+					free(tmp);
+				}
+				tmp = mustach_fastjson_print(data, NULL);
+				fprintf(output, "\t..     DATA[%s]\n", tmp);
+				free(tmp);
+				fprintf(output, "\t.. TEMPLATE[");
+				emit(output, t);
+				fprintf(output, "]\n");
+				fprintf(output, "\t.. EXPECTED[");
+				emit(output, e);
+				fprintf(output, "]\n");
+				if (s == 0) {
+					fprintf(output, "\t..      GOT[");
+					emit(output, got);
+					fprintf(output, "]\n");
+				}
+			}
+			free(got);
+		}
+		i++;
+	}
+	return 0;
+}
+static void close_json()
+{
+	mustach_fastjson_destroy(d);
+}
+
 #else
 #error "no defined json library"
 #endif
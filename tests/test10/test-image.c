@@ -0,0 +1,224 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+/*
+ * Renders templates after saving and loading them back,
+ * once with text referenced and once with text copied.
+ * Then loads the images with one word of their code corrupted
+ * and checks that they are refused or rendered without harm.
+ * Also checks templates whose sections are closed at the last
+ * word of a block of code.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mustach-json-c.h"
+#include "mustach-helpers.h"
+
+static const char image[] = "image.last";
+
+static int write_image(void *closure, const char *buffer, size_t size)
+{
+	return fwrite(buffer, 1, size, closure) == size ? MUSTACH_OK : MUSTACH_ERROR_SYSTEM;
+}
+
+static int write_none(void *closure, const char *buffer, size_t size)
+{
+	(void)closure; (void)buffer; (void)size;/*make compiler happy #@!%!!*/
+	return MUSTACH_OK;
+}
+
+static void release_copy(void *value, void *closure)
+{
+	(void)closure;/*make compiler happy #@!%!!*/
+	free(value);
+}
+
+/* load the image with words of its code corrupted in several ways */
+static void corrupt(struct json_object *o)
+{
+	static const uint32_t masks[] = { 0xffffffff, 0x1, 0x10, 0x400, 0x10000 };
+	mustach_template_t *templ;
+	mustach_sbuf_t sbuf;
+	uint32_t *words;
+	size_t size, iw, first, last, im, step;
+	int refused = 0, rendered = 0;
+	char *copy;
+	FILE *file;
+
+	/* read the image */
+	file = fopen(image, "r");
+	if (file == NULL)
+		exit(1);
+	fseek(file, 0, SEEK_END);
+	size = (size_t)ftell(file);
+	rewind(file);
+	words = malloc(size);
+	if (words == NULL || fread(words, 1, size, file) != size)
+		exit(1);
+	fclose(file);
+
+	/* compute the range of the code, after the header and the counts */
+	first = 8 + words[7];
+	for (last = first, iw = 8 ; iw < first ; iw++)
+		last += words[iw];
+
+	/* big images are corrupted at some words only */
+	step = 1 + (last - first) / 500;
+	for (iw = first ; iw < last ; iw += step) {
+		for (im = 0 ; im < sizeof masks / sizeof *masks ; im++) {
+			copy = malloc(size);
+			if (copy == NULL)
+				exit(1);
+			memcpy(copy, words, size);
+			((uint32_t*)copy)[iw] ^= masks[im];
+			sbuf.value = copy;
+			sbuf.length = size;
+			sbuf.releasecb = release_copy;
+			sbuf.closure = NULL;
+			if (mustach_load_template(&templ, &sbuf, NULL, NULL) != MUSTACH_OK)
+				refused++;
+			else {
+				mustach_json_c_apply(templ, o, Mustach_With_AllExtensions,
+						write_none, NULL, NULL);
+				mustach_destroy_template(templ, NULL, NULL);
+				rendered++;
+			}
+		}
+	}
+	free(words);
+	printf("---- corrupted: %d refused, %d rendered\n", refused, rendered);
+}
+
+static int render(struct json_object *o, const char *path, int flags)
+{
+	mustach_template_t *templ;
+	mustach_sbuf_t sbuf = MUSTACH_SBUF_INIT;
+	FILE *file;
+	int rc;
+
+	/* prepare the template and save it */
+	rc = mustach_read_file(path, &sbuf);
+	if (rc == MUSTACH_OK)
+		rc = mustach_make_template(&templ, flags, &sbuf, path);
+	if (rc != MUSTACH_OK)
+		return rc;
+	file = fopen(image, "w");
+	if (file == NULL)
+		rc = MUSTACH_ERROR_SYSTEM;
+	else {
+		rc = mustach_save_template(templ, write_image, file);
+		fclose(file);
+	}
+	mustach_destroy_template(templ, NULL, NULL);
+	if (rc != MUSTACH_OK)
+		return rc;
+
+	/* load the image and render it */
+	rc = mustach_map_file(image, &sbuf);
+	if (rc == MUSTACH_OK)
+		rc = mustach_load_template(&templ, &sbuf, NULL, NULL);
+	if (rc != MUSTACH_OK)
+		return rc;
+	printf("---- %s (%s)\n", mustach_get_template_name(templ, NULL),
+		flags & Mustach_Build_Null_Term_Text ? "copy" : "ref");
+	rc = mustach_json_c_apply(templ, o, Mustach_With_AllExtensions,
+			mustach_fwrite_cb, NULL, stdout);
+	mustach_destroy_template(templ, NULL, NULL);
+	if (rc == MUSTACH_OK)
+		corrupt(o);
+	return rc;
+}
+
+/* build templates of many sections after a padding of growing size,
+ * so that the operations closing sections fall at the end of blocks,
+ * and check that their images load, the load verifying the addresses */
+static void check_blocks(struct json_object *o)
+{
+	static const char pad[] = "x{{a}}\n";
+	static const char sec[] = "{{#s}}{{a}}{{/s}}{{$b}}{{a}}{{/b}}";
+	mustach_template_t *templ;
+	mustach_sbuf_t sbuf;
+	int ipad, i, rc, ok = 0, count = 0;
+	char *text, *iter;
+	FILE *file;
+
+	for (ipad = 0 ; ipad < 400 ; ipad++) {
+		text = iter = malloc(ipad * (sizeof pad - 1) + 100 * (sizeof sec - 1) + 1);
+		if (text == NULL)
+			exit(1);
+		for (i = 0 ; i < ipad ; i++, iter += sizeof pad - 1)
+			memcpy(iter, pad, sizeof pad - 1);
+		for (i = 0 ; i < 100 ; i++, iter += sizeof sec - 1)
+			memcpy(iter, sec, sizeof sec - 1);
+		*iter = 0;
+		sbuf.value = text;
+		sbuf.length = (size_t)(iter - text);
+		sbuf.releasecb = release_copy;
+		sbuf.closure = NULL;
+		rc = mustach_make_template(&templ, 0, &sbuf, "blocks");
+		if (rc == MUSTACH_OK) {
+			file = fopen(image, "w");
+			if (file == NULL)
+				rc = MUSTACH_ERROR_SYSTEM;
+			else {
+				rc = mustach_save_template(templ, write_image, file);
+				fclose(file);
+			}
+			mustach_destroy_template(templ, NULL, NULL);
+		}
+		if (rc == MUSTACH_OK)
+			rc = mustach_map_file(image, &sbuf);
+		if (rc == MUSTACH_OK)
+			rc = mustach_load_template(&templ, &sbuf, NULL, NULL);
+		if (rc == MUSTACH_OK) {
+			rc = mustach_json_c_apply(templ, o, Mustach_With_AllExtensions,
+					write_none, NULL, NULL);
+			mustach_destroy_template(templ, NULL, NULL);
+		}
+		ok += rc == MUSTACH_OK;
+		count++;
+	}
+	printf("---- sections closed at the end of blocks: %d/%d\n", ok, count);
+}
+
+int main(int ac, char **av)
+{
+	struct json_object *o;
+	int rc, status = 0;
+
+	if (ac < 2) {
+		fprintf(stderr, "usage: %s json templates...\n", av[0]);
+		return 1;
+	}
+	o = json_object_from_file(av[1]);
+	if (o == NULL) {
+		fprintf(stderr, "Aborted: null json (file %s)\n", av[1]);
+		return 1;
+	}
+	for (av += 2 ; *av != NULL ; av++) {
+		rc = render(o, *av, Mustach_Build_With_Colon | Mustach_Build_With_EmptyTag);
+		if (rc == MUSTACH_OK)
+			rc = render(o, *av, Mustach_Build_With_Colon | Mustach_Build_With_EmptyTag
+					| Mustach_Build_Null_Term_Tag | Mustach_Build_Null_Term_Text);
+		if (rc != MUSTACH_OK) {
+			fprintf(stderr, "Template error %s (file %s)\n", mustach_strerror(rc), *av);
+			status = 1;
+		}
+	}
+	check_blocks(o);
+	json_object_put(o);
+	return status;
+}
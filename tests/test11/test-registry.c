@@ -0,0 +1,94 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+/*
+ * Renders templates of a registry loaded from a directory,
+ * the partials being provided by the registry.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mustach-json-c.h"
+#include "mustach-helpers.h"
+
+static const char inline_template[] = "{{#items}}[{{> parts/item}}]{{/items}}\n";
+
+static int render(mustach_registry_t *registry, struct json_object *o, const char *name)
+{
+	mustach_template_t *templ;
+	int rc;
+
+	rc = mustach_registry_get(registry, name, 0, &templ);
+	if (rc != MUSTACH_OK)
+		return rc;
+	printf("---- %s\n", mustach_get_template_name(templ, NULL));
+	rc = mustach_json_c_apply(templ, o, Mustach_With_AllExtensions,
+			mustach_fwrite_cb, NULL, stdout);
+	mustach_registry_release(templ);
+	return rc;
+}
+
+int main(int ac, char **av)
+{
+	static const char *names[] = { "inline" };
+	mustach_sbuf_t sbuf = MUSTACH_SBUF_INIT;
+	mustach_registry_t *registry;
+	struct json_object *o;
+	int rc, status = 0;
+
+	if (ac < 3) {
+		fprintf(stderr, "usage: %s json directory names...\n", av[0]);
+		return 1;
+	}
+	o = json_object_from_file(av[1]);
+	if (o == NULL) {
+		fprintf(stderr, "Aborted: null json (file %s)\n", av[1]);
+		return 1;
+	}
+
+	/* prepare the templates */
+	rc = mustach_registry_create(&registry, 0, 4);
+	if (rc == MUSTACH_OK)
+		rc = mustach_registry_load_dir(registry, av[2]);
+	if (rc == MUSTACH_OK) {
+		sbuf.value = inline_template;
+		sbuf.length = sizeof inline_template - 1;
+		rc = mustach_registry_build(registry, 1, names, &sbuf);
+	}
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "Registry error %s (directory %s)\n", mustach_strerror(rc), av[2]);
+		json_object_put(o);
+		mustach_registry_destroy(registry);
+		return 1;
+	}
+	printf("%u templates\n", mustach_registry_count(registry));
+
+	/* render */
+	mustach_wrap_partial_registry = registry;
+	for (av += 3 ; *av != NULL ; av++) {
+		rc = render(registry, o, *av);
+		if (rc != MUSTACH_OK) {
+			fprintf(stderr, "Template error %s (name %s)\n", mustach_strerror(rc), *av);
+			status = 1;
+		}
+	}
+	rc = render(registry, o, names[0]);
+	if (rc != MUSTACH_OK)
+		status = 1;
+	mustach_wrap_partial_registry = NULL;
+	mustach_registry_destroy(registry);
+	json_object_put(o);
+	return status;
+}
+
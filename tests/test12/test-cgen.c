@@ -0,0 +1,127 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+/*
+ * Renders the templates translated to C by mustach-cgen
+ * and checks that the result is the same than the result
+ * of the interpreted templates.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mustach-fastjson.h"
+#include "mustach-helpers.h"
+
+extern const struct mustach_native_entry mustach_cgen_templates[];
+
+/* count of the memory blocks of native templates */
+static int allocated;
+
+static void *count_alloc(size_t size, void *closure)
+{
+	(void)closure;/*make compiler happy #@!%!!*/
+	allocated++;
+	return malloc(size);
+}
+
+static void count_dealloc(void *item, void *closure)
+{
+	(void)closure;/*make compiler happy #@!%!!*/
+	allocated--;
+	free(item);
+}
+
+/* native templates are allocated through this interface */
+static const mustach_build_itf_t build_itf = {
+	.version = MUSTACH_BUILD_ITF_VERSION_1,
+	.error = NULL,
+	.alloc = count_alloc,
+	.dealloc = count_dealloc
+};
+
+/* render the template in the stream */
+static int render(const mustach_fastjson_value_t *o, mustach_template_t *templ,
+		const mustach_build_itf_t *itf, char **result, size_t *length)
+{
+	mustach_stream_t stream = MUSTACH_STREAM_INIT;
+	int rc = mustach_fastjson_apply(templ, o, Mustach_With_AllExtensions,
+			mustach_stream_write_cb, NULL, &stream);
+	mustach_destroy_template(templ, itf, NULL);
+	if (rc == MUSTACH_OK)
+		rc = mustach_stream_end(&stream, result, length);
+	else
+		mustach_stream_abort(&stream);
+	return rc;
+}
+
+/* render the native template of entry and the template of its file */
+static int check(const mustach_fastjson_value_t *o, const struct mustach_native_entry *entry)
+{
+	mustach_sbuf_t sbuf = MUSTACH_SBUF_INIT;
+	mustach_template_t *templ;
+	char path[200], *nat, *itp;
+	size_t lnat, litp;
+	int rc;
+
+	/* native */
+	rc = mustach_make_native_template(&templ, entry->render, entry->name, &build_itf, NULL);
+	if (rc == MUSTACH_OK)
+		rc = render(o, templ, &build_itf, &nat, &lnat);
+	if (rc != MUSTACH_OK)
+		return rc;
+
+	/* interpreted */
+	snprintf(path, sizeof path, "%s.mustache", entry->name);
+	rc = mustach_read_file(path, &sbuf);
+	if (rc == MUSTACH_OK)
+		rc = mustach_make_template(&templ, Mustach_Build_With_Colon
+				| Mustach_Build_With_EmptyTag, &sbuf, path);
+	if (rc == MUSTACH_OK)
+		rc = render(o, templ, NULL, &itp, &litp);
+	if (rc == MUSTACH_OK) {
+		printf("---- %s: %s\n", entry->name,
+			lnat == litp && !memcmp(nat, itp, lnat) ? "same" : "DIFFERENT");
+		fwrite(nat, 1, lnat, stdout);
+		free(itp);
+	}
+	free(nat);
+	return rc;
+}
+
+int main(int ac, char **av)
+{
+	const struct mustach_native_entry *entry;
+	mustach_fastjson_t *doc;
+	int rc, status = 0;
+
+	if (ac < 2) {
+		fprintf(stderr, "usage: %s json\n", av[0]);
+		return 1;
+	}
+	if (mustach_fastjson_load_file(&doc, av[1]) != MUSTACH_OK) {
+		fprintf(stderr, "Aborted: null json (file %s)\n", av[1]);
+		return 1;
+	}
+	for (entry = mustach_cgen_templates ; entry->name != NULL ; entry++) {
+		rc = check(mustach_fastjson_root(doc), entry);
+		if (rc != MUSTACH_OK) {
+			fprintf(stderr, "Template error %s (name %s)\n", mustach_strerror(rc), entry->name);
+			status = 1;
+		}
+	}
+	printf("---- native allocations: %s\n", allocated == 0 ? "released" : "LEAKED");
+	mustach_fastjson_destroy(doc);
+	return status;
+}
+
@@ -0,0 +1,70 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+/*
+ * Prints the data paths read by the templates given as arguments.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mustach-wrap.h"
+#include "mustach-helpers.h"
+
+/* print the path indented by its nesting */
+static int print(void *closure, const struct mustach_wrap_path *path)
+{
+	const struct mustach_wrap_path *p;
+	unsigned i;
+
+	(void)closure;/*make compiler happy #@!%!!*/
+	for (p = path->parent ; p != NULL ; p = p->parent)
+		printf("  ");
+	printf("%c%c%c%c%c %.*s:",
+		path->usage & Mustach_Path_Value ? 'v' : '-',
+		path->usage & Mustach_Path_Section ? 's' : '-',
+		path->usage & Mustach_Path_Inverted ? 'i' : '-',
+		path->usage & Mustach_Path_Compare ? 'c' : '-',
+		path->usage & Mustach_Path_Partial ? 'p' : '-',
+		(int)path->length, path->name);
+	for (i = 0 ; i < path->nkeys ; i++)
+		printf(" [%s]", path->keys[i]);
+	if (path->value != NULL)
+		printf(" = [%s]", path->value);
+	printf("\n");
+	return MUSTACH_OK;
+}
+
+int main(int ac, char **av)
+{
+	mustach_sbuf_t sbuf;
+	mustach_template_t *templ;
+	int rc;
+
+	while (*++av) {
+		printf("--- %s\n", *av);
+		rc = mustach_read_file(*av, &sbuf);
+		if (rc == MUSTACH_OK)
+			rc = mustach_make_template(&templ, 0, &sbuf, *av);
+		if (rc == MUSTACH_OK) {
+			rc = mustach_wrap_template_paths(templ, Mustach_With_AllExtensions, print, NULL);
+			mustach_destroy_template(templ, NULL, NULL);
+		}
+		if (rc != MUSTACH_OK) {
+			fprintf(stderr, "error %d for %s\n", rc, *av);
+			return 1;
+		}
+	}
+	(void)ac;/*make compiler happy #@!%!!*/
+	return 0;
+}
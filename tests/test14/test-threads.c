@@ -0,0 +1,137 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+/*
+ * Renders the same template for the same json-c data from many
+ * threads at the same time with the flag Mustach_With_ReadOnlyData
+ * and checks that all the results are the result of json-c's own
+ * serialization, obtained without the flag on a copy of the data.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "mustach-json-c.h"
+#include "mustach-helpers.h"
+
+#define THREADS    8
+#define RENDERINGS 200
+
+#define FLAGS (Mustach_With_AllExtensions | Mustach_With_ReadOnlyData)
+
+static mustach_template_t *templ;
+static struct json_object *root;
+static const char *expected;
+
+static int render(char **result, size_t *size)
+{
+	mustach_stream_t stream;
+	int rc;
+
+	mustach_stream_init(&stream);
+	rc = mustach_json_c_apply(templ, root, FLAGS, mustach_stream_write_cb, NULL, &stream);
+	if (rc == MUSTACH_OK)
+		return mustach_stream_end(&stream, result, size);
+	mustach_stream_abort(&stream);
+	return rc;
+}
+
+static void *run(void *arg)
+{
+	long bad = 0;
+	char *result;
+	size_t size;
+	int i;
+
+	(void)arg;/*make compiler happy #@!%!!*/
+	for (i = 0 ; i < RENDERINGS ; i++) {
+		if (render(&result, &size) != MUSTACH_OK)
+			bad++;
+		else {
+			if (strcmp(result, expected))
+				bad++;
+			free(result);
+		}
+	}
+	return (void*)bad;
+}
+
+int main(int ac, char **av)
+{
+	mustach_sbuf_t sbuf = MUSTACH_SBUF_INIT;
+	struct json_object *copy;
+	pthread_t threads[THREADS];
+	char *reference, *result;
+	size_t size;
+	long bad, count;
+	void *ret;
+	int i, rc;
+
+	if (ac != 3) {
+		fprintf(stderr, "usage: %s json template\n", av[0]);
+		return 1;
+	}
+	root = json_object_from_file(av[1]);
+	copy = json_object_from_file(av[1]);
+	if (root == NULL || copy == NULL) {
+		fprintf(stderr, "Aborted: null json (file %s)\n", av[1]);
+		return 1;
+	}
+	rc = mustach_read_file(av[2], &sbuf);
+	if (rc == MUSTACH_OK)
+		rc = mustach_make_template(&templ, 0, &sbuf, av[2]);
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "Aborted: bad template %s: %s\n", av[2], mustach_strerror(rc));
+		return 1;
+	}
+
+	/* the reference is the rendering using the serialization of json-c */
+	rc = mustach_json_c_apply(templ, copy, Mustach_With_AllExtensions,
+			mustach_fwrite_cb, NULL, stdout);
+	if (rc == MUSTACH_OK)
+		rc = mustach_json_c_mem(sbuf.value, 0, copy, Mustach_With_AllExtensions, &reference, &size);
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "Aborted: can't render: %s\n", mustach_strerror(rc));
+		return 1;
+	}
+	expected = reference;
+
+	/* check the rendering without modification of the data */
+	rc = render(&result, &size);
+	if (rc != MUSTACH_OK || strcmp(result, reference)) {
+		printf("---- read only rendering differs\n%s", rc == MUSTACH_OK ? result : "");
+		return 1;
+	}
+	free(result);
+	printf("---- read only rendering is the same\n");
+
+	/* render from the threads */
+	for (i = 0 ; i < THREADS ; i++)
+		if (pthread_create(&threads[i], NULL, run, NULL) != 0) {
+			fprintf(stderr, "Aborted: can't create thread\n");
+			return 1;
+		}
+	for (bad = 0, i = 0 ; i < THREADS ; i++) {
+		pthread_join(threads[i], &ret);
+		bad += (long)ret;
+	}
+	count = THREADS * RENDERINGS;
+	printf("---- %ld renderings from %d threads, %ld differs\n", count, THREADS, bad);
+
+	mustach_destroy_template(templ, NULL, NULL);
+	free(reference);
+	json_object_put(root);
+	json_object_put(copy);
+	return bad != 0;
+}
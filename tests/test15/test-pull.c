@@ -0,0 +1,357 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+/*
+ * Pulls the output of a template, with its partials, parents
+ * and blocks, using buffers of various sizes and checks that
+ * it is the output of mustach_apply_template. Checks also that
+ * the function 'escape' of the interface is used in both modes
+ * and that interfaces escaping only with 'emit_esc' can't pull.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mustach2.h"
+#include "mustach-helpers.h"
+
+/* the data: sections 'rows' of 3 items, 'yes' and 'no' */
+struct data {
+	int depth;
+	int remain[MUSTACH_MAX_DEPTH];
+	int index[MUSTACH_MAX_DEPTH];
+	char scratch[16];
+	int starts, stops, gets, puts;
+	mustach_stream_t *stream;
+};
+
+static int start(void *closure)
+{
+	struct data *d = closure;
+	d->depth = 0;
+	d->index[0] = 0;
+	d->starts++;
+	return MUSTACH_OK;
+}
+
+static void stop(void *closure, int status)
+{
+	struct data *d = closure;
+	(void)status;/*make compiler happy #@!%!!*/
+	d->stops++;
+}
+
+static int emit(void *closure, const char *buffer, size_t size)
+{
+	struct data *d = closure;
+	return mustach_stream_write(d->stream, buffer, size);
+}
+
+/* an escaping other than the default one, for checking its use */
+static int escape(void *closure, const char *buffer, size_t size,
+		int (*write)(void *wrclosure, const char *buffer, size_t size), void *wrclosure)
+{
+	const char *entity;
+	size_t i, done;
+	int rc = MUSTACH_OK;
+
+	(void)closure;/*make compiler happy #@!%!!*/
+	for (i = done = 0 ; rc == MUSTACH_OK && i < size ; i++) {
+		switch (buffer[i]) {
+		case '<': entity = "[lt]"; break;
+		case '>': entity = "[gt]"; break;
+		case '&': entity = "[amp]"; break;
+		case '"': entity = "[quot]"; break;
+		default: continue;
+		}
+		rc = write(wrclosure, &buffer[done], i - done);
+		if (rc == MUSTACH_OK)
+			rc = write(wrclosure, entity, strlen(entity));
+		done = i + 1;
+	}
+	return rc == MUSTACH_OK ? write(wrclosure, &buffer[done], size - done) : rc;
+}
+
+static int emit_esc(void *closure, const char *buffer, size_t size, int esc)
+{
+	struct data *d = closure;
+	return esc
+		? escape(closure, buffer, size, mustach_stream_write_cb, d->stream)
+		: mustach_stream_write(d->stream, buffer, size);
+}
+
+static int get(void *closure, const char *name, size_t length, mustach_sbuf_t *sbuf)
+{
+	struct data *d = closure;
+	if (length == 1 && name[0] == 'i') {
+		sbuf->length = (size_t)sprintf(d->scratch, "%d", d->index[d->depth]);
+		sbuf->value = d->scratch;
+	}
+	else if (length == 4 && !memcmp(name, "name", 4))
+		sbuf->value = "World & <co>";
+	else if (length == 5 && !memcmp(name, "title", 5))
+		sbuf->value = "the \"pulled\" page";
+	else
+		sbuf->value = "";
+	return MUSTACH_OK;
+}
+
+static int enter(void *closure, const char *name, size_t length)
+{
+	struct data *d = closure;
+	int count;
+
+	if (length == 4 && !memcmp(name, "rows", 4))
+		count = 3;
+	else if (length == 3 && !memcmp(name, "yes", 3))
+		count = 1;
+	else
+		count = 0;
+	if (count == 0)
+		return 0;
+	if (d->depth + 1 >= MUSTACH_MAX_DEPTH)
+		return MUSTACH_ERROR_TOO_DEEP;
+	d->depth++;
+	d->remain[d->depth] = count - 1;
+	d->index[d->depth] = count > 1 ? 1 : d->index[d->depth - 1];
+	return 1;
+}
+
+static int next(void *closure)
+{
+	struct data *d = closure;
+	if (d->remain[d->depth] == 0)
+		return 0;
+	d->remain[d->depth]--;
+	d->index[d->depth]++;
+	return 1;
+}
+
+static int leave(void *closure)
+{
+	struct data *d = closure;
+	d->depth--;
+	return MUSTACH_OK;
+}
+
+static int partial_get(void *closure, const char *name, size_t length, mustach_template_t **partial)
+{
+	struct data *d = closure;
+	mustach_sbuf_t sbuf = MUSTACH_SBUF_INIT;
+	char path[100];
+	int rc;
+
+	snprintf(path, sizeof path, "%.*s.mustache", (int)length, name);
+	rc = mustach_read_file(path, &sbuf);
+	if (rc == MUSTACH_OK)
+		rc = mustach_make_template(partial, 0, &sbuf, path);
+	if (rc == MUSTACH_OK)
+		d->gets++;
+	return rc;
+}
+
+static void partial_put(void *closure, mustach_template_t *partial)
+{
+	struct data *d = closure;
+	d->puts++;
+	mustach_destroy_template(partial, NULL, NULL);
+}
+
+static const mustach_apply_itf_t itf = {
+	.version = MUSTACH_APPLY_ITF_VERSION_CUR,
+	.start = start,
+	.stop = stop,
+	.emit_raw = emit,
+	.get = get,
+	.enter = enter,
+	.next = next,
+	.leave = leave,
+	.partial_get = partial_get,
+	.partial_put = partial_put
+};
+
+/* the interface for pulling, the output goes to the buffers */
+static const mustach_apply_itf_t pull_itf = {
+	.version = MUSTACH_APPLY_ITF_VERSION_CUR,
+	.start = start,
+	.stop = stop,
+	.get = get,
+	.enter = enter,
+	.next = next,
+	.leave = leave,
+	.partial_get = partial_get,
+	.partial_put = partial_put
+};
+
+/* the interfaces using the escaping above, when pushing or pulling */
+static const mustach_apply_itf_t esc_itf = {
+	.version = MUSTACH_APPLY_ITF_VERSION_CUR,
+	.start = start,
+	.stop = stop,
+	.emit_esc = emit_esc,
+	.get = get,
+	.enter = enter,
+	.next = next,
+	.leave = leave,
+	.partial_get = partial_get,
+	.partial_put = partial_put,
+	.escape = escape
+};
+
+static const mustach_apply_itf_t pull_esc_itf = {
+	.version = MUSTACH_APPLY_ITF_VERSION_CUR,
+	.start = start,
+	.stop = stop,
+	.get = get,
+	.enter = enter,
+	.next = next,
+	.leave = leave,
+	.partial_get = partial_get,
+	.partial_put = partial_put,
+	.escape = escape
+};
+
+/* an interface escaping with 'emit_esc' only, it can't pull */
+static const mustach_apply_itf_t emit_esc_itf = {
+	.version = MUSTACH_APPLY_ITF_VERSION_CUR,
+	.start = start,
+	.stop = stop,
+	.emit_esc = emit_esc,
+	.get = get,
+	.enter = enter,
+	.next = next,
+	.leave = leave,
+	.partial_get = partial_get,
+	.partial_put = partial_put
+};
+
+/* pull the whole output with buffers of 'size' */
+static int pull(mustach_template_t *templ, const mustach_apply_itf_t *pitf, size_t size, struct data *d, mustach_stream_t *stream)
+{
+	mustach_apply_t *apply;
+	char buffer[size];
+	size_t written;
+	int rc, wrc;
+
+	rc = mustach_apply_begin(&apply, templ, 0, pitf, d);
+	if (rc != MUSTACH_OK)
+		return rc;
+	do {
+		rc = mustach_apply_step(apply, buffer, size, &written);
+		if (rc >= MUSTACH_OK && written != 0) {
+			wrc = mustach_stream_write(stream, buffer, written);
+			if (wrc != MUSTACH_OK)
+				rc = wrc;
+		}
+	} while (rc > MUSTACH_OK);
+	mustach_apply_end(apply);
+	return rc;
+}
+
+int main(int ac, char **av)
+{
+	static const size_t sizes[] = { 1, 2, 3, 5, 8, 13, 64, 1000 };
+	mustach_sbuf_t sbuf = MUSTACH_SBUF_INIT;
+	mustach_template_t *templ;
+	mustach_stream_t stream;
+	mustach_apply_t *apply;
+	struct data d;
+	char *expected, *result, buffer[10];
+	size_t length, size, i;
+	int rc;
+
+	if (ac != 2) {
+		fprintf(stderr, "usage: %s template\n", av[0]);
+		return 1;
+	}
+	memset(&d, 0, sizeof d);
+	rc = mustach_read_file(av[1], &sbuf);
+	if (rc == MUSTACH_OK)
+		rc = mustach_make_template(&templ, 0, &sbuf, av[1]);
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "Aborted: bad template %s: %s\n", av[1], mustach_strerror(rc));
+		return 1;
+	}
+
+	/* the expected output */
+	mustach_stream_init(&stream);
+	d.stream = &stream;
+	rc = mustach_apply_template(templ, 0, &itf, &d);
+	if (rc == MUSTACH_OK)
+		rc = mustach_stream_end(&stream, &expected, &length);
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "Aborted: can't apply: %s\n", mustach_strerror(rc));
+		return 1;
+	}
+	fputs(expected, stdout);
+
+	/* pull it with buffers of various sizes */
+	for (i = 0 ; i < sizeof sizes / sizeof *sizes ; i++) {
+		mustach_stream_init(&stream);
+		rc = pull(templ, &pull_itf, sizes[i], &d, &stream);
+		if (rc == MUSTACH_OK)
+			rc = mustach_stream_end(&stream, &result, &size);
+		else
+			mustach_stream_abort(&stream);
+		if (rc != MUSTACH_OK)
+			printf("---- buffers of %u bytes: error %s\n", (unsigned)sizes[i], mustach_strerror(rc));
+		else {
+			printf("---- buffers of %u bytes: %s\n", (unsigned)sizes[i],
+				size == length && !memcmp(result, expected, length) ? "same" : "differs");
+			free(result);
+		}
+	}
+
+	/* the escaping of the interface, pushed then pulled */
+	mustach_stream_init(&stream);
+	d.stream = &stream;
+	rc = mustach_apply_template(templ, 0, &esc_itf, &d);
+	free(expected);
+	if (rc == MUSTACH_OK)
+		rc = mustach_stream_end(&stream, &expected, &length);
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "Aborted: can't apply: %s\n", mustach_strerror(rc));
+		return 1;
+	}
+	fputs(expected, stdout);
+	mustach_stream_init(&stream);
+	rc = pull(templ, &pull_esc_itf, 5, &d, &stream);
+	if (rc == MUSTACH_OK)
+		rc = mustach_stream_end(&stream, &result, &size);
+	else
+		mustach_stream_abort(&stream);
+	if (rc != MUSTACH_OK)
+		printf("---- escaping of the interface: error %s\n", mustach_strerror(rc));
+	else {
+		printf("---- escaping of the interface: %s\n",
+			size == length && !memcmp(result, expected, length) ? "same" : "differs");
+		free(result);
+	}
+	rc = mustach_apply_begin(&apply, templ, 0, &emit_esc_itf, &d);
+	printf("---- pulling with emit_esc only: %s\n", mustach_strerror(rc));
+
+	/* end before the completion */
+	rc = mustach_apply_begin(&apply, templ, 0, &pull_itf, &d);
+	if (rc == MUSTACH_OK) {
+		for (i = 0 ; i < 8 ; i++)
+			rc = mustach_apply_step(apply, buffer, sizeof buffer, &size);
+		mustach_apply_end(apply);
+	}
+	printf("---- ended before completion: %s\n", rc > 0 ? "yes" : "no");
+	printf("---- starts %s stops, partial gets %s puts\n",
+		d.starts == d.stops ? "==" : "!=", d.gets == d.puts ? "==" : "!=");
+
+	mustach_destroy_template(templ, NULL, NULL);
+	free(expected);
+	return 0;
+}
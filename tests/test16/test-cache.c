@@ -0,0 +1,323 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+/*
+ * Checks the cache of templates: hits, replacement, references
+ * kept after eviction, eviction of the least recently used records,
+ * invalidation of records of modified files, the caching of the
+ * partials of mustach-wrap, including the partials found in the data,
+ * and the partials made again at each use by a resolver.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mustach-fastjson.h"
+#include "mustach-helpers.h"
+
+/* count of destroyed templates */
+static int destroyed;
+
+static void release_text(void *value, void *closure)
+{
+	(void)closure;/*make compiler happy #@!%!!*/
+	free(value);
+	destroyed++;
+}
+
+/* make a template owning a copy of text repeated count times */
+static mustach_template_t *make(const char *text, int count)
+{
+	mustach_sbuf_t sbuf = MUSTACH_SBUF_INIT;
+	mustach_template_t *templ;
+	size_t length = strlen(text);
+	char *copy;
+	int i;
+
+	copy = malloc(length * (size_t)count + 1);
+	if (copy == NULL)
+		exit(1);
+	for (i = 0 ; i < count ; i++)
+		memcpy(&copy[length * (size_t)i], text, length);
+	copy[length * (size_t)count] = 0;
+	sbuf.value = copy;
+	sbuf.releasecb = release_text;
+	if (mustach_make_template(&templ, 0, &sbuf, NULL) != MUSTACH_OK)
+		exit(1);
+	return templ;
+}
+
+/* is the key recorded for templ? (NULL for any template) */
+static const char *has(mustach_cache_t *cache, const char *key, mustach_template_t *templ)
+{
+	mustach_template_t *found;
+
+	if (mustach_cache_get(cache, key, strlen(key), &found) != MUSTACH_OK)
+		return "miss";
+	mustach_cache_release(found);
+	return templ == NULL || found == templ ? "hit" : "other";
+}
+
+/* is the key made of prefix and key recorded for templ? */
+static const char *prefixed(mustach_cache_t *cache, char prefix, const char *key, mustach_template_t *templ)
+{
+	mustach_template_t *found;
+
+	if (mustach_cache_get_prefixed(cache, prefix, key, strlen(key), &found) != MUSTACH_OK)
+		return "miss";
+	mustach_cache_release(found);
+	return templ == NULL || found == templ ? "hit" : "other";
+}
+
+static void add(mustach_cache_t *cache, const char *key, mustach_template_t *templ, const char *path)
+{
+	if (mustach_cache_add(cache, key, strlen(key), templ, path) != MUSTACH_OK)
+		exit(1);
+}
+
+static void write_file(const char *path, const char *text)
+{
+	FILE *file = fopen(path, "w");
+	if (file == NULL)
+		exit(1);
+	fputs(text, file);
+	fclose(file);
+}
+
+static void check_hits(void)
+{
+	mustach_cache_t *cache;
+	mustach_template_t *a, *b;
+
+	printf("---- hits\n");
+	mustach_cache_create(&cache, 0, 0);
+	a = make("a{{x}}", 1);
+	b = make("b{{x}}", 1);
+	add(cache, "a", a, NULL);
+	printf("a: %s, ", has(cache, "a", a));
+	printf("b: %s\n", has(cache, "b", NULL));
+	add(cache, "a", b, NULL);
+	printf("a replaced by b: %s\n", has(cache, "a", b));
+	add(cache, "xa", a, NULL);
+	printf("xa prefixed: %s, ", prefixed(cache, 'x', "a", a));
+	printf("ya prefixed: %s\n", prefixed(cache, 'y', "a", NULL));
+	mustach_unref_template(a, NULL, NULL);
+	printf("replaced and released: %d destroyed\n", destroyed);
+	mustach_unref_template(b, NULL, NULL);
+	mustach_cache_destroy(cache);
+	printf("cache destroyed: %d destroyed\n", destroyed);
+}
+
+static void check_references(void)
+{
+	mustach_cache_t *cache;
+	mustach_template_t *a, *got;
+
+	printf("---- references\n");
+	destroyed = 0;
+	mustach_cache_create(&cache, 0, 0);
+	a = make("a{{x}}", 1);
+	add(cache, "a", a, NULL);
+	mustach_unref_template(a, NULL, NULL);
+	printf("owned by the cache: %d destroyed\n", destroyed);
+	mustach_cache_get(cache, "a", 1, &got);
+	mustach_cache_clear(cache);
+	printf("got and cleared: %d destroyed, ", destroyed);
+	printf("a: %s\n", has(cache, "a", NULL));
+	mustach_cache_release(got);
+	printf("released: %d destroyed\n", destroyed);
+	mustach_cache_destroy(cache);
+}
+
+static void check_lru(void)
+{
+	mustach_cache_t *cache;
+	mustach_template_t *one, *two, *three;
+	const char *r1, *r2, *r3;
+	size_t size;
+
+	/* the budget holds two templates but not three */
+	printf("---- least recently used\n");
+	destroyed = 0;
+	one = make("one {{x}}\n", 200);
+	two = make("two {{x}}\n", 200);
+	three = make("three{{x}}\n", 200);
+	size = mustach_get_template_size(one);
+	mustach_cache_create(&cache, 2 * size + size / 2, 0);
+	add(cache, "one", one, NULL);
+	add(cache, "two", two, NULL);
+	r1 = has(cache, "one", one);
+	r2 = has(cache, "two", two);
+	printf("one: %s, two: %s\n", r1, r2);
+
+	/* 'one' is the least recently used */
+	add(cache, "three", three, NULL);
+	r1 = has(cache, "one", one);
+	r2 = has(cache, "two", two);
+	r3 = has(cache, "three", three);
+	printf("one: %s, two: %s, three: %s\n", r1, r2, r3);
+
+	/* 'two' is the least recently used */
+	add(cache, "one", one, NULL);
+	r1 = has(cache, "one", one);
+	r2 = has(cache, "two", two);
+	r3 = has(cache, "three", three);
+	printf("one: %s, two: %s, three: %s\n", r1, r2, r3);
+	mustach_unref_template(one, NULL, NULL);
+	mustach_unref_template(two, NULL, NULL);
+	mustach_unref_template(three, NULL, NULL);
+	printf("evicted and released: %d destroyed\n", destroyed);
+	mustach_cache_destroy(cache);
+	printf("cache destroyed: %d destroyed\n", destroyed);
+}
+
+static void check_mtime(const char *path)
+{
+	mustach_cache_t *checked, *unchecked;
+	mustach_template_t *templ;
+
+	printf("---- modification of files\n");
+	mustach_cache_create(&checked, 0, Mustach_Cache_Check_MTime);
+	mustach_cache_create(&unchecked, 0, 0);
+	write_file(path, "first {{x}}\n");
+	templ = make("first {{x}}\n", 1);
+	add(checked, "file", templ, path);
+	add(unchecked, "file", templ, path);
+	mustach_unref_template(templ, NULL, NULL);
+	printf("checked: %s, ", has(checked, "file", NULL));
+	printf("unchecked: %s\n", has(unchecked, "file", NULL));
+	write_file(path, "modified {{x}}\n");
+	printf("checked: %s, ", has(checked, "file", NULL));
+	printf("unchecked: %s\n", has(unchecked, "file", NULL));
+	remove(path);
+	mustach_cache_destroy(checked);
+	mustach_cache_destroy(unchecked);
+}
+
+/* count of partials given by the hook */
+static int hooked;
+
+static int get_partial(const char *name, struct mustach_sbuf *sbuf)
+{
+	if (strcmp(name, "item"))
+		return MUSTACH_ERROR_NOT_FOUND;
+	hooked++;
+	sbuf->value = "<{{.}}>";
+	return MUSTACH_OK;
+}
+
+static void check_wrap(void)
+{
+	static const char template[] = "{{#items}}{{>item}}{{/items}}\n";
+	static const char indata[] = "[{{>inline}}]\n";
+	mustach_fastjson_t *doc;
+	int i;
+
+	printf("---- partials of mustach-wrap\n");
+	mustach_fastjson_parse_copy(&doc, "{\"items\":[1,2,3],\"inline\":\"data {{items.1}}\"}", 0);
+	printf("without cache: ");
+	mustach_fastjson_file(indata, 0, mustach_fastjson_root(doc), 0, stdout);
+	mustach_cache_create(&mustach_wrap_partial_cache, 0, 0);
+	mustach_wrap_get_partial = get_partial;
+	for (i = 0 ; i < 2 ; i++)
+		mustach_fastjson_file(template, 0, mustach_fastjson_root(doc), 0, stdout);
+	printf("partial got %d time(s) from the hook\n", hooked);
+	printf("with cache: ");
+	mustach_fastjson_file(indata, 0, mustach_fastjson_root(doc), 0, stdout);
+	mustach_wrap_get_partial = NULL;
+	mustach_cache_destroy(mustach_wrap_partial_cache);
+	mustach_wrap_partial_cache = NULL;
+	mustach_fastjson_destroy(doc);
+}
+
+/* count of partials made by the resolver and greatest count alive */
+static int made, alive;
+
+static int resolver_get(void *closure, const char *name, size_t length, mustach_template_t **partial)
+{
+	(void)closure;/*make compiler happy #@!%!!*/
+	if (length != 4 || memcmp(name, "item", 4))
+		return MUSTACH_ERROR_NOT_FOUND;
+	*partial = make("[{{name}}]", 1);
+	made++;
+	if (made - destroyed > alive)
+		alive = made - destroyed;
+	return MUSTACH_OK;
+}
+
+static void resolver_put(void *closure, mustach_template_t *partial)
+{
+	(void)closure;/*make compiler happy #@!%!!*/
+	mustach_unref_template(partial, NULL, NULL);
+}
+
+/* the output of the rendering */
+static char output[8192];
+static size_t outlen;
+
+static int write_output(void *closure, const char *buffer, size_t size)
+{
+	(void)closure;/*make compiler happy #@!%!!*/
+	if (outlen + size > sizeof output)
+		return MUSTACH_ERROR_TOO_BIG;
+	memcpy(&output[outlen], buffer, size);
+	outlen += size;
+	return MUSTACH_OK;
+}
+
+static void check_resolver(void)
+{
+	static const mustach_partial_resolver_t resolver = {
+		.get = resolver_get,
+		.put = resolver_put,
+		.closure = NULL
+	};
+	mustach_fastjson_t *doc;
+	mustach_template_t *templ;
+	char json[8192];
+	size_t pos;
+	int i, rc, ok;
+
+	printf("---- partials made at each use by a resolver\n");
+	pos = (size_t)sprintf(json, "{\"name\":\"root\",\"items\":[0");
+	for (i = 1 ; i < 1000 ; i++)
+		pos += (size_t)sprintf(&json[pos], ",%d", i);
+	strcpy(&json[pos], "]}");
+	mustach_fastjson_parse_copy(&doc, json, 0);
+	templ = make("{{#items}}{{>item}}{{/items}}", 1);
+	destroyed = 0;
+	rc = mustach_fastjson_apply_with(templ, mustach_fastjson_root(doc),
+			Mustach_With_AllExtensions | Mustach_With_LoopInvariant,
+			&resolver, write_output, NULL, NULL);
+	for (ok = rc == MUSTACH_OK && outlen == 6000, i = 0 ; ok && i < 1000 ; i++)
+		ok = !memcmp(&output[6 * i], "[root]", 6);
+	printf("rendered: %s, made %d, at most %d alive, %d destroyed\n",
+		ok ? "ok" : "bad", made, alive, destroyed);
+	mustach_unref_template(templ, NULL, NULL);
+	mustach_fastjson_destroy(doc);
+}
+
+int main(int ac, char **av)
+{
+	if (ac != 2) {
+		fprintf(stderr, "usage: %s scratch-file\n", av[0]);
+		return 1;
+	}
+	check_hits();
+	check_references();
+	check_lru();
+	check_mtime(av[1]);
+	check_wrap();
+	check_resolver();
+	return 0;
+}
@@ -0,0 +1,239 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+/*
+ * Renders a template with an interface allocated with the size it
+ * had before the fields following 'get' were added, without the flag
+ * Mustach_With_ExtendedItf, then with the full interface of version 2
+ * without and with the flag, and counts the calls to the functions of
+ * the extended fields: without the flag, neither the version nor the
+ * functions 'compare_lit', 'sel_ic', 'sel_len', 'subsel_len' and
+ * 'sel_ic_len' are read.
+ * Then checks that the flag Mustach_With_LoopInvariant gets once the
+ * values found outside of the loop but not the values of its items,
+ * given by the interface as a cursor of the same address.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mustach-wrap.h"
+#include "mustach-helpers.h"
+
+static const char template[] =
+	"hello {{name}}: {{#loop}}[{{name}}/{{id}}]{{/loop}}"
+	" {{#value=3}}three{{/value=3}}{{^value>4}} not above four{{/value>4}}\n";
+
+/* the data, some named values, the value 'loop' being a list of 3 items */
+static const struct value { const char *name, *value; } values[] = {
+	{ "name", "world" },
+	{ "value", "3" },
+	{ "loop", "" }
+};
+
+/* the field 'id' of the items of the list */
+static const char *ids[] = { "a", "b", "c" };
+
+struct data {
+	/* the selection */
+	const struct value *sel;
+	/* the item of the list, given as a cursor of the same address */
+	struct value cursor;
+	/* count of entered sections and depth of the list or 0 */
+	int depth, loop;
+	/* index in the list */
+	int index;
+	/* count of calls to the extended functions and to get */
+	int extended, gets;
+};
+
+/* search the name, returns the depth where found or -1 */
+static int find(struct data *d, const char *name, size_t length)
+{
+	unsigned i;
+
+	if (d->loop && length == 2 && !memcmp(name, "id", 2)) {
+		d->cursor.name = "id";
+		d->cursor.value = ids[d->index];
+		d->sel = &d->cursor;
+		return d->loop;
+	}
+	for (i = 0 ; i < sizeof values / sizeof *values ; i++)
+		if (strlen(values[i].name) == length && !memcmp(values[i].name, name, length)) {
+			d->sel = &values[i];
+			return 0;
+		}
+	return -1;
+}
+
+static int sel_len(void *closure, const char *name, size_t length)
+{
+	return find(closure, name, length) >= 0;
+}
+
+static int sel(void *closure, const char *name)
+{
+	struct data *d = closure;
+
+	if (name != NULL)
+		return sel_len(closure, name, strlen(name));
+	return d->sel != NULL;
+}
+
+static int subsel(void *closure, const char *name)
+{
+	(void)closure; (void)name;/*make compiler happy #@!%!!*/
+	return 0;
+}
+
+static int compare(void *closure, const char *value)
+{
+	struct data *d = closure;
+	return strcmp(d->sel->value, value);
+}
+
+static int enter(void *closure, int objiter)
+{
+	struct data *d = closure;
+
+	(void)objiter;/*make compiler happy #@!%!!*/
+	if (d->sel == &values[2]) {
+		d->loop = ++d->depth;
+		d->index = 0;
+		return 1;
+	}
+	if (d->sel == NULL || d->sel->value[0] == 0)
+		return 0;
+	d->depth++;
+	return 1;
+}
+
+static int next(void *closure)
+{
+	struct data *d = closure;
+	return d->depth == d->loop && ++d->index < 3;
+}
+
+static int leave(void *closure)
+{
+	struct data *d = closure;
+	if (d->depth-- == d->loop)
+		d->loop = 0;
+	return MUSTACH_OK;
+}
+
+static int get(void *closure, struct mustach_sbuf *sbuf, int key)
+{
+	struct data *d = closure;
+	d->gets++;
+	sbuf->value = key ? d->sel->name : d->sel->value;
+	return 1;
+}
+
+static int x_compare_lit(void *closure, const struct mustach_wrap_lit *lit)
+{
+	struct data *d = closure;
+	d->extended++;
+	return compare(closure, lit->string);
+}
+
+static int x_sel_ic_len(void *closure, const char *name, size_t length, struct mustach_wrap_ic *ic)
+{
+	struct data *d = closure;
+	d->extended++;
+	ic->stamp = 1;
+	ic->depth = find(d, name, length);
+	ic->item = ic->depth < 0 ? NULL : (void*)d->sel;
+	return ic->depth >= 0;
+}
+
+static int x_sel_ic(void *closure, const char *name, struct mustach_wrap_ic *ic)
+{
+	return x_sel_ic_len(closure, name, strlen(name), ic);
+}
+
+static int x_sel_len(void *closure, const char *name, size_t length)
+{
+	struct data *d = closure;
+	d->extended++;
+	return sel_len(closure, name, length);
+}
+
+static int x_subsel_len(void *closure, const char *name, size_t length)
+{
+	struct data *d = closure;
+	(void)name; (void)length;/*make compiler happy #@!%!!*/
+	d->extended++;
+	return 0;
+}
+
+static const struct mustach_wrap_itf itf = {
+	.start = NULL,
+	.stop = NULL,
+	.compare = compare,
+	.sel = sel,
+	.subsel = subsel,
+	.enter = enter,
+	.next = next,
+	.leave = leave,
+	.get = get,
+	.compare_lit = x_compare_lit,
+	.sel_ic = x_sel_ic,
+	.version = MUSTACH_WRAP_ITF_VERSION_2,
+	.sel_len = x_sel_len,
+	.subsel_len = x_subsel_len,
+	.sel_ic_len = x_sel_ic_len
+};
+
+static int render(const char *title, const struct mustach_wrap_itf *witf, int flags)
+{
+	struct data d;
+	char *result;
+	size_t size;
+	int rc;
+
+	memset(&d, 0, sizeof d);
+	rc = mustach_wrap_mem(template, 0, witf, &d, flags, &result, &size);
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "Template error %s (%s)\n", mustach_strerror(rc), title);
+		return 1;
+	}
+	printf("---- %s\n%sextended calls: %s, values got: %d\n",
+		title, result, d.extended ? "some" : "none", d.gets);
+	free(result);
+	return 0;
+}
+
+int main(int ac, char **av)
+{
+	struct mustach_wrap_itf *base;
+	size_t size = offsetof(struct mustach_wrap_itf, compare_lit);
+	int status;
+
+	(void)ac; (void)av;/*make compiler happy #@!%!!*/
+
+	/* an interface of the size it had before the extension */
+	base = malloc(size);
+	if (base == NULL)
+		return 1;
+	memcpy(base, &itf, size);
+
+	status = render("base interface", base, Mustach_With_AllExtensions);
+	status |= render("extended interface without the flag", &itf, Mustach_With_AllExtensions);
+	status |= render("extended interface", &itf, Mustach_With_AllExtensions | Mustach_With_ExtendedItf);
+	status |= render("extended interface with loop invariants", &itf,
+			Mustach_With_AllExtensions | Mustach_With_ExtendedItf | Mustach_With_LoopInvariant);
+	free(base);
+	return status;
+}
@@ -0,0 +1,146 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+/*
+ * Renders templates in memory chunks of various sizes and checks
+ * that the chunks, given as iovec or concatenated, hold the output
+ * rendered in one buffer. Checks also that pulling the output in
+ * buffers of various sizes gives the same output.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "mustach-fastjson.h"
+#include "mustach-helpers.h"
+
+/* render in chunks of the size and compare to the expected output */
+static int check(const char *templ, const mustach_fastjson_value_t *root, size_t chunksize,
+		const char *expected, size_t length)
+{
+	mustach_chunks_t chunks;
+	struct iovec *iov;
+	size_t n, i, total, size, max;
+	char *result;
+	int rc;
+
+	mustach_chunks_init(&chunks, chunksize);
+	rc = mustach_fastjson_emit(templ, 0, root, Mustach_With_AllExtensions,
+			mustach_chunks_emit_cb, &chunks);
+	if (rc != MUSTACH_OK) {
+		mustach_chunks_abort(&chunks);
+		return rc;
+	}
+
+	/* check the chunks given as iovec */
+	n = mustach_chunks_iovec(&chunks, NULL, 0);
+	iov = malloc(n * sizeof *iov);
+	if (iov == NULL)
+		exit(1);
+	mustach_chunks_iovec(&chunks, iov, n);
+	for (total = max = i = 0 ; i < n ; i++) {
+		if (memcmp(iov[i].iov_base, &expected[total], iov[i].iov_len))
+			break;
+		total += iov[i].iov_len;
+		if (iov[i].iov_len > max)
+			max = iov[i].iov_len;
+	}
+	free(iov);
+
+	/* check the concatenation */
+	rc = mustach_chunks_end(&chunks, &result, &size);
+	if (rc != MUSTACH_OK)
+		return rc;
+	printf("chunks of %u: %s in %u chunk(s) of at most %u bytes, %s\n",
+		(unsigned)chunksize,
+		i == n && total == length ? "same" : "differs",
+		(unsigned)n, (unsigned)max,
+		size == length && !memcmp(result, expected, length) ? "same" : "differs");
+	free(result);
+	return MUSTACH_OK;
+}
+
+/* pull the rendering in buffers of the size and compare to the expected output */
+static int pull(const char *templ, const mustach_fastjson_value_t *root, size_t size,
+		const char *expected, size_t length)
+{
+	mustach_sbuf_t sbuf = MUSTACH_SBUF_INIT;
+	mustach_template_t *template;
+	mustach_wrap_apply_t *apply;
+	char buffer[size];
+	size_t written, total;
+	int rc, same;
+
+	sbuf.value = templ;
+	rc = mustach_make_template(&template, 0, &sbuf, NULL);
+	if (rc != MUSTACH_OK)
+		return rc;
+	rc = mustach_fastjson_apply_begin(&apply, template, root, Mustach_With_AllExtensions, NULL);
+	if (rc == MUSTACH_OK) {
+		total = 0;
+		same = 1;
+		do {
+			rc = mustach_wrap_apply_step(apply, buffer, size, &written);
+			if (rc >= MUSTACH_OK) {
+				same = same && total + written <= length && !memcmp(buffer, &expected[total], written);
+				total += written;
+			}
+		} while (rc > MUSTACH_OK);
+		mustach_wrap_apply_end(apply);
+		if (rc == MUSTACH_OK)
+			printf("pulled in buffers of %u: %s\n", (unsigned)size,
+				same && total == length ? "same" : "differs");
+	}
+	mustach_destroy_template(template, NULL, NULL);
+	return rc;
+}
+
+int main(int ac, char **av)
+{
+	static const size_t sizes[] = { 0, 1, 64, 100, 1000 };
+	static const size_t pulls[] = { 1, 7, 64, 1000 };
+	mustach_fastjson_t *doc;
+	mustach_sbuf_t sbuf = MUSTACH_SBUF_INIT;
+	char *expected;
+	size_t length, i;
+	int rc = MUSTACH_OK;
+
+	if (ac < 2) {
+		fprintf(stderr, "usage: %s json templates...\n", av[0]);
+		return 1;
+	}
+	if (mustach_fastjson_load_file(&doc, av[1]) != MUSTACH_OK) {
+		fprintf(stderr, "Aborted: bad json (file %s)\n", av[1]);
+		return 1;
+	}
+	for (av += 2 ; rc == MUSTACH_OK && *av != NULL ; av++) {
+		rc = mustach_read_file(*av, &sbuf);
+		if (rc == MUSTACH_OK)
+			rc = mustach_fastjson_mem(sbuf.value, sbuf.length, mustach_fastjson_root(doc),
+					Mustach_With_AllExtensions, &expected, &length);
+		if (rc == MUSTACH_OK) {
+			printf("---- %s (%u bytes)\n%s", *av, (unsigned)length, expected);
+			for (i = 0 ; rc == MUSTACH_OK && i < sizeof sizes / sizeof *sizes ; i++)
+				rc = check(sbuf.value, mustach_fastjson_root(doc), sizes[i], expected, length);
+			for (i = 0 ; rc == MUSTACH_OK && i < sizeof pulls / sizeof *pulls ; i++)
+				rc = pull(sbuf.value, mustach_fastjson_root(doc), pulls[i], expected, length);
+			free(expected);
+		}
+		mustach_sbuf_release(&sbuf);
+		if (rc != MUSTACH_OK)
+			fprintf(stderr, "Template error %s (file %s)\n", mustach_strerror(rc), *av);
+	}
+	mustach_fastjson_destroy(doc);
+	return rc != MUSTACH_OK;
+}
@@ -0,0 +1,172 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+/*
+ * Checks that the numbers are rendered by the backends as their
+ * libraries print them: as cJSON_PrintUnformatted does for cJSON
+ * and as json_dumps does for jansson. The numbers, one per line,
+ * are read from the file given as argument.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_JANSSON 2
+#define TEST_CJSON   3
+
+#if TEST == TEST_CJSON
+
+#include "mustach-cjson.h"
+
+typedef cJSON json_t;
+
+static json_t *parse(const char *text)
+{
+	return cJSON_Parse(text);
+}
+
+static json_t *at(json_t *root, int index)
+{
+	return cJSON_GetArrayItem(cJSON_GetObjectItem(root, "n"), index);
+}
+
+static char *print(json_t *value)
+{
+	return cJSON_PrintUnformatted(value);
+}
+
+static void dispose(char *text)
+{
+	cJSON_free(text);
+}
+
+static void destroy(json_t *root)
+{
+	cJSON_Delete(root);
+}
+
+static int render(const char *templ, json_t *root, char **result, size_t *size)
+{
+	return mustach_cJSON_mem(templ, 0, root, 0, result, size);
+}
+
+#elif TEST == TEST_JANSSON
+
+#include "mustach-jansson.h"
+
+static json_t *parse(const char *text)
+{
+	json_error_t error;
+	return json_loads(text, 0, &error);
+}
+
+static json_t *at(json_t *root, int index)
+{
+	return json_array_get(json_object_get(root, "n"), (size_t)index);
+}
+
+static char *print(json_t *value)
+{
+	return json_dumps(value, JSON_ENCODE_ANY | JSON_COMPACT);
+}
+
+static void dispose(char *text)
+{
+	free(text);
+}
+
+static void destroy(json_t *root)
+{
+	json_decref(root);
+}
+
+static int render(const char *templ, json_t *root, char **result, size_t *size)
+{
+	return mustach_jansson_mem(templ, 0, root, 0, result, size);
+}
+
+#else
+#error "unknown TEST"
+#endif
+
+#define MAXNUMBERS 100
+
+int main(int ac, char **av)
+{
+	char line[100], *numbers[MAXNUMBERS], *text, *result, *rendered, *printed, *end;
+	size_t length;
+	int count, i, rc;
+	FILE *file;
+	json_t *root;
+
+	if (ac != 2) {
+		fprintf(stderr, "usage: %s numbers\n", av[0]);
+		return 1;
+	}
+	file = fopen(av[1], "r");
+	if (file == NULL) {
+		fprintf(stderr, "can't open %s\n", av[1]);
+		return 1;
+	}
+
+	/* read the numbers and make the object {"n":[numbers...]} */
+	count = 0;
+	length = 8;
+	while (count < MAXNUMBERS && fgets(line, (int)sizeof line, file) != NULL) {
+		line[strcspn(line, "\r\n")] = 0;
+		if (line[0]) {
+			numbers[count++] = strdup(line);
+			length += strlen(line) + 1;
+		}
+	}
+	fclose(file);
+	text = malloc(length);
+	strcpy(text, "{\"n\":[");
+	for (i = 0 ; i < count ; i++) {
+		if (i)
+			strcat(text, ",");
+		strcat(text, numbers[i]);
+	}
+	strcat(text, "]}");
+	root = parse(text);
+	if (root == NULL) {
+		fprintf(stderr, "can't parse %s\n", text);
+		return 1;
+	}
+
+	/* render the numbers, one per line, and compare with the prints */
+	rc = render("{{#n}}{{.}}\n{{/n}}", root, &result, &length);
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "rendering failed: %d\n", rc);
+		return 1;
+	}
+	rendered = result;
+	for (i = 0 ; i < count ; i++) {
+		end = strchr(rendered, '\n');
+		if (end == NULL) {
+			printf("%s: missing\n", numbers[i]);
+			break;
+		}
+		*end = 0;
+		printed = print(at(root, i));
+		if (printed != NULL && strcmp(rendered, printed) == 0)
+			printf("%s: same\n", numbers[i]);
+		else
+			printf("%s: differs, %s instead of %s\n", numbers[i], rendered, printed ? printed : "(null)");
+		dispose(printed);
+		rendered = &end[1];
+	}
+
+	free(result);
+	destroy(root);
+	free(text);
+	for (i = 0 ; i < count ; i++)
+		free(numbers[i]);
+	return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+/*
+ * Checks the indexes that the backend cJSON makes for the objects
+ * and the arrays having more than CJ_INDEX_MIN children: the values
+ * rendered are those given by cJSON_GetObjectItemCaseSensitive and
+ * cJSON_GetArrayItem, for duplicated keys, for keys after a member
+ * without key, for missing keys and for indexes out of range. Many
+ * objects are indexed during one rendering, growing the table of
+ * the indexes.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mustach-cjson.h"
+
+#define MEMBERS  40
+#define OBJECTS  100
+#define FIELDS   20
+
+/* the selections checked, one per line of the template */
+static const char *paths[] = {
+	"big.k0",
+	"big.k15",
+	"big.k16",
+	"big.k29",
+	"big.k5",
+	"big.after",
+	"big.missing",
+	"list.0",
+	"list.15",
+	"list.16",
+	"list.39",
+	"list.40",
+	"list.1000",
+	NULL
+};
+
+static void add_string(cJSON *object, const char *key, const char *value)
+{
+	cJSON *item = cJSON_CreateString(value);
+	if (item == NULL)
+		exit(1);
+	if (key != NULL)
+		cJSON_AddItemToObject(object, key, item);
+	else
+		cJSON_AddItemToArray(object, item);
+}
+
+/* make the data: big is an object whose key k5 is duplicated and
+ * whose member 30 has no key, list is an array of MEMBERS strings and
+ * objs an array of OBJECTS objects of FIELDS members */
+static cJSON *make(void)
+{
+	cJSON *root, *big, *list, *objs, *obj;
+	char key[20], value[20];
+	int i, j;
+
+	root = cJSON_CreateObject();
+	big = cJSON_CreateObject();
+	list = cJSON_CreateArray();
+	objs = cJSON_CreateArray();
+	if (root == NULL || big == NULL || list == NULL || objs == NULL)
+		exit(1);
+	cJSON_AddItemToObject(root, "big", big);
+	cJSON_AddItemToObject(root, "list", list);
+	cJSON_AddItemToObject(root, "objs", objs);
+	for (i = 0 ; i < MEMBERS ; i++) {
+		sprintf(key, "k%d", i);
+		sprintf(value, "v%d", i);
+		add_string(big, i == 20 ? "k5" : i == 30 ? NULL : i == 31 ? "after" : key, value);
+		sprintf(value, "i%d", i);
+		add_string(list, NULL, value);
+	}
+	for (i = 0 ; i < OBJECTS ; i++) {
+		obj = cJSON_CreateObject();
+		if (obj == NULL)
+			exit(1);
+		cJSON_AddItemToArray(objs, obj);
+		for (j = 0 ; j < FIELDS ; j++) {
+			sprintf(key, "m%d", j);
+			sprintf(value, "%d.%d", i, j);
+			add_string(obj, key, value);
+		}
+	}
+	return root;
+}
+
+/* the value of the path as given by cJSON or "" */
+static const char *lookup(const cJSON *item, const char *path)
+{
+	char key[20];
+	size_t length;
+	const char *value;
+
+	while (item != NULL && *path) {
+		length = strcspn(path, ".");
+		memcpy(key, path, length);
+		key[length] = 0;
+		path += length + (path[length] == '.');
+		if (cJSON_IsArray(item))
+			item = cJSON_GetArrayItem(item, atoi(key));
+		else
+			item = cJSON_GetObjectItemCaseSensitive(item, key);
+	}
+	value = item == NULL ? NULL : cJSON_GetStringValue(item);
+	return value == NULL ? "" : value;
+}
+
+int main(int ac, char **av)
+{
+	char templ[1000], *expected, *result, *rendered, *end;
+	const char *ref;
+	size_t length, pos;
+	cJSON *root;
+	int i, rc;
+
+	(void)ac; (void)av;/*make compiler happy #@!%!!*/
+	root = make();
+
+	/* one line per path, then the field m19 of each object */
+	for (pos = 0, i = 0 ; paths[i] != NULL ; i++)
+		pos += (size_t)sprintf(&templ[pos], "{{%s}}\n", paths[i]);
+	strcpy(&templ[pos], "{{#objs}}{{m19}},{{/objs}}\n");
+	rc = mustach_cJSON_mem(templ, 0, root, Mustach_With_AllExtensions, &result, &length);
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "rendering failed: %d\n", rc);
+		return 1;
+	}
+
+	rendered = result;
+	for (i = 0 ; paths[i] != NULL ; i++) {
+		end = strchr(rendered, '\n');
+		if (end == NULL) {
+			printf("%s: missing\n", paths[i]);
+			break;
+		}
+		*end = 0;
+		ref = lookup(root, paths[i]);
+		if (strcmp(rendered, ref) == 0)
+			printf("%s: same, \"%s\"\n", paths[i], rendered);
+		else
+			printf("%s: differs, \"%s\" instead of \"%s\"\n", paths[i], rendered, ref);
+		rendered = &end[1];
+	}
+
+	expected = malloc(OBJECTS * FIELDS);
+	if (expected == NULL)
+		return 1;
+	for (pos = 0, i = 0 ; i < OBJECTS ; i++)
+		pos += (size_t)sprintf(&expected[pos], "%s,", lookup(cJSON_GetArrayItem(cJSON_GetObjectItemCaseSensitive(root, "objs"), i), "m19"));
+	strcpy(&expected[pos], "\n");
+	printf("m19 of %d objects: %s\n", OBJECTS, strcmp(rendered, expected) ? "differs" : "same");
+
+	free(expected);
+	free(result);
+	cJSON_Delete(root);
+	return 0;
+}
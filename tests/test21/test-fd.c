@@ -0,0 +1,116 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+/*
+ * Renders to a file descriptor with output buffers of various sizes
+ * and checks that the file holds the output rendered in memory: no
+ * buffer, buffers too small for escaping in place, the default size,
+ * allocated buffers and values written at once that are bigger than
+ * the buffer.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mustach-fastjson.h"
+#include "mustach-helpers.h"
+
+/* size of the big value, bigger than all the buffers */
+#define BIGSIZE (5 * MUSTACH_FDBUF_SIZE)
+
+static const char templ[] =
+	"{{name}}\n"
+	"{{#items}}{{.}} {{/items}}\n"
+	"{{{big}}}\n"
+	"{{big}}\n";
+
+static const struct {
+	size_t size;
+	const char *label;
+} sizes[] = {
+	{ 0, "no buffer" },
+	{ 1, "1 byte" },
+	{ 5, "5 bytes" },
+	{ 6, "6 bytes" },
+	{ 100, "100 bytes" },
+	{ MUSTACH_FDBUF_SIZE, "MUSTACH_FDBUF_SIZE" },
+	{ 3 * MUSTACH_FDBUF_SIZE, "3 * MUSTACH_FDBUF_SIZE" }
+};
+
+/* render in a temporary file with a buffer of size and compare to the expected output */
+static int check(const mustach_fastjson_value_t *root, size_t size, const char *expected, size_t length)
+{
+	FILE *file;
+	char *result;
+	size_t got;
+	int rc;
+
+	file = tmpfile();
+	if (file == NULL)
+		return 0;
+	rc = mustach_fastjson_fd_with(templ, 0, root, Mustach_With_AllExtensions, NULL, fileno(file), size);
+	result = malloc(length + 1);
+	got = 0;
+	if (rc == MUSTACH_OK && result != NULL) {
+		rewind(file);
+		got = fread(result, 1, length + 1, file);
+	}
+	rc = rc == MUSTACH_OK && result != NULL && got == length && !memcmp(result, expected, length);
+	free(result);
+	fclose(file);
+	return rc;
+}
+
+int main(int ac, char **av)
+{
+	static const char piece[] = "<0123456789 & abcdef>";
+	mustach_fastjson_t *doc;
+	char *json, *expected;
+	size_t pos, length, i;
+	int rc;
+
+	(void)ac; (void)av;/*make compiler happy #@!%!!*/
+
+	/* the data: escaped strings and a big value */
+	json = malloc(BIGSIZE + 1000);
+	if (json == NULL)
+		return 1;
+	pos = (size_t)sprintf(json, "{\"name\":\"<a & b>\",\"items\":[\"x<y\"");
+	for (i = 1 ; i < 100 ; i++)
+		pos += (size_t)sprintf(&json[pos], ",\"%zu>%zu\"", i, i - 1);
+	pos += (size_t)sprintf(&json[pos], "],\"big\":\"");
+	for (i = 0 ; i < BIGSIZE ; i++)
+		json[pos++] = piece[i % (sizeof piece - 1)];
+	strcpy(&json[pos], "\"}");
+	rc = mustach_fastjson_parse_copy(&doc, json, 0);
+	free(json);
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "can't parse the data: %s\n", mustach_strerror(rc));
+		return 1;
+	}
+
+	/* the expected output rendered in memory */
+	rc = mustach_fastjson_mem(templ, 0, mustach_fastjson_root(doc), Mustach_With_AllExtensions, &expected, &length);
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "can't render: %s\n", mustach_strerror(rc));
+		return 1;
+	}
+
+	for (i = 0 ; i < sizeof sizes / sizeof *sizes ; i++)
+		printf("written with %s: %s\n", sizes[i].label,
+			check(mustach_fastjson_root(doc), sizes[i].size, expected, length) ? "same" : "differs");
+
+	free(expected);
+	mustach_fastjson_destroy(doc);
+	return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: 0BSD
+*/
+
+/*
+ * Checks what the builder drops from the prepared templates: the
+ * lines with the flag Mustach_Build_Strip_Lines and the sections and
+ * inverted sections without content. The templates are walked for
+ * counting what remains and their renderings are compared with the
+ * renderings of templates where nothing is dropped.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mustach-fastjson.h"
+#include "mustach-helpers.h"
+
+/* count of lines and sections walked */
+static int lines, sections;
+
+static int walk_line(void *closure, unsigned line)
+{
+	(void)closure; (void)line;/*make compiler happy #@!%!!*/
+	lines++;
+	return MUSTACH_OK;
+}
+
+static int walk_enter(void *closure, int kind, const char *name, size_t length)
+{
+	(void)closure; (void)kind; (void)name; (void)length;/*make compiler happy #@!%!!*/
+	sections++;
+	return MUSTACH_OK;
+}
+
+static const mustach_walk_itf_t walk_itf = {
+	.version = MUSTACH_WALK_ITF_VERSION_CUR,
+	.line = walk_line,
+	.enter = walk_enter
+};
+
+/* build the template and walk it */
+static mustach_template_t *build(const char *text, int flags)
+{
+	mustach_sbuf_t sbuf = MUSTACH_SBUF_INIT;
+	mustach_template_t *templ;
+
+	sbuf.value = text;
+	if (mustach_build_template(&templ, flags, &sbuf, NULL, 0, NULL, NULL) != MUSTACH_OK)
+		exit(1);
+	lines = sections = 0;
+	if (mustach_walk_template(templ, &walk_itf, NULL) != MUSTACH_OK)
+		exit(1);
+	return templ;
+}
+
+/* render the template for the json in a buffer */
+static char *render(mustach_template_t *templ, const char *json)
+{
+	mustach_fastjson_t *doc;
+	char *result;
+	size_t size;
+	FILE *file;
+
+	if (mustach_fastjson_parse_copy(&doc, json, 0) != MUSTACH_OK)
+		exit(1);
+	file = mustach_memfile_open(&result, &size);
+	if (file == NULL
+	 || mustach_fastjson_apply(templ, mustach_fastjson_root(doc), Mustach_With_AllExtensions,
+				mustach_fwrite_cb, NULL, file) != MUSTACH_OK
+	 || mustach_memfile_close(file, &result, &size) != MUSTACH_OK)
+		exit(1);
+	mustach_fastjson_destroy(doc);
+	return result;
+}
+
+static void check_strip_lines(void)
+{
+	static const char text[] =
+		"first {{x}}\n"
+		"{{#s}}\n"
+		"  item {{.}}\n"
+		"{{/s}}\n"
+		"last {{x}}\n";
+	static const char json[] = "{\"x\":\"X\",\"s\":[1,2,3]}";
+	mustach_template_t *kept, *stripped;
+	char *out1, *out2;
+	int nlines;
+
+	printf("---- stripping lines\n");
+	kept = build(text, 0);
+	nlines = lines;
+	stripped = build(text, Mustach_Build_Strip_Lines);
+	printf("lines walked: %s without the flag, %d with Mustach_Build_Strip_Lines\n",
+		nlines > 0 ? "some" : "none", lines);
+	out1 = render(kept, json);
+	out2 = render(stripped, json);
+	printf("rendering: %s\n%s", strcmp(out1, out2) ? "differs" : "same", out2);
+	free(out1);
+	free(out2);
+	mustach_unref_template(kept, NULL, NULL);
+	mustach_unref_template(stripped, NULL, NULL);
+}
+
+static void check_empty_sections(void)
+{
+	/* the same templates, with or without a tag in the sections */
+	static const char empty[] =
+		"<\n"
+		"{{#a}}{{/a}}\n"
+		"|{{#a}}{{/a}}|\n"
+		"  {{^a}}{{/a}}  \n"
+		"|{{^b}}{{/b}}|{{#b}}{{/b}}|\n"
+		"{{#a}}in{{/a}}\n"
+		">\n";
+	static const char full[] =
+		"<\n"
+		"{{#a}}{{z}}{{/a}}\n"
+		"|{{#a}}{{z}}{{/a}}|\n"
+		"  {{^a}}{{z}}{{/a}}  \n"
+		"|{{^b}}{{z}}{{/b}}|{{#b}}{{z}}{{/b}}|\n"
+		"{{#a}}in{{/a}}\n"
+		">\n";
+	static const char *jsons[] = {
+		"{\"a\":true,\"b\":false}",
+		"{\"a\":false,\"b\":true}",
+		NULL
+	};
+	mustach_template_t *templ, *ref;
+	const char **json;
+	char *out, *outref;
+
+	printf("---- empty sections\n");
+	templ = build(empty, 0);
+	printf("sections walked: %d\n", sections);
+	ref = build(full, 0);
+	for (json = jsons ; *json != NULL ; json++) {
+		out = render(templ, *json);
+		outref = render(ref, *json);
+		printf("rendering for %s: %s\n%s", *json, strcmp(out, outref) ? "differs" : "same", out);
+		free(out);
+		free(outref);
+	}
+	mustach_unref_template(templ, NULL, NULL);
+	mustach_unref_template(ref, NULL, NULL);
+}
+
+int main(int ac, char **av)
+{
+	(void)ac; (void)av;/*make compiler happy #@!%!!*/
+	check_strip_lines();
+	check_empty_sections();
+	return 0;
+}